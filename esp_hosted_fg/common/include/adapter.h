@@ -6,8 +6,10 @@
 
 #ifdef __KERNEL__
   #include <linux/types.h>
+  #include <linux/string.h>
 #else
   #include <stdint.h>
+  #include <string.h>
 #endif
 
 #define ESP_PKT_NUM_DEBUG                         (0)
@@ -22,10 +24,22 @@
 #define FLAG_WAKEUP_PKT                           (1 << 1)
 #define FLAG_POWER_SAVE_STARTED                   (1 << 2)
 #define FLAG_POWER_SAVE_STOPPED                   (1 << 3)
+/* SPI: next slave transaction is cut short to spi_next_len, see
+ * ESP_SPI_LEN_LIMIT_SLACK. Like spi_next_len, not covered by checksum */
+#define FLAG_SPI_NEXT_LEN_LIMIT                   (1 << 4)
 
 /* Serial interface */
 #define SERIAL_IF_FILE                            "/dev/esps0"
 
+/* Serial interface message mode
+ * ioctl(fd, ESP_SERIAL_IOCTL_MSG_MODE, 1) makes every read() on
+ * SERIAL_IF_FILE return exactly one complete TLV frame.
+ * ioctl returns 1 once message mode is enabled, older drivers return 0 */
+#define ESP_SERIAL_IOCTL_MSG_MODE                 _IO('E', 0x01)
+#define ESP_SERIAL_MSG_EPNAME_MAX                 16
+/* type + len + endpoint + type + len + data */
+#define ESP_SERIAL_MSG_MAX_LEN                    (1 + 2 + ESP_SERIAL_MSG_EPNAME_MAX + 1 + 2 + 0xFFFF)
+
 /* Protobuf related info */
 /* Endpoints registered must have same string length */
 #define CTRL_EP_NAME_RESP                         "ctrlResp"
@@ -39,7 +53,10 @@ struct esp_payload_header {
 	uint16_t         offset;
 	uint16_t         checksum;
 	uint16_t		 seq_num;
-	uint8_t          reserved2;
+	union {
+		uint8_t      reserved2;
+		uint8_t      spi_next_len;	/* SPI: length of next slave frame, in ESP_SPI_NEXT_LEN_UNIT */
+	};
 	#if ESP_PKT_NUM_DEBUG
 	uint16_t         pkt_num;
 	#endif
@@ -55,6 +72,12 @@ struct esp_payload_header {
 
 #define H_ESP_PAYLOAD_HEADER_OFFSET sizeof(struct esp_payload_header)
 
+/* Granularity of spi_next_len, keeps max SPI frame within one byte */
+#define ESP_SPI_NEXT_LEN_UNIT       8
+/* Transaction limited by FLAG_SPI_NEXT_LEN_LIMIT is only DMA aligned, so it
+ * may end this much short of spi_next_len. Host frame sent in it has to fit */
+#define ESP_SPI_LEN_LIMIT_SLACK     (ESP_SPI_NEXT_LEN_UNIT - 4)
+
 typedef enum {
 	ESP_STA_IF,
 	ESP_AP_IF,
@@ -97,6 +120,7 @@ typedef enum {
 
 typedef enum {
 	ESP_PRIV_EVENT_INIT,
+	ESP_PRIV_EVENT_RX_CREDIT,	/* le32 count of host Wi-Fi frames taken off rx queue */
 } ESP_PRIV_EVENT_TYPE;
 
 typedef enum {
@@ -105,6 +129,10 @@ typedef enum {
 	ESP_PRIV_FIRMWARE_CHIP_ID,
 	ESP_PRIV_TEST_RAW_TP,
 	ESP_PRIV_FW_DATA,
+	ESP_PRIV_SPI_VAR_LEN,
+	ESP_PRIV_RX_CREDITS,		/* Wi-Fi frames host may have outstanding */
+	ESP_PRIV_SPI_PREQUEUE,		/* Transactions host may have in flight */
+	ESP_PRIV_SPI_LEN_LIMIT,		/* Slave may set FLAG_SPI_NEXT_LEN_LIMIT */
 } ESP_PRIV_TAG_TYPE;
 
 struct esp_priv_event {
@@ -122,16 +150,44 @@ struct fw_version {
 	uint8_t		revision_patch_2;
 }__attribute__((packed));
 
+/* Checksum is 16 bit sum of all bytes. Bytes are summed a word at a time,
+ * in two 16 bit lanes, folding the lanes before they can overflow. */
+#define CHECKSUM_FOLD_WORDS 128
+
 static inline uint16_t compute_checksum(uint8_t *buf, uint16_t len)
 {
 	uint16_t checksum = 0;
-	uint16_t i = 0;
+	uint32_t lanes = 0;
+	uint32_t val = 0;
+	uint16_t count = 0;
+
+	/* Head bytes till word aligned */
+	while (len && ((uintptr_t)buf & (sizeof(uint32_t) - 1))) {
+		checksum += *buf++;
+		len--;
+	}
 
-	while(i < len) {
-		checksum += buf[i];
-		i++;
+	while (len >= sizeof(uint32_t)) {
+		count = len / sizeof(uint32_t);
+		if (count > CHECKSUM_FOLD_WORDS)
+			count = CHECKSUM_FOLD_WORDS;
+		len -= count * sizeof(uint32_t);
+
+		lanes = 0;
+		while (count--) {
+			/* Aligned by now, memcpy compiles to a plain load
+			 * without type punning the byte buffer */
+			memcpy(&val, buf, sizeof(val));
+			buf += sizeof(val);
+			lanes += (val & 0x00FF00FF) + ((val >> 8) & 0x00FF00FF);
+		}
+		checksum += (lanes & 0xFFFF) + (lanes >> 16);
 	}
 
+	/* Tail bytes */
+	while (len--)
+		checksum += *buf++;
+
 	return checksum;
 }
 
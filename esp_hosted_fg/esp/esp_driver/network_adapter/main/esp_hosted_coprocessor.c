@@ -45,6 +45,7 @@
 #include "esp_hosted_cli.h"
 
 #if CONFIG_NETWORK_SPLIT_ENABLED
+	#include <stdatomic.h>
 	#include "host_power_save.h"
 	#include "esp_hosted_config.pb-c.h"
 
@@ -75,6 +76,21 @@ static const char TAG[] = "fg_slave";
 #define ETH_DATA_LEN                     1500
 #define MAX_WIFI_STA_TX_RETRY            2
 
+#if CONFIG_ESP_WIFI_TX_STAGING
+#define WIFI_TX_STAGE_QUEUE_SIZE         CONFIG_ESP_WIFI_TX_STAGING_Q_SIZE
+#define WIFI_TX_STAGE_TIMEOUT_TICKS      pdMS_TO_TICKS(CONFIG_ESP_WIFI_TX_STAGING_TIMEOUT_MS)
+/* Fallback re-poll in case tx done notification is missed */
+#define WIFI_TX_STAGE_POLL_TICKS         (pdMS_TO_TICKS(10) ? pdMS_TO_TICKS(10) : 1)
+
+struct wifi_tx_stage_entry {
+	interface_buffer_handle_t buf_handle;
+	TickType_t staged_at;
+};
+
+static QueueHandle_t wifi_tx_stage_q;
+static TaskHandle_t wifi_tx_task_handle;
+#endif
+
 
 
 volatile uint8_t datapath = 0;
@@ -83,6 +99,7 @@ volatile uint8_t softap_started = 0;
 
 interface_context_t *if_context = NULL;
 interface_handle_t *if_handle = NULL;
+static TaskHandle_t recv_task_handle = NULL;
 
 esp_netif_t *slave_sta_netif = NULL;
 
@@ -177,6 +194,76 @@ static inline esp_err_t populate_buff_handle(interface_buffer_handle_t *buf_hand
 #define populate_wifi_buffer_handle(Buf_hdL, TypE, BuF, LeN) \
 	populate_buff_handle(Buf_hdL, TypE, BuF, LeN, esp_wifi_internal_free_rx_buffer, eb, 0, 0, 0);
 
+#ifdef CONFIG_NETWORK_SPLIT_ENABLED
+/* Wi-Fi rx buffer fanned out to both slave lwIP and host.
+ * Each consumer holds a reference, eb is freed on last put */
+#define FRAME_REF_POOL_SIZE              16
+
+struct frame_ref {
+	void *eb;
+	_Atomic uint8_t refcnt;
+};
+
+static struct frame_ref frame_ref_pool[FRAME_REF_POOL_SIZE];
+
+static struct frame_ref *frame_ref_get(void *eb, uint8_t refcnt)
+{
+	for (int i = 0; i < FRAME_REF_POOL_SIZE; i++) {
+		uint8_t unused = 0;
+
+		if (atomic_compare_exchange_strong(&frame_ref_pool[i].refcnt,
+					&unused, refcnt)) {
+			frame_ref_pool[i].eb = eb;
+			return &frame_ref_pool[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void frame_ref_put(void *ref)
+{
+	struct frame_ref *fref = ref;
+	void *eb = fref->eb;
+
+	if (atomic_fetch_sub(&fref->refcnt, 1) == 1)
+		esp_wifi_internal_free_rx_buffer(eb);
+}
+
+static inline bool is_frame_ref(void *buffer)
+{
+	return ((struct frame_ref *)buffer >= frame_ref_pool) &&
+		((struct frame_ref *)buffer < frame_ref_pool + FRAME_REF_POOL_SIZE);
+}
+
+/* Slave lwIP returns rx buffers through netif driver. Buffers given to
+ * it could be either plain Wi-Fi eb or a shared frame reference */
+static void slave_sta_free_rx_buffer(void *h, void *buffer)
+{
+	if (is_frame_ref(buffer))
+		frame_ref_put(buffer);
+	else
+		esp_wifi_internal_free_rx_buffer(buffer);
+}
+
+static esp_err_t slave_sta_transmit(void *h, void *buffer, size_t len)
+{
+	return esp_wifi_internal_tx(ESP_IF_WIFI_STA, buffer, len);
+}
+
+/* Same as default Wi-Fi netif driver: with PSRAM, lwIP pbuf is handed to
+ * Wi-Fi by reference instead of being copied to internal memory */
+static esp_err_t slave_sta_transmit_wrap(void *h, void *buffer, size_t len,
+		void *netstack_buf)
+{
+#if CONFIG_SPIRAM
+	return esp_wifi_internal_tx_by_ref(ESP_IF_WIFI_STA, buffer, len, netstack_buf);
+#else
+	return esp_wifi_internal_tx(ESP_IF_WIFI_STA, buffer, len);
+#endif
+}
+#endif
+
 
 esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb)
 {
@@ -264,30 +351,34 @@ esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb)
 		case BOTH_LWIP_BRIDGE:
 			ESP_LOGV(TAG, "slave & host packet");
 
-			void * copy_buff = malloc(len);
-			assert(copy_buff);
-			memcpy(copy_buff, buffer, len);
+			struct frame_ref *fref = NULL;
 
-			/* slave LWIP */
-			esp_netif_receive(slave_sta_netif, buffer, len, eb);
-
-			ESP_LOGV(TAG, "slave & host packet");
-			if (datapath) {
-				/* Host LWIP, free up wifi buffers */
-				populate_buff_handle(&buf_handle, ESP_STA_IF, copy_buff, len, free, copy_buff, 0, 0, 0);
-				if (unlikely(send_to_host_queue(&buf_handle, PRIO_Q_OTHERS)))
-					goto DONE;
+			if (datapath)
+				fref = frame_ref_get(eb, 2);
 
-			#if ESP_PKT_STATS
-				pkt_stats.sta_sh_in++;
-				pkt_stats.sta_both_lwip_out++;
-			#endif
-			} else {
+			if (!fref) {
+				/* Refs exhausted or datapath closed, slave LWIP only */
+				esp_netif_receive(slave_sta_netif, buffer, len, eb);
 			#if ESP_PKT_STATS
 				pkt_stats.sta_slave_lwip_out++;
 			#endif
+				break;
 			}
 
+			/* slave LWIP, puts its reference once done */
+			esp_netif_receive(slave_sta_netif, buffer, len, fref);
+
+			/* Host LWIP, puts its reference after bus write */
+			populate_buff_handle(&buf_handle, ESP_STA_IF, buffer, len, frame_ref_put, fref, 0, 0, 0);
+			if (unlikely(send_to_host_queue(&buf_handle, PRIO_Q_OTHERS))) {
+				frame_ref_put(fref);
+				return ESP_OK;
+			}
+
+		#if ESP_PKT_STATS
+			pkt_stats.sta_sh_in++;
+			pkt_stats.sta_both_lwip_out++;
+		#endif
 			break;
 
 		default:
@@ -419,14 +510,99 @@ static void process_priv_pkt(uint8_t *payload, uint16_t payload_len)
 	}
 }
 
+static void free_rx_buf_handle(interface_buffer_handle_t *buf_handle)
+{
+	if (buf_handle->free_buf_handle && buf_handle->priv_buffer_handle) {
+		buf_handle->free_buf_handle(buf_handle->priv_buffer_handle);
+		buf_handle->priv_buffer_handle = NULL;
+	}
+}
+
+#if CONFIG_ESP_WIFI_TX_STAGING
+static void wifi_tx_done_cb(uint8_t ifidx, uint8_t *data, uint16_t *data_len, bool tx_status)
+{
+	/* Wi-Fi tx buffer got released, staged frame can be retried */
+	if (wifi_tx_task_handle && uxQueueMessagesWaiting(wifi_tx_stage_q))
+		xTaskNotifyGive(wifi_tx_task_handle);
+}
+
+/* Returns true if frame got staged. Buffer is then owned by wifi_tx_task,
+ * and its transport credit is returned only once it is freed there */
+static bool wifi_sta_tx_or_stage(interface_buffer_handle_t *buf_handle,
+		uint8_t *payload, uint16_t payload_len)
+{
+	struct wifi_tx_stage_entry entry = {0};
+
+	/* Frames behind a staged one are staged too, to keep them in order */
+	if (!uxQueueMessagesWaiting(wifi_tx_stage_q) &&
+	    !esp_wifi_internal_tx(ESP_IF_WIFI_STA, payload, payload_len)) {
+#if ESP_PKT_STATS
+		pkt_stats.hs_bus_sta_out++;
+#endif
+		return false;
+	}
+
+	entry.buf_handle = *buf_handle;
+	entry.staged_at = xTaskGetTickCount();
+
+	/* Never block recv_task, serial and other interfaces share it */
+	if (xQueueSend(wifi_tx_stage_q, &entry, 0) != pdTRUE) {
+#if ESP_PKT_STATS
+		pkt_stats.hs_bus_sta_fail++;
+#endif
+		return false;
+	}
+#if ESP_PKT_STATS
+	pkt_stats.hs_bus_sta_staged++;
+#endif
+	return true;
+}
+
+static void wifi_tx_task(void* pvParameters)
+{
+	struct wifi_tx_stage_entry entry = {0};
+	struct esp_payload_header *header = NULL;
+	esp_err_t ret = ESP_OK;
+
+	for (;;) {
+		/* Head stays queued till done, so recv_task keeps later frames behind it */
+		xQueuePeek(wifi_tx_stage_q, &entry, portMAX_DELAY);
+
+		header = (struct esp_payload_header *) entry.buf_handle.payload;
+		ret = ESP_FAIL;
+		if (station_connected)
+			ret = esp_wifi_internal_tx(ESP_IF_WIFI_STA,
+					entry.buf_handle.payload + le16toh(header->offset),
+					le16toh(header->len));
+
+		if (ret && station_connected &&
+		    (xTaskGetTickCount() - entry.staged_at) < WIFI_TX_STAGE_TIMEOUT_TICKS) {
+			ulTaskNotifyTake(pdTRUE, WIFI_TX_STAGE_POLL_TICKS);
+			continue;
+		}
+
+		xQueueReceive(wifi_tx_stage_q, &entry, 0);
+#if ESP_PKT_STATS
+		if (ret)
+			pkt_stats.hs_bus_sta_fail++;
+		else
+			pkt_stats.hs_bus_sta_out++;
+#endif
+		free_rx_buf_handle(&entry.buf_handle);
+	}
+}
+#endif
+
 static void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 {
 
 	struct esp_payload_header *header = NULL;
 	uint8_t *payload = NULL;
 	uint16_t payload_len = 0;
+#if !CONFIG_ESP_WIFI_TX_STAGING
 	int ret = 0;
 	int retry_wifi_tx = MAX_WIFI_STA_TX_RETRY;
+#endif
 
 	header = (struct esp_payload_header *) buf_handle->payload;
 	payload = buf_handle->payload + le16toh(header->offset);
@@ -437,6 +613,10 @@ static void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 
 	if (buf_handle->if_type == ESP_STA_IF && station_connected) {
 		/* Forward data to wlan driver */
+#if CONFIG_ESP_WIFI_TX_STAGING
+		if (wifi_sta_tx_or_stage(buf_handle, payload, payload_len))
+			return;
+#else
 		do {
 			ret = esp_wifi_internal_tx(ESP_IF_WIFI_STA, payload, payload_len);
 			if (ret) {
@@ -451,6 +631,7 @@ static void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 			pkt_stats.hs_bus_sta_fail++;
 		else
 			pkt_stats.hs_bus_sta_out++;
+#endif
 #endif
 	} else if (buf_handle->if_type == ESP_AP_IF && softap_started) {
 		/* Forward data to wlan driver */
@@ -476,39 +657,63 @@ static void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 #endif
 
 	/* Free buffer handle */
-	if (buf_handle->free_buf_handle && buf_handle->priv_buffer_handle) {
-		buf_handle->free_buf_handle(buf_handle->priv_buffer_handle);
-		buf_handle->priv_buffer_handle = NULL;
-	}
-
+	free_rx_buf_handle(buf_handle);
 }
 
 /* Get data from host */
 static void recv_task(void* pvParameters)
 {
 	interface_buffer_handle_t buf_handle = {0};
+#ifdef CONFIG_ESP_HOSTED_FUNCTION_PROFILING
+	struct timing_stats_entry *rx_latency_prof = register_prof_entry("rx_queue_latency");
+#endif
 
 	for (;;) {
 
 		if (!datapath) {
-			/* Datapath is not enabled by host yet*/
-			vTaskDelay(pdMS_TO_TICKS(1));
+			/* Datapath is not enabled by host yet, sleep till notified */
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 			continue;
 		}
 
-		/* receive data from transport layer */
+		/* receive data from transport layer, blocks till data arrives */
 		if (if_context && if_context->if_ops && if_context->if_ops->read) {
 			int len = if_context->if_ops->read(if_handle, &buf_handle);
 			if (len <= 0) {
-				vTaskDelay(2);
+				/* Read fails straight while bus is not active. Back off
+				 * instead of spinning, datapath change wakes us early */
+				ulTaskNotifyTake(pdTRUE, 2);
 				continue;
 			}
 		}
 
+#ifdef CONFIG_ESP_HOSTED_FUNCTION_PROFILING
+		if (buf_handle.enqueue_time) {
+			ESP_HOSTED_FUNC_PROF_RECORD(rx_latency_prof,
+					(uint32_t)esp_timer_get_time() - buf_handle.enqueue_time);
+			buf_handle.enqueue_time = 0;
+		}
+#endif
 		process_rx_pkt(&buf_handle);
 	}
 }
 
+static void recv_task_wakeup(void)
+{
+	if (!recv_task_handle)
+		return;
+
+	if (xPortInIsrContext()) {
+		BaseType_t do_yield = pdFALSE;
+
+		vTaskNotifyGiveFromISR(recv_task_handle, &do_yield);
+		if (do_yield)
+			portYIELD_FROM_ISR();
+	} else {
+		xTaskNotifyGive(recv_task_handle);
+	}
+}
+
 static ssize_t serial_read_data(uint8_t *data, ssize_t len)
 {
 	len = min(len, r.len);
@@ -582,6 +787,7 @@ int event_handler(uint8_t val)
 			if (if_handle) {
 				if_handle->state = ACTIVE;
 				datapath = 1;
+				recv_task_wakeup();
 				ESP_EARLY_LOGI(TAG, "Start Data Path");
 				if (host_reset_sem) {
 					xSemaphoreGive(host_reset_sem);
@@ -684,6 +890,15 @@ void create_slave_sta_netif(uint8_t dhcp_at_slave)
 	ESP_ERROR_CHECK(esp_netif_attach_wifi_station(netif_sta));
 	ESP_ERROR_CHECK(esp_wifi_set_default_wifi_sta_handlers());
 
+	/* Route rx buffer release through frame reference aware callback */
+	esp_netif_driver_ifconfig_t driver_ifconfig = {
+		.handle = esp_netif_get_io_driver(netif_sta),
+		.transmit = slave_sta_transmit,
+		.transmit_wrap = slave_sta_transmit_wrap,
+		.driver_free_rx_buffer = slave_sta_free_rx_buffer,
+	};
+	ESP_ERROR_CHECK(esp_netif_set_driver_config(netif_sta, &driver_ifconfig));
+
 	if (!dhcp_at_slave) {
 		ESP_ERROR_CHECK(esp_netif_dhcpc_stop(netif_sta));
 		ESP_LOGI(TAG, "No DHCP at slave");
@@ -782,6 +997,11 @@ static int connect_sta(void)
 
 	ESP_ERROR_CHECK(esp_hosted_wifi_init(&cfg));
 
+#if CONFIG_ESP_WIFI_TX_STAGING
+	/* Staged frames get retried on tx done */
+	esp_wifi_set_tx_done_cb(wifi_tx_done_cb);
+#endif
+
 	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
 
 #if CONFIG_WIFI_CMD_DEFAULT_COUNTRY_CN
@@ -950,6 +1170,10 @@ esp_err_t esp_hosted_coprocessor_init(void)
 #endif
 
 
+#if defined(CONFIG_NETWORK_SPLIT_ENABLED) && defined(CONFIG_LWIP_ENABLE)
+	lwip_filter_init();
+#endif
+
 #ifdef CONFIG_ESP_HOSTED_HOST_RESERVED_PORTS_CONFIGURED
 	ESP_LOGI(TAG, "Configuring host static port forwarding rules from slave kconfig");
 	configure_host_static_port_forwarding_rules(CONFIG_ESP_HOSTED_HOST_RESERVED_TCP_SRC_PORTS,
@@ -1008,9 +1232,18 @@ esp_err_t esp_hosted_coprocessor_init(void)
 	}
 
 
+#if CONFIG_ESP_WIFI_TX_STAGING
+	wifi_tx_stage_q = xQueueCreate(WIFI_TX_STAGE_QUEUE_SIZE, sizeof(struct wifi_tx_stage_entry));
+	assert(wifi_tx_stage_q);
+
+	assert(xTaskCreate(wifi_tx_task , "wifi_tx_task" ,
+			CONFIG_ESP_DEFAULT_TASK_STACK_SIZE, NULL ,
+			CONFIG_ESP_HOSTED_TASK_PRIORITY_DEFAULT, &wifi_tx_task_handle) == pdTRUE);
+#endif
+
 	assert(xTaskCreate(recv_task , "recv_task" ,
 			CONFIG_ESP_DEFAULT_TASK_STACK_SIZE, NULL ,
-			CONFIG_ESP_HOSTED_TASK_PRIORITY_DEFAULT, NULL) == pdTRUE);
+			CONFIG_ESP_HOSTED_TASK_PRIORITY_DEFAULT, &recv_task_handle) == pdTRUE);
 	create_debugging_tasks();
 
 #ifdef H_ESP_HOSTED_CLI_ENABLED
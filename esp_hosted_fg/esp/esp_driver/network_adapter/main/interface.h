@@ -64,6 +64,9 @@ typedef struct {
 	uint8_t flag;
 	uint16_t payload_len;
 	uint16_t seq_num;
+#if defined(CONFIG_ESP_HOSTED_FUNCTION_PROFILING) || defined(CONFIG_ESP_TX_SCHED_DRR)
+	uint32_t enqueue_time;	/* us, when queued to transport rx/tx queue */
+#endif
 
 	void (*free_buf_handle)(void *buf_handle);
 } interface_buffer_handle_t;
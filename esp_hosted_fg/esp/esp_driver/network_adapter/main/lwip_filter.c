@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "esp_log.h"
 #include "esp_timer.h"
@@ -65,40 +66,141 @@ static struct {
 	uint16_t last_port;
 } udp_cache = {0};
 
-#define MAX_ALLOWED_TCP_SRC_PORTS 10
-#define MAX_ALLOWED_UDP_SRC_PORTS 10
-#define MAX_ALLOWED_TCP_DST_PORTS 10
-#define MAX_ALLOWED_UDP_DST_PORTS 10
-
-/* In the file-scope variables section */
-static uint16_t allowed_tcp_src_ports[MAX_ALLOWED_TCP_SRC_PORTS] = {0};
-static uint16_t allowed_udp_src_ports[MAX_ALLOWED_UDP_SRC_PORTS] = {0};
-static uint16_t allowed_tcp_dst_ports[MAX_ALLOWED_TCP_DST_PORTS] = {0};
-static uint16_t allowed_udp_dst_ports[MAX_ALLOWED_UDP_DST_PORTS] = {0};
-static int allowed_tcp_src_ports_count = 0;
-static int allowed_udp_src_ports_count = 0;
-static int allowed_tcp_dst_ports_count = 0;
-static int allowed_udp_dst_ports_count = 0;
-
-/* Parse a comma-separated list of ports into an array */
-static int init_allowed_ports(const char *ports_str, int *ports_count, uint16_t *ports_array, int max_ports, const char *port_type) {
-    /* Only initialize once */
-    static bool tcp_src_initialized = false;
-    static bool tcp_dst_initialized = false;
-    static bool udp_src_initialized = false;
-    static bool udp_dst_initialized = false;
-
-    /* Check if already initialized for this port type */
-    if ((strcmp(port_type, "tcp_src") == 0 && tcp_src_initialized) ||
-        (strcmp(port_type, "tcp_dst") == 0 && tcp_dst_initialized) ||
-        (strcmp(port_type, "udp_src") == 0 && udp_src_initialized) ||
-        (strcmp(port_type, "udp_dst") == 0 && udp_dst_initialized)) {
+#define MAX_ALLOWED_PORTS_PER_TYPE 10
+
+/* Port rules. Each rule is one L4 port and what it means for tcp/udp,
+ * src/dst direction: host reserved from Kconfig, or one of the fixed ports
+ * the filter treats specially. Rules live in an open addressed hash table,
+ * so classifying a frame costs one lookup per port. Table is filled once at
+ * startup and only read afterwards, there is no runtime update of rules */
+#define PORT_RULE_TCP_SRC          (1 << 0)
+#define PORT_RULE_TCP_DST          (1 << 1)
+#define PORT_RULE_UDP_SRC          (1 << 2)
+#define PORT_RULE_UDP_DST          (1 << 3)
+#define PORT_RULE_TCP_IPERF_DST    (1 << 4)
+#define PORT_RULE_UDP_IPERF_DST    (1 << 5)
+#define PORT_RULE_DHCP_CLIENT_DST  (1 << 6)
+#define PORT_RULE_MQTT_SRC         (1 << 7)
+
+/* Rule bits looked up per port of a frame */
+#define PORT_RULES_TCP_SRC         (PORT_RULE_TCP_SRC | PORT_RULE_MQTT_SRC)
+#define PORT_RULES_TCP_DST         (PORT_RULE_TCP_DST | PORT_RULE_TCP_IPERF_DST)
+#define PORT_RULES_UDP_SRC         (PORT_RULE_UDP_SRC)
+#define PORT_RULES_UDP_DST         (PORT_RULE_UDP_DST | PORT_RULE_UDP_IPERF_DST | \
+                                    PORT_RULE_DHCP_CLIENT_DST)
+
+#define PORT_RULE_TABLE_BITS       6
+#define PORT_RULE_TABLE_SIZE       (1 << PORT_RULE_TABLE_BITS)
+#define PORT_RULE_TABLE_MASK       (PORT_RULE_TABLE_SIZE - 1)
+/* Fixed port rules, see lwip_filter_init() */
+#define PORT_RULE_FIXED            3
+/* Keep load factor around 2/3 for short probe sequences */
+#define PORT_RULE_MAX              (4 * MAX_ALLOWED_PORTS_PER_TYPE + PORT_RULE_FIXED)
+/* Bitmap of longer hashes of ports in table. Most ports of a frame have no
+ * rule, bitmap turns them away without probing the table */
+#define PORT_RULE_BITMAP_BITS      10
+
+struct port_rule {
+	uint16_t port;
+	uint8_t match;      /* PORT_RULE_* bits, 0 if slot unused */
+	uint32_t hits;
+};
+
+static struct port_rule port_rules[PORT_RULE_TABLE_SIZE];
+static int port_rules_count = 0;
+static uint8_t port_rules_types_loaded = 0;
+static uint32_t port_rule_bitmap[(1 << PORT_RULE_BITMAP_BITS) / 32];
+
+/* Fibonacci hashing, top bits of 16 bit product */
+#define PORT_RULE_HASH(port, bits) (((uint16_t)((port) * 40503u)) >> (16 - (bits)))
+
+static inline uint32_t port_rule_hash(uint16_t port)
+{
+	return PORT_RULE_HASH(port, PORT_RULE_TABLE_BITS);
+}
+
+static struct port_rule *port_rule_find(uint16_t port)
+{
+	uint32_t idx = PORT_RULE_HASH(port, PORT_RULE_BITMAP_BITS);
+
+	if (!(port_rule_bitmap[idx / 32] & (1u << (idx % 32))))
+		return NULL;
+
+	idx = port_rule_hash(port);
+	for (int i = 0; i < PORT_RULE_TABLE_SIZE; i++) {
+		struct port_rule *rule = &port_rules[idx];
+
+		if (!rule->match)
+			return NULL;
+		if (rule->port == port)
+			return rule;
+		idx = (idx + 1) & PORT_RULE_TABLE_MASK;
+	}
+
+	return NULL;
+}
+
+static int port_rule_add(uint16_t port, uint8_t match)
+{
+	uint32_t idx = port_rule_hash(port);
+
+	for (int i = 0; i < PORT_RULE_TABLE_SIZE; i++) {
+		struct port_rule *rule = &port_rules[idx];
+
+		if (rule->match && rule->port == port) {
+			rule->match |= match;
+			return 0;
+		}
+		if (!rule->match) {
+			if (port_rules_count >= PORT_RULE_MAX)
+				break;
+			rule->port = port;
+			rule->match = match;
+			rule->hits = 0;
+			port_rules_count++;
+			idx = PORT_RULE_HASH(port, PORT_RULE_BITMAP_BITS);
+			port_rule_bitmap[idx / 32] |= 1u << (idx % 32);
+			return 0;
+		}
+		idx = (idx + 1) & PORT_RULE_TABLE_MASK;
+	}
+
+	ESP_LOGE(TAG, "Port rule table full, port %u not added", port);
+	return -1;
+}
+
+/* Rule bits of src and dst port of a frame, limited to given directions */
+static uint8_t port_rules_match(uint16_t src_port, uint8_t src_mask,
+		uint16_t dst_port, uint8_t dst_mask)
+{
+	struct port_rule *rule = NULL;
+	uint8_t match = 0;
+
+	rule = port_rule_find(src_port);
+	if (rule && (rule->match & src_mask)) {
+		match |= rule->match & src_mask;
+		rule->hits++;
+	}
+
+	rule = port_rule_find(dst_port);
+	if (rule && (rule->match & dst_mask)) {
+		match |= rule->match & dst_mask;
+		rule->hits++;
+	}
+
+	return match;
+}
+
+/* Parse a comma-separated list of ports into the rule table */
+static int init_allowed_ports(const char *ports_str, uint8_t match, const char *port_type) {
+    int ports_count = 0;
+    int ret = 0;
+
+    /* Only initialize once per port type */
+    if (port_rules_types_loaded & match) {
         return 0;
     }
 
-    /* Reset counter */
-    *ports_count = 0;
-
     /* If no ports string provided, return */
     if (!ports_str || !ports_str[0]) {
         ESP_LOGI(TAG, "No %s ports configured", port_type);
@@ -108,45 +210,34 @@ static int init_allowed_ports(const char *ports_str, int *ports_count, uint16_t
     char port_buf[6]; /* Max 5 digits for a port + null terminator */
     int port_buf_idx = 0;
 
-    for (int i = 0; ports_str[i] != '\0' && *ports_count < max_ports; i++) {
+    for (int i = 0; ; i++) {
         if (isdigit((unsigned char)ports_str[i])) {  /* Fix: cast to unsigned char */
             port_buf[port_buf_idx++] = ports_str[i];
             if (port_buf_idx >= sizeof(port_buf) - 1) {
                 port_buf_idx = sizeof(port_buf) - 2; /* Prevent overflow */
             }
-        } else if (ports_str[i] == ',') {
-            if (port_buf_idx > 0) {
+        } else if (ports_str[i] == ',' || ports_str[i] == '\0') {
+            /* Last port may have no trailing comma */
+            if (port_buf_idx > 0 && ports_count < MAX_ALLOWED_PORTS_PER_TYPE) {
                 port_buf[port_buf_idx] = '\0';
-                ports_array[(*ports_count)++] = atoi(port_buf);
-                port_buf_idx = 0;
+                ret = port_rule_add(atoi(port_buf), match);
+                if (ret)
+                    break;
+                ESP_LOGI(TAG, "  - Port %s", port_buf);
+                ports_count++;
             }
+            port_buf_idx = 0;
+            if (ports_str[i] == '\0')
+                break;
         }
     }
 
-    /* Process the last port if there's no trailing comma */
-    if (port_buf_idx > 0) {
-        port_buf[port_buf_idx] = '\0';
-        ports_array[(*ports_count)++] = atoi(port_buf);
-    }
-
-    /* Log the results */
-    ESP_LOGI(TAG, "Initialized %d allowed %s ports:", *ports_count, port_type);
-    for (int i = 0; i < *ports_count; i++) {
-        ESP_LOGI(TAG, "  - Port %d", ports_array[i]);
-    }
+    ESP_LOGI(TAG, "Initialized %d allowed %s ports", ports_count, port_type);
 
     /* Mark as initialized */
-    if (strcmp(port_type, "tcp_src") == 0) {
-        tcp_src_initialized = true;
-    } else if (strcmp(port_type, "tcp_dst") == 0) {
-        tcp_dst_initialized = true;
-    } else if (strcmp(port_type, "udp_src") == 0) {
-        udp_src_initialized = true;
-    } else if (strcmp(port_type, "udp_dst") == 0) {
-        udp_dst_initialized = true;
-    }
+    port_rules_types_loaded |= match;
 
-    return 0;
+    return ret;
 }
 
 
@@ -155,14 +246,12 @@ static int init_allowed_tcp_ports(const char *ports_str_src, const char *ports_s
 
     if (ports_str_src && strlen(ports_str_src) > 0) {
         ESP_LOGI(TAG, "Host reserved TCP src ports: %s", ports_str_src);
-        ret1 = init_allowed_ports(ports_str_src, &allowed_tcp_src_ports_count,
-                                 allowed_tcp_src_ports, MAX_ALLOWED_TCP_SRC_PORTS, "tcp_src");
+        ret1 = init_allowed_ports(ports_str_src, PORT_RULE_TCP_SRC, "tcp_src");
     }
 
     if (ports_str_dst && strlen(ports_str_dst) > 0) {
         ESP_LOGI(TAG, "Host reserved TCP dst ports: %s", ports_str_dst);
-        ret2 = init_allowed_ports(ports_str_dst, &allowed_tcp_dst_ports_count,
-                                 allowed_tcp_dst_ports, MAX_ALLOWED_TCP_DST_PORTS, "tcp_dst");
+        ret2 = init_allowed_ports(ports_str_dst, PORT_RULE_TCP_DST, "tcp_dst");
     }
 
     if (ret1) {
@@ -180,11 +269,11 @@ static int init_allowed_udp_ports(const char *ports_str_src, const char *ports_s
     int ret1=0, ret2=0;
 	if (ports_str_src && strlen(ports_str_src) > 0) {
 		ESP_LOGI(TAG, "host reserved udp src ports: %s", ports_str_src);
-		ret1 = init_allowed_ports(ports_str_src, &allowed_udp_src_ports_count, allowed_udp_src_ports, MAX_ALLOWED_UDP_SRC_PORTS, "udp_src");
+		ret1 = init_allowed_ports(ports_str_src, PORT_RULE_UDP_SRC, "udp_src");
 	}
 	if (ports_str_dst && strlen(ports_str_dst) > 0) {
 		ESP_LOGI(TAG, "host reserved udp dst ports: %s", ports_str_dst);
-		ret2 = init_allowed_ports(ports_str_dst, &allowed_udp_dst_ports_count, allowed_udp_dst_ports, MAX_ALLOWED_UDP_DST_PORTS, "udp_dst");
+		ret2 = init_allowed_ports(ports_str_dst, PORT_RULE_UDP_DST, "udp_dst");
 	}
 
 	if (ret1) {
@@ -227,43 +316,6 @@ static int punch_hole_for_host_ports_from_config(const char *ports_str_tcp_src,
     return 0;
 }
 
-/* Add this function to check if a port is allowed */
-static inline bool is_tcp_src_port_allowed(uint16_t port) {
-    for (int i = 0; i < allowed_tcp_src_ports_count; i++) {
-        if (port == allowed_tcp_src_ports[i]) {
-            return true;
-        }
-    }
-    return false;
-}
-
-static inline bool is_tcp_dst_port_allowed(uint16_t port) {
-    for (int i = 0; i < allowed_tcp_dst_ports_count; i++) {
-        if (port == allowed_tcp_dst_ports[i]) {
-            return true;
-        }
-    }
-    return false;
-}
-
-static inline bool is_udp_src_port_allowed(uint16_t port) {
-    for (int i = 0; i < allowed_udp_src_ports_count; i++) {
-        if (port == allowed_udp_src_ports[i]) {
-            return true;
-        }
-    }
-    return false;
-}
-
-static inline bool is_udp_dst_port_allowed(uint16_t port) {
-    for (int i = 0; i < allowed_udp_dst_ports_count; i++) {
-        if (port == allowed_udp_dst_ports[i]) {
-            return true;
-        }
-    }
-    return false;
-}
-
 static bool host_mqtt_wakeup_triggered(const void *payload, uint16_t payload_length)
 {
 	/* Check if payload contains "wakeup-host" string */
@@ -353,6 +405,7 @@ hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length
 	u8_t proto;
 	u16_t dst_port = 0;
 	u16_t src_port = 0;
+	uint8_t match = 0;
 
 	/* Check if the frame is a MAC broadcast */
 	if (ethhdr->dest.addr[0] & 0x01) {
@@ -376,15 +429,18 @@ hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length
 
 			ESP_LOGV(TAG, "dst_port: %u, src_port: %u", dst_port, src_port);
 
+			match = port_rules_match(src_port, PORT_RULES_TCP_SRC,
+					dst_port, PORT_RULES_TCP_DST);
+
 			/* Check for allowed ports (SSH, RTSP, etc.) */
-			if (is_tcp_src_port_allowed(src_port) || is_tcp_dst_port_allowed(dst_port)) {
+			if (match & (PORT_RULE_TCP_SRC | PORT_RULE_TCP_DST)) {
 				ESP_LOGV(TAG, "Priority tcp port traffic detected, forwarding to host");
 				result = HOST_LWIP_BRIDGE;
 				return result;
 			}
 
 			/* Check for iperf port */
-			if (dst_port == DEFAULT_IPERF_PORT) {
+			if (match & PORT_RULE_TCP_IPERF_DST) {
 				ESP_LOGV(TAG, "iperf pkt %u", DEFAULT_IPERF_PORT);
 				if (is_local_tcp_port_open(dst_port)) {
 					result = SLAVE_LWIP_BRIDGE;
@@ -398,7 +454,7 @@ hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length
 			if (IS_REMOTE_TCP_PORT(dst_port)) {
 				if (is_host_power_saving()) {
 					/* filter host destined mqtt packet says 'wake-up-host' */
-					if (src_port == MQTT_PORT) {
+					if (match & PORT_RULE_MQTT_SRC) {
 					#define TCP_HDR_LEN(tcphdr) ((TCPH_FLAGS(tcphdr) >> 12) * 4)
 
 						u16_t tcp_hdr_len = TCP_HDR_LEN(tcphdr);
@@ -439,15 +495,18 @@ hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length
 
 			ESP_LOGV(TAG, "UDP dst_port: %u, src_port: %u", dst_port, src_port);
 
+			match = port_rules_match(src_port, PORT_RULES_UDP_SRC,
+					dst_port, PORT_RULES_UDP_DST);
+
 			/* Check for allowed ports */
-			if (is_udp_src_port_allowed(src_port) || is_udp_dst_port_allowed(dst_port)) {
+			if (match & (PORT_RULE_UDP_SRC | PORT_RULE_UDP_DST)) {
 				ESP_LOGV(TAG, "Priority udp port traffic detected, forwarding to host");
 				result = HOST_LWIP_BRIDGE;
 				return result;
 			}
 
 			/* Check for iperf UDP port */
-			if (dst_port == DEFAULT_IPERF_PORT) {
+			if (match & PORT_RULE_UDP_IPERF_DST) {
 				ESP_LOGV(TAG, "Detected iperf UDP packet on port %u", DEFAULT_IPERF_PORT);
 				if (is_local_udp_port_open(dst_port)) {
 					result = SLAVE_LWIP_BRIDGE;
@@ -458,7 +517,7 @@ hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length
 				}
 			}
 
-			if (dst_port == LWIP_IANA_PORT_DHCP_CLIENT) {
+			if (match & PORT_RULE_DHCP_CLIENT_DST) {
 				result = DHCP_LWIP_BRIDGE;
 				return result;
 			}
@@ -519,7 +578,35 @@ hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length
 	return result;
 }
 
+void lwip_filter_init(void)
+{
+	port_rule_add(DEFAULT_IPERF_PORT, PORT_RULE_TCP_IPERF_DST | PORT_RULE_UDP_IPERF_DST);
+	port_rule_add(LWIP_IANA_PORT_DHCP_CLIENT, PORT_RULE_DHCP_CLIENT_DST);
+	port_rule_add(MQTT_PORT, PORT_RULE_MQTT_SRC);
+}
+
 int configure_host_static_port_forwarding_rules(const char *ports_str_tcp_src, const char *ports_str_tcp_dst, const char *ports_str_udp_src, const char *ports_str_udp_dst) {
     return punch_hole_for_host_ports_from_config(ports_str_tcp_src, ports_str_tcp_dst, ports_str_udp_src, ports_str_udp_dst);
 }
+
+void lwip_filter_print_rule_hits(void)
+{
+	for (int i = 0; i < PORT_RULE_TABLE_SIZE; i++) {
+		struct port_rule *rule = &port_rules[i];
+
+		if (!rule->match)
+			continue;
+
+		ESP_LOGI(TAG, "port rule %5u [%s%s%s%s%s%s%s%s] hits[%" PRIu32 "]", rule->port,
+				(rule->match & PORT_RULE_TCP_SRC) ? " tcp_src" : "",
+				(rule->match & PORT_RULE_TCP_DST) ? " tcp_dst" : "",
+				(rule->match & PORT_RULE_UDP_SRC) ? " udp_src" : "",
+				(rule->match & PORT_RULE_UDP_DST) ? " udp_dst" : "",
+				(rule->match & PORT_RULE_TCP_IPERF_DST) ? " tcp_iperf" : "",
+				(rule->match & PORT_RULE_UDP_IPERF_DST) ? " udp_iperf" : "",
+				(rule->match & PORT_RULE_DHCP_CLIENT_DST) ? " dhcp_client" : "",
+				(rule->match & PORT_RULE_MQTT_SRC) ? " mqtt_src" : "",
+				rule->hits);
+	}
+}
 #endif
@@ -14,8 +14,14 @@ typedef enum {
 #if defined(CONFIG_NETWORK_SPLIT_ENABLED) && defined(CONFIG_LWIP_ENABLE)
 #include "esp_hosted_lwip_src_port_hook.h"
 
+/* Load fixed port rules, before any frame is filtered */
+void lwip_filter_init(void);
+
 hosted_l2_bridge filter_and_route_packet(void *frame_data, uint16_t frame_length);
 
 int configure_host_static_port_forwarding_rules(const char *ports_str_tcp_src, const char *ports_str_tcp_dst,
                                                 const char *ports_str_udp_src, const char *ports_str_udp_dst);
+
+/* Log configured host port rules with their hit counts */
+void lwip_filter_print_rule_hits(void);
 #endif
@@ -19,6 +19,52 @@
 
 const char *TAG = "HS_MP";
 
+#ifdef CONFIG_ESP_CACHE_MALLOC
+/* Host stress test widens the race window of pop through this */
+#ifndef MEMPOOL_TEST_POP_WINDOW
+#define MEMPOOL_TEST_POP_WINDOW()
+#endif
+
+/*
+ * Blocks are handed out from a lock-free stack, so alloc/free never block
+ * and are safe between tasks on either core. Free list links live in a
+ * separate index array, keeping blocks untouched while they are free.
+ */
+static void * mempool_pop(struct hosted_mempool *mempool)
+{
+	uint32_t head = atomic_load_explicit(&mempool->free_head, memory_order_acquire);
+	uint32_t new_head = 0;
+	uint16_t idx = 0;
+
+	do {
+		idx = MEMPOOL_HEAD_IDX(head);
+		if (idx == MEMPOOL_IDX_NONE)
+			return NULL;
+
+		/* May read a stale link, tag makes the exchange fail then */
+		new_head = MEMPOOL_HEAD(MEMPOOL_HEAD_TAG(head) + 1,
+				atomic_load_explicit(&mempool->next[idx], memory_order_relaxed));
+		MEMPOOL_TEST_POP_WINDOW();
+	} while (!atomic_compare_exchange_weak_explicit(&mempool->free_head,
+				&head, new_head, memory_order_acquire, memory_order_acquire));
+
+	return mempool->heap + (idx * mempool->block_size);
+}
+
+static void mempool_push(struct hosted_mempool *mempool, uint16_t idx)
+{
+	uint32_t head = atomic_load_explicit(&mempool->free_head, memory_order_relaxed);
+	uint32_t new_head = 0;
+
+	do {
+		atomic_store_explicit(&mempool->next[idx], MEMPOOL_HEAD_IDX(head),
+				memory_order_relaxed);
+		new_head = MEMPOOL_HEAD(MEMPOOL_HEAD_TAG(head) + 1, idx);
+	} while (!atomic_compare_exchange_weak_explicit(&mempool->free_head,
+				&head, new_head, memory_order_release, memory_order_relaxed));
+}
+#endif
+
 /* For Statically allocated memory, please pass as pre_allocated_mem.
  * If NULL passed, will allocate from heap
  */
@@ -27,14 +73,22 @@ struct hosted_mempool * hosted_mempool_create(void *pre_allocated_mem,
 {
 #ifdef CONFIG_ESP_CACHE_MALLOC
 	struct hosted_mempool *new = NULL;
-	struct os_mempool *pool = NULL;
 	uint8_t *heap = NULL;
-	char str[MEMPOOL_NAME_STR_SIZE] = {0};
+	size_t idx = 0;
+
+	if (!num_blocks || num_blocks > MEMPOOL_MAX_BLOCKS) {
+		ESP_LOGE(TAG, "mempool create failed, invalid num_blocks[%u]\n",
+				(unsigned int)num_blocks);
+		return NULL;
+	}
+
+	/* Keep every block DMA aligned */
+	if (!IS_MEMPOOL_ALIGNED(block_size))
+		block_size = MEMPOOL_ALIGNED(block_size);
 
 	if (!pre_allocated_mem) {
 		/* no pre-allocated mem, allocate new */
-		heap = (uint8_t *)MEM_ALLOC( MEMPOOL_ALIGNED(OS_MEMPOOL_BYTES(
-						num_blocks,block_size)));
+		heap = (uint8_t *)MEM_ALLOC(num_blocks * block_size);
 		if (!heap) {
 			ESP_LOGE(TAG, "mempool create failed, no mem\n");
 			return NULL;
@@ -54,36 +108,36 @@ struct hosted_mempool * hosted_mempool_create(void *pre_allocated_mem,
 	}
 
 	new = (struct hosted_mempool*)CALLOC(1, sizeof(struct hosted_mempool));
-	pool = (struct os_mempool *)CALLOC(1, sizeof(struct os_mempool));
-
-	if(!new || !pool) {
+	if (!new)
 		goto free_buffs;
-	}
-
-	snprintf(str, MEMPOOL_NAME_STR_SIZE, "hosted_%p", pool);
 
-	if (os_mempool_init(pool, num_blocks, block_size, heap, str)) {
-		ESP_LOGE(TAG, "os_mempool_init failed\n");
+	new->next = (_Atomic uint16_t *)CALLOC(num_blocks, sizeof(*new->next));
+	if (!new->next)
 		goto free_buffs;
-	}
+
+	/* Chain all blocks, block 0 on top */
+	for (idx = 0; idx < num_blocks; idx++)
+		atomic_init(&new->next[idx],
+				(idx + 1 < num_blocks) ? (uint16_t)(idx + 1) : MEMPOOL_IDX_NONE);
+	atomic_init(&new->free_head, MEMPOOL_HEAD(0, 0));
 
 	if (pre_allocated_mem)
 		new->static_heap = 1;
 
 	new->heap = heap;
-	new->pool = pool;
 	new->num_blocks = num_blocks;
 	new->block_size = block_size;
 
 #if MEMPOOL_DEBUG
-	ESP_LOGI(TAG, "Create mempool %p with num_blk[%u] blk_size:[%u]", new->pool, (unsigned int)new->num_blocks, (unsigned int)new->block_size);
+	ESP_LOGI(TAG, "Create mempool %p with num_blk[%u] blk_size:[%u]", new, (unsigned int)new->num_blocks, (unsigned int)new->block_size);
 #endif
 
 	return new;
 
 free_buffs:
+	if (new)
+		FREE(new->next);
 	FREE(new);
-	FREE(pool);
 	if (!pre_allocated_mem)
 		FREE(heap);
 	return NULL;
@@ -98,9 +152,9 @@ void hosted_mempool_destroy(struct hosted_mempool *mempool)
 	if (!mempool)
 		return;
 
-	ESP_LOGI(TAG, "Destroy mempool %p num_blk[%u] blk_size:[%u]", mempool->pool, (unsigned int)mempool->num_blocks, (unsigned int)mempool->block_size);
+	ESP_LOGI(TAG, "Destroy mempool %p num_blk[%u] blk_size:[%u]", mempool, (unsigned int)mempool->num_blocks, (unsigned int)mempool->block_size);
 
-	FREE(mempool->pool);
+	FREE(mempool->next);
 
 	if (!mempool->static_heap)
 		FREE(mempool->heap);
@@ -118,18 +172,13 @@ void * hosted_mempool_alloc(struct hosted_mempool *mempool,
 	if (!mempool)
 		return NULL;
 
-#if MYNEWT_VAL(OS_MEMPOOL_CHECK)
-	assert(mempool->heap);
-	assert(mempool->pool);
-
 	if(nbytes > mempool->block_size) {
 		ESP_LOGE(TAG, "Exp alloc bytes[%u] > mempool block size[%u]\n",
 				(unsigned int)nbytes, (unsigned int)mempool->block_size);
 		return NULL;
 	}
-#endif
 
-	mem = os_memblock_get(mempool->pool);
+	mem = mempool_pop(mempool);
 #else
 	mem = MEM_ALLOC(MEMPOOL_ALIGNED(nbytes));
 #endif
@@ -141,18 +190,27 @@ void * hosted_mempool_alloc(struct hosted_mempool *mempool,
 
 int hosted_mempool_free(struct hosted_mempool *mempool, void *mem)
 {
+#ifdef CONFIG_ESP_CACHE_MALLOC
+	size_t offset = 0;
+#endif
+
 	if (!mem)
 		return 0;
 #ifdef CONFIG_ESP_CACHE_MALLOC
 	if (!mempool)
 		return MEMPOOL_FAIL;
 
-#if MYNEWT_VAL(OS_MEMPOOL_CHECK)
-	assert(mempool->heap);
-	assert(mempool->pool);
-#endif
+	/* A foreign or misaligned pointer would corrupt the free list */
+	offset = (uint8_t *)mem - mempool->heap;
+	if ((uint8_t *)mem < mempool->heap ||
+	    offset >= mempool->num_blocks * mempool->block_size ||
+	    offset % mempool->block_size) {
+		ESP_LOGE(TAG, "Free of %p not from mempool %p\n", mem, mempool);
+		return MEMPOOL_FAIL;
+	}
 
-	return os_memblock_put(mempool->pool, mem);
+	mempool_push(mempool, offset / mempool->block_size);
+	return MEMPOOL_OK;
 #else
 	FREE(mem);
 	return 0;
@@ -24,9 +24,19 @@
 #include <freertos/portmacro.h>
 
 #ifdef CONFIG_ESP_CACHE_MALLOC
-#include "mempool_ll.h"
+#include <stdatomic.h>
+
+/* Free list is a stack of block indices. Head packs the top index with a
+ * tag bumped on every update, so a stale head never compares equal (ABA) */
+#define MEMPOOL_IDX_NONE                 0xFFFF
+#define MEMPOOL_MAX_BLOCKS               MEMPOOL_IDX_NONE
+#define MEMPOOL_HEAD(TAG, IDX)           (((uint32_t)(TAG) << 16) | (IDX))
+#define MEMPOOL_HEAD_IDX(HEAD)           ((uint16_t)((HEAD) & 0xFFFF))
+#define MEMPOOL_HEAD_TAG(HEAD)           ((uint16_t)((HEAD) >> 16))
+
 struct hosted_mempool {
-	struct os_mempool *pool;
+	_Atomic uint32_t free_head;
+	_Atomic uint16_t *next;
 	uint8_t *heap;
 	uint8_t static_heap;
 	size_t num_blocks;
@@ -29,6 +29,15 @@
 #include "stats.h"
 #include "esp_fw_version.h"
 #include "host_power_save.h"
+#if CONFIG_ESP_SDIO_TX_ZERO_COPY
+#include "esp_private/wifi.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
+#endif
 
 #define SIMPLIFIED_SDIO_SLAVE            1
 #define SDIO_DRIVER_TX_QUEUE_SIZE        10
@@ -38,6 +47,13 @@ static uint8_t sdio_slave_rx_buffer[SDIO_RX_BUFFER_NUM][SDIO_RX_BUFFER_SIZE];
 
 static struct hosted_mempool * buf_mp_tx_g;
 
+#if CONFIG_ESP_SDIO_TX_ZERO_COPY
+#define SDIO_DMA_ALIGNMENT_BYTES         4
+#define SDIO_DMA_ALIGNMENT_MASK          (SDIO_DMA_ALIGNMENT_BYTES-1)
+/* Tag on send queue arg, for buffers owned by Wi-Fi driver */
+#define SDIO_TX_ARG_WIFI_EB              0x1
+#endif
+
 interface_context_t context;
 interface_handle_t if_handle_g;
 static const char *TAG = "SDIO_SLAVE";
@@ -405,16 +421,22 @@ static void sdio_tx_done_task(void* pvParameters)
 			continue;
 		}
 		xSemaphoreGive(sdio_send_queue_sem);
+#if CONFIG_ESP_SDIO_TX_ZERO_COPY
+		if ((uintptr_t)sendbuf_p & SDIO_TX_ARG_WIFI_EB) {
+			esp_wifi_internal_free_rx_buffer((void *)((uintptr_t)sendbuf_p &
+					~SDIO_TX_ARG_WIFI_EB));
+			continue;
+		}
+#endif
 		sdio_buffer_tx_free(sendbuf_p);
 	}
 }
 #endif
 
 static inline struct esp_payload_header * update_tx_header(uint8_t* sendbuf,
-		interface_buffer_handle_t *buf_handle)
+		uint16_t offset, interface_buffer_handle_t *buf_handle)
 {
 	struct esp_payload_header *header = (struct esp_payload_header *)sendbuf;
-	uint16_t offset = sizeof(struct esp_payload_header);
 
 	if (unlikely(!header))
 		return NULL;
@@ -444,10 +466,33 @@ static inline esp_err_t copy_tx_payload(uint8_t *sendbuf, uint8_t* payload, uint
 	return ESP_OK;
 }
 
+#if CONFIG_ESP_SDIO_TX_ZERO_COPY
+/* Header for a Wi-Fi rx frame goes in the headroom left in front of it
+ * after 802.11 to 802.3 conversion, rounded down for DMA alignment */
+static uint8_t * get_zero_copy_sendbuf(interface_buffer_handle_t *buf_handle)
+{
+	uint8_t *sendbuf = NULL;
+
+	if (buf_handle->free_buf_handle != esp_wifi_internal_free_rx_buffer ||
+	    !buf_handle->priv_buffer_handle)
+		return NULL;
+
+	sendbuf = buf_handle->payload - sizeof(struct esp_payload_header);
+	sendbuf = (uint8_t *)((uintptr_t)sendbuf & ~SDIO_DMA_ALIGNMENT_MASK);
+
+	if (!esp_ptr_dma_capable(sendbuf) ||
+	    !esp_ptr_dma_capable(buf_handle->payload + buf_handle->payload_len - 1))
+		return NULL;
+
+	return sendbuf;
+}
+#endif
+
 static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t *buf_handle)
 {
 	int32_t total_len = 0;
 	uint8_t* sendbuf = NULL;
+	void *send_arg = NULL;
 	uint16_t offset = sizeof(struct esp_payload_header);
 	int ret = 0;
 
@@ -466,25 +511,39 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 		return ESP_FAIL;
 	}
 
+#if CONFIG_ESP_SDIO_TX_ZERO_COPY
+	sendbuf = get_zero_copy_sendbuf(buf_handle);
+	if (sendbuf) {
+		offset = buf_handle->payload - sendbuf;
+		send_arg = (void *)((uintptr_t)buf_handle->priv_buffer_handle |
+				SDIO_TX_ARG_WIFI_EB);
+	}
+#endif
+
 	total_len = buf_handle->payload_len + offset;
 
-	sendbuf = sdio_buffer_tx_alloc(total_len, MEMSET_REQUIRED);
-	if (sendbuf == NULL) {
-		ESP_LOGE(TAG, "send buffer[%"PRIu32"] malloc fail", total_len);
-		return ESP_FAIL;
-	}
+	if (!sendbuf) {
+		/* Header and payload are written over, no memset needed */
+		sendbuf = sdio_buffer_tx_alloc(total_len, MEMSET_NOT_REQUIRED);
+		if (sendbuf == NULL) {
+			ESP_LOGE(TAG, "send buffer[%"PRIu32"] malloc fail", total_len);
+			return ESP_FAIL;
+		}
+		send_arg = sendbuf;
 
-	copy_tx_payload(sendbuf, buf_handle->payload, buf_handle->payload_len);
-	update_tx_header(sendbuf, buf_handle);
+		copy_tx_payload(sendbuf, buf_handle->payload, buf_handle->payload_len);
+	}
+	update_tx_header(sendbuf, offset, buf_handle);
 
 	ESP_HEXLOGV("bus_tx", sendbuf, total_len, 32);
 
 #if !SIMPLIFIED_SDIO_SLAVE
 	if (xSemaphoreTake(sdio_send_queue_sem, portMAX_DELAY) != pdTRUE) {
-		sdio_buffer_tx_free(sendbuf);
+		if (send_arg == sendbuf)
+			sdio_buffer_tx_free(sendbuf);
 		return ESP_FAIL;
 	}
-	ret = sdio_slave_send_queue(sendbuf, total_len, sendbuf, portMAX_DELAY);
+	ret = sdio_slave_send_queue(sendbuf, total_len, send_arg, portMAX_DELAY);
 #else
 	ret = sdio_slave_transmit(sendbuf, total_len);
 #endif
@@ -493,12 +552,19 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 #if !SIMPLIFIED_SDIO_SLAVE
 		xSemaphoreGive(sdio_send_queue_sem);
 #endif
-		sdio_buffer_tx_free(sendbuf);
+		if (send_arg == sendbuf)
+			sdio_buffer_tx_free(sendbuf);
 		return ESP_FAIL;
 	}
 
 #if SIMPLIFIED_SDIO_SLAVE
-	sdio_buffer_tx_free(sendbuf);
+	/* Wi-Fi buffer, if sent in place, is freed by caller on return */
+	if (send_arg == sendbuf)
+		sdio_buffer_tx_free(sendbuf);
+#else
+	/* Wi-Fi buffer now released from sdio_tx_done_task */
+	if (send_arg != sendbuf)
+		buf_handle->priv_buffer_handle = NULL;
 #endif
 
 #if ESP_PKT_STATS
@@ -610,6 +676,9 @@ static void sdio_rx_task(void* pvParameters)
 		if (header->if_type == ESP_STA_IF)
 			pkt_stats.hs_bus_sta_in++;
   #endif
+  #ifdef CONFIG_ESP_HOSTED_FUNCTION_PROFILING
+		buf_handle.enqueue_time = esp_timer_get_time();
+  #endif
 
 
   #ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
@@ -66,6 +66,14 @@
             }                       \
         }
 
+/* Decoded request is carved from this arena and dropped as a whole once
+ * handled. Sized for an OTA write chunk (4000 bytes) with its headers,
+ * bigger requests spill over to heap */
+#ifndef CTRL_REQ_ARENA_SIZE
+#define CTRL_REQ_ARENA_SIZE         4608
+#endif
+#define CTRL_REQ_ARENA_ALIGN        8
+
 #ifdef CONFIG_NETWORK_SPLIT_ENABLED
 
 typedef struct {
@@ -94,7 +102,19 @@ typedef struct esp_ctrl_msg_cmd {
 			CtrlMsg *resp, void *priv_data);
 } esp_ctrl_msg_req_t;
 
+/* Scan list entry along with storage for its strings */
+typedef struct {
+	ScanResult entry;
+	uint8_t ssid[SSID_LENGTH + 1];
+	uint8_t bssid[BSSID_LENGTH + 1];
+} scan_result_buf_t;
+
 static const char* TAG = "slave_ctrl";
+
+/* Requests are decoded in pserial task only, one at a time */
+static uint8_t ctrl_req_arena[CTRL_REQ_ARENA_SIZE] __attribute__((aligned(CTRL_REQ_ARENA_ALIGN)));
+static size_t ctrl_req_arena_used;
+
 static TimerHandle_t handle_heartbeat_task;
 static uint32_t hb_num;
 
@@ -1472,6 +1492,7 @@ static esp_err_t req_get_ap_scan_list_handler (CtrlMsg *req,
 	credentials_t credentials = {0};
 	wifi_ap_record_t *ap_info = NULL;
 	ScanResult **results = NULL;
+	scan_result_buf_t *result_bufs = NULL;
 	CtrlMsgRespScanResult *resp_payload = NULL;
 	wifi_scan_config_t scanConf = {
 		.show_hidden = true
@@ -1563,34 +1584,34 @@ static esp_err_t req_get_ap_scan_list_handler (CtrlMsg *req,
 	credentials.count = ap_count;
 
 	results = (ScanResult **)
-		calloc(credentials.count, sizeof(ScanResult));
+		calloc(credentials.count, sizeof(ScanResult *));
 	if (!results) {
 		ESP_LOGE(TAG,"Failed To allocate memory");
 		goto err;
 	}
 
+	/* All entries and their strings in one block, see esp_ctrl_msg_cleanup */
+	result_bufs = (scan_result_buf_t *)
+		calloc(credentials.count, sizeof(scan_result_buf_t));
+	if (!result_bufs) {
+		ESP_LOGE(TAG,"Failed To allocate memory");
+		mem_free(results);
+		goto err;
+	}
+
+	for (int i = 0; i < credentials.count; i++ )
+		results[i] = &result_bufs[i].entry;
+
 	resp_payload->entries = results;
 	ESP_LOGI(TAG,"Total APs scanned = %u",ap_count);
 	for (int i = 0; i < credentials.count; i++ ) {
-		results[i] = (ScanResult *)calloc(1,sizeof(ScanResult));
-		if (!results[i]) {
-			ESP_LOGE(TAG,"Failed to allocate memory");
-			goto err;
-		}
 		scan_result__init(results[i]);
 
 		ESP_LOGI(TAG,"Details of AP no %d",i);
 
 		results[i]->ssid.len = strnlen((char *)ap_info[i].ssid, SSID_LENGTH);
-
-
-		results[i]->ssid.data = (uint8_t *)strndup((char *)ap_info[i].ssid,
-				SSID_LENGTH);
-		if (!results[i]->ssid.data) {
-			ESP_LOGE(TAG,"Failed to allocate memory for scan result entry SSID");
-			mem_free(results[i]);
-			goto err;
-		}
+		memcpy(result_bufs[i].ssid, ap_info[i].ssid, results[i]->ssid.len);
+		results[i]->ssid.data = result_bufs[i].ssid;
 
 		credentials.chnl = ap_info[i].primary;
 		results[i]->chnl = credentials.chnl;
@@ -1602,16 +1623,10 @@ static esp_err_t req_get_ap_scan_list_handler (CtrlMsg *req,
 		results[i]->bssid.len = strnlen((char *)credentials.bssid, BSSID_LENGTH);
 		if (!results[i]->bssid.len) {
 			ESP_LOGE(TAG, "Invalid BSSID length");
-			mem_free(results[i]);
-			goto err;
-		}
-		results[i]->bssid.data = (uint8_t *)strndup((char *)credentials.bssid,
-				BSSID_LENGTH);
-		if (!results[i]->bssid.data) {
-			ESP_LOGE(TAG, "Failed to allocate memory for scan result entry BSSID");
-			mem_free(results[i]);
 			goto err;
 		}
+		memcpy(result_bufs[i].bssid, credentials.bssid, results[i]->bssid.len);
+		results[i]->bssid.data = result_bufs[i].bssid;
 
 		credentials.ecn = ap_info[i].authmode;
 		results[i]->sec_prot = credentials.ecn;
@@ -3049,17 +3064,8 @@ static void esp_ctrl_msg_cleanup(CtrlMsg *resp)
 		} case (CTRL_MSG_ID__Resp_GetAPScanList) : {
 			if (resp->resp_scan_ap_list) {
 				if (resp->resp_scan_ap_list->entries) {
-					for (int i=0 ; i<resp->resp_scan_ap_list->n_entries; i++) {
-						if (resp->resp_scan_ap_list->entries[i]) {
-							if (resp->resp_scan_ap_list->entries[i]->ssid.data) {
-								mem_free(resp->resp_scan_ap_list->entries[i]->ssid.data);
-							}
-							if (resp->resp_scan_ap_list->entries[i]->bssid.data) {
-								mem_free(resp->resp_scan_ap_list->entries[i]->bssid.data);
-							}
-							mem_free(resp->resp_scan_ap_list->entries[i]);
-						}
-				   }
+					/* first entry is start of block holding all entries */
+					mem_free(resp->resp_scan_ap_list->entries[0]);
 					mem_free(resp->resp_scan_ap_list->entries);
 				}
 				mem_free(resp->resp_scan_ap_list);
@@ -3182,6 +3188,41 @@ static void esp_ctrl_msg_cleanup(CtrlMsg *resp)
 	}
 }
 
+static void *ctrl_req_arena_alloc(void *allocator_data, size_t size)
+{
+	size_t off = (ctrl_req_arena_used + CTRL_REQ_ARENA_ALIGN - 1) &
+		~(size_t)(CTRL_REQ_ARENA_ALIGN - 1);
+
+	if (size <= CTRL_REQ_ARENA_SIZE && off <= CTRL_REQ_ARENA_SIZE - size) {
+		ctrl_req_arena_used = off + size;
+		return &ctrl_req_arena[off];
+	}
+
+	return malloc(size);
+}
+
+static void ctrl_req_arena_free(void *allocator_data, void *ptr)
+{
+	uint8_t *p = ptr;
+
+	/* arena memory is reclaimed by ctrl_req_arena_reset() */
+	if (p >= ctrl_req_arena && p < ctrl_req_arena + CTRL_REQ_ARENA_SIZE)
+		return;
+
+	free(ptr);
+}
+
+static inline void ctrl_req_arena_reset(void)
+{
+	ctrl_req_arena_used = 0;
+}
+
+static ProtobufCAllocator ctrl_req_allocator = {
+	.alloc = ctrl_req_arena_alloc,
+	.free = ctrl_req_arena_free,
+	.allocator_data = NULL,
+};
+
 esp_err_t data_transfer_handler(uint32_t session_id,const uint8_t *inbuf,
 		ssize_t inlen, uint8_t **outbuf, ssize_t *outlen, void *priv_data)
 {
@@ -3193,9 +3234,10 @@ esp_err_t data_transfer_handler(uint32_t session_id,const uint8_t *inbuf,
 		return ESP_FAIL;
 	}
 
-	req = ctrl_msg__unpack(NULL, inlen, inbuf);
+	req = ctrl_msg__unpack(&ctrl_req_allocator, inlen, inbuf);
 	if (!req) {
 		ESP_LOGE(TAG, "Unable to unpack config data");
+		ctrl_req_arena_reset();
 		return ESP_FAIL;
 	}
 
@@ -3207,13 +3249,17 @@ esp_err_t data_transfer_handler(uint32_t session_id,const uint8_t *inbuf,
 	resp.uid = req->uid;
 
 	ret = esp_ctrl_msg_command_dispatcher(req,&resp,NULL);
+
+	/* Response does not refer to request, release it before encoding */
+	ctrl_msg__free_unpacked(req, &ctrl_req_allocator);
+	ctrl_req_arena_reset();
+	req = NULL;
+
 	if (ret) {
 		ESP_LOGE(TAG, "Command dispatching not happening");
 		goto err;
 	}
 
-	ctrl_msg__free_unpacked(req, NULL);
-
 	*outlen = ctrl_msg__get_packed_size (&resp);
 	if (*outlen <= 0) {
 		ESP_LOGE(TAG, "Invalid encoding for response");
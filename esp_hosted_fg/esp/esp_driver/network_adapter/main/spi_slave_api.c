@@ -30,6 +30,18 @@
 #include "stats.h"
 #include "esp_timer.h"
 #include "esp_fw_version.h"
+#if CONFIG_ESP_TX_SCHED_DRR
+#include "tx_sched.h"
+#endif
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+#include "esp_private/wifi.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
+#endif
 
 // de-assert HS signal on CS, instead of at end of transaction
 #if defined(CONFIG_ESP_SPI_DEASSERT_HS_ON_CS)
@@ -110,12 +122,45 @@ static const char TAG[] = "SPI_DRIVER";
     #define SPI_RX_TOTAL_QUEUE_SIZE    SPI_RX_QUEUE_SIZE
 #endif
 
+#if CONFIG_ESP_SPI_RX_CREDITS
+  #ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
+    #define SPI_RX_CREDIT_Q_SIZE       SPI_RX_WIFI_QUEUE_SIZE
+  #else
+    #define SPI_RX_CREDIT_Q_SIZE       SPI_RX_QUEUE_SIZE
+  #endif
+  /* Window travels as a single byte TLV */
+  #define SPI_RX_CREDIT_WINDOW       (SPI_RX_CREDIT_Q_SIZE > 255 ? 255 : SPI_RX_CREDIT_Q_SIZE)
+  #define SPI_RX_CREDIT_REPORT_BATCH ((SPI_RX_CREDIT_WINDOW + 3) / 4)
+
+  /* Host Wi-Fi frames whose rx buffer got freed, and count last sent to host.
+   * Buffers are freed from recv_task as well as Wi-Fi tx staging task */
+  static uint32_t rx_credit_returned;
+  static uint32_t rx_credit_reported;
+  static bool rx_credit_report_pending;
+  static portMUX_TYPE rx_credit_lock = portMUX_INITIALIZER_UNLOCKED;
+  /* Host stamps credited frames in seq_num, last one seen by post process task */
+  static uint16_t rx_credit_seq;
+#endif
+
 static interface_context_t context;
 static interface_handle_t if_handle_g;
 
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
   static QueueHandle_t spi_tx_queue[MAX_PRIORITY_QUEUES];
   static SemaphoreHandle_t spi_tx_sem;
+#if CONFIG_ESP_TX_SCHED_DRR
+  static struct tx_sched spi_tx_sched;
+  static const uint16_t spi_tx_quantum[MAX_PRIORITY_QUEUES] = {
+	[PRIO_Q_SERIAL] = CONFIG_ESP_TX_SCHED_QUANTUM_SERIAL,
+	[PRIO_Q_BT] = CONFIG_ESP_TX_SCHED_QUANTUM_BT,
+	[PRIO_Q_OTHERS] = CONFIG_ESP_TX_SCHED_QUANTUM_WIFI,
+  };
+  static const char * const spi_tx_q_names[MAX_PRIORITY_QUEUES] = {
+	[PRIO_Q_SERIAL] = "serial",
+	[PRIO_Q_BT] = "bt",
+	[PRIO_Q_OTHERS] = "wifi",
+  };
+#endif
 #else
   static QueueHandle_t spi_tx_queue;
 #endif
@@ -129,6 +174,36 @@ static interface_handle_t if_handle_g;
 
 #if HS_DEASSERT_ON_CS
 static SemaphoreHandle_t wait_cs_deassert_sem;
+/* CS deassert edges seen by ISR, and by post process task */
+static volatile uint32_t cs_deassert_cnt;
+static uint32_t cs_deassert_seen;
+
+#if defined(ESP_FUNCTION_PROFILING) || CONFIG_ESP_SPI_HS_ADAPTIVE_PREARM
+#define H_SPI_HS_TIMESTAMPS 1
+/* Handshake state machine timestamps of last transaction, in us */
+static struct {
+	volatile uint32_t setup;
+	volatile uint32_t cs_assert;
+	volatile uint32_t dma_done;
+	volatile uint32_t cs_deassert;
+} hs_ts;
+
+#ifdef ESP_FUNCTION_PROFILING
+/* Registered at init, post process task records into them per transfer */
+static struct {
+	struct timing_stats_entry *setup_to_cs;
+	struct timing_stats_entry *cs_to_dma_done;
+	struct timing_stats_entry *cs_hold;
+	struct timing_stats_entry *cs_deassert_wait;
+} hs_prof;
+#endif
+#endif
+
+#if CONFIG_ESP_SPI_HS_ADAPTIVE_PREARM
+/* Running average of CS hold after transfer end. Start out of range,
+ * so pre-arm kicks in only once host is seen releasing CS in time */
+static uint32_t cs_hold_avg_us = CONFIG_ESP_SPI_HS_PREARM_MAX_HOLD_US + 1;
+#endif
 #endif
 static interface_handle_t * esp_spi_init(void);
 static int32_t esp_spi_write(interface_handle_t *handle,
@@ -154,6 +229,31 @@ static struct hosted_mempool * trans_mp_g;
 /* Full size dummy buffer for no-data transactions */
 static DRAM_ATTR uint8_t dummy_buffer[SPI_BUFFER_SIZE] __attribute__((aligned(4)));
 
+#if CONFIG_ESP_SPI_VARIABLE_LEN_TRANS
+/* Host clocks each transaction only up to the length advertised in the
+ * previous frame header. Next tx frame is fetched in advance to advertise it */
+#define SPI_MIN_TRANS_LEN          ((sizeof(struct esp_payload_header) + \
+				SPI_DMA_ALIGNMENT_MASK) & ~SPI_DMA_ALIGNMENT_MASK)
+static interface_buffer_handle_t spi_next_tx_buf;
+static uint16_t spi_tx_len_advertised = SPI_BUFFER_SIZE;
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+/* Host was told next transaction is only as long as its frame */
+static bool spi_tx_len_limited;
+#endif
+#endif
+
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+/* Real data transactions loaded in SPI driver but not yet completed */
+static uint8_t spi_data_trans_queued;
+static portMUX_TYPE spi_data_trans_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Handshake is held high while at least this many transactions are queued in
+ * SPI driver, so host may keep as many transfers in flight */
+#define SPI_HS_PREQUEUE_DEPTH      2
+/* Transactions queued in SPI driver, including one loaded in hardware */
+static int16_t spi_trans_loaded;
+#endif
+
 static inline void spi_mempool_create()
 {
 #ifdef CONFIG_ESP_CACHE_MALLOC
@@ -258,6 +358,133 @@ static inline void spi_trans_free(spi_slave_transaction_t *trans)
 #define set_dataready_gpio()     gpio_set_level(GPIO_DATA_READY, 1);
 #define reset_dataready_gpio()   gpio_set_level(GPIO_DATA_READY, 0);
 
+#if CONFIG_ESP_SPI_RX_CREDITS
+/* Tell host how many of its Wi-Fi frames are done with, so it can send more */
+static int send_rx_credit_event(uint32_t count)
+{
+	struct esp_payload_header *header = NULL;
+	interface_buffer_handle_t buf_handle = {0};
+	struct esp_priv_event *event = NULL;
+	uint16_t len = 0;
+	uint32_t total_len = 0;
+
+	buf_handle.payload = spi_buffer_tx_alloc(MEMSET_REQUIRED);
+	if (!buf_handle.payload)
+		return ESP_FAIL;
+
+	header = (struct esp_payload_header *) buf_handle.payload;
+	header->if_type = ESP_PRIV_IF;
+	header->if_num = 0;
+	header->offset = htole16(sizeof(struct esp_payload_header));
+	header->priv_pkt_type = ESP_PACKET_TYPE_EVENT;
+
+	event = (struct esp_priv_event *) (buf_handle.payload + sizeof(struct esp_payload_header));
+	event->event_type = ESP_PRIV_EVENT_RX_CREDIT;
+	event->event_len = sizeof(count);
+	event->event_data[0] = count & 0xff;
+	event->event_data[1] = (count >> 8) & 0xff;
+	event->event_data[2] = (count >> 16) & 0xff;
+	event->event_data[3] = (count >> 24) & 0xff;
+
+	len = event->event_len + 2;
+	header->len = htole16(len);
+
+	total_len = len + sizeof(struct esp_payload_header);
+	if (!IS_SPI_DMA_ALIGNED(total_len)) {
+		MAKE_SPI_DMA_ALIGNED(total_len);
+	}
+
+	buf_handle.if_type = ESP_PRIV_IF;
+	buf_handle.payload_len = total_len;
+
+#if CONFIG_ESP_SPI_CHECKSUM
+	header->checksum = htole16(compute_checksum(buf_handle.payload, len + sizeof(struct esp_payload_header)));
+#endif
+
+	/* Credits go ahead of bulk data, host tx may be waiting on them.
+	 * Never wait on a full queue, callers free rx buffers */
+#ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
+#if CONFIG_ESP_TX_SCHED_DRR
+	buf_handle.enqueue_time = esp_timer_get_time();
+#endif
+	if (xQueueSend(spi_tx_queue[PRIO_Q_SERIAL], &buf_handle, 0) != pdTRUE) {
+		spi_buffer_tx_free(buf_handle.payload);
+		return ESP_FAIL;
+	}
+	xSemaphoreGive(spi_tx_sem);
+#else
+	if (xQueueSend(spi_tx_queue, &buf_handle, 0) != pdTRUE) {
+		spi_buffer_tx_free(buf_handle.payload);
+		return ESP_FAIL;
+	}
+#endif
+
+	set_dataready_gpio();
+
+	return ESP_OK;
+}
+
+static void report_rx_credits(void)
+{
+	uint32_t count = 0;
+
+	portENTER_CRITICAL(&rx_credit_lock);
+	rx_credit_reported = rx_credit_returned;
+	rx_credit_report_pending = false;
+	count = rx_credit_reported;
+	portEXIT_CRITICAL(&rx_credit_lock);
+
+	/* Count is cumulative, so retrying with a later count covers this one.
+	 * Retried from post process task, as host may be stalled on the window */
+	if (send_rx_credit_event(count)) {
+		portENTER_CRITICAL(&rx_credit_lock);
+		rx_credit_report_pending = true;
+		portEXIT_CRITICAL(&rx_credit_lock);
+	}
+}
+
+static void return_rx_credits(uint32_t count)
+{
+	bool report = false;
+
+	portENTER_CRITICAL(&rx_credit_lock);
+	rx_credit_returned += count;
+	report = rx_credit_returned - rx_credit_reported >= SPI_RX_CREDIT_REPORT_BATCH;
+	portEXIT_CRITICAL(&rx_credit_lock);
+
+	if (report)
+		report_rx_credits();
+}
+
+/* Credit frames host sent before this one, which never made it to rx queue */
+static void account_rx_credit_seq(uint16_t seq)
+{
+	uint16_t lost = seq - rx_credit_seq - 1;
+
+	rx_credit_seq = seq;
+
+	/* Far off sequence is a reused one, or host not stamping frames */
+	if (lost && lost < SPI_RX_CREDIT_WINDOW)
+		return_rx_credits(lost);
+}
+
+/*
+ * Frame dropped for bad length or checksum. If it looks like a credited one,
+ * count it right away, host may have no further frame to reveal the gap.
+ * Frames with len or offset 0 are host dummy transfers, their corrupted
+ * credited ones are caught by the gap.
+ */
+static void drop_rx_credit(struct esp_payload_header *header)
+{
+	if ((header->if_type != ESP_STA_IF && header->if_type != ESP_AP_IF) ||
+	    !header->len)
+		return;
+
+	rx_credit_seq++;
+	return_rx_credits(1);
+}
+#endif
+
 interface_context_t *interface_insert_driver(int (*event_handler)(uint8_t val))
 {
 	ESP_LOGI(TAG, "Using SPI interface");
@@ -324,6 +551,34 @@ void generate_startup_event(uint8_t cap)
 	*pos = LENGTH_1_BYTE;               pos++;len++;
 	*pos = raw_tp_cap;                  pos++;len++;
 
+#if CONFIG_ESP_SPI_VARIABLE_LEN_TRANS
+	/* TLV - Variable length SPI transactions */
+	*pos = ESP_PRIV_SPI_VAR_LEN;        pos++;len++;
+	*pos = LENGTH_1_BYTE;               pos++;len++;
+	*pos = ESP_SPI_NEXT_LEN_UNIT;       pos++;len++;
+#endif
+
+#if CONFIG_ESP_SPI_RX_CREDITS
+	/* TLV - Host to slave Wi-Fi frame credits */
+	*pos = ESP_PRIV_RX_CREDITS;         pos++;len++;
+	*pos = LENGTH_1_BYTE;               pos++;len++;
+	*pos = SPI_RX_CREDIT_WINDOW;        pos++;len++;
+#endif
+
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+	/* TLV - Transactions of Wi-Fi buffer frames are cut to frame length */
+	*pos = ESP_PRIV_SPI_LEN_LIMIT;      pos++;len++;
+	*pos = LENGTH_1_BYTE;               pos++;len++;
+	*pos = ESP_SPI_LEN_LIMIT_SLACK;     pos++;len++;
+#endif
+
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+	/* TLV - Transfers host may pipeline */
+	*pos = ESP_PRIV_SPI_PREQUEUE;       pos++;len++;
+	*pos = LENGTH_1_BYTE;               pos++;len++;
+	*pos = SPI_HS_PREQUEUE_DEPTH;       pos++;len++;
+#endif
+
 	/* fill structure with fw info */
 	strlcpy(fw_ver.project_name, PROJECT_NAME, sizeof(fw_ver.project_name));
 	fw_ver.major1 = PROJECT_VERSION_MAJOR_1;
@@ -360,6 +615,9 @@ void generate_startup_event(uint8_t cap)
 #endif
 
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
+#if CONFIG_ESP_TX_SCHED_DRR
+	buf_handle.enqueue_time = esp_timer_get_time();
+#endif
 	xQueueSend(spi_tx_queue[PRIO_Q_OTHERS], &buf_handle, portMAX_DELAY);
 	xSemaphoreGive(spi_tx_sem);
 #else
@@ -367,47 +625,130 @@ void generate_startup_event(uint8_t cap)
 #endif
 
 	set_dataready_gpio();
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+	/* Fill the driver queue so that next transaction is loaded
+	 * right after current one completes */
+	for (int i = 0; i < SPI_DRIVER_QUEUE_SIZE; i++)
+		queue_next_transaction();
+#else
 	/* process first data packet here to start transactions */
 	queue_next_transaction();
+#endif
 }
 
 
 /* Invoked after transaction is queued and ready for pickup by master */
 static void IRAM_ATTR spi_post_setup_cb(spi_slave_transaction_t *trans)
 {
+#if !CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
 	/* ESP peripheral ready for spi transaction. Set hadnshake line high. */
 	set_handshake_gpio();
+#endif
+#if H_SPI_HS_TIMESTAMPS
+	hs_ts.setup = esp_timer_get_time();
+#endif
 }
 
 /* Invoked after transaction is sent/received.
  * Use this to set the handshake line low */
 static void IRAM_ATTR spi_post_trans_cb(spi_slave_transaction_t *trans)
 {
-#if !HS_DEASSERT_ON_CS
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+	portENTER_CRITICAL_ISR(&spi_data_trans_lock);
+	if (--spi_trans_loaded < SPI_HS_PREQUEUE_DEPTH)
+		reset_handshake_gpio();
+	portEXIT_CRITICAL_ISR(&spi_data_trans_lock);
+#elif !HS_DEASSERT_ON_CS
 	/* Clear handshake line */
 	reset_handshake_gpio();
 #endif
+#if H_SPI_HS_TIMESTAMPS
+	hs_ts.dma_done = esp_timer_get_time();
+#endif
 }
 
-static uint8_t * get_next_tx_buffer(uint32_t *len)
+static esp_err_t dequeue_tx_buffer(interface_buffer_handle_t *buf_handle)
 {
-	interface_buffer_handle_t buf_handle = {0};
 	esp_err_t ret = ESP_OK;
 
-
 	#ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
 	ret = xSemaphoreTake(spi_tx_sem, 0);
 	if (pdTRUE == ret) {
-
-		if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_SERIAL], &buf_handle, 0))
-			if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_BT], &buf_handle, 0))
-				if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_OTHERS], &buf_handle, 0))
+#if CONFIG_ESP_TX_SCHED_DRR
+		if (tx_sched_dequeue(&spi_tx_sched, buf_handle) < 0)
+			ret = pdFALSE;
+#else
+		if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_SERIAL], buf_handle, 0))
+			if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_BT], buf_handle, 0))
+				if (pdFALSE == xQueueReceive(spi_tx_queue[PRIO_Q_OTHERS], buf_handle, 0))
 					ret = pdFALSE;
+#endif
 	}
 	#else
-	ret = xQueueReceive(spi_tx_queue, &buf_handle, 0);
+	ret = xQueueReceive(spi_tx_queue, buf_handle, 0);
 	#endif
 
+	return ret;
+}
+
+#if CONFIG_ESP_SPI_VARIABLE_LEN_TRANS
+/* Advertise in outgoing frame how many bytes host has to clock next time */
+static void spi_advertise_next_len(uint8_t *tx_buf)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *)tx_buf;
+	uint16_t next_len = SPI_MIN_TRANS_LEN;
+
+	if (spi_next_tx_buf.payload && spi_next_tx_buf.payload_len > next_len)
+		next_len = spi_next_tx_buf.payload_len;
+
+	header->spi_next_len = (next_len + ESP_SPI_NEXT_LEN_UNIT - 1) / ESP_SPI_NEXT_LEN_UNIT;
+	spi_tx_len_advertised = header->spi_next_len * ESP_SPI_NEXT_LEN_UNIT;
+
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+	/* Frame sent from Wi-Fi buffer gets a transaction of its own length,
+	 * so that DMA stays within the buffer. Host must keep its frame within */
+	spi_tx_len_limited = spi_next_tx_buf.payload && spi_next_tx_buf.priv_buffer_handle;
+	if (spi_tx_len_limited)
+		header->flags |= FLAG_SPI_NEXT_LEN_LIMIT;
+	else
+		header->flags &= ~FLAG_SPI_NEXT_LEN_LIMIT;
+#endif
+}
+#endif
+
+static uint8_t * get_next_tx_buffer(uint32_t *len, void **tx_eb)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	esp_err_t ret = ESP_OK;
+
+#if CONFIG_ESP_SPI_VARIABLE_LEN_TRANS
+	if (spi_next_tx_buf.payload) {
+		buf_handle = spi_next_tx_buf;
+		memset(&spi_next_tx_buf, 0, sizeof(spi_next_tx_buf));
+		ret = pdTRUE;
+	} else {
+		ret = dequeue_tx_buffer(&buf_handle);
+	}
+
+	if (ret == pdTRUE && buf_handle.payload) {
+		if (buf_handle.payload_len > spi_tx_len_advertised
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+		    || (buf_handle.priv_buffer_handle && !spi_tx_len_limited)
+#endif
+		   ) {
+			/* Host would truncate this frame, or may clock more than
+			 * its Wi-Fi buffer holds. Send a dummy now, announcing
+			 * the frame for next transaction */
+			spi_next_tx_buf = buf_handle;
+			ret = pdFALSE;
+		} else if (pdTRUE != dequeue_tx_buffer(&spi_next_tx_buf)) {
+			memset(&spi_next_tx_buf, 0, sizeof(spi_next_tx_buf));
+		}
+	}
+#else
+	ret = dequeue_tx_buffer(&buf_handle);
+#endif
+
 	if (ret == pdTRUE && buf_handle.payload) {
 		struct esp_payload_header *header = (struct esp_payload_header *)buf_handle.payload;
 		ESP_LOGD(TAG, "[TX] Real data queued - if_type: %d, len: %d",
@@ -419,12 +760,32 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
 #endif
 			*len = buf_handle.payload_len;
 		}
+		/* Set only for frames sent straight from Wi-Fi buffer */
+		if (tx_eb)
+			*tx_eb = buf_handle.priv_buffer_handle;
+#if CONFIG_ESP_SPI_VARIABLE_LEN_TRANS
+		spi_advertise_next_len(buf_handle.payload);
+#endif
 		return buf_handle.payload;
 	}
 
 	/* No real data, using dummy buffer */
 	ESP_LOGV(TAG, "[TX] No data - using dummy buffer");
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+	/* Real data may still be queued ahead of this buffer in SPI driver.
+	 * Keep ready line asserted till it is transferred */
+	portENTER_CRITICAL(&spi_data_trans_lock);
+	if (!spi_data_trans_queued)
+		reset_dataready_gpio();
+	portEXIT_CRITICAL(&spi_data_trans_lock);
+#elif CONFIG_ESP_SPI_VARIABLE_LEN_TRANS
+	/* Frame held back for next transaction still needs host to read it */
+	if (!spi_next_tx_buf.payload)
+		reset_dataready_gpio();
+	spi_advertise_next_len(dummy_buffer);
+#else
 	reset_dataready_gpio();
+#endif
 	return dummy_buffer;
 }
 
@@ -463,6 +824,9 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 
 	if ((len+offset) > SPI_BUFFER_SIZE) {
 		ESP_LOGE(TAG, "rx_pkt len+offset[%u]>max[%u], dropping it", len+offset, SPI_BUFFER_SIZE);
+#if CONFIG_ESP_SPI_RX_CREDITS
+		drop_rx_credit(header);
+#endif
 		return -1;
 	}
 
@@ -489,10 +853,18 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	if (checksum != rx_checksum) {
 		ESP_LOGE(TAG, "%s: cal_chksum[%u] != exp_chksum[%u], drop len[%u] offset[%u]",
 				__func__, checksum, rx_checksum, len, offset);
+#if CONFIG_ESP_SPI_RX_CREDITS
+		drop_rx_credit(header);
+#endif
 		return -1;
 	}
 #endif
 
+#if CONFIG_ESP_SPI_RX_CREDITS
+	if (header->if_type == ESP_STA_IF || header->if_type == ESP_AP_IF)
+		account_rx_credit_seq(le16toh(header->seq_num));
+#endif
+
 	/* Buffer is valid */
 	buf_handle->if_type = header->if_type;
 	buf_handle->if_num = header->if_num;
@@ -504,6 +876,9 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	if (buf_handle->if_type == ESP_STA_IF)
 		pkt_stats.hs_bus_sta_in++;
 #endif
+#ifdef CONFIG_ESP_HOSTED_FUNCTION_PROFILING
+	buf_handle->enqueue_time = esp_timer_get_time();
+#endif
 #ifdef CONFIG_ESP_ENABLE_RX_PRIORITY_QUEUES
 	if (header->if_type == ESP_SERIAL_IF) {
 		xQueueSend(spi_rx_queue[PRIO_Q_SERIAL], buf_handle, portMAX_DELAY);
@@ -521,15 +896,16 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	return 0;
 }
 
-static void queue_next_transaction(void)
+static spi_slave_transaction_t * prepare_next_transaction(void)
 {
 	spi_slave_transaction_t *spi_trans = NULL;
 	uint32_t len = 0;
-	uint8_t *tx_buffer = get_next_tx_buffer(&len);
+	void *tx_eb = NULL;
+	uint8_t *tx_buffer = get_next_tx_buffer(&len, &tx_eb);
 	if (!tx_buffer) {
 		/* Queue next transaction failed */
 		ESP_LOGE(TAG , "Failed to queue new transaction\r\n");
-		return;
+		return NULL;
 	}
 
 	spi_trans = spi_trans_alloc(MEMSET_REQUIRED);
@@ -541,10 +917,85 @@ static void queue_next_transaction(void)
 
 	spi_trans->rx_buffer = rx_buffer;
 	spi_trans->tx_buffer = tx_buffer;
+	spi_trans->user = tx_eb;
 	spi_trans->length = SPI_BUFFER_SIZE * SPI_BITS_PER_WORD;
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+	/* Host was told to keep within frame length, see spi_advertise_next_len() */
+	if (tx_eb)
+		spi_trans->length = len * SPI_BITS_PER_WORD;
+#endif
+
+	return spi_trans;
+}
+
+static void submit_transaction(spi_slave_transaction_t *spi_trans)
+{
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+	if (spi_trans->tx_buffer != dummy_buffer) {
+		portENTER_CRITICAL(&spi_data_trans_lock);
+		spi_data_trans_queued++;
+		portEXIT_CRITICAL(&spi_data_trans_lock);
+	}
+#endif
 
 	spi_slave_queue_trans(ESP_SPI_CONTROLLER, spi_trans, portMAX_DELAY);
+
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+	/* Counted only once queued, so host is never told of more than there are */
+	portENTER_CRITICAL(&spi_data_trans_lock);
+	if (++spi_trans_loaded >= SPI_HS_PREQUEUE_DEPTH)
+		set_handshake_gpio();
+	portEXIT_CRITICAL(&spi_data_trans_lock);
+#endif
+}
+
+static void queue_next_transaction(void)
+{
+	spi_slave_transaction_t *spi_trans = prepare_next_transaction();
+
+	if (spi_trans)
+		submit_transaction(spi_trans);
+}
+
+#if HS_DEASSERT_ON_CS
+static void wait_cs_deassert(bool spin)
+{
+#if CONFIG_ESP_SPI_HS_ADAPTIVE_PREARM
+	if (spin) {
+		/* Cheaper than ISR to task wakeup for short holds. Bounded, so a
+		 * slow host only costs this much before falling back to blocking */
+		int64_t until = esp_timer_get_time() + 2 * CONFIG_ESP_SPI_HS_PREARM_MAX_HOLD_US;
+
+		while (cs_deassert_cnt == cs_deassert_seen && esp_timer_get_time() < until)
+			;
+	}
+#endif
+	/* Semaphore may carry a give for an edge already consumed by spinning */
+	while (cs_deassert_cnt == cs_deassert_seen)
+		xSemaphoreTake(wait_cs_deassert_sem, portMAX_DELAY);
+
+	cs_deassert_seen = cs_deassert_cnt;
+}
+
+#if H_SPI_HS_TIMESTAMPS
+static void update_hs_timing(uint32_t wait_us)
+{
+	int32_t cs_hold = (int32_t)(hs_ts.cs_deassert - hs_ts.dma_done);
+
+	if (cs_hold < 0)
+		cs_hold = 0;
+
+#if CONFIG_ESP_SPI_HS_ADAPTIVE_PREARM
+	/* 1/8 weight to new sample */
+	cs_hold_avg_us = cs_hold_avg_us - (cs_hold_avg_us >> 3) + ((uint32_t)cs_hold >> 3);
+#endif
+	ESP_HOSTED_FUNC_PROF_RECORD(hs_prof.setup_to_cs, hs_ts.cs_assert - hs_ts.setup);
+	ESP_HOSTED_FUNC_PROF_RECORD(hs_prof.cs_to_dma_done, hs_ts.dma_done - hs_ts.cs_assert);
+	ESP_HOSTED_FUNC_PROF_RECORD(hs_prof.cs_hold, (uint32_t)cs_hold);
+	ESP_HOSTED_FUNC_PROF_RECORD(hs_prof.cs_deassert_wait, wait_us);
 }
+#endif
+#endif
 
 static void spi_transaction_post_process_task(void* pvParameters)
 {
@@ -558,6 +1009,17 @@ static void spi_transaction_post_process_task(void* pvParameters)
 		ESP_ERROR_CHECK(spi_slave_get_trans_result(ESP_SPI_CONTROLLER, &spi_trans, portMAX_DELAY));
 
 #if HS_DEASSERT_ON_CS
+		spi_slave_transaction_t *spi_trans_next = NULL;
+#if H_SPI_HS_TIMESTAMPS
+		uint32_t wait_start = esp_timer_get_time();
+#endif
+
+#if CONFIG_ESP_SPI_HS_ADAPTIVE_PREARM
+		/* Host has been releasing CS shortly after transfers.
+		 * Build next transaction meanwhile, only submit waits for CS */
+		if (cs_hold_avg_us <= CONFIG_ESP_SPI_HS_PREARM_MAX_HOLD_US)
+			spi_trans_next = prepare_next_transaction();
+#endif
 		/* Wait until CS has been deasserted before we queue a new transaction.
 		 *
 		 * Some MCUs delay deasserting CS at the end of a transaction.
@@ -565,10 +1027,27 @@ static void spi_transaction_post_process_task(void* pvParameters)
 		 * the slave SPI can start (since CS is still asserted), and data is lost
 		 * as host is not expecting any data.
 		 */
-		xSemaphoreTake(wait_cs_deassert_sem, portMAX_DELAY);
+		wait_cs_deassert(spi_trans_next != NULL);
+
+		if (spi_trans_next)
+			submit_transaction(spi_trans_next);
+		else
+			queue_next_transaction();
+
+#if H_SPI_HS_TIMESTAMPS
+		update_hs_timing((uint32_t)esp_timer_get_time() - wait_start);
 #endif
+#else
 		/* Queue new transaction to get ready as soon as possible */
 		queue_next_transaction();
+#endif
+
+#if CONFIG_ESP_TX_SCHED_DRR
+		if (CONFIG_ESP_TX_SCHED_STATS_INTERVAL_SEC &&
+		    esp_timer_get_time() - spi_tx_sched.stats_logged_at >
+		    SEC_TO_USEC((int64_t)CONFIG_ESP_TX_SCHED_STATS_INTERVAL_SEC))
+			tx_sched_log_stats(&spi_tx_sched);
+#endif
 
 		/* Process received data */
 		if (spi_trans->rx_buffer) {
@@ -577,21 +1056,36 @@ static void spi_transaction_post_process_task(void* pvParameters)
 		}
 
 		ESP_HEXLOGV("spi_tx:", (uint8_t*)spi_trans->tx_buffer, 16, 16);
-		/* Free buffers */
-		if (spi_trans->tx_buffer != dummy_buffer) {
-			spi_buffer_tx_free((void *)spi_trans->tx_buffer);
-		}
-
 #if ESP_PKT_STATS
 		struct esp_payload_header *header =
 			(struct esp_payload_header *)spi_trans->tx_buffer;
 		if (header->if_type == ESP_STA_IF)
 			pkt_stats.sta_sh_out++;
 #endif
+		/* Free buffers */
+		if (spi_trans->tx_buffer != dummy_buffer) {
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+			portENTER_CRITICAL(&spi_data_trans_lock);
+			if (spi_data_trans_queued)
+				spi_data_trans_queued--;
+			portEXIT_CRITICAL(&spi_data_trans_lock);
+#endif
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+			if (spi_trans->user)
+				esp_wifi_internal_free_rx_buffer(spi_trans->user);
+			else
+#endif
+				spi_buffer_tx_free((void *)spi_trans->tx_buffer);
+		}
 		if (ret != ESP_OK && spi_trans->rx_buffer) {
 			spi_buffer_rx_free((void *)spi_trans->rx_buffer);
 		}
 
+#if CONFIG_ESP_SPI_RX_CREDITS
+		if (rx_credit_report_pending)
+			report_rx_credits();
+#endif
+
 		spi_trans_free(spi_trans);
 	}
 }
@@ -603,8 +1097,15 @@ static void IRAM_ATTR gpio_disable_hs_isr_handler(void* arg)
 	if (level == 0) {
 		/* CS is asserted, disable HS */
 		reset_handshake_gpio();
+#if H_SPI_HS_TIMESTAMPS
+		hs_ts.cs_assert = esp_timer_get_time();
+#endif
 	} else {
+#if H_SPI_HS_TIMESTAMPS
+		hs_ts.cs_deassert = esp_timer_get_time();
+#endif
 		/* Last transaction complete, populate next one */
+		cs_deassert_cnt++;
 		if (wait_cs_deassert_sem)
 			xSemaphoreGive(wait_cs_deassert_sem);
 	}
@@ -756,6 +1257,11 @@ static interface_handle_t * esp_spi_init(void)
 	assert(spi_tx_queue[PRIO_Q_BT]);
 	spi_tx_queue[PRIO_Q_SERIAL] = xQueueCreate(SPI_TX_SERIAL_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
 	assert(spi_tx_queue[PRIO_Q_SERIAL]);
+
+#if CONFIG_ESP_TX_SCHED_DRR
+	tx_sched_init(&spi_tx_sched, spi_tx_queue, spi_tx_quantum, spi_tx_q_names,
+			CONFIG_ESP_TX_SCHED_STARVATION_LIMIT);
+#endif
 #else
 	spi_tx_queue = xQueueCreate(SPI_TX_QUEUE_SIZE, sizeof(interface_buffer_handle_t));
 	assert(spi_tx_queue);
@@ -776,6 +1282,12 @@ static interface_handle_t * esp_spi_init(void)
 	assert(spi_rx_queue);
 #endif
 
+#if H_SPI_HS_TIMESTAMPS && defined(ESP_FUNCTION_PROFILING)
+	hs_prof.setup_to_cs = register_prof_entry("spi_hs_setup_to_cs");
+	hs_prof.cs_to_dma_done = register_prof_entry("spi_cs_to_dma_done");
+	hs_prof.cs_hold = register_prof_entry("spi_cs_hold");
+	hs_prof.cs_deassert_wait = register_prof_entry("spi_cs_deassert_wait");
+#endif
 
 	assert(xTaskCreate(spi_transaction_post_process_task , "spi_post_process_task" ,
 			CONFIG_ESP_DEFAULT_TASK_STACK_SIZE, NULL,
@@ -786,9 +1298,36 @@ static interface_handle_t * esp_spi_init(void)
 	return &if_handle_g;
 }
 
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+/* Wi-Fi rx frames have at least 802.11 + LLC header size less the 802.3
+ * header as headroom before payload. Place our header there, on a DMA
+ * aligned address.
+ *
+ * Transaction of such frame is cut to the frame length, DMA aligned, which
+ * ends within the word holding the last payload byte, so DMA never reads
+ * past eb. Host is told so through FLAG_SPI_NEXT_LEN_LIMIT */
+static uint8_t *spi_zero_copy_header(interface_buffer_handle_t *buf_handle)
+{
+	uint8_t *hdr = NULL;
+
+	if (buf_handle->free_buf_handle != esp_wifi_internal_free_rx_buffer ||
+	    !buf_handle->priv_buffer_handle)
+		return NULL;
+
+	hdr = buf_handle->payload - sizeof(struct esp_payload_header);
+	hdr = (uint8_t *)((uintptr_t)hdr & ~SPI_DMA_ALIGNMENT_MASK);
+
+	if (!esp_ptr_dma_capable(hdr))
+		return NULL;
+
+	return hdr;
+}
+#endif
+
 static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle_t *buf_handle)
 {
 	int32_t total_len = 0;
+	uint16_t offset = sizeof(struct esp_payload_header);
 	struct esp_payload_header *header;
 	interface_buffer_handle_t tx_buf_handle = {0};
 
@@ -805,8 +1344,14 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 		return ESP_FAIL;
 	}
 
+#if CONFIG_ESP_SPI_TX_ZERO_COPY
+	tx_buf_handle.payload = spi_zero_copy_header(buf_handle);
+	if (tx_buf_handle.payload)
+		offset = buf_handle->payload - tx_buf_handle.payload;
+#endif
+
 	/* Calculate total length */
-	total_len = buf_handle->payload_len + sizeof(struct esp_payload_header);
+	total_len = buf_handle->payload_len + offset;
 
 	/* DMA alignment check */
 	if (!IS_SPI_DMA_ALIGNED(total_len)) {
@@ -818,11 +1363,17 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 		return ESP_FAIL;
 	}
 
-	/* Allocate and validate TX buffer */
-	tx_buf_handle.payload = spi_buffer_tx_alloc(MEMSET_NOT_REQUIRED);
-	if (!tx_buf_handle.payload) {
-		ESP_LOGE(TAG, "TX buffer allocation failed");
-		return ESP_FAIL;
+	if (tx_buf_handle.payload) {
+		/* Wi-Fi buffer is released once transaction completes */
+		tx_buf_handle.priv_buffer_handle = buf_handle->priv_buffer_handle;
+		buf_handle->priv_buffer_handle = NULL;
+	} else {
+		/* Allocate and validate TX buffer */
+		tx_buf_handle.payload = spi_buffer_tx_alloc(MEMSET_NOT_REQUIRED);
+		if (!tx_buf_handle.payload) {
+			ESP_LOGE(TAG, "TX buffer allocation failed");
+			return ESP_FAIL;
+		}
 	}
 
 	/* Setup header */
@@ -832,13 +1383,14 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 	header->if_type = buf_handle->if_type;
 	header->if_num = buf_handle->if_num;
 	header->len = htole16(buf_handle->payload_len);
-	header->offset = htole16(sizeof(struct esp_payload_header));
+	header->offset = htole16(offset);
 	header->seq_num = htole16(buf_handle->seq_num);
 	header->flags = buf_handle->flag;
 
 	/* Copy payload data */
-	memcpy(tx_buf_handle.payload + sizeof(struct esp_payload_header),
-			buf_handle->payload, buf_handle->payload_len);
+	if (!tx_buf_handle.priv_buffer_handle)
+		memcpy(tx_buf_handle.payload + offset,
+				buf_handle->payload, buf_handle->payload_len);
 
 	tx_buf_handle.if_type = buf_handle->if_type;
 	tx_buf_handle.if_num = buf_handle->if_num;
@@ -848,7 +1400,7 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 	/* Calculate checksum with header checksum field zeroed */
 	header->checksum = 0;
 	uint16_t checksum = compute_checksum(tx_buf_handle.payload,
-			sizeof(struct esp_payload_header)+buf_handle->payload_len);
+			offset+buf_handle->payload_len);
 	header->checksum = htole16(checksum);
 #endif
 
@@ -856,6 +1408,9 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 			header->if_type, buf_handle->payload_len, total_len);
 
 #ifdef CONFIG_ESP_ENABLE_TX_PRIORITY_QUEUES
+#if CONFIG_ESP_TX_SCHED_DRR
+	tx_buf_handle.enqueue_time = esp_timer_get_time();
+#endif
 	if (header->if_type == ESP_SERIAL_IF)
 		xQueueSend(spi_tx_queue[PRIO_Q_SERIAL], &tx_buf_handle, portMAX_DELAY);
 	else if (header->if_type == ESP_HCI_IF)
@@ -875,6 +1430,14 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 
 static void IRAM_ATTR esp_spi_read_done(void *handle)
 {
+#if CONFIG_ESP_SPI_RX_CREDITS
+	struct esp_payload_header *header = (struct esp_payload_header *) handle;
+
+	/* Credit goes back only once buffer is free, including frames that
+	 * were held in Wi-Fi tx staging */
+	if (header->if_type == ESP_STA_IF || header->if_type == ESP_AP_IF)
+		return_rx_credits(1);
+#endif
 	spi_buffer_rx_free(handle);
 }
 
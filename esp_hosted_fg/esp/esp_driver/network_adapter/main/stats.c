@@ -16,9 +16,11 @@
 
 #include "stats.h"
 #include <unistd.h>
+#include <stdio.h>
 #include "esp_log.h"
 #include <string.h>
 #include <inttypes.h>
+#include "lwip_filter.h"
 
 #if TEST_RAW_TP || ESP_PKT_STATS || CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS || ESP_PKT_NUM_DEBUG
 static const char TAG[] = "stats";
@@ -37,28 +39,47 @@ struct dbg_stats_t dbg_stats;
 /* Define the global variables */
 struct timing_stats_entry timing_entries[CONFIG_ESP_HOSTED_FUNCTION_PROFILING_MAX_ENTRIES] = {0};
 int num_timing_entries = 0;
+/* Serializes registration, tasks may register entries concurrently */
+static portMUX_TYPE timing_entries_lock = portMUX_INITIALIZER_UNLOCKED;
 
-/* Function to register new timing stats */
-struct timing_stats* register_prof_stats(const char *func_name)
+/* Look up or add timing entry. Meant to be called once per entry, with
+ * caller keeping the handle, as it scans all entries */
+struct timing_stats_entry* register_prof_entry(const char *func_name)
 {
-	if (num_timing_entries >= CONFIG_ESP_HOSTED_FUNCTION_PROFILING_MAX_ENTRIES) {
-		ESP_LOGE(TAG, "Max timing stats reached");
-		return NULL;
-	}
+	struct timing_stats_entry *entry = NULL;
+
+	portENTER_CRITICAL(&timing_entries_lock);
 
 	/* Check if already registered */
 	for (int i = 0; i < num_timing_entries; i++) {
 		if (strcmp(timing_entries[i].name, func_name) == 0) {
-			return &timing_entries[i].stats;
+			entry = &timing_entries[i];
+			break;
 		}
 	}
 
-	/* Add new entry */
-	timing_entries[num_timing_entries].name = func_name;
-	timing_entries[num_timing_entries].active = true;
-	num_timing_entries++;
+	/* Add new entry, published to readers by count update */
+	if (!entry && num_timing_entries < CONFIG_ESP_HOSTED_FUNCTION_PROFILING_MAX_ENTRIES) {
+		entry = &timing_entries[num_timing_entries];
+		entry->name = func_name;
+		entry->active = true;
+		num_timing_entries++;
+	}
+
+	portEXIT_CRITICAL(&timing_entries_lock);
+
+	if (!entry)
+		ESP_LOGE(TAG, "Max timing stats reached");
+
+	return entry;
+}
 
-	return &timing_entries[num_timing_entries-1].stats;
+/* Function to register new timing stats */
+struct timing_stats* register_prof_stats(const char *func_name)
+{
+	struct timing_stats_entry *entry = register_prof_entry(func_name);
+
+	return entry ? &entry->stats : NULL;
 }
 
 /* Function to get timing measure for a stats entry */
@@ -296,14 +317,18 @@ static void raw_tp_tx_task(void* pvParameters)
 static void stats_timer_func(void* arg)
 {
 	/* Rest of existing stats_timer_func code */
-	ESP_LOGI(TAG, "STA: flw_ctrl(on[%lu] off[%lu]) H2S(in[%lu] out[%lu] fail[%lu]) S2H(in[%lu] out[%lu]) Ctrl: (in[%lu] rsp[%lu] evt[%lu])",
+	ESP_LOGI(TAG, "STA: flw_ctrl(on[%lu] off[%lu]) H2S(in[%lu] out[%lu] fail[%lu] staged[%lu]) S2H(in[%lu] out[%lu]) Ctrl: (in[%lu] rsp[%lu] evt[%lu])",
 			pkt_stats.sta_flowctrl_on, pkt_stats.sta_flowctrl_off,
 			pkt_stats.hs_bus_sta_in,pkt_stats.hs_bus_sta_out, pkt_stats.hs_bus_sta_fail,
+			pkt_stats.hs_bus_sta_staged,
 			pkt_stats.sta_sh_in,pkt_stats.sta_sh_out,
 			pkt_stats.serial_rx, pkt_stats.serial_tx_total, pkt_stats.serial_tx_evt);
 	ESP_LOGI(TAG, "Lwip: in[%lu] slave_out[%lu] host_out[%lu] both_out[%lu]",
 			pkt_stats.sta_lwip_in, pkt_stats.sta_slave_lwip_out,
 			pkt_stats.sta_host_lwip_out, pkt_stats.sta_both_lwip_out);
+#if defined(CONFIG_NETWORK_SPLIT_ENABLED) && defined(CONFIG_LWIP_ENABLE)
+	lwip_filter_print_rule_hits();
+#endif
 
 #ifdef ESP_FUNCTION_PROFILING
 	/* Print timing stats for all active entries */
@@ -326,6 +351,22 @@ static void stats_timer_func(void* arg)
 				s->max_time,
 				s->avg_time,
 				rate);
+
+		/* Latency distribution, bucket upper bounds in us */
+		char hist_str[ESP_HOSTED_PROF_HIST_BUCKETS * 20];
+		int pos = 0;
+		for (int b = 0; b < ESP_HOSTED_PROF_HIST_BUCKETS; b++) {
+			if (!s->hist[b])
+				continue;
+			if (b == ESP_HOSTED_PROF_HIST_BUCKETS - 1)
+				pos += snprintf(hist_str + pos, sizeof(hist_str) - pos, " >=%u:%" PRIu32,
+						1u << (ESP_HOSTED_PROF_HIST_MIN_SHIFT + b - 1), s->hist[b]);
+			else
+				pos += snprintf(hist_str + pos, sizeof(hist_str) - pos, " <%u:%" PRIu32,
+						1u << (ESP_HOSTED_PROF_HIST_MIN_SHIFT + b), s->hist[b]);
+		}
+		if (pos)
+			ESP_LOGI(TAG, "[%s] Latency hist (us):%s", timing_entries[i].name, hist_str);
 	}
 #endif /* ESP_FUNCTION_PROFILING */
 }
@@ -105,6 +105,7 @@ struct pkt_stats_t {
 	uint32_t hs_bus_sta_in;
 	uint32_t hs_bus_sta_out;
 	uint32_t hs_bus_sta_fail;
+	uint32_t hs_bus_sta_staged;
 	uint32_t serial_rx;
 	uint32_t serial_tx_total;
 	uint32_t serial_tx_evt;
@@ -136,10 +137,15 @@ struct timing_measure {
 	uint32_t count;
 };
 
+/* Latency histogram, log2 buckets: [0, 16us), [16us, 32us), ... */
+#define ESP_HOSTED_PROF_HIST_BUCKETS   12
+#define ESP_HOSTED_PROF_HIST_MIN_SHIFT 4
+
 struct timing_stats {
 	uint32_t min_time;
 	uint32_t max_time;
 	uint32_t avg_time;
+	uint32_t hist[ESP_HOSTED_PROF_HIST_BUCKETS];
 };
 
 /* Move struct definition to header file */
@@ -180,29 +186,60 @@ struct timing_stats_entry {
         break; \
     } \
     t->end_time = esp_timer_get_time(); \
-    t->count++; \
-    int64_t elapsed = t->end_time - t->start_time; \
-    t->total_time += elapsed; \
-    if (s->min_time == 0 || elapsed < s->min_time) { \
-        s->min_time = elapsed; \
-    } \
-    if (elapsed > s->max_time) { \
-        s->max_time = elapsed; \
+    esp_hosted_prof_record(t, s, t->end_time - t->start_time); \
+} while(0)
+
+/* Record an interval measured by caller, e.g. across tasks, into entry
+ * handle from register_prof_entry(). Hot paths register once and keep it */
+#define ESP_HOSTED_FUNC_PROF_RECORD(entry, elapsed_us) do { \
+    struct timing_stats_entry *e = (entry); \
+    if (e) { \
+        esp_hosted_prof_record(&e->measure, &e->stats, elapsed_us); \
     } \
-    if (t->count > 0) { \
-        s->avg_time = t->total_time / t->count; \
+} while(0)
+
+/* Same, registering on first use from each call site */
+#define ESP_HOSTED_FUNC_PROF_SAMPLE(func_name, elapsed_us) do { \
+    static struct timing_stats_entry *prof_entry; \
+    if (!prof_entry) { \
+        prof_entry = register_prof_entry(func_name); \
     } \
+    ESP_HOSTED_FUNC_PROF_RECORD(prof_entry, elapsed_us); \
 } while(0)
 
 extern struct timing_stats_entry timing_entries[CONFIG_ESP_HOSTED_FUNCTION_PROFILING_MAX_ENTRIES];
 extern int num_timing_entries;
 
 /* Function declarations */
+struct timing_stats_entry* register_prof_entry(const char *func_name);
 struct timing_stats* register_prof_stats(const char *func_name);
 struct timing_measure* get_prof_data(struct timing_stats *s);
+
+static inline void esp_hosted_prof_record(struct timing_measure *t,
+		struct timing_stats *s, uint32_t elapsed)
+{
+	uint32_t bucket = 0;
+
+	t->count++;
+	t->total_time += elapsed;
+	if (s->min_time == 0 || elapsed < s->min_time)
+		s->min_time = elapsed;
+	if (elapsed > s->max_time)
+		s->max_time = elapsed;
+	s->avg_time = t->total_time / t->count;
+
+	elapsed >>= ESP_HOSTED_PROF_HIST_MIN_SHIFT;
+	while (elapsed && bucket < ESP_HOSTED_PROF_HIST_BUCKETS - 1) {
+		elapsed >>= 1;
+		bucket++;
+	}
+	s->hist[bucket]++;
+}
 #else
 #define ESP_HOSTED_FUNC_PROF_START(func_name)
 #define ESP_HOSTED_FUNC_PROF_END(func_name)
+#define ESP_HOSTED_FUNC_PROF_RECORD(entry, elapsed_us)
+#define ESP_HOSTED_FUNC_PROF_SAMPLE(func_name, elapsed_us)
 #endif
 
 #endif  /*__STATS__H__*/
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2015-2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tx_sched.h"
+
+static const char TAG[] = "tx_sched";
+
+void tx_sched_init(struct tx_sched *sched, QueueHandle_t *queues,
+		const uint16_t *quantum, const char * const *names, uint16_t starve_limit)
+{
+	memset(sched, 0, sizeof(*sched));
+
+	for (int i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+		sched->cls[i].queue = queues[i];
+		sched->cls[i].quantum = quantum[i] ? quantum[i] : 1;
+		sched->cls[i].name = names[i];
+	}
+	sched->starve_limit = starve_limit;
+	sched->stats_logged_at = esp_timer_get_time();
+}
+
+static void tx_sched_account(struct tx_sched *sched, struct tx_sched_class *served,
+		interface_buffer_handle_t *buf_handle)
+{
+	uint32_t delay = (uint32_t)esp_timer_get_time() - buf_handle->enqueue_time;
+
+	served->passed_over = 0;
+	for (int i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+		struct tx_sched_class *c = &sched->cls[i];
+
+		if (c != served && uxQueueMessagesWaiting(c->queue))
+			c->passed_over++;
+	}
+
+	served->pkts++;
+	served->delay_total_us += delay;
+	if (delay > served->delay_max_us)
+		served->delay_max_us = delay;
+}
+
+/* Returns index of queue served, or -1 if all queues are empty */
+int tx_sched_dequeue(struct tx_sched *sched, interface_buffer_handle_t *buf_handle)
+{
+	struct tx_sched_class *c = NULL;
+	uint8_t idle = 0;
+
+	if (sched->starve_limit) {
+		for (int i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+			c = &sched->cls[i];
+			if (c->passed_over >= sched->starve_limit &&
+				xQueueReceive(c->queue, buf_handle, 0) == pdTRUE) {
+				c->deficit = 0;
+				tx_sched_account(sched, c, buf_handle);
+				return i;
+			}
+		}
+	}
+
+	while (idle < MAX_PRIORITY_QUEUES) {
+		c = &sched->cls[sched->cur];
+
+		/* Only consumer here, so head seen by peek is what receive gets */
+		if (xQueuePeek(c->queue, buf_handle, 0) != pdTRUE) {
+			/* Idle class does not bank credit */
+			c->deficit = 0;
+			c->in_turn = false;
+			c->passed_over = 0;
+			sched->cur = (sched->cur + 1) % MAX_PRIORITY_QUEUES;
+			idle++;
+			continue;
+		}
+		idle = 0;
+
+		if (!c->in_turn) {
+			c->deficit += c->quantum;
+			c->in_turn = true;
+		}
+
+		if (buf_handle->payload_len <= c->deficit) {
+			xQueueReceive(c->queue, buf_handle, 0);
+			c->deficit -= buf_handle->payload_len;
+			tx_sched_account(sched, c, buf_handle);
+			return sched->cur;
+		}
+
+		/* Credit left over is carried to next round */
+		c->in_turn = false;
+		sched->cur = (sched->cur + 1) % MAX_PRIORITY_QUEUES;
+	}
+
+	return -1;
+}
+
+void tx_sched_log_stats(struct tx_sched *sched)
+{
+	for (int i = 0; i < MAX_PRIORITY_QUEUES; i++) {
+		struct tx_sched_class *c = &sched->cls[i];
+
+		ESP_LOGI(TAG, "%s: pkts[%" PRIu32 "] delay avg[%" PRIu32 "us] max[%" PRIu32 "us]",
+				c->name, c->pkts,
+				c->pkts ? (uint32_t)(c->delay_total_us / c->pkts) : 0,
+				c->delay_max_us);
+		c->pkts = 0;
+		c->delay_total_us = 0;
+		c->delay_max_us = 0;
+	}
+	sched->stats_logged_at = esp_timer_get_time();
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2015-2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef __TX_SCHED_H__
+#define __TX_SCHED_H__
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "adapter.h"
+#include "interface.h"
+
+/* Deficit round robin scheduler for SERIAL/BT/OTHERS tx queues.
+ *
+ * A queue gets `quantum` bytes added to its deficit on each of its turns,
+ * and keeps sending while the head buffer length fits the deficit.
+ * starve_limit (if non zero) caps how many buffers of other queues may be
+ * sent while a queue has data waiting.
+ */
+struct tx_sched_class {
+	QueueHandle_t queue;
+	const char *name;
+	uint16_t quantum;
+	int32_t deficit;
+	uint16_t passed_over;
+	bool in_turn;
+
+	/* Queue delay, from enqueue to dequeue */
+	uint32_t pkts;
+	uint64_t delay_total_us;
+	uint32_t delay_max_us;
+};
+
+struct tx_sched {
+	struct tx_sched_class cls[MAX_PRIORITY_QUEUES];
+	uint8_t cur;
+	uint16_t starve_limit;
+	int64_t stats_logged_at;
+};
+
+void tx_sched_init(struct tx_sched *sched, QueueHandle_t *queues,
+		const uint16_t *quantum, const char * const *names, uint16_t starve_limit);
+int tx_sched_dequeue(struct tx_sched *sched, interface_buffer_handle_t *buf_handle);
+void tx_sched_log_stats(struct tx_sched *sched);
+
+#endif /* __TX_SCHED_H__ */
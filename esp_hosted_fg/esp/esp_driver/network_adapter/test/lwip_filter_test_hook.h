@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Force included into lwip_filter.c by test build. Stands in for
+ * host_power_save.h, so that test can switch host power save */
+
+#ifndef __LWIP_FILTER_TEST_HOOK_H__
+#define __LWIP_FILTER_TEST_HOOK_H__
+
+#define __HOST_POWER_SAVE_H__
+
+extern int lwip_filter_test_power_save;
+
+static inline int is_host_power_saving(void)
+{
+	return lwip_filter_test_power_save;
+}
+
+#define ESP_HEXLOGV(tag2, buff, buf_len, display_len) do { } while (0)
+
+#endif
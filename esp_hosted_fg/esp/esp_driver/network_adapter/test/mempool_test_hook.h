@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Force included into mempool.c by test build, see MEMPOOL_TEST_POP_WINDOW */
+
+#ifndef __MEMPOOL_TEST_HOOK_H__
+#define __MEMPOOL_TEST_HOOK_H__
+
+void mempool_test_pop_window(void);
+
+#endif
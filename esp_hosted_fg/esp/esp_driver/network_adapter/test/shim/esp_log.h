@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of ESP-IDF logging */
+
+#ifndef __TEST_SHIM_ESP_LOG_H__
+#define __TEST_SHIM_ESP_LOG_H__
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+/* Tests routing frames on purpose to warned about paths keep W quiet */
+#ifdef TEST_SHIM_LOGW_QUIET
+#define ESP_LOGW(tag, fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#else
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#endif
+#define ESP_LOGI(tag, fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+
+#endif
@@ -0,0 +1,11 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of ESP-IDF timer, test provides the clock */
+
+#ifndef __TEST_SHIM_ESP_TIMER_H__
+#define __TEST_SHIM_ESP_TIMER_H__
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif
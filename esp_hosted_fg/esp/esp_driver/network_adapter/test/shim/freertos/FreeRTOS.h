@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim, just enough of ESP-IDF for firmware sources under test */
+
+#ifndef __TEST_SHIM_FREERTOS_H__
+#define __TEST_SHIM_FREERTOS_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION                          ESP_IDF_VERSION_VAL(5, 1, 0)
+
+#define MALLOC_CAP_DMA                           (1 << 3)
+#define MALLOC_CAP_8BIT                          (1 << 2)
+#define MALLOC_CAP_DEFAULT                       (1 << 12)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	(void)caps;
+	return malloc(size);
+}
+
+#endif
@@ -0,0 +1,2 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim, nothing needed beyond FreeRTOS.h */
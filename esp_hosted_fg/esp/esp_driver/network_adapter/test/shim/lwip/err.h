@@ -0,0 +1,3 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP */
+#include "lwip/opt.h"
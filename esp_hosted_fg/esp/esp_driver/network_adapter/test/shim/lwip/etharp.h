@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP ethernet and ARP headers */
+
+#ifndef __TEST_SHIM_LWIP_ETHARP_H__
+#define __TEST_SHIM_LWIP_ETHARP_H__
+
+#include "lwip/opt.h"
+
+#define ETH_HWADDR_LEN   6
+#define SIZEOF_ETH_HDR   14
+#define ETHTYPE_IP       0x0800U
+#define ETHTYPE_ARP      0x0806U
+#define ARP_REQUEST      1
+#define ARP_REPLY        2
+
+struct eth_addr {
+	u8_t addr[ETH_HWADDR_LEN];
+} PACK_STRUCT_STRUCT;
+
+struct eth_hdr {
+	struct eth_addr dest;
+	struct eth_addr src;
+	u16_t type;
+} PACK_STRUCT_STRUCT;
+
+struct etharp_hdr {
+	u16_t hwtype;
+	u16_t proto;
+	u8_t  hwlen;
+	u8_t  protolen;
+	u16_t opcode;
+	struct eth_addr shwaddr;
+	u8_t  sipaddr[4];
+	struct eth_addr dhwaddr;
+	u8_t  dipaddr[4];
+} PACK_STRUCT_STRUCT;
+
+#endif
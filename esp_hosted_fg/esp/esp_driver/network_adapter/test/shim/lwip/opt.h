@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP, only what lwip_filter.c uses */
+
+#ifndef __TEST_SHIM_LWIP_OPT_H__
+#define __TEST_SHIM_LWIP_OPT_H__
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+typedef uint8_t  u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+
+#define lwip_ntohs(x)  ntohs(x)
+#define lwip_htons(x)  htons(x)
+
+#define PACK_STRUCT_STRUCT __attribute__((packed))
+
+#endif
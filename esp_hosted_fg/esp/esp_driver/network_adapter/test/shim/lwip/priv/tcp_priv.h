@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP */
+
+#ifndef __TEST_SHIM_LWIP_TCP_PRIV_H__
+#define __TEST_SHIM_LWIP_TCP_PRIV_H__
+
+#include "lwip/tcp.h"
+
+union tcp_listen_pcbs_t {
+	struct tcp_pcb *pcbs;
+};
+
+extern union tcp_listen_pcbs_t tcp_listen_pcbs;
+
+#endif
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP */
+
+#ifndef __TEST_SHIM_LWIP_PROT_IANA_H__
+#define __TEST_SHIM_LWIP_PROT_IANA_H__
+
+#define LWIP_IANA_PORT_DHCP_SERVER  67
+#define LWIP_IANA_PORT_DHCP_CLIENT  68
+
+#endif
@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP ICMP header */
+
+#ifndef __TEST_SHIM_LWIP_PROT_ICMP_H__
+#define __TEST_SHIM_LWIP_PROT_ICMP_H__
+
+#include "lwip/opt.h"
+
+#define ICMP_ER    0
+#define ICMP_ECHO  8
+
+struct icmp_echo_hdr {
+	u8_t  type;
+	u8_t  code;
+	u16_t chksum;
+	u16_t id;
+	u16_t seqno;
+} PACK_STRUCT_STRUCT;
+
+#endif
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP IPv4 header */
+
+#ifndef __TEST_SHIM_LWIP_PROT_IP_H__
+#define __TEST_SHIM_LWIP_PROT_IP_H__
+
+#include "lwip/opt.h"
+
+#define IP_PROTO_ICMP    1
+#define IP_PROTO_TCP     6
+#define IP_PROTO_UDP     17
+
+struct ip_hdr {
+	u8_t  _v_hl;
+	u8_t  _tos;
+	u16_t _len;
+	u16_t _id;
+	u16_t _offset;
+	u8_t  _ttl;
+	u8_t  _proto;
+	u16_t _chksum;
+	u32_t src;
+	u32_t dest;
+} PACK_STRUCT_STRUCT;
+
+#define IPH_HL(hdr)     ((hdr)->_v_hl & 0x0f)
+#define IPH_PROTO(hdr)  ((hdr)->_proto)
+
+#endif
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP TCP header */
+
+#ifndef __TEST_SHIM_LWIP_PROT_TCP_H__
+#define __TEST_SHIM_LWIP_PROT_TCP_H__
+
+#include "lwip/opt.h"
+
+#define TCP_FLAGS        0x3fU
+
+struct tcp_hdr {
+	u16_t src;
+	u16_t dest;
+	u32_t seqno;
+	u32_t ackno;
+	u16_t _hdrlen_rsvd_flags;
+	u16_t wnd;
+	u16_t chksum;
+	u16_t urgp;
+} PACK_STRUCT_STRUCT;
+
+#define TCPH_FLAGS(phdr)  ((u16_t)(lwip_ntohs((phdr)->_hdrlen_rsvd_flags) & TCP_FLAGS))
+
+#endif
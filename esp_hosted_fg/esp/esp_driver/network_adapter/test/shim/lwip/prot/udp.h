@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP UDP header */
+
+#ifndef __TEST_SHIM_LWIP_PROT_UDP_H__
+#define __TEST_SHIM_LWIP_PROT_UDP_H__
+
+#include "lwip/opt.h"
+
+struct udp_hdr {
+	u16_t src;
+	u16_t dest;
+	u16_t len;
+	u16_t chksum;
+} PACK_STRUCT_STRUCT;
+
+#endif
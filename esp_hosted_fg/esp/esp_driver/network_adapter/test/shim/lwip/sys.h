@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP, test is single threaded */
+
+#ifndef __TEST_SHIM_LWIP_SYS_H__
+#define __TEST_SHIM_LWIP_SYS_H__
+
+#include "lwip/opt.h"
+
+#define SYS_ARCH_DECL_PROTECT(lev)  int lev = 0
+#define SYS_ARCH_PROTECT(lev)       (void)(lev)
+#define SYS_ARCH_UNPROTECT(lev)     (void)(lev)
+
+#endif
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP, listening pcbs are set up by test */
+
+#ifndef __TEST_SHIM_LWIP_TCP_H__
+#define __TEST_SHIM_LWIP_TCP_H__
+
+#include "lwip/opt.h"
+
+struct tcp_pcb {
+	struct tcp_pcb *next;
+	u16_t local_port;
+};
+
+#endif
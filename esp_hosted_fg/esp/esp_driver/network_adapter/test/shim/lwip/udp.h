@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim of lwIP, bound pcbs are set up by test */
+
+#ifndef __TEST_SHIM_LWIP_UDP_H__
+#define __TEST_SHIM_LWIP_UDP_H__
+
+#include "lwip/opt.h"
+
+struct udp_pcb {
+	struct udp_pcb *next;
+	u16_t local_port;
+};
+
+extern struct udp_pcb *udp_pcbs;
+
+#endif
@@ -0,0 +1,2 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Host shim, config of each test comes from its flags in Makefile */
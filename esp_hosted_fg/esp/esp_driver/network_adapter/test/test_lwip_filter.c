@@ -0,0 +1,460 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2015-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+/*
+ * Host built test of network split packet filter. Random frames, with host
+ * power save and listening iperf sockets switched on and off, are routed by
+ * filter_and_route_packet() and by the if/else cascade with linear port
+ * scans it replaced, transcribed below. Every decision must match.
+ * With -b [file.pcap], frames of the capture, or the random mix if none is
+ * given, are replayed through both and time per frame is compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lwip_filter.h"
+#include "lwip_filter_test_hook.h"
+#include "lwip/etharp.h"
+#include "lwip/prot/iana.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/prot/udp.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/udp.h"
+#include "lwip/priv/tcp_priv.h"
+
+#define TEST_FRAMES          500000
+#define BENCH_ROUNDS         20
+#define FRAME_SLOT           128
+#define PCAP_MAX_FRAMES      100000
+
+#define MQTT_PORT            1883
+#define IPERF_PORT           5001
+
+/* Overlaps of host ports with fixed ports and more ports than kept on purpose */
+#define HOST_TCP_SRC_PORTS   "22,554,8554"
+#define HOST_TCP_DST_PORTS   "8080,5001"
+#define HOST_UDP_SRC_PORTS   "5353"
+#define HOST_UDP_DST_PORTS   "9999,1234,1,2,3,4,5,6,7,8,10,11"
+
+#define MAX_REF_PORTS        10
+
+int lwip_filter_test_power_save;
+struct udp_pcb *udp_pcbs;
+union tcp_listen_pcbs_t tcp_listen_pcbs;
+
+static struct tcp_pcb iperf_tcp_pcb = { .local_port = IPERF_PORT };
+static struct udp_pcb iperf_udp_pcb = { .local_port = IPERF_PORT };
+static int64_t now_us;
+
+/* Every call is 2 sec later, so port open checks are never served stale */
+int64_t esp_timer_get_time(void)
+{
+	now_us += 2000000;
+	return now_us;
+}
+
+/* Old filter, port lists scanned linearly */
+struct ref_ports {
+	uint16_t port[MAX_REF_PORTS];
+	int count;
+};
+
+static struct ref_ports ref_tcp_src, ref_tcp_dst, ref_udp_src, ref_udp_dst;
+
+static void ref_parse_ports(struct ref_ports *p, const char *str)
+{
+	const char *s = str;
+
+	while (*s && p->count < MAX_REF_PORTS) {
+		p->port[p->count++] = atoi(s);
+		s = strchr(s, ',');
+		if (!s)
+			break;
+		s++;
+	}
+}
+
+static int ref_port_allowed(const struct ref_ports *p, uint16_t port)
+{
+	for (int i = 0; i < p->count; i++)
+		if (p->port[i] == port)
+			return 1;
+	return 0;
+}
+
+static int ref_tcp_listening(uint16_t port)
+{
+	for (struct tcp_pcb *pcb = tcp_listen_pcbs.pcbs; pcb; pcb = pcb->next)
+		if (pcb->local_port == port)
+			return 1;
+	return 0;
+}
+
+static int ref_udp_bound(uint16_t port)
+{
+	for (struct udp_pcb *pcb = udp_pcbs; pcb; pcb = pcb->next)
+		if (pcb->local_port == port)
+			return 1;
+	return 0;
+}
+
+static hosted_l2_bridge ref_route(void *frame)
+{
+	struct eth_hdr *ethhdr = frame;
+	struct ip_hdr *iphdr = (struct ip_hdr *)((u8_t *)frame + SIZEOF_ETH_HDR);
+	int ps = is_host_power_saving();
+	u16_t src_port = 0, dst_port = 0;
+
+	if (ethhdr->dest.addr[0] & 0x01)
+		return SLAVE_LWIP_BRIDGE;
+
+	if (lwip_ntohs(ethhdr->type) == ETHTYPE_ARP) {
+		struct etharp_hdr *arphdr = (struct etharp_hdr *)iphdr;
+
+		if (arphdr->opcode == lwip_htons(ARP_REQUEST) || ps)
+			return SLAVE_LWIP_BRIDGE;
+		return BOTH_LWIP_BRIDGE;
+	}
+
+	if (lwip_ntohs(ethhdr->type) != ETHTYPE_IP)
+		return SLAVE_LWIP_BRIDGE;
+
+	if (IPH_PROTO(iphdr) == IP_PROTO_TCP) {
+		struct tcp_hdr *tcphdr = (struct tcp_hdr *)((u8_t *)iphdr + IPH_HL(iphdr) * 4);
+
+		dst_port = lwip_ntohs(tcphdr->dest);
+		src_port = lwip_ntohs(tcphdr->src);
+
+		if (ref_port_allowed(&ref_tcp_src, src_port) ||
+		    ref_port_allowed(&ref_tcp_dst, dst_port))
+			return HOST_LWIP_BRIDGE;
+
+		if (dst_port == IPERF_PORT) {
+			if (ref_tcp_listening(dst_port))
+				return SLAVE_LWIP_BRIDGE;
+			else if (!ps)
+				return HOST_LWIP_BRIDGE;
+		}
+
+		if (IS_REMOTE_TCP_PORT(dst_port)) {
+			if (!ps)
+				return HOST_LWIP_BRIDGE;
+			if (src_port == MQTT_PORT) {
+				u16_t hdr_len = (TCPH_FLAGS(tcphdr) >> 12) * 4;
+				u16_t len = lwip_ntohs(tcphdr->wnd);
+
+				if (len >= strlen("wakeup-host") &&
+				    !memcmp((u8_t *)tcphdr + hdr_len, "wakeup-host", strlen("wakeup-host")))
+					return HOST_LWIP_BRIDGE;
+			}
+			return INVALID_BRIDGE;
+		} else if (IS_LOCAL_TCP_PORT(dst_port)) {
+			return SLAVE_LWIP_BRIDGE;
+		}
+	} else if (IPH_PROTO(iphdr) == IP_PROTO_UDP) {
+		struct udp_hdr *udphdr = (struct udp_hdr *)((u8_t *)iphdr + IPH_HL(iphdr) * 4);
+
+		dst_port = lwip_ntohs(udphdr->dest);
+		src_port = lwip_ntohs(udphdr->src);
+
+		if (ref_port_allowed(&ref_udp_src, src_port) ||
+		    ref_port_allowed(&ref_udp_dst, dst_port))
+			return HOST_LWIP_BRIDGE;
+
+		if (dst_port == IPERF_PORT) {
+			if (ref_udp_bound(dst_port))
+				return SLAVE_LWIP_BRIDGE;
+			else if (!ps)
+				return HOST_LWIP_BRIDGE;
+		}
+
+		if (dst_port == LWIP_IANA_PORT_DHCP_CLIENT)
+			return HOST_LWIP_BRIDGE;
+
+		if (IS_REMOTE_UDP_PORT(dst_port))
+			return ps ? INVALID_BRIDGE : HOST_LWIP_BRIDGE;
+		else if (IS_LOCAL_UDP_PORT(dst_port))
+			return SLAVE_LWIP_BRIDGE;
+	} else if (IPH_PROTO(iphdr) == IP_PROTO_ICMP) {
+		struct icmp_echo_hdr *icmphdr = (struct icmp_echo_hdr *)((u8_t *)iphdr + IPH_HL(iphdr) * 4);
+
+		if (icmphdr->type == ICMP_ECHO)
+			return SLAVE_LWIP_BRIDGE;
+		if (icmphdr->type == ICMP_ER)
+			return ps ? SLAVE_LWIP_BRIDGE : BOTH_LWIP_BRIDGE;
+	}
+
+	return SLAVE_LWIP_BRIDGE;
+}
+
+static uint16_t pick_port(unsigned int *seed)
+{
+	static const uint16_t fixed[] = {
+		22, 554, 8554, 8080, 5353, 9999, 1234, 10, 11,
+		IPERF_PORT, MQTT_PORT, LWIP_IANA_PORT_DHCP_CLIENT, 67, 53, 80, 443,
+		49152, 61439, 61440, 65535,
+	};
+
+	switch (rand_r(seed) % 4) {
+	case 0:
+	case 1:
+		return fixed[rand_r(seed) % (sizeof(fixed) / sizeof(fixed[0]))];
+	case 2:
+		return 49152 + rand_r(seed) % (65536 - 49152);
+	default:
+		return rand_r(seed) & 0xffff;
+	}
+}
+
+/* Random frame, weighted towards ports and types filter treats specially */
+static void build_frame(uint8_t *frame, unsigned int *seed)
+{
+	struct eth_hdr *eth = (struct eth_hdr *)frame;
+	struct ip_hdr *ip = (struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+	uint8_t *l4 = NULL;
+	int r = rand_r(seed) % 20;
+
+	memset(frame, 0, FRAME_SLOT);
+	eth->dest.addr[0] = (rand_r(seed) % 16) ? 0x24 : 0xff;
+
+	if (r < 2) {
+		struct etharp_hdr *arp = (struct etharp_hdr *)ip;
+
+		eth->type = lwip_htons(ETHTYPE_ARP);
+		arp->opcode = lwip_htons((rand_r(seed) & 1) ? ARP_REQUEST : ARP_REPLY);
+		return;
+	}
+	if (r < 4) {
+		eth->type = lwip_htons(0x86dd);
+		return;
+	}
+
+	eth->type = lwip_htons(ETHTYPE_IP);
+	ip->_v_hl = 0x40 | ((rand_r(seed) % 4) ? 5 : 6);
+	l4 = (uint8_t *)ip + IPH_HL(ip) * 4;
+
+	r = rand_r(seed) % 20;
+	if (r < 9) {
+		struct tcp_hdr *tcp = (struct tcp_hdr *)l4;
+		static const char *payload[] = { "wakeup-host", "other-data!" };
+
+		ip->_proto = IP_PROTO_TCP;
+		tcp->src = lwip_htons(pick_port(seed));
+		tcp->dest = lwip_htons(pick_port(seed));
+		tcp->_hdrlen_rsvd_flags = lwip_htons((5 << 12) | (rand_r(seed) & TCP_FLAGS));
+		tcp->wnd = lwip_htons((rand_r(seed) % 3) ? 11 : 4);
+		memcpy(l4 + sizeof(*tcp), payload[rand_r(seed) & 1], 11);
+	} else if (r < 17) {
+		struct udp_hdr *udp = (struct udp_hdr *)l4;
+
+		ip->_proto = IP_PROTO_UDP;
+		udp->src = lwip_htons(pick_port(seed));
+		udp->dest = lwip_htons(pick_port(seed));
+	} else if (r < 19) {
+		static const uint8_t types[] = { ICMP_ER, ICMP_ECHO, 3 };
+
+		ip->_proto = IP_PROTO_ICMP;
+		((struct icmp_echo_hdr *)l4)->type = types[rand_r(seed) % 3];
+	} else {
+		ip->_proto = 47;
+	}
+}
+
+static const char *bridge_name(hosted_l2_bridge b)
+{
+	static const char *name[] = { "SLAVE", "HOST", "BOTH", "INVALID" };
+
+	return b <= INVALID_BRIDGE ? name[b] : "?";
+}
+
+static int test_decisions(void)
+{
+	uint8_t frame[FRAME_SLOT];
+	unsigned int seed = 1;
+	unsigned long mismatch = 0;
+	hosted_l2_bridge got, want;
+	unsigned long count[INVALID_BRIDGE + 1] = {0};
+
+	for (int i = 0; i < TEST_FRAMES; i++) {
+		build_frame(frame, &seed);
+		lwip_filter_test_power_save = !(rand_r(&seed) % 4);
+		tcp_listen_pcbs.pcbs = (rand_r(&seed) & 1) ? &iperf_tcp_pcb : NULL;
+		udp_pcbs = (rand_r(&seed) & 1) ? &iperf_udp_pcb : NULL;
+
+		got = filter_and_route_packet(frame, sizeof(frame));
+		want = ref_route(frame);
+		count[want]++;
+
+		if (got != want && mismatch++ < 10) {
+			printf("frame %d: got %s, old filter %s, power save %d\n",
+					i, bridge_name(got), bridge_name(want),
+					lwip_filter_test_power_save);
+			for (int j = 0; j < 54; j++)
+				printf("%02x%s", frame[j], (j % 16 == 15) ? "\n" : " ");
+			printf("\n");
+		}
+	}
+
+	if (mismatch) {
+		printf("%lu of %d decisions differ from old filter\n", mismatch, TEST_FRAMES);
+		return -1;
+	}
+
+	printf("lwip_filter: %d frames match old filter (slave %lu, host %lu, both %lu, drop %lu)\n",
+			TEST_FRAMES, count[SLAVE_LWIP_BRIDGE], count[HOST_LWIP_BRIDGE],
+			count[BOTH_LWIP_BRIDGE], count[INVALID_BRIDGE]);
+	return 0;
+}
+
+static uint32_t pcap_u32(const uint8_t *p, int swap)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+/* Classic pcap of ethernet frames, each copied in a zeroed slot */
+static int load_pcap(const char *path, uint8_t *frames, int max)
+{
+	uint8_t hdr[24], rec[16];
+	uint32_t magic = 0, caplen = 0;
+	int swap = 0, n = 0;
+	FILE *f = fopen(path, "rb");
+
+	if (!f || fread(hdr, sizeof(hdr), 1, f) != 1) {
+		printf("cannot read %s\n", path);
+		goto fail;
+	}
+
+	magic = pcap_u32(hdr, 0);
+	if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		swap = 1;
+	else if (magic != 0xa1b2c3d4 && magic != 0xa1b23c4d) {
+		printf("%s is not a pcap file\n", path);
+		goto fail;
+	}
+	if (pcap_u32(hdr + 20, swap) != 1) {
+		printf("%s is not an ethernet capture\n", path);
+		goto fail;
+	}
+
+	while (n < max && fread(rec, sizeof(rec), 1, f) == 1) {
+		uint8_t *slot = frames + (size_t)n * FRAME_SLOT;
+
+		caplen = pcap_u32(rec + 8, swap);
+		memset(slot, 0, FRAME_SLOT);
+		if (fread(slot, 1, caplen < FRAME_SLOT ? caplen : FRAME_SLOT, f) == 0)
+			break;
+		if (caplen > FRAME_SLOT)
+			fseek(f, caplen - FRAME_SLOT, SEEK_CUR);
+		n++;
+	}
+
+	fclose(f);
+	return n;
+
+fail:
+	if (f)
+		fclose(f);
+	return -1;
+}
+
+static double replay(hosted_l2_bridge (*route)(void *, uint16_t),
+		uint8_t *frames, int n, unsigned long *sum)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (int i = 0; i < n; i++)
+			*sum += route(frames + (size_t)i * FRAME_SLOT, FRAME_SLOT);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) /
+		((double)BENCH_ROUNDS * n);
+}
+
+static hosted_l2_bridge ref_route_len(void *frame, uint16_t len)
+{
+	(void)len;
+	return ref_route(frame);
+}
+
+static int bench(const char *pcap)
+{
+	uint8_t *frames = malloc((size_t)PCAP_MAX_FRAMES * FRAME_SLOT);
+	unsigned int seed = 7;
+	unsigned long sum_new = 0, sum_old = 0;
+	double ns_new = 0, ns_old = 0;
+	int n = 0;
+
+	if (!frames)
+		return -1;
+
+	if (pcap) {
+		n = load_pcap(pcap, frames, PCAP_MAX_FRAMES);
+	} else {
+		for (n = 0; n < PCAP_MAX_FRAMES; n++)
+			build_frame(frames + (size_t)n * FRAME_SLOT, &seed);
+	}
+	if (n <= 0) {
+		free(frames);
+		return -1;
+	}
+
+	lwip_filter_test_power_save = 0;
+	tcp_listen_pcbs.pcbs = &iperf_tcp_pcb;
+	udp_pcbs = NULL;
+
+	ns_new = replay(filter_and_route_packet, frames, n, &sum_new);
+	ns_old = replay(ref_route_len, frames, n, &sum_old);
+
+	printf("bench %d frames of %s: rule table %.1f ns, old filter %.1f ns per frame%s\n",
+			n, pcap ? pcap : "random mix", ns_new, ns_old,
+			sum_new != sum_old ? " (decisions differ)" : "");
+
+	free(frames);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	lwip_filter_init();
+	if (configure_host_static_port_forwarding_rules(HOST_TCP_SRC_PORTS, HOST_TCP_DST_PORTS,
+			HOST_UDP_SRC_PORTS, HOST_UDP_DST_PORTS)) {
+		printf("FAIL: lwip_filter rules\n");
+		return 1;
+	}
+	ref_parse_ports(&ref_tcp_src, HOST_TCP_SRC_PORTS);
+	ref_parse_ports(&ref_tcp_dst, HOST_TCP_DST_PORTS);
+	ref_parse_ports(&ref_udp_src, HOST_UDP_SRC_PORTS);
+	ref_parse_ports(&ref_udp_dst, HOST_UDP_DST_PORTS);
+
+	if (test_decisions()) {
+		printf("FAIL: lwip_filter\n");
+		return 1;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "-b") && bench(argc > 2 ? argv[2] : NULL)) {
+		printf("FAIL: lwip_filter bench\n");
+		return 1;
+	}
+
+	return 0;
+}
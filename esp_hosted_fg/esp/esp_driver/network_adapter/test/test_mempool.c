@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2015-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+/*
+ * Host built stress test of lock-free hosted_mempool, with pthreads standing
+ * in for tasks on both cores. Threads churn alloc/free on a small pool and
+ * claim every block they get in an owner table, so a block handed out twice
+ * is caught. With -b, alloc/free throughput is compared with a mutex guarded
+ * free list, which is what the os_mempool port used to do.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "mempool.h"
+#include "mempool_test_hook.h"
+
+#define NUM_BLOCKS           32
+#define BLOCK_SIZE           64
+#define MAX_HELD             6
+#define STRESS_THREADS       8
+#define STRESS_ROUNDS        400000
+#define BENCH_ROUNDS         2000000
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int rounds;
+	unsigned int seed;
+	unsigned long failed;
+};
+
+static struct hosted_mempool *pool;
+static _Atomic int pop_window_enabled;
+static _Thread_local unsigned int pop_window_seed = 1;
+static _Atomic int owner[NUM_BLOCKS];
+static _Atomic unsigned long errors;
+
+/*
+ * Called by mempool_pop() between reading head and its compare exchange.
+ * Yielding there now and then lets other threads pop and push the same
+ * block meanwhile, which is the ABA case, even on a single core host.
+ */
+void mempool_test_pop_window(void)
+{
+	if (atomic_load_explicit(&pop_window_enabled, memory_order_relaxed) &&
+	    !(rand_r(&pop_window_seed) % 8))
+		sched_yield();
+}
+
+static int block_idx(void *mem)
+{
+	return ((uint8_t *)mem - pool->heap) / pool->block_size;
+}
+
+static void claim(struct worker *w, uint8_t *mem)
+{
+	int prev = atomic_exchange(&owner[block_idx(mem)], w->id);
+
+	if (prev) {
+		printf("block %d handed to thread %d while held by %d\n",
+				block_idx(mem), w->id, prev);
+		atomic_fetch_add(&errors, 1);
+	}
+	memset(mem, w->id, BLOCK_SIZE);
+}
+
+static void release(struct worker *w, uint8_t *mem)
+{
+	int i = 0;
+
+	/* Block contents must be ours till free */
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		if (mem[i] != w->id) {
+			printf("block %d written by another thread\n", block_idx(mem));
+			atomic_fetch_add(&errors, 1);
+			break;
+		}
+	}
+
+	if (atomic_exchange(&owner[block_idx(mem)], 0) != w->id) {
+		printf("block %d lost ownership\n", block_idx(mem));
+		atomic_fetch_add(&errors, 1);
+	}
+
+	if (hosted_mempool_free(pool, mem) != MEMPOOL_OK)
+		atomic_fetch_add(&errors, 1);
+}
+
+static void *stress_worker(void *arg)
+{
+	struct worker *w = arg;
+	uint8_t *held[MAX_HELD] = {0};
+	int n = 0, want = 0, i = 0, r = 0;
+
+	for (r = 0; r < w->rounds; r++) {
+		want = 1 + rand_r(&w->seed) % MAX_HELD;
+
+		for (n = 0; n < want; n++) {
+			held[n] = hosted_mempool_alloc(pool, BLOCK_SIZE, MEMSET_NOT_REQUIRED);
+			if (!held[n]) {
+				/* Pool exhausted by others, fine */
+				w->failed++;
+				break;
+			}
+			claim(w, held[n]);
+		}
+
+		/* Free in random order, so pushes interleave with pops elsewhere */
+		while (n) {
+			i = rand_r(&w->seed) % n;
+			release(w, held[i]);
+			held[i] = held[--n];
+		}
+	}
+
+	return NULL;
+}
+
+static int check_all_free(void)
+{
+	void *mem[NUM_BLOCKS + 1] = {0};
+	int seen[NUM_BLOCKS] = {0};
+	int i = 0;
+
+	for (i = 0; i < NUM_BLOCKS; i++) {
+		mem[i] = hosted_mempool_alloc(pool, BLOCK_SIZE, MEMSET_NOT_REQUIRED);
+		if (!mem[i]) {
+			printf("only %d of %d blocks left after stress\n", i, NUM_BLOCKS);
+			return -1;
+		}
+		if (seen[block_idx(mem[i])]++) {
+			printf("block %d twice on free list\n", block_idx(mem[i]));
+			return -1;
+		}
+	}
+
+	if (hosted_mempool_alloc(pool, BLOCK_SIZE, MEMSET_NOT_REQUIRED)) {
+		printf("alloc beyond pool size succeeded\n");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_BLOCKS; i++)
+		hosted_mempool_free(pool, mem[i]);
+
+	return 0;
+}
+
+static int test_api(void)
+{
+	uint8_t *mem = NULL;
+
+	/* Foreign and misaligned pointers must not reach the free list */
+	mem = hosted_mempool_alloc(pool, BLOCK_SIZE, MEMSET_REQUIRED);
+	if (!mem || hosted_mempool_free(pool, mem + 1) != MEMPOOL_FAIL ||
+	    hosted_mempool_free(pool, &errors) != MEMPOOL_FAIL ||
+	    hosted_mempool_free(pool, mem) != MEMPOOL_OK) {
+		printf("free of invalid pointer not rejected\n");
+		return -1;
+	}
+
+	if (hosted_mempool_alloc(pool, BLOCK_SIZE + 1, MEMSET_NOT_REQUIRED)) {
+		printf("alloc above block size succeeded\n");
+		return -1;
+	}
+
+	return check_all_free();
+}
+
+static int run_stress(void)
+{
+	struct worker w[STRESS_THREADS] = {0};
+	int i = 0;
+
+	atomic_store(&pop_window_enabled, 1);
+	for (i = 0; i < STRESS_THREADS; i++) {
+		w[i].id = i + 1;
+		w[i].rounds = STRESS_ROUNDS;
+		w[i].seed = i * 7919 + 1;
+		pthread_create(&w[i].thread, NULL, stress_worker, &w[i]);
+	}
+	for (i = 0; i < STRESS_THREADS; i++)
+		pthread_join(w[i].thread, NULL);
+	atomic_store(&pop_window_enabled, 0);
+
+	if (atomic_load(&errors))
+		return -1;
+
+	return check_all_free();
+}
+
+/* Free list guarded by one mutex per get/put, like os_mempool port was */
+static pthread_mutex_t mutex_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *mutex_pool_free[NUM_BLOCKS];
+static int mutex_pool_count;
+
+static void *mutex_pool_alloc(void)
+{
+	void *mem = NULL;
+
+	pthread_mutex_lock(&mutex_pool_lock);
+	if (mutex_pool_count)
+		mem = mutex_pool_free[--mutex_pool_count];
+	pthread_mutex_unlock(&mutex_pool_lock);
+
+	return mem;
+}
+
+static void mutex_pool_put(void *mem)
+{
+	pthread_mutex_lock(&mutex_pool_lock);
+	mutex_pool_free[mutex_pool_count++] = mem;
+	pthread_mutex_unlock(&mutex_pool_lock);
+}
+
+static void *bench_lockfree(void *arg)
+{
+	void *mem = NULL;
+	int r = 0;
+
+	for (r = 0; r < *(int *)arg; r++) {
+		mem = hosted_mempool_alloc(pool, BLOCK_SIZE, MEMSET_NOT_REQUIRED);
+		if (mem)
+			hosted_mempool_free(pool, mem);
+	}
+	return NULL;
+}
+
+static void *bench_mutex(void *arg)
+{
+	void *mem = NULL;
+	int r = 0;
+
+	for (r = 0; r < *(int *)arg; r++) {
+		mem = mutex_pool_alloc();
+		if (mem)
+			mutex_pool_put(mem);
+	}
+	return NULL;
+}
+
+static double run_bench(void *(*fn)(void *), int threads)
+{
+	pthread_t t[STRESS_THREADS];
+	struct timespec start, end;
+	int rounds = BENCH_ROUNDS;
+	int i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < threads; i++)
+		pthread_create(&t[i], NULL, fn, &rounds);
+	for (i = 0; i < threads; i++)
+		pthread_join(t[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+static void bench(void)
+{
+	int threads[] = { 1, 2, 4 };
+	double ns_lockfree = 0, ns_mutex = 0;
+	size_t i = 0;
+
+	for (i = 0; i < NUM_BLOCKS; i++)
+		mutex_pool_put(pool->heap + i * pool->block_size);
+
+	for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		ns_lockfree = run_bench(bench_lockfree, threads[i]);
+		ns_mutex = run_bench(bench_mutex, threads[i]);
+		printf("bench %d thread(s): lock-free %.1f ns, mutex %.1f ns per alloc+free\n",
+				threads[i],
+				ns_lockfree / ((double)BENCH_ROUNDS * threads[i]),
+				ns_mutex / ((double)BENCH_ROUNDS * threads[i]));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	pool = hosted_mempool_create(NULL, 0, NUM_BLOCKS, BLOCK_SIZE);
+	if (!pool) {
+		printf("FAIL: mempool create\n");
+		return 1;
+	}
+
+	if (test_api() || run_stress()) {
+		printf("FAIL: mempool, %lu errors\n", atomic_load(&errors));
+		return 1;
+	}
+	printf("mempool: %d threads x %d rounds on %d blocks, no block handed out twice\n",
+			STRESS_THREADS, STRESS_ROUNDS, NUM_BLOCKS);
+
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+
+	hosted_mempool_destroy(pool);
+	return 0;
+}
@@ -589,6 +589,45 @@ int reset_event_callback(int event);
  **/
 int init_hosted_control_lib(void);
 
+/* Initialize hosted control library for application event loop (Linux)
+ *
+ * Same as init_hosted_control_lib(), but no rx thread and no per request
+ * timer is created. Application adds fd from ctrl_get_event_fd() in its
+ * own poll/epoll/select loop and calls ctrl_process_events() once it is
+ * readable. Responses, events and async request timeouts are then
+ * delivered from within ctrl_process_events().
+ *
+ * Synchronous requests wait till response is processed by event loop,
+ * so those should not be issued from thread running the event loop.
+ *
+ * Returns:
+ * > SUCCESS - 0
+ * > FAILURE - -1
+ **/
+int init_hosted_control_lib_event_loop(void);
+
+/* Get pollable fd of hosted control library (Linux)
+ *
+ * Only valid after init_hosted_control_lib_event_loop()
+ * fd becomes readable when ctrl_process_events() has work to do
+ *
+ * Returns:
+ * > fd - On success
+ * > FAILURE - -1, if not in event loop mode
+ **/
+int ctrl_get_event_fd(void);
+
+/* Process pending control path work without blocking (Linux)
+ *
+ * Reads messages received from ESP32, calls response and event callbacks
+ * and expires timed out async requests
+ *
+ * Returns:
+ * > SUCCESS - 0
+ * > FAILURE - -1
+ **/
+int ctrl_process_events(void);
+
 /* De-initialize hosted control library
  *
  * This is last step for application while using control path
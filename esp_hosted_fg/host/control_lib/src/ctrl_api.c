@@ -24,6 +24,7 @@
 } while(0);
 
 extern int init_hosted_control_lib_internal(void);
+extern int init_hosted_control_lib_event_loop_internal(void);
 extern int deinit_hosted_control_lib_internal(void);
 
 
@@ -32,6 +33,11 @@ int init_hosted_control_lib(void)
 	return init_hosted_control_lib_internal();
 }
 
+int init_hosted_control_lib_event_loop(void)
+{
+	return init_hosted_control_lib_event_loop_internal();
+}
+
 int deinit_hosted_control_lib(void)
 {
 	return deinit_hosted_control_lib_internal();
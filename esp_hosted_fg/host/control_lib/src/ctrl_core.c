@@ -8,7 +8,6 @@
 #include "ctrl_core.h"
 #include "serial_if.h"
 #include "platform_wrapper.h"
-#include "esp_queue.h"
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -18,6 +17,9 @@
 #include "common.h"
 #define command_log(...)             printf(__VA_ARGS__); printf("\r");
 #else
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #define command_log(...) do { printf("%s:%u ",__func__,__LINE__); printf(__VA_ARGS__); } while(0)
 #define min(X, Y)                    (((X) < (Y)) ? (X) : (Y))
 #endif
@@ -43,6 +45,37 @@
 #define CTRL_LIB_STATE_INIT          1
 #define CTRL_LIB_STATE_READY         2
 
+/* Requests in flight at a time. Slave protocomm_pserial queues up to
+ * REQ_Q_MAX (10, 3 on ESP32-C2) requests, extra ones wait on slave side */
+#ifndef CTRL_MAX_PENDING_REQ
+#define CTRL_MAX_PENDING_REQ         10
+#endif
+
+#define CTRL_PENDING_FREE            0
+#define CTRL_PENDING_WAIT            1
+#define CTRL_PENDING_DONE            2
+
+/* Event loop mode: async request deadlines are kept in timer wheel,
+ * ticking once a second as request timeouts are in seconds.
+ * Deadlines beyond one wheel round stay in slot for later rounds */
+#define CTRL_TIMER_WHEEL_SLOTS       64
+#define CTRL_TIMER_WHEEL_NONE        -1
+
+#define CTRL_EV_SERIAL               1
+#define CTRL_EV_WAKE                 2
+#define CTRL_EV_TICK                 3
+
+/* Received msg is decoded in arena, which is reset once msg is handled.
+ * Default fits scan list of several dozen APs, larger msgs use heap */
+#ifndef CTRL_RX_ARENA_SIZE
+#ifdef MCU_SYS
+#define CTRL_RX_ARENA_SIZE           2048
+#else
+#define CTRL_RX_ARENA_SIZE           8192
+#endif
+#endif
+#define CTRL_RX_ARENA_ALIGN          8
+
 #define CLEANUP_APP_MSG(app_msg) do {                                         \
   if (app_msg) {                                                              \
     if (app_msg->free_buffer_handle) {                                        \
@@ -92,41 +125,72 @@ struct ctrl_lib_context {
 	int state;
 };
 
-typedef void (*ctrl_rx_ind_t)(void);
+/* Request sent to ESP32 and waiting for its response
+ * 1. Synchrounous request (resp_cb NULL): requesting thread waits on
+ *    done_sem, response is handed over in `resp`
+ * 2. Asynchrounous request: `timer` runs till response arrives, and
+ *    resp_cb is called with either response or timeout failure
+ */
+struct ctrl_pending_req {
+	int32_t uid;
+	int state;
+	int resp_msg_id;
+	ctrl_resp_cb_t resp_cb;
+	void *timer;
+	void *done_sem;
+	ctrl_cmd_t *resp;
+
+	/* Event loop mode: deadline tick (0 if not in wheel), next in slot */
+	uint32_t deadline;
+	int wheel_next;
+};
 
-esp_queue_t* ctrl_msg_Q = NULL;
 static void * ctrl_rx_thread_handle;
-static void * read_sem;
-static void * ctrl_req_sem;
-static void * async_timer_handle;
 static struct ctrl_lib_context ctrl_lib_ctxt;
 
+/* Request table, looked up by uid of response */
+static struct ctrl_pending_req pending_req[CTRL_MAX_PENDING_REQ];
+static void * pending_req_lock;
+/* Counts free entries in pending_req */
+static void * pending_req_slots;
+/* Serializes requests written to serial interface */
+static void * ctrl_tx_lock;
+
+/* Event loop mode, no rx thread and no per request timer.
+ * Application polls ctrl_get_event_fd() and calls ctrl_process_events() */
+static uint8_t ctrl_event_loop_mode;
+
+/* Timer wheel, protected by pending_req_lock */
+static int timer_wheel[CTRL_TIMER_WHEEL_SLOTS];
+static uint32_t timer_wheel_now;
+static int timer_wheel_count;
+
+#ifndef MCU_SYS
+static int ctrl_epoll_fd = -1;
+static int ctrl_wake_fd = -1;
+static int ctrl_tick_fd = -1;
+static uint8_t ctrl_tick_armed;
+#endif
+
+/* Used by rx path only, which handles one msg at a time */
+static uint8_t ctrl_rx_arena[CTRL_RX_ARENA_SIZE] __attribute__((aligned(CTRL_RX_ARENA_ALIGN)));
+static size_t ctrl_rx_arena_used;
+
+static void * ctrl_rx_arena_alloc(void *allocator_data, size_t size);
+static void ctrl_rx_arena_free(void *allocator_data, void *ptr);
+
+static ProtobufCAllocator ctrl_rx_allocator = {
+	.alloc = ctrl_rx_arena_alloc,
+	.free = ctrl_rx_arena_free,
+	.allocator_data = NULL,
+};
+
 static int call_event_callback(ctrl_cmd_t *app_event);
-static int is_async_resp_callback_registered_by_resp_msg_id(int resp_msg_id);
-static int call_async_resp_callback(ctrl_cmd_t *app_resp);
 
 /* uid to link between requests and responses
  * uids are incrementing values from 1 onwards. */
 static int32_t uid = 0;
 
-/* expected uid in response
- * -1 means not a valid id
- *  0 means slave fw was not updated to support UIDs */
-static int32_t expected_resp_uid = -1;
-
-/* Control response callbacks
- * These will be updated per control request received
- * 1. If application wants to use synchrounous, i.e. Wait till the response received
- *    after current control request is sent or timeout occurs,
- *    application will pass this callback in request as NULL.
- * 2. If application wants to use `asynchrounous`, i.e. Just send the request and
- *    unblock for next processing, application will assign function pointer in
- *    control request, which will be registered here.
- *    When the response comes, the this registered callback function will be called
- *    with input as response
- */
-static ctrl_resp_cb_t ctrl_resp_cb_table [CTRL_RESP_MAX - CTRL_RESP_BASE] = { NULL };
-
 /* Control event callbacks
  * These will be updated when user registers event callback
  * using `set_event_callback` API
@@ -158,6 +222,36 @@ static int serial_deinit(void)
 	return SUCCESS;
 }
 
+/* Bump allocate from rx arena, fall back to heap once it is used up */
+static void * ctrl_rx_arena_alloc(void *allocator_data, size_t size)
+{
+	size_t off = (ctrl_rx_arena_used + CTRL_RX_ARENA_ALIGN - 1) &
+		~(size_t)(CTRL_RX_ARENA_ALIGN - 1);
+
+	if (size <= CTRL_RX_ARENA_SIZE && off <= CTRL_RX_ARENA_SIZE - size) {
+		ctrl_rx_arena_used = off + size;
+		return &ctrl_rx_arena[off];
+	}
+
+	return hosted_malloc(size);
+}
+
+static void ctrl_rx_arena_free(void *allocator_data, void *ptr)
+{
+	uint8_t *p = ptr;
+
+	/* Arena blocks are only given back by ctrl_rx_arena_reset() */
+	if (p >= ctrl_rx_arena && p < ctrl_rx_arena + CTRL_RX_ARENA_SIZE)
+		return;
+
+	hosted_free(ptr);
+}
+
+static inline void ctrl_rx_arena_reset(void)
+{
+	ctrl_rx_arena_used = 0;
+}
+
 static inline void set_ctrl_lib_state(int state)
 {
 	ctrl_lib_ctxt.state = state;
@@ -354,12 +448,12 @@ static int ctrl_app_parse_event(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_ntfy)
 		}
 	}
 
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
 	return SUCCESS;
 
 fail_parse_ctrl_msg:
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
 	app_ntfy->resp_event_status = FAILURE;
 	return FAILURE;
@@ -384,12 +478,6 @@ static int ctrl_app_parse_resp(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_resp)
 	app_resp->msg_id = ctrl_msg->msg_id;
 	app_resp->uid = ctrl_msg->uid;
 	app_resp->resp_event_status = FAILURE;
-	/* if app_resp->uid is 0, slave fw is not updated to return uid
-	 * so we skip this check */
-	if (app_resp->uid && (expected_resp_uid != app_resp->uid)) {
-		// response uid mis-match: ignore this response
-		goto fail_parse_ctrl_msg2;
-	}
 
 	/* 3. parse CtrlMsg into ctrl_cmd_t */
 	switch (ctrl_msg->msg_id) {
@@ -787,30 +875,183 @@ static int ctrl_app_parse_resp(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_resp)
 	}
 
 	/* 4. Free up buffers */
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
-	expected_resp_uid = -1;
 	return SUCCESS;
 
 	/* 5. Free up buffers in failure cases */
 fail_parse_ctrl_msg:
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
-	expected_resp_uid = -1;
 	return SUCCESS;
 	/* intended fall-through */
 
 fail_parse_ctrl_msg2:
-	ctrl_msg__free_unpacked(ctrl_msg, NULL);
+	ctrl_msg__free_unpacked(ctrl_msg, &ctrl_rx_allocator);
 	ctrl_msg = NULL;
-	expected_resp_uid = -1;
 	return FAILURE;
 }
 
-/* Control path RX indication */
-static void ctrl_rx_ind(void)
+static inline void pending_req_table_lock(void)
+{
+	hosted_get_semaphore(pending_req_lock, HOSTED_SEM_BLOCKING);
+}
+
+static inline void pending_req_table_unlock(void)
 {
-	hosted_post_semaphore(read_sem);
+	hosted_post_semaphore(pending_req_lock);
+}
+
+/* Reserve request table entry and assign uid to request.
+ * If all entries are in use, waits up to WAIT_TIME_B2B_CTRL_REQ seconds */
+static struct ctrl_pending_req * pending_req_alloc(ctrl_cmd_t *app_req)
+{
+	struct ctrl_pending_req *p = NULL;
+	int i = 0;
+
+	if (hosted_get_semaphore(pending_req_slots, WAIT_TIME_B2B_CTRL_REQ))
+		return NULL;
+
+	pending_req_table_lock();
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		if (pending_req[i].state == CTRL_PENDING_FREE) {
+			p = &pending_req[i];
+			break;
+		}
+	}
+	assert(p);
+
+	// handle rollover in uid value (range: 1 to INT32_MAX)
+	if (uid < INT32_MAX)
+		uid++;
+	else
+		uid = 1;
+
+	p->uid = uid;
+	p->state = CTRL_PENDING_WAIT;
+	p->resp_msg_id = app_req->msg_id - CTRL_REQ_BASE + CTRL_RESP_BASE;
+	p->resp_cb = app_req->ctrl_resp_cb;
+	p->timer = NULL;
+	p->resp = NULL;
+	p->deadline = 0;
+	p->wheel_next = CTRL_TIMER_WHEEL_NONE;
+	app_req->uid = uid;
+
+	pending_req_table_unlock();
+
+	return p;
+}
+
+static void timer_wheel_init(void)
+{
+	int i = 0;
+
+	for (i = 0; i < CTRL_TIMER_WHEEL_SLOTS; i++)
+		timer_wheel[i] = CTRL_TIMER_WHEEL_NONE;
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		pending_req[i].deadline = 0;
+		pending_req[i].wheel_next = CTRL_TIMER_WHEEL_NONE;
+	}
+
+	timer_wheel_now = 0;
+	timer_wheel_count = 0;
+}
+
+/* Should be called with pending_req_lock held */
+static void timer_wheel_add(struct ctrl_pending_req *p, int timeout_sec)
+{
+	int slot = 0;
+
+	/* Current tick is already partly gone, so round up by one */
+	p->deadline = timer_wheel_now + timeout_sec + 1;
+	if (!p->deadline)
+		p->deadline = 1;
+
+	slot = p->deadline % CTRL_TIMER_WHEEL_SLOTS;
+	p->wheel_next = timer_wheel[slot];
+	timer_wheel[slot] = p - pending_req;
+	timer_wheel_count++;
+}
+
+/* Should be called with pending_req_lock held */
+static void timer_wheel_del(struct ctrl_pending_req *p)
+{
+	int idx = p - pending_req;
+	int *link = NULL;
+
+	if (!p->deadline)
+		return;
+
+	link = &timer_wheel[p->deadline % CTRL_TIMER_WHEEL_SLOTS];
+	while (*link != CTRL_TIMER_WHEEL_NONE) {
+		if (*link == idx) {
+			*link = p->wheel_next;
+			timer_wheel_count--;
+			break;
+		}
+		link = &pending_req[*link].wheel_next;
+	}
+
+	p->deadline = 0;
+	p->wheel_next = CTRL_TIMER_WHEEL_NONE;
+}
+
+/* Should be called with pending_req_lock held */
+static void pending_req_free(struct ctrl_pending_req *p)
+{
+	timer_wheel_del(p);
+	p->uid = 0;
+	p->state = CTRL_PENDING_FREE;
+	p->resp_cb = NULL;
+	p->timer = NULL;
+	p->resp = NULL;
+	hosted_post_semaphore(pending_req_slots);
+}
+
+/* Should be called with pending_req_lock held */
+static struct ctrl_pending_req * pending_req_get_by_uid(int32_t req_uid)
+{
+	int i = 0;
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		if (pending_req[i].state != CTRL_PENDING_FREE &&
+		    pending_req[i].uid == req_uid)
+			return &pending_req[i];
+	}
+
+	return NULL;
+}
+
+/* Find request still waiting for this response.
+ * Should be called with pending_req_lock held */
+static struct ctrl_pending_req * pending_req_match_resp(int32_t resp_uid,
+		int resp_msg_id)
+{
+	struct ctrl_pending_req *p = NULL;
+	struct ctrl_pending_req *oldest = NULL;
+	int i = 0;
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		p = &pending_req[i];
+		if (p->state != CTRL_PENDING_WAIT)
+			continue;
+
+		if (resp_uid) {
+			if (p->uid == resp_uid)
+				return p;
+			continue;
+		}
+
+		/* uid 0: slave fw is not updated to return uid.
+		 * Slave serves requests in order, so oldest of this type */
+		if (p->resp_msg_id == resp_msg_id &&
+		    (!oldest || p->uid < oldest->uid))
+			oldest = p;
+	}
+
+	return oldest;
 }
 
 /* Returns CALLBACK_AVAILABLE if a non NULL control event
@@ -836,9 +1077,11 @@ static int is_event_callback_registered(int event)
 
 
 /* Process control msg (response or event) received from ESP32 */
-static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
+static int process_ctrl_rx_msg(CtrlMsg * proto_msg)
 {
-	esp_queue_elem_t *elem = NULL;
+	struct ctrl_pending_req *p = NULL;
+	ctrl_resp_cb_t resp_cb = NULL;
+	void *timer = NULL;
 	ctrl_cmd_t *app_resp = NULL;
 	ctrl_cmd_t *app_event = NULL;
 
@@ -884,8 +1127,8 @@ static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
 	/* 3. Check if it is response msg */
 	} else if (proto_msg->msg_type == CTRL_MSG_TYPE__Resp) {
 
-		/* Ctrl responses are handled asynchronously and
-		 * asynchronpusly */
+		/* Ctrl responses are handled synchronously and
+		 * asynchronously, as per request they belong to */
 
 		/* Allocate app struct for response */
 		app_resp = (ctrl_cmd_t *)hosted_malloc(sizeof(ctrl_cmd_t));
@@ -895,65 +1138,46 @@ static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
 		}
 		memset(app_resp, 0, sizeof(ctrl_cmd_t));
 
-		/* If this was async procedure, timer would have
-		 * been running for response.
-		 * As response received, stop timer */
-		if (async_timer_handle) {
-			/* async_timer_handle will be cleaned in hosted_timer_stop */
-			hosted_timer_stop(async_timer_handle);
-			async_timer_handle = NULL;
-		}
-
 		/* Decode protobuf buffer of response and
 		 * copy into app structures */
 		ctrl_app_parse_resp(proto_msg, app_resp);
+		proto_msg = NULL;
 
-		/* Is callback is available,
-		 * progress as async response */
-		if (CALLBACK_AVAILABLE ==
-			is_async_resp_callback_registered_by_resp_msg_id(app_resp->msg_id)) {
-
-			/* User registered control async response callback
-			 * function is available for this proto_msg,
-			 * so call to that function should be done and
-			 * return to select
-			 */
-			//command_log("async_resp_callback for msg_id [%d] available: %p\n", app_resp->msg_id, ctrl_resp_cb_table[app_resp->msg_id-CTRL_RESP_BASE]);
-			call_async_resp_callback(app_resp);
-
-			//CLEANUP_APP_MSG(app_resp);
-
-		} else {
-
-			/* as control async response callback function is
-			 * NOT available/registered, treat this response as
-			 * synchronous response. forward this response to app
-			 * using 'esp_queue' and help of semaphore
-			 **/
-			//command_log("async_resp_callback for msg_id [%d] NOT available\n", app_resp->msg_id);
+		/* Match response to request, responses may come in any order */
+		pending_req_table_lock();
+		p = pending_req_match_resp(app_resp->uid, app_resp->msg_id);
+		if (p) {
+			resp_cb = p->resp_cb;
+			timer = p->timer;
 
-			elem = (esp_queue_elem_t*)hosted_malloc(sizeof(esp_queue_elem_t));
-			if (!elem) {
-				command_log("%s %u: Malloc failed\n",__func__,__LINE__);
-				goto free_buffers;
+			if (resp_cb) {
+				pending_req_free(p);
+			} else {
+				/* User is RESPONSIBLE to free memory from
+				 * app_resp in case of async callbacks NOT provided
+				 * to free memory, please refer CLEANUP_APP_MSG macro
+				 **/
+				p->resp = app_resp;
+				p->state = CTRL_PENDING_DONE;
+				hosted_post_semaphore(p->done_sem);
 			}
+		}
+		pending_req_table_unlock();
+
+		if (!p) {
+			/* Request timed out already, or response is not ours */
+			command_log("Drop resp[%u] uid[%d], no request waiting\n",
+					app_resp->msg_id, (int)app_resp->uid);
+			CLEANUP_APP_MSG(app_resp);
+			return FAILURE;
+		}
 
-			/* User is RESPONSIBLE to free memory from
-			 * app_resp in case of async callbacks NOT provided
-			 * to free memory, please refer CLEANUP_APP_MSG macro
-			 **/
-			elem->buf = app_resp;
-			elem->buf_len = sizeof(ctrl_cmd_t);
-			if (esp_queue_put(ctrl_msg_Q, (void*)elem)) {
-				command_log("%s %u: ctrl Q put fail\n",__func__,__LINE__);
-				goto free_buffers;
-			}
+		/* timer will be cleaned in hosted_timer_stop */
+		if (timer)
+			hosted_timer_stop(timer);
 
-			/* Call up rx ind to unblock user */
-			if (ctrl_rx_func)
-				ctrl_rx_func();
-		}
-		hosted_post_semaphore(ctrl_req_sem);
+		if (resp_cb)
+			resp_cb(app_resp);
 
 	} else {
 		/* 4. some unsupported msg, drop it */
@@ -964,42 +1188,46 @@ static int process_ctrl_rx_msg(CtrlMsg * proto_msg, ctrl_rx_ind_t ctrl_rx_func)
 
 	/* 5. cleanup */
 free_buffers:
-	mem_free(elem);
 	mem_free(app_event);
+	mem_free(app_resp);
 	if (proto_msg) {
-		ctrl_msg__free_unpacked(proto_msg, NULL);
+		ctrl_msg__free_unpacked(proto_msg, &ctrl_rx_allocator);
 		proto_msg = NULL;
 	}
 	return FAILURE;
 }
 
-/* Control path rx thread
- * This is entry point for control path messages received from ESP32 */
-static void ctrl_rx_thread(void const *arg)
+/* Decode protobuf encoded msg read from serial interface
+ * and process it as event or response. Frees buf */
+static void ctrl_rx_process_buf(uint8_t *buf, uint32_t buf_len)
 {
-	uint32_t buf_len = 0;
+	CtrlMsg *resp = NULL;
 
-	ctrl_rx_ind_t ctrl_rx_func;
-	ctrl_rx_func = (ctrl_rx_ind_t) arg;
+	/* 1. Decode protobuf */
+	resp = ctrl_msg__unpack(&ctrl_rx_allocator, buf_len, buf);
 
-	/* 1. Get callback for synchronous procedure
-	 * for semaphore post */
-	if (!ctrl_rx_func) {
-		command_log("ERROR: NULL rx async cb for esp_queue,sem\n");
+	/* 2. Release the read buffer */
+	transport_pserial_read_done(buf);
+	if (!resp) {
+		ctrl_rx_arena_reset();
 		return;
 	}
 
-	/* 2. This queue should already be created
-	 * if NULL, exit here */
-	if (!ctrl_msg_Q) {
-		command_log("Ctrl msg Q is not created\n");
-		return;
-	}
+	/* 3. Send for further processing as event or response.
+	 * Decoded msg is copied to app structs and freed by then */
+	process_ctrl_rx_msg(resp);
+	ctrl_rx_arena_reset();
+}
 
-	/* 3. Infinite loop to process incoming msg on serial interface */
+/* Control path rx thread
+ * This is entry point for control path messages received from ESP32 */
+static void ctrl_rx_thread(void const *arg)
+{
+	uint32_t buf_len = 0;
+
+	/* Infinite loop to process incoming msg on serial interface */
 	while (1) {
 		uint8_t *buf = NULL;
-		CtrlMsg *resp = NULL;
 
 		/* 3.1 Block on read of protobuf encoded msg */
 		if (is_ctrl_lib_state(CTRL_LIB_STATE_INACTIVE)) {
@@ -1010,28 +1238,13 @@ static void ctrl_rx_thread(void const *arg)
 
 		if (!buf_len || !buf) {
 			command_log("%s buf_len read = 0\n",__func__);
-			goto free_bufs;
-		}
-
-		/* 3.2 Decode protobuf */
-		resp = ctrl_msg__unpack(NULL, buf_len, buf);
-		if (!resp) {
-			goto free_bufs;
+			if (buf)
+				transport_pserial_read_done(buf);
+			continue;
 		}
-		/* 3.3 Free the read buffer */
-		mem_free(buf);
-
-		/* 3.4 Send for further processing as event or response */
-		process_ctrl_rx_msg(resp, ctrl_rx_func);
-		continue;
 
-		/* 4. cleanup */
-free_bufs:
-		mem_free(buf);
-		if (resp) {
-			ctrl_msg__free_unpacked(resp, NULL);
-			resp = NULL;
-		}
+		/* 3.2 Decode and process */
+		ctrl_rx_process_buf(buf, buf_len);
 	}
 }
 
@@ -1039,7 +1252,7 @@ free_bufs:
 /* create new thread for control RX path handling */
 static int spawn_ctrl_rx_thread(void)
 {
-	ctrl_rx_thread_handle = hosted_thread_create(ctrl_rx_thread, ctrl_rx_ind);
+	ctrl_rx_thread_handle = hosted_thread_create(ctrl_rx_thread, NULL);
 	if (!ctrl_rx_thread_handle) {
 		command_log("Thread creation failed for ctrl_rx_thread\n");
 		return FAILURE;
@@ -1061,80 +1274,6 @@ static int cancel_ctrl_rx_thread(void)
 
 
 
-/* This function will be only invoked in synchrounous control response path,
- * i.e. if control response callbcak is not available i.e. NULL
- * This function is called after sending synchrounous control request to wait
- * for the response using semaphores and esp_queue
- **/
-static ctrl_cmd_t * get_response(int *read_len, int timeout_sec)
-{
-	void * data = NULL;
-	uint8_t * buf = NULL;
-	esp_queue_elem_t *elem = NULL;
-	int ret = 0;
-
-	/* 1. Any problems in response, return NULL */
-	if (!read_len) {
-		command_log("Invalid input parameter\n");
-		return NULL;
-	}
-
-	/* 2. If timeout not specified, use default */
-	if (!timeout_sec)
-		timeout_sec = DEFAULT_CTRL_RESP_TIMEOUT;
-
-	/* 3. Wait for response */
-	ret = hosted_get_semaphore(read_sem, timeout_sec);
-	if (ret) {
-		if (errno == ETIMEDOUT)
-			command_log("Control response timed out after %u sec\n", timeout_sec);
-		else
-			command_log("ctrl lib error[%u] in sem of timeout[%u]\n", errno, timeout_sec);
-		/* Unlock semaphore in negative case */
-		hosted_post_semaphore(ctrl_req_sem);
-		return NULL;
-	}
-
-	/* 4. Fetch response from `esp_queue` */
-	data = esp_queue_get(ctrl_msg_Q);
-	if (data) {
-		elem = (esp_queue_elem_t*)data;
-		if (!elem)
-			return NULL;
-
-		*read_len = elem->buf_len;
-		buf = elem->buf;
-		mem_free(elem);
-		/* Free queue element and return the rx data */
-		return (ctrl_cmd_t*)buf;
-
-	} else {
-		command_log("Ctrl Q empty or uninitialised\n");
-		return NULL;
-	}
-
-	return NULL;
-}
-
-/* Check and call control response asynchronous callback if available
- * else flag error
- *     MSG_ID_OUT_OF_ORDER - if response id is not understandable
- *     CALLBACK_NOT_REGISTERED - callback is not registered
- **/
-static int call_async_resp_callback(ctrl_cmd_t *app_resp)
-{
-	if ((app_resp->msg_id <= CTRL_RESP_BASE) ||
-	    (app_resp->msg_id >= CTRL_RESP_MAX)) {
-		return MSG_ID_OUT_OF_ORDER;
-	}
-
-	if (ctrl_resp_cb_table[app_resp->msg_id-CTRL_RESP_BASE]) {
-		return ctrl_resp_cb_table[app_resp->msg_id-CTRL_RESP_BASE](app_resp);
-	}
-
-	return CALLBACK_NOT_REGISTERED;
-}
-
 /* Check and call control event asynchronous callback if available
  * else flag error
  *     MSG_ID_OUT_OF_ORDER - if event id is not understandable
@@ -1155,45 +1294,6 @@ static int call_event_callback(ctrl_cmd_t *app_event)
 	return CALLBACK_NOT_REGISTERED;
 }
 
-/* Set asynchronous control response callback from control **request**
- * In case of synchronous request, `resp_cb` will be NULL and table
- * `ctrl_resp_cb_table` will be updated with NULL
- * In case of asynchronous request, valid callback will be cached
- **/
-static int set_async_resp_callback(int req_msg_id, ctrl_resp_cb_t resp_cb)
-{
-	/* Assign(Replace) response callback passed */
-	int exp_resp_msg_id = (req_msg_id - CTRL_REQ_BASE + CTRL_RESP_BASE);
-	if (exp_resp_msg_id >= CTRL_RESP_MAX) {
-		command_log("Not able to map new request to resp id\n");
-		return MSG_ID_OUT_OF_ORDER;
-	} else {
-		ctrl_resp_cb_table[exp_resp_msg_id-CTRL_RESP_BASE] = resp_cb;
-		return CALLBACK_SET_SUCCESS;
-	}
-}
-
-/* Set asynchronous control response callback from control **response**
- * In case of synchronous request, `resp_cb` will be NULL and table
- * `ctrl_resp_cb_table` will be updated with NULL
- * In case of asynchronous request, valid callback will be cached
- **/
-static int is_async_resp_callback_registered_by_resp_msg_id(int resp_msg_id)
-{
-	if ((resp_msg_id <= CTRL_RESP_BASE) || (resp_msg_id >= CTRL_RESP_MAX)) {
-		command_log("resp id[%u] out of range\n", resp_msg_id);
-		return MSG_ID_OUT_OF_ORDER;
-	}
-
-	if (ctrl_resp_cb_table[resp_msg_id-CTRL_RESP_BASE]) {
-		return CALLBACK_AVAILABLE;
-	}
-
-	return CALLBACK_NOT_REGISTERED;
-}
-
-
-
 /* Check if async control response callback is available
  * Returns CALLBACK_AVAILABLE if a non NULL asynchrounous control response
  * callback is available. It will return failure -
@@ -1213,7 +1313,7 @@ int is_async_resp_callback_registered(ctrl_cmd_t *req)
 		return MSG_ID_OUT_OF_ORDER;
 	}
 
-	if (ctrl_resp_cb_table[exp_resp_msg_id-CTRL_RESP_BASE]) {
+	if (req->ctrl_resp_cb) {
 		return CALLBACK_AVAILABLE;
 	}
 
@@ -1267,25 +1367,53 @@ int reset_event_callback(int event)
  **/
 ctrl_cmd_t * ctrl_wait_and_parse_sync_resp(ctrl_cmd_t *app_req)
 {
-	ctrl_cmd_t * rx_buf = NULL;
-	int rx_buf_len = 0;
+	struct ctrl_pending_req *p = NULL;
+	ctrl_cmd_t *rx_buf = NULL;
+	int timeout_sec = 0;
+	int ret = 0;
 
-	//command_log("ctrl_wait_and_parse_sync_resp for msg_id [%d]\n", app_req->msg_id);
+	if (!app_req) {
+		command_log("Invalid request pointer\n");
+		return NULL;
+	}
 
-	rx_buf = get_response(&rx_buf_len, app_req->cmd_timeout_sec);
-	if (!rx_buf || !rx_buf_len) {
-		command_log("Response not received\n");
-		if (rx_buf) {
-			mem_free(rx_buf);
-		}
+	/* If timeout not specified, use default */
+	timeout_sec = app_req->cmd_timeout_sec;
+	if (!timeout_sec)
+		timeout_sec = DEFAULT_CTRL_RESP_TIMEOUT;
+
+	pending_req_table_lock();
+	p = pending_req_get_by_uid(app_req->uid);
+	pending_req_table_unlock();
 
-		/* Response timeout
-		 * Reset the response uid to an invalid value as we no longer
-		 * expect a response until the next request
-		 * If a response arrives after this, it will be flagged
-		 * as an invalid response */
-		expected_resp_uid = -1;
+	if (!p || p->resp_cb) {
+		command_log("No sync request pending for uid[%d]\n", (int)app_req->uid);
+		return NULL;
 	}
+
+	/* Wait for response */
+	ret = hosted_get_semaphore(p->done_sem, timeout_sec);
+	if (ret) {
+		if (errno == ETIMEDOUT)
+			command_log("Control response timed out after %u sec\n", timeout_sec);
+		else
+			command_log("ctrl lib error[%u] in sem of timeout[%u]\n", errno, timeout_sec);
+	}
+
+	pending_req_table_lock();
+	if (p->state == CTRL_PENDING_DONE) {
+		rx_buf = p->resp;
+		/* Response made it in between, drop its post */
+		if (ret)
+			hosted_get_semaphore(p->done_sem, HOSTED_SEM_NON_BLOCKING);
+	}
+	/* A response arriving after this is dropped */
+	pending_req_free(p);
+	pending_req_table_unlock();
+
+	if (!rx_buf)
+		command_log("Response not received\n");
+
 	return rx_buf;
 }
 
@@ -1297,45 +1425,258 @@ ctrl_cmd_t * ctrl_wait_and_parse_sync_resp(ctrl_cmd_t *app_req)
  * */
 static void ctrl_async_timeout_handler(void const *arg)
 {
-	ctrl_resp_cb_t func = arg;
+	int32_t req_uid = (int32_t)(intptr_t)arg;
+	struct ctrl_pending_req *p = NULL;
+	ctrl_resp_cb_t func = NULL;
+	ctrl_cmd_t *app_resp = NULL;
+	void *timer = NULL;
+	int resp_msg_id = 0;
+
+	/* Response may have won the race, nothing to do then */
+	pending_req_table_lock();
+	p = pending_req_get_by_uid(req_uid);
+	if (p && p->state == CTRL_PENDING_WAIT) {
+		func = p->resp_cb;
+		timer = p->timer;
+		resp_msg_id = p->resp_msg_id;
+		/* Response arriving after this is dropped */
+		pending_req_free(p);
+	}
+	pending_req_table_unlock();
+
+	/* timer will be cleaned in hosted_timer_stop */
+	if (timer)
+		hosted_timer_stop(timer);
+
 	if (!func) {
-		command_log("NULL func, failed to call callback\n");
-		hosted_post_semaphore(ctrl_req_sem);
 		return;
 	}
-	ctrl_cmd_t *app_resp = NULL;
+
 	app_resp = (ctrl_cmd_t *)hosted_calloc(1, sizeof(ctrl_cmd_t));
 	if (!app_resp) {
 		command_log("Failed to allocate app_resp\n");
-		hosted_post_semaphore(ctrl_req_sem);
 		return;
 	}
 	app_resp->msg_type = CTRL_RESP;
+	app_resp->msg_id = resp_msg_id;
+	app_resp->uid = req_uid;
 	app_resp->resp_event_status = CTRL_ERR_REQUEST_TIMEOUT;
 
 	/* call func pointer to notify failure */
 	func(app_resp);
+}
 
-	/* only one async timer at a time is handled
-	 * therefore, only one wifi request can be sent at a time
-	 */
-	if (async_timer_handle) {
-		/* async_timer_handle will be cleaned in hosted_timer_stop */
-		hosted_timer_stop(async_timer_handle);
-		async_timer_handle = NULL;
+#ifndef MCU_SYS
+/* Advance timer wheel by `ticks` seconds and notify expired requests */
+static void timer_wheel_expire(uint64_t ticks)
+{
+	int32_t expired[CTRL_MAX_PENDING_REQ];
+	int num_expired = 0;
+	struct ctrl_pending_req *p = NULL;
+	int idx = 0, next = 0;
+	int i = 0;
+
+	pending_req_table_lock();
+	while (ticks-- && timer_wheel_count) {
+		timer_wheel_now++;
+		if (!timer_wheel_now)
+			timer_wheel_now = 1;
+
+		idx = timer_wheel[timer_wheel_now % CTRL_TIMER_WHEEL_SLOTS];
+		while (idx != CTRL_TIMER_WHEEL_NONE) {
+			p = &pending_req[idx];
+			next = p->wheel_next;
+
+			/* Later rounds of wheel stay in slot */
+			if ((int32_t)(p->deadline - timer_wheel_now) <= 0) {
+				expired[num_expired++] = p->uid;
+				timer_wheel_del(p);
+			}
+			idx = next;
+		}
 	}
+	pending_req_table_unlock();
 
-	/* Response timeout
-	 * Reset the response uid to an invalid value as we no longer
-	 * expect a response until the next request
-	 * If a response arrives after this, it will be flagged
-	 * as an invalid response */
-	expected_resp_uid = -1;
+	/* Same as per request timer expiry, outside of lock */
+	for (i = 0; i < num_expired; i++)
+		ctrl_async_timeout_handler((void *)(intptr_t)expired[i]);
+}
+
+/* Let application event loop know new deadline was added */
+static void ctrl_event_loop_wake(void)
+{
+	uint64_t val = 1;
 
-	/* Unlock semaphore in negative case */
-	hosted_post_semaphore(ctrl_req_sem);
+	if (ctrl_wake_fd >= 0 && write(ctrl_wake_fd, &val, sizeof(val)) < 0)
+		command_log("Failed to wake event loop: %d\n", errno);
 }
 
+/* Tick only while async requests are waiting */
+static int ctrl_tick_update(void)
+{
+	struct itimerspec its = {0};
+	int count = 0;
+
+	pending_req_table_lock();
+	count = timer_wheel_count;
+	pending_req_table_unlock();
+
+	if (!!count == ctrl_tick_armed)
+		return SUCCESS;
+
+	if (count) {
+		its.it_value.tv_sec = 1;
+		its.it_interval.tv_sec = 1;
+	}
+
+	if (timerfd_settime(ctrl_tick_fd, 0, &its, NULL)) {
+		command_log("timerfd_settime failed: %d\n", errno);
+		return FAILURE;
+	}
+	ctrl_tick_armed = !!count;
+
+	return SUCCESS;
+}
+
+static int ctrl_event_loop_add_fd(int fd, uint32_t tag)
+{
+	struct epoll_event ev = {0};
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = tag;
+	return epoll_ctl(ctrl_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void ctrl_event_loop_deinit(void)
+{
+	if (ctrl_epoll_fd >= 0)
+		close(ctrl_epoll_fd);
+	if (ctrl_wake_fd >= 0)
+		close(ctrl_wake_fd);
+	if (ctrl_tick_fd >= 0)
+		close(ctrl_tick_fd);
+
+	ctrl_epoll_fd = -1;
+	ctrl_wake_fd = -1;
+	ctrl_tick_fd = -1;
+	ctrl_tick_armed = 0;
+	ctrl_event_loop_mode = 0;
+}
+
+static int ctrl_event_loop_init(void)
+{
+	int serial_fd = transport_pserial_get_fd();
+
+	if (serial_fd < 0 || transport_pserial_set_nonblocking(1)) {
+		command_log("Serial interface not ready for event loop\n");
+		return FAILURE;
+	}
+
+	ctrl_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ctrl_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ctrl_tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ctrl_epoll_fd < 0 || ctrl_wake_fd < 0 || ctrl_tick_fd < 0) {
+		command_log("Failed to create event loop fds: %d\n", errno);
+		goto fail;
+	}
+
+	if (ctrl_event_loop_add_fd(serial_fd, CTRL_EV_SERIAL) ||
+	    ctrl_event_loop_add_fd(ctrl_wake_fd, CTRL_EV_WAKE) ||
+	    ctrl_event_loop_add_fd(ctrl_tick_fd, CTRL_EV_TICK)) {
+		command_log("epoll_ctl failed: %d\n", errno);
+		goto fail;
+	}
+
+	ctrl_event_loop_mode = 1;
+	return SUCCESS;
+
+fail:
+	ctrl_event_loop_deinit();
+	return FAILURE;
+}
+
+/* Read and process all complete messages from serial interface */
+static int ctrl_event_loop_rx(void)
+{
+	uint8_t *buf = NULL;
+	uint32_t buf_len = 0;
+
+	while (1) {
+		buf = transport_pserial_read_nonblocking(&buf_len);
+		if (!buf) {
+			if (errno == EAGAIN || errno == EINTR)
+				return SUCCESS;
+			/* Broken frame is dropped, rest of stream is still usable */
+			if (errno == EBADMSG || errno == ENOMEM)
+				continue;
+			command_log("serial read failed: %d\n", errno);
+			return FAILURE;
+		}
+
+		ctrl_rx_process_buf(buf, buf_len);
+	}
+}
+
+int ctrl_get_event_fd(void)
+{
+	if (!ctrl_event_loop_mode)
+		return FAILURE;
+
+	return ctrl_epoll_fd;
+}
+
+int ctrl_process_events(void)
+{
+	struct epoll_event events[3];
+	uint64_t val = 0;
+	int ret = SUCCESS;
+	int n = 0, i = 0;
+
+	if (!ctrl_event_loop_mode || !is_ctrl_lib_state(CTRL_LIB_STATE_READY)) {
+		command_log("Control lib not initialised in event loop mode\n");
+		return FAILURE;
+	}
+
+	n = epoll_wait(ctrl_epoll_fd, events, 3, 0);
+	if (n < 0) {
+		if (errno == EINTR)
+			return SUCCESS;
+		command_log("epoll_wait failed: %d\n", errno);
+		return FAILURE;
+	}
+
+	for (i = 0; i < n; i++) {
+		switch (events[i].data.u32) {
+		case CTRL_EV_SERIAL:
+			if (ctrl_event_loop_rx())
+				ret = FAILURE;
+			break;
+		case CTRL_EV_WAKE:
+			/* only to re-evaluate tick below */
+			if (read(ctrl_wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+				ret = FAILURE;
+			break;
+		case CTRL_EV_TICK:
+			/* val is number of ticks elapsed */
+			if (read(ctrl_tick_fd, &val, sizeof(val)) == sizeof(val))
+				timer_wheel_expire(val);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (ctrl_tick_update())
+		ret = FAILURE;
+
+	return ret;
+}
+#else
+static void ctrl_event_loop_wake(void)
+{
+}
+#endif
+
 /* This is entry level function when control request APIs are used
  * This function will encode control request in protobuf and send to ESP32
  * It will copy application structure `ctrl_cmd_t` to
@@ -1350,34 +1691,25 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 	uint8_t  *buff_to_free1 = NULL;
 	void     *buff_to_free2 = NULL;
 	uint8_t   failure_status = 0;
-	uint8_t   got_ctrl_req_sem = 0;
+	struct ctrl_pending_req *pending = NULL;
+	void     *timer = NULL;
 
 	if (!app_req) {
 		failure_status = CTRL_ERR_INCORRECT_ARG;
 		command_log("Invalid request pointer\n");
-		goto fail_req;
+		goto fail_req2;
 	}
 
-	/* 1. Check if any ongoing request present
-	 * Send failure in that case */
-	ret = hosted_get_semaphore(ctrl_req_sem, WAIT_TIME_B2B_CTRL_REQ);
-	if (ret) {
+	/* 1. Reserve entry in request table, which also assigns uid.
+	 * Send failure if all entries stay in use */
+	app_req->msg_type = CTRL_REQ;
+	pending = pending_req_alloc(app_req);
+	if (!pending) {
 		failure_status = CTRL_ERR_REQ_IN_PROG;
-		command_log("Request already in progress\n");
+		command_log("%u requests already in progress\n", CTRL_MAX_PENDING_REQ);
 		goto fail_req;
-	} else {
-		got_ctrl_req_sem = 1;
 	}
 
-	app_req->msg_type = CTRL_REQ;
-
-	// handle rollover in uid value (range: 1 to INT32_MAX)
-	if (uid < INT32_MAX)
-		uid++;
-	else
-		uid = 1;
-	app_req->uid = uid;
-
 	/* 2. Protobuf msg init */
 	ctrl_msg__init(&req);
 
@@ -1386,9 +1718,6 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 	req.payload_case = (CtrlMsg__PayloadCase) app_req->msg_id;
 
 	req.uid = app_req->uid;
-	assert(expected_resp_uid == -1);
-	// set the expected response uid
-	expected_resp_uid = req.uid;
 
 	/* 3. identify request and compose CtrlMsg */
 	switch(req.msg_id) {
@@ -1684,35 +2013,36 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 		goto fail_req;
 	}
 
-	/* 6. Assign response callback
-	 * a. If the response callback is not set, this will reset the
-	 *    callback to NULL.
-	 * b. If the non NULL response is assigned, this will set the
-	 *    callback to user defined callback function */
-	ret = set_async_resp_callback(app_req->msg_id, app_req->ctrl_resp_cb);
-	if (ret < 0) {
-		command_log("could not set callback for req[%u]\n",req.msg_id);
-		failure_status = CTRL_ERR_SET_ASYNC_CB;
-		goto fail_req;
-	}
+	/* 6. Response callback, if any, is kept in request table entry */
 
 	/* 7. Start timeout for response for async only
 	 * For sync procedures, hosted_get_semaphore takes care to
-	 * handle timeout situations */
-	if (app_req->ctrl_resp_cb) {
-		async_timer_handle = hosted_timer_start(app_req->cmd_timeout_sec, CTRL__TIMER_ONESHOT,
-				ctrl_async_timeout_handler, app_req->ctrl_resp_cb);
-		if (!async_timer_handle) {
+	 * handle timeout situations.
+	 * Timer is looked up by uid, so its expiry never hits a later request */
+	if (app_req->ctrl_resp_cb && ctrl_event_loop_mode) {
+		pending_req_table_lock();
+		timer_wheel_add(pending, app_req->cmd_timeout_sec ?
+				app_req->cmd_timeout_sec : DEFAULT_CTRL_RESP_TIMEOUT);
+		pending_req_table_unlock();
+		ctrl_event_loop_wake();
+	} else if (app_req->ctrl_resp_cb) {
+		pending_req_table_lock();
+		pending->timer = hosted_timer_start(app_req->cmd_timeout_sec, CTRL__TIMER_ONESHOT,
+				ctrl_async_timeout_handler, (void *)(intptr_t)pending->uid);
+		timer = pending->timer;
+		pending_req_table_unlock();
+		if (!timer) {
 			command_log("Failed to start async resp timer\n");
 			goto fail_req;
 		}
-		/* For async, clearing semaphore on failed cases done on above timer expiry */
-		got_ctrl_req_sem = 0;
 	}
 
 	/* 8. Pack in protobuf and send the request */
 	ctrl_msg__pack(&req, tx_data);
-	if (transport_pserial_send(tx_data, tx_len)) {
+	hosted_get_semaphore(ctrl_tx_lock, HOSTED_SEM_BLOCKING);
+	ret = transport_pserial_send(tx_data, tx_len);
+	hosted_post_semaphore(ctrl_tx_lock);
+	if (ret) {
 		command_log("Send control req[%u] failed\n",req.msg_id);
 		failure_status = CTRL_ERR_TRANSPORT_SEND;
 		goto fail_req;
@@ -1727,12 +2057,27 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 
 fail_req:
 
-	if (got_ctrl_req_sem) {
-		hosted_post_semaphore(ctrl_req_sem);
+	if (pending) {
+		timer = NULL;
+		pending_req_table_lock();
+		/* Timer may have expired and released entry already */
+		if (pending->uid != app_req->uid) {
+			pending = NULL;
+		} else {
+			timer = pending->timer;
+			pending_req_free(pending);
+		}
+		pending_req_table_unlock();
+
+		/* Timeout handler has notified application already */
+		if (!pending)
+			goto fail_req2;
+
+		/* timer will be cleaned in hosted_timer_stop */
+		if (timer)
+			hosted_timer_stop(timer);
 	}
 
-	//TODO: need to test below and possibly remove redundant code
-	// if(!async_timer_handle && app_req->ctrl_resp_cb) {
 	if (app_req->ctrl_resp_cb) {
 		/* 10. In case of async procedure,
 		 * Let application know of failure using callback itself
@@ -1765,6 +2110,7 @@ fail_req2:
 int deinit_hosted_control_lib_internal(void)
 {
 	int ret = SUCCESS;
+	int i = 0;
 
 	if (is_ctrl_lib_state(CTRL_LIB_STATE_INACTIVE)) {
 		return SUCCESS;
@@ -1772,25 +2118,42 @@ int deinit_hosted_control_lib_internal(void)
 
 	set_ctrl_lib_state(CTRL_LIB_STATE_INACTIVE);
 
-	if (ctrl_msg_Q) {
-		esp_queue_destroy(&ctrl_msg_Q);
+#ifndef MCU_SYS
+	ctrl_event_loop_deinit();
+#endif
+
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		if (pending_req[i].timer) {
+			/* timer will be cleaned in hosted_timer_stop */
+			hosted_timer_stop(pending_req[i].timer);
+			pending_req[i].timer = NULL;
+		}
+
+		if (pending_req[i].done_sem &&
+		    hosted_destroy_semaphore(pending_req[i].done_sem)) {
+			ret = FAILURE;
+			command_log("pending req sem deinit failed\n");
+		}
+		memset(&pending_req[i], 0, sizeof(pending_req[i]));
 	}
 
-	if (ctrl_req_sem && hosted_destroy_semaphore(ctrl_req_sem)) {
+	if (pending_req_slots && hosted_destroy_semaphore(pending_req_slots)) {
 		ret = FAILURE;
-		command_log("ctrl req sem deinit failed\n");
+		command_log("pending req slots sem deinit failed\n");
 	}
+	pending_req_slots = NULL;
 
-	if (read_sem && hosted_destroy_semaphore(read_sem)) {
+	if (pending_req_lock && hosted_destroy_semaphore(pending_req_lock)) {
 		ret = FAILURE;
-		command_log("read sem deinit failed\n");
+		command_log("pending req lock deinit failed\n");
 	}
+	pending_req_lock = NULL;
 
-	if (async_timer_handle) {
-		/* async_timer_handle will be cleaned in hosted_timer_stop */
-		hosted_timer_stop(async_timer_handle);
-		async_timer_handle = NULL;
+	if (ctrl_tx_lock && hosted_destroy_semaphore(ctrl_tx_lock)) {
+		ret = FAILURE;
+		command_log("ctrl tx lock deinit failed\n");
 	}
+	ctrl_tx_lock = NULL;
 
 	if (serial_deinit()) {
 		ret = FAILURE;
@@ -1805,39 +2168,56 @@ int deinit_hosted_control_lib_internal(void)
 	return ret;
 }
 
-/* Init hosted control lib */
-int init_hosted_control_lib_internal(void)
+/* Init hosted control lib
+ * event_loop: no rx thread, application drives ctrl_process_events() */
+static int ctrl_lib_init(int event_loop)
 {
 	int ret = SUCCESS;
+	int i = 0;
+
+	/* lets deinit clean up partial init on failure */
+	set_ctrl_lib_state(CTRL_LIB_STATE_INIT);
 
 	/* semaphore init */
-	read_sem = hosted_create_semaphore(1);
-	ctrl_req_sem = hosted_create_semaphore(1);
-	if (!read_sem || !ctrl_req_sem) {
+	pending_req_lock = hosted_create_semaphore(1);
+	pending_req_slots = hosted_create_semaphore(CTRL_MAX_PENDING_REQ);
+	ctrl_tx_lock = hosted_create_semaphore(1);
+	if (!pending_req_lock || !pending_req_slots || !ctrl_tx_lock) {
 		command_log("sem init failed, exiting\n");
 		goto free_bufs;
 	}
 
+	for (i = 0; i < CTRL_MAX_PENDING_REQ; i++) {
+		pending_req[i].done_sem = hosted_create_semaphore(0);
+		if (!pending_req[i].done_sem) {
+			command_log("sem init failed, exiting\n");
+			goto free_bufs;
+		}
+	}
+
+	timer_wheel_init();
+
 	/* serial init */
 	if (serial_init()) {
 		//command_log("Failed to serial_init\n");
 		goto free_bufs;
 	}
 
-	/* queue init */
-	ctrl_msg_Q = create_esp_queue();
-	if (!ctrl_msg_Q) {
-		command_log("Failed to create app ctrl msg Q\n");
+	if (event_loop) {
+#ifndef MCU_SYS
+		/* Application polls fd instead of rx thread */
+		if (ctrl_event_loop_init())
+			goto free_bufs;
+#else
+		command_log("Event loop mode not supported\n");
 		goto free_bufs;
+#endif
+	} else {
+		/* thread init */
+		if (spawn_ctrl_rx_thread())
+			goto free_bufs;
 	}
 
-	/* Get read semaphore for first time */
-	hosted_get_semaphore(read_sem, HOSTED_SEM_BLOCKING);
-
-	/* thread init */
-	if (spawn_ctrl_rx_thread())
-		goto free_bufs;
-
 	/* state init */
 	set_ctrl_lib_state(CTRL_LIB_STATE_READY);
 
@@ -1847,3 +2227,13 @@ free_bufs:
 	deinit_hosted_control_lib_internal();
 	return FAILURE;
 }
+
+int init_hosted_control_lib_internal(void)
+{
+	return ctrl_lib_init(0);
+}
+
+int init_hosted_control_lib_event_loop_internal(void)
+{
+	return ctrl_lib_init(1);
+}
@@ -25,6 +25,8 @@
 #include <linux/interrupt.h>
 #include <linux/netdevice.h>
 #include <linux/inetdevice.h>
+#include <linux/kfifo.h>
+#include <linux/rcupdate.h>
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/hci_core.h>
 #include "esp_kernel_port.h"
@@ -49,7 +51,10 @@ struct esp_adapter;
 #define SKB_DATA_ADDR_ALIGNMENT 4
 #define INTERFACE_HEADER_PADDING (SKB_DATA_ADDR_ALIGNMENT*3)
 
-#define TX_MAX_PENDING_COUNT    100
+/* Netdev TX queues per interface, each staged in its own ring */
+#define ESP_TX_QUEUES           4
+#define ESP_TX_RING_SIZE        64
+#define ESP_TX_RING_SLOTS       (ESP_MAX_INTERFACE * ESP_TX_QUEUES)
 
 enum context_state {
 	ESP_CONTEXT_DISABLED = 0,
@@ -79,6 +84,7 @@ struct module_params {
 	int spi_cs;
 	int spi_handshake;
 	int spi_dataready;
+	int spi_pipeline;
 };
 
 struct esp_adapter {
@@ -108,6 +114,17 @@ struct esp_adapter {
 	struct workqueue_struct *tx_workqueue;
 	struct work_struct      tx_work;
 	struct module_params    mod_param;
+
+	/* Open interfaces whose tx rings transport drains, published under
+	 * RCU. tx_ring_lock serializes open/stop only */
+	struct esp_private __rcu *tx_ring_priv[ESP_MAX_INTERFACE];
+	spinlock_t              tx_ring_lock;
+	u8                      tx_ring_next;
+};
+
+/* Single producer (ndo_start_xmit of one queue), single consumer (transport) */
+struct esp_tx_ring {
+	DECLARE_KFIFO(skbs, struct sk_buff *, ESP_TX_RING_SIZE);
 };
 
 
@@ -120,9 +137,20 @@ struct esp_private {
 	u8                      if_type;
 	u8                      if_num;
 	struct notifier_block   nb;
+	struct napi_struct      napi;
+	struct sk_buff_head     rx_q;
+
+	struct esp_tx_ring      tx_ring[ESP_TX_QUEUES];
+	/* Bumped on esp_stop(), BQL of frames staged before is not completed */
+	u32                     tx_epoch;
 };
 
 struct esp_skb_cb {
 	struct esp_private      *priv;
+	/* Set on staging, for esp_tx_skb_done() */
+	u32                     tx_epoch;
+	u32                     bql_len;
+	/* Set by SPI transport on dequeue, 0 if frame took no tx credit */
+	u32                     tx_credit_seq;
 };
 #endif
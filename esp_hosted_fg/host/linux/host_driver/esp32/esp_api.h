@@ -29,10 +29,14 @@ void esp_process_new_packet_intr(struct esp_adapter *adapter);
 struct esp_adapter * esp_get_adapter(void);
 struct sk_buff * esp_alloc_skb(u32 len);
 int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+int esp_send_packet_list(struct esp_adapter *adapter, struct sk_buff_head *list);
 u8 esp_is_bt_supported_over_sdio(u32 cap);
 int esp_is_tx_queue_paused(void);
-void esp_tx_pause(void);
-void esp_tx_resume(void);
+int esp_tx_running_queue(struct net_device *ndev);
+int esp_tx_stage_skb(struct sk_buff *skb);
+struct sk_buff * esp_tx_dequeue_staged(struct esp_adapter *adapter);
+void esp_tx_skb_done(struct sk_buff *skb);
+bool esp_tx_staged_pending(struct esp_adapter *adapter);
 int process_init_event(u8 *evt_buf, u8 len);
 void process_capabilities(u8 cap);
 void process_test_capabilities(u8 cap);
@@ -27,6 +27,8 @@ struct esp_if_ops {
 	int (*init)(struct esp_adapter *adapter);
 	struct sk_buff* (*read)(struct esp_adapter *adapter);
 	int (*write)(struct esp_adapter *adapter, struct sk_buff *skb);
+	/* optional: write whole list, consumes all skbs */
+	int (*write_list)(struct esp_adapter *adapter, struct sk_buff_head *list);
 	int (*deinit)(struct esp_adapter *adapter);
 };
 
@@ -46,6 +46,30 @@ static inline void ether_addr_copy(u8 *dst, const u8 *src)
 
 
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 16, 0)
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+
+/* Only for iters wrapping one user buffer, as built by esp_serial read/write */
+static inline size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, iov_iter_count(i));
+	if (copy_to_user(i->iov->iov_base + i->iov_offset, addr, bytes))
+		return 0;
+	iov_iter_advance(i, bytes);
+	return bytes;
+}
+
+static inline size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, iov_iter_count(i));
+	if (copy_from_user(addr, i->iov->iov_base + i->iov_offset, bytes))
+		return 0;
+	iov_iter_advance(i, bytes);
+	return bytes;
+}
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 17, 0)
   #define ALLOC_NETDEV(size, name, type, setup) \
     alloc_netdev(size, name, setup)
@@ -105,6 +129,18 @@ static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
     #define netif_rx_ni(skb)    netif_rx(skb)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0))
+    #define napi_complete_done(napi, work_done) napi_complete(napi)
+#endif
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0))
+    #define NETIF_NAPI_ADD(ndev, napi, poll) \
+        netif_napi_add(ndev, napi, poll, NAPI_POLL_WEIGHT)
+#else
+    #define NETIF_NAPI_ADD(ndev, napi, poll) \
+        netif_napi_add(ndev, napi, poll)
+#endif
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0))
 #define do_exit(code)	kthread_complete_and_exit(NULL, code)
 #endif
@@ -119,4 +155,8 @@ static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
 #define spi_alloc_host(x,y) spi_alloc_master(x,y)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0))
+#define skb_free_frag(data) put_page(virt_to_head_page(data))
+#endif
+
 #endif
@@ -10,161 +10,168 @@
 #include <linux/errno.h>
 #include <linux/sched.h>
 #include <linux/types.h>
-#include <linux/slab.h>
-#include <linux/semaphore.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
 #include <linux/uaccess.h>
 
 #include "esp_rb.h"
+#include "esp_kernel_port.h"
 
 int esp_rb_init(esp_rb_t *rb, size_t sz)
 {
 	esp_dbg("%u\n", __LINE__);
 	init_waitqueue_head(&(rb->wq));
 
-	rb->buf = kmalloc(sz, GFP_KERNEL);
+	if (!is_power_of_2(sz) || sz > (1U << 31)) {
+		esp_err("rb size %zu is not power of 2\n", sz);
+		return -EINVAL;
+	}
+
+	/* no need for physically contiguous memory */
+	rb->buf = vmalloc(sz);
 	if (!rb->buf) {
 		esp_err("Failed to allocate memory for rb\n");
 		return -ENOMEM;
 	}
 
-	rb->end = rb->buf + sz;
-	rb->rp = rb->wp = rb->buf;
 	rb->size = sz;
+	rb->head = rb->tail = 0;
+	rb->wr = rb->msg_end = 0;
+	rb->rd_off = 0;
 
-	sema_init(&(rb->sem), 1);
 	esp_verbose("\n");
 	return 0;
 }
 
-int esp_rb_read_by_user(esp_rb_t *rb, const char __user *buf, size_t sz, int block)
+static void rb_put(esp_rb_t *rb, u32 idx, const void *data, u32 len)
 {
-	int read_len = 0, temp_len = 0;
-
-	if (down_interruptible(&rb->sem)) {
-		esp_verbose("%u interrupted by signal\n", __LINE__);
-		return -ERESTARTSYS; /* Signal interruption */
-	}
+	u32 off = idx & (rb->size - 1);
+	u32 first = min(len, rb->size - off);
 
-	while (rb->rp == rb->wp) {
-		up(&rb->sem);
-		if (block == 0) {
-			esp_verbose("%u EAGAIN\n", __LINE__);
-			return -EAGAIN;
-		}
-		if (wait_event_interruptible(rb->wq, (rb->rp != rb->wp))) {
-			esp_verbose("%u Interrupted2 by signal\n", __LINE__);
-			return -ERESTARTSYS; /* Signal interruption */
-		}
-		if (down_interruptible(&rb->sem)) {
-			esp_verbose("%u Interrupted3 by signal\n", __LINE__);
-			return -ERESTARTSYS;
-		}
-	}
-
-	if (rb->wp > rb->rp) {
-		read_len = min(sz, (size_t)(rb->wp - rb->rp));
-	} else {
-		read_len = min(sz, (size_t)(rb->end - rb->rp));
-	}
+	memcpy(rb->buf + off, data, first);
+	if (first < len)
+		memcpy(rb->buf, (const u8 *)data + first, len - first);
+}
 
-	if (copy_to_user((void *)buf, rb->rp, read_len)) {
-		up(&rb->sem);
-		esp_warn("%d: Incomplete/Failed read\n", __LINE__);
-		return -EFAULT;
-	}
+static u32 rb_msg_len(esp_rb_t *rb, u32 idx)
+{
+	u32 off = idx & (rb->size - 1);
+	u32 first = min((u32)ESP_RB_MSG_HDR_LEN, rb->size - off);
+	u32 len = 0;
 
-	rb->rp += read_len;
-	if (rb->rp == rb->end) {
-		rb->rp = rb->buf;
-	}
+	memcpy(&len, rb->buf + off, first);
+	if (first < ESP_RB_MSG_HDR_LEN)
+		memcpy((u8 *)&len + first, rb->buf, ESP_RB_MSG_HDR_LEN - first);
 
-	if (read_len < sz) {
-		temp_len = min(sz-read_len,(size_t)(rb->wp - rb->rp));
-		if (copy_to_user((void *)buf+read_len, rb->rp, temp_len)) {
-			up(&rb->sem);
-			esp_warn("%d: Incomplete/Failed read\n", __LINE__);
-			return -EFAULT;
-		}
-	}
+	return len;
+}
 
-	rb->rp += temp_len;
-	read_len += temp_len;
+static size_t rb_copy_to_iter(esp_rb_t *rb, u32 idx, u32 len, struct iov_iter *to)
+{
+	u32 off = idx & (rb->size - 1);
+	u32 first = min(len, rb->size - off);
+	size_t copied = 0;
 
-	up(&rb->sem);
+	copied = copy_to_iter(rb->buf + off, first, to);
+	if (copied == first && first < len)
+		copied += copy_to_iter(rb->buf, len - first, to);
 
-	return read_len;
+	return copied;
 }
 
-int get_free_space(esp_rb_t *rb)
+/* Reserve space for message of len bytes.
+ * Returns -ENOSPC if consumer has not freed enough space yet */
+int esp_rb_msg_begin(esp_rb_t *rb, size_t len)
 {
-	if (!rb || !rb->rp || !rb->wp) {
-		esp_err("%u Err fault\n", __LINE__);
+	u32 tail = smp_load_acquire(&rb->tail);
+	u32 space = rb->size - (rb->head - tail);
+
+	if (!rb->buf)
 		return -EFAULT;
-	}
-	if (rb->rp == rb->wp) {
-		return rb->size - 1;
-	} else {
-		return ((rb->rp + rb->size - rb->wp) % rb->size) - 1;
-	}
+
+	if (len > space || (space - len) < ESP_RB_MSG_HDR_LEN)
+		return -ENOSPC;
+
+	rb->wr = rb->head + ESP_RB_MSG_HDR_LEN;
+	rb->msg_end = rb->wr + len;
+
+	return 0;
 }
 
-int esp_rb_write_by_kernel(esp_rb_t *rb, const char *buf, size_t sz)
+/* Copy data in message being built, up to space reserved */
+size_t esp_rb_msg_append(esp_rb_t *rb, const void *data, size_t len)
 {
-	int write_len = 0, temp_len = 0;
+	len = min(len, (size_t)(rb->msg_end - rb->wr));
 
-	if (!rb || !rb->wp || !rb->rp) {
-		esp_err("%u rb uninitialized\n", __LINE__);
-		return -EFAULT;
-	}
+	rb_put(rb, rb->wr, data, len);
+	rb->wr += len;
 
-	if (down_interruptible(&rb->sem)) {
-		esp_verbose("%u intr by sig\n", __LINE__);
-		return -ERESTARTSYS;
-	}
+	return len;
+}
 
-	if (get_free_space(rb) <= 0) {
-		up(&rb->sem);
-		esp_err("%d, Ringbuffer full or inaccessible\n", __LINE__);
-		return 0;
-	}
+/* Publish message and wake up reader */
+void esp_rb_msg_commit(esp_rb_t *rb)
+{
+	u32 len = rb->wr - rb->head - ESP_RB_MSG_HDR_LEN;
 
-	sz = min(sz, (size_t)get_free_space(rb));
-	if (rb->wp >= rb->rp) {
-		write_len = min(sz, (size_t)(rb->end - rb->wp));
-	} else {
-		write_len = min(sz, (size_t)(rb->rp - rb->wp - 1));
-	}
+	rb_put(rb, rb->head, &len, ESP_RB_MSG_HDR_LEN);
 
-	memcpy(rb->wp, buf, write_len);
-	rb->wp += write_len;
-	if (rb->wp == rb->end) {
-		rb->wp = rb->buf;
-	}
+	/* message contents visible before new head */
+	smp_store_release(&rb->head, rb->wr);
 
-	if (write_len < sz) {
-		temp_len = (size_t)min(sz-write_len,(size_t)(rb->rp - rb->wp - 1));
-		memcpy(rb->wp, buf+write_len, temp_len);
-	}
+	wake_up_interruptible(&rb->wq);
+}
 
-	rb->wp += temp_len;
-	write_len += temp_len;
+bool esp_rb_empty(esp_rb_t *rb)
+{
+	return smp_load_acquire(&rb->head) == rb->tail;
+}
 
-	if (rb->wp == rb->end) {
-		rb->wp = rb->buf;
-	}
+/* Copy messages to user.
+ * whole_msg: copy rest of one message, -EMSGSIZE if it does not fit.
+ * Otherwise copy as many bytes as fit, message boundaries ignored.
+ * Returns bytes copied, 0 if no message is available */
+ssize_t esp_rb_read_iter(esp_rb_t *rb, struct iov_iter *to, bool whole_msg)
+{
+	u32 head = smp_load_acquire(&rb->head);
+	u32 len = 0, left = 0, n = 0;
+	ssize_t copied = 0;
+	size_t ret = 0;
+
+	while (rb->tail != head && iov_iter_count(to)) {
+		len = rb_msg_len(rb, rb->tail);
+		left = len - rb->rd_off;
+
+		if (whole_msg && iov_iter_count(to) < left)
+			return copied ? copied : -EMSGSIZE;
+
+		n = min_t(size_t, left, iov_iter_count(to));
+		ret = rb_copy_to_iter(rb, rb->tail + ESP_RB_MSG_HDR_LEN + rb->rd_off, n, to);
+		copied += ret;
+		rb->rd_off += ret;
+
+		if (rb->rd_off == len) {
+			rb->rd_off = 0;
+			/* done with message data before producer may reuse it */
+			smp_store_release(&rb->tail, rb->tail + ESP_RB_MSG_HDR_LEN + len);
+		}
 
-	up(&rb->sem);
+		if (ret != n)
+			return copied ? copied : -EFAULT;
 
-	wake_up_interruptible(&rb->wq);
+		if (whole_msg)
+			break;
+	}
 
-	return write_len;
+	return copied;
 }
 
 void esp_rb_cleanup(esp_rb_t *rb)
 {
-	kfree(rb->buf);
-	rb->buf = rb->end = rb->rp = rb->wp = NULL;
+	vfree(rb->buf);
+	rb->buf = NULL;
 	rb->size = 0;
+	rb->head = rb->tail = rb->wr = rb->msg_end = rb->rd_off = 0;
 	esp_verbose("\n");
 	return;
 }
@@ -8,18 +8,37 @@
 #ifndef _ESP_RB_H_
 #define _ESP_RB_H_
 
+#include <linux/uio.h>
+
+/* Length stored ahead of every message */
+#define ESP_RB_MSG_HDR_LEN	sizeof(u32)
+
+/* Single producer, single consumer ring of messages.
+ * Producer (rx path) builds message in place and publishes it with
+ * esp_rb_msg_commit(), so consumer only ever sees complete messages.
+ * head and tail are free running indices, masked with (size - 1).
+ * Consumer calls must be serialized by caller. */
 typedef struct esp_rb {
-	wait_queue_head_t wq;		/* waitqueue to wait for data */
-	unsigned char *buf, *end;	/* actual queue start and end */
-	size_t size;
-	unsigned char *rp, *wp;		/* current read/write pointers */
-	struct semaphore sem;		/* Mutex to protect rb */
+	wait_queue_head_t wq;		/* waitqueue to wait for messages */
+	unsigned char *buf;
+	u32 size;			/* power of 2 */
+	u32 head;			/* end of published messages, producer */
+	u32 tail;			/* start of unread messages, consumer */
+	u32 wr;				/* producer: write index in message being built */
+	u32 msg_end;			/* producer: end of reserved space */
+	u32 rd_off;			/* consumer: bytes already read of message at tail */
 } esp_rb_t;
 
 int esp_rb_init(esp_rb_t *rb, size_t sz);
 void esp_rb_cleanup(esp_rb_t *rb);
-int esp_rb_read_by_user(esp_rb_t *rb, const char __user *buf, size_t sz, int block);
-int esp_rb_write_by_kernel(esp_rb_t *rb, const char *buf, size_t sz);
-int get_free_space(esp_rb_t *rb);
+
+/* producer */
+int esp_rb_msg_begin(esp_rb_t *rb, size_t len);
+size_t esp_rb_msg_append(esp_rb_t *rb, const void *data, size_t len);
+void esp_rb_msg_commit(esp_rb_t *rb);
+
+/* consumer */
+bool esp_rb_empty(esp_rb_t *rb);
+ssize_t esp_rb_read_iter(esp_rb_t *rb, struct iov_iter *to, bool whole_msg);
 
 #endif
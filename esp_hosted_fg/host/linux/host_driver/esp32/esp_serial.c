@@ -28,6 +28,10 @@
 #include <linux/kthread.h>
 #include <linux/delay.h>
 #include <linux/slab.h>
+#include <linux/version.h>
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 16, 0))
+#include <linux/aio.h>
+#endif
 
 #include "esp.h"
 #include "esp_rb.h"
@@ -36,9 +40,16 @@
 
 #define ESP_SERIAL_MAJOR      221
 #define ESP_SERIAL_MINOR_MAX  1
-#define ESP_RX_RB_SIZE        4096
+/* Power of 2, large enough to hold biggest frame */
+#define ESP_RX_RB_SIZE        (128 * 1024)
 #define ESP_SERIAL_MAX_TX     4096
 
+/* protocomm_pserial frame: type | len | endpoint | type | len | data */
+#define ESP_SERIAL_TLV_T_EPNAME     0x01
+#define ESP_SERIAL_TLV_T_DATA       0x02
+#define ESP_SERIAL_TLV_HDR_LEN(ep)  (1 + 2 + (ep) + 1 + 2)
+#define ESP_SERIAL_TLV_HDR_MAX      ESP_SERIAL_TLV_HDR_LEN(ESP_SERIAL_MSG_EPNAME_MAX)
+
 static struct esp_serial_devs {
 	struct device* dev;
 	struct cdev cdev;
@@ -46,15 +57,31 @@ static struct esp_serial_devs {
 	esp_rb_t rb;
 	void *priv;
 	struct mutex lock;
+	u8 msg_mode;
+
+	/* Serializes writers, so fragments of one write stay together */
+	struct mutex tx_lock;
+	u16 tx_seq_num;
+
+	/* rx path: TLV frame being assembled in rb */
+	u8 rx_hdr[ESP_SERIAL_TLV_HDR_MAX];
+	u16 rx_hdr_len;
+	u16 rx_hdr_need;
+	u32 rx_left;
+	u8 rx_in_frame;
+	u8 rx_drop;
 } devs[ESP_SERIAL_MINOR_MAX];
 
 static uint8_t serial_init_done;
 static atomic_t ref_count_open;
 
-static ssize_t esp_serial_read(struct file *file, char __user *user_buffer, size_t size, loff_t *offset)
+/* Every read returns whole messages in message mode,
+ * else message boundaries are ignored, like a byte stream */
+static ssize_t esp_serial_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
+	struct file *file = iocb->ki_filp;
 	struct esp_serial_devs *dev = NULL;
-	int ret_size = 0;
+	ssize_t ret = 0;
 	dev = (struct esp_serial_devs *) file->private_data;
 
 	/* Check if slave connection is still active */
@@ -63,35 +90,54 @@ static ssize_t esp_serial_read(struct file *file, char __user *user_buffer, size
 		return -ENODEV;
 	}
 
-	ret_size = esp_rb_read_by_user(&dev->rb, user_buffer, size, !(file->f_flags & O_NONBLOCK));
-	if (ret_size == 0) {
-		esp_verbose("%u err: EAGAIN\n", __LINE__);
-		return -EAGAIN;
+	if (!iov_iter_count(to))
+		return 0;
+
+	while (1) {
+		mutex_lock(&dev->lock);
+		ret = esp_rb_read_iter(&dev->rb, to, dev->msg_mode);
+		mutex_unlock(&dev->lock);
+
+		if (ret)
+			return ret;
+
+		if (file->f_flags & O_NONBLOCK) {
+			esp_verbose("%u err: EAGAIN\n", __LINE__);
+			return -EAGAIN;
+		}
+
+		if (wait_event_interruptible(dev->rb.wq, !esp_rb_empty(&dev->rb))) {
+			esp_verbose("%u interrupted by signal\n", __LINE__);
+			return -ERESTARTSYS;
+		}
 	}
-	return ret_size;
 }
 
-static ssize_t esp_serial_write(struct file *file, const char __user *user_buffer, size_t size, loff_t * offset)
+/* Fragments are built up front and handed to transport as one batch */
+static ssize_t esp_serial_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
 	struct esp_payload_header *hdr = NULL;
 	u8 *tx_buf = NULL;
 	struct esp_serial_devs *dev = NULL;
 	struct sk_buff *tx_skb = NULL;
-	int ret = 0;
+	struct sk_buff_head frags;
+	size_t size = iov_iter_count(from);
 	size_t total_len = 0;
 	size_t frag_len = 0;
 	u32 left_len = size;
-	static u16 seq_num = 0;
+	ssize_t ret = 0;
+	u16 seq_num = 0;
 	u8 flag = 0;
-	u8 *pos;
 
 	if (size > ESP_SERIAL_MAX_TX) {
 		esp_err("Exceed max tx buffer size [%zu]\n", size);
 		return 0;
 	}
 
-	seq_num++;
-	dev = (struct esp_serial_devs *) file->private_data;
+	if (!size)
+		return 0;
+
+	dev = (struct esp_serial_devs *) iocb->ki_filp->private_data;
 
 	/* Check if slave connection is still active */
 	if (!dev || !dev->priv) {
@@ -99,7 +145,10 @@ static ssize_t esp_serial_write(struct file *file, const char __user *user_buffe
 		return -ENODEV;
 	}
 
-	pos = (u8 *) user_buffer;
+	__skb_queue_head_init(&frags);
+
+	mutex_lock(&dev->tx_lock);
+	seq_num = ++dev->tx_seq_num;
 
 	do {
 		if (atomic_read(&((struct esp_adapter *)dev->priv)->state) < ESP_CONTEXT_READY) {
@@ -107,7 +156,8 @@ static ssize_t esp_serial_write(struct file *file, const char __user *user_buffe
 			if (atomic_read(&ref_count_open)) {
 				atomic_dec(&ref_count_open);
 			}
-			return -ENODEV;
+			ret = -ENODEV;
+			goto purge;
 		}
 
 		/* Fragmentation support
@@ -127,7 +177,8 @@ static ssize_t esp_serial_write(struct file *file, const char __user *user_buffe
 		tx_skb = esp_alloc_skb(total_len);
 		if (!tx_skb) {
 			esp_err("SKB alloc failed\n");
-			return (size - left_len);
+			ret = -ENOMEM;
+			goto purge;
 		}
 
 		tx_buf = skb_put(tx_skb, total_len);
@@ -143,29 +194,48 @@ static ssize_t esp_serial_write(struct file *file, const char __user *user_buffe
 		hdr->offset = cpu_to_le16(sizeof(struct esp_payload_header));
 		hdr->flags |= flag;
 
-		ret = copy_from_user(tx_buf + hdr->offset, pos, frag_len);
-		if (ret) {
+		if (copy_from_iter(tx_buf + sizeof(struct esp_payload_header),
+					frag_len, from) != frag_len) {
 			dev_kfree_skb(tx_skb);
 			esp_err("Error copying buffer to send serial data\n");
-			return (size - left_len);
-		}
-		esp_hex_dump_dbg("esp_serial_tx: ", pos, frag_len);
-
-		ret = esp_send_packet(dev->priv, tx_skb);
-		if (ret) {
-			esp_err("Failed to transmit data, error %d\n", ret);
-			return (size - left_len);
+			ret = -EFAULT;
+			goto purge;
 		}
+		esp_hex_dump_dbg("esp_serial_tx: ",
+				tx_buf + sizeof(struct esp_payload_header), frag_len);
 
+		__skb_queue_tail(&frags, tx_skb);
 		left_len -= frag_len;
-		pos += frag_len;
 	} while(left_len);
 
+	ret = esp_send_packet_list(dev->priv, &frags);
+	mutex_unlock(&dev->tx_lock);
+
+	if (ret) {
+		esp_err("Failed to transmit data, error %zd\n", ret);
+		return ret;
+	}
+
 	return size;
+
+purge:
+	__skb_queue_purge(&frags);
+	mutex_unlock(&dev->tx_lock);
+	return ret;
 }
 
 static long esp_serial_ioctl (struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct esp_serial_devs *dev = (struct esp_serial_devs *) file->private_data;
+
+	if (cmd == ESP_SERIAL_IOCTL_MSG_MODE) {
+		mutex_lock(&dev->lock);
+		dev->msg_mode = !!arg;
+		mutex_unlock(&dev->lock);
+		esp_verbose("message mode %s\n", dev->msg_mode ? "on" : "off");
+		return dev->msg_mode;
+	}
+
 	esp_info("IOCTL unsupported %u\n", cmd);
 	return 0;
 }
@@ -184,6 +254,7 @@ static int esp_serial_open(struct inode *inode, struct file *file)
 
 	devs = container_of(inode->i_cdev, struct esp_serial_devs, cdev);
 	file->private_data = devs;
+	devs->msg_mode = 0;
 
 	atomic_inc(&ref_count_open);
 
@@ -209,54 +280,161 @@ static unsigned int esp_serial_poll(struct file *file, poll_table *wait)
     mutex_lock(&dev->lock);
     poll_wait(file, &dev->rb.wq,  wait);
 
-    if (dev->rb.rp != dev->rb.wp) {
+    /* rb only holds complete messages */
+    if (!esp_rb_empty(&dev->rb)) {
         mask |= (POLLIN | POLLRDNORM) ;   /* readable */
     }
-    if (get_free_space(&dev->rb)) {
-        mask |= (POLLOUT | POLLWRNORM) ;  /* writable */
-    }
+    /* writes go straight to transport */
+    mask |= (POLLOUT | POLLWRNORM) ;      /* writable */
 
     mutex_unlock(&dev->lock);
     return mask;
 }
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 16, 0))
+/* No read_iter/write_iter before 3.16, user buffer goes in a one segment iter */
+static ssize_t esp_serial_read(struct file *file, char __user *user_buffer,
+		size_t size, loff_t *offset)
+{
+	struct iovec iov = { .iov_base = user_buffer, .iov_len = size };
+	struct iov_iter iter;
+	struct kiocb kiocb;
+
+	init_sync_kiocb(&kiocb, file);
+	iov_iter_init(&iter, &iov, 1, size, 0);
+
+	return esp_serial_read_iter(&kiocb, &iter);
+}
+
+static ssize_t esp_serial_write(struct file *file, const char __user *user_buffer,
+		size_t size, loff_t *offset)
+{
+	struct iovec iov = { .iov_base = (void __user *) user_buffer, .iov_len = size };
+	struct iov_iter iter;
+	struct kiocb kiocb;
+
+	init_sync_kiocb(&kiocb, file);
+	iov_iter_init(&iter, &iov, 1, size, 0);
+
+	return esp_serial_write_iter(&kiocb, &iter);
+}
+#endif
+
 const struct file_operations esp_serial_fops = {
 	.owner = THIS_MODULE,
 	.open = esp_serial_open,
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0))
+	.read_iter = esp_serial_read_iter,
+	.write_iter = esp_serial_write_iter,
+#else
 	.read = esp_serial_read,
 	.write = esp_serial_write,
+#endif
 	.unlocked_ioctl = esp_serial_ioctl,
 	.poll = esp_serial_poll,
 	.release = esp_serial_release,
 };
 
+static void esp_serial_rx_reset(struct esp_serial_devs *dev)
+{
+	dev->rx_hdr_len = 0;
+	dev->rx_hdr_need = 3;
+	dev->rx_left = 0;
+	dev->rx_in_frame = 0;
+	dev->rx_drop = 0;
+}
+
+/* TLV header of next frame is complete, reserve room for whole frame */
+static void esp_serial_rx_frame_start(struct esp_serial_devs *dev)
+{
+	u16 hdr_len = dev->rx_hdr_len;
+	u32 frame_len = hdr_len + (dev->rx_hdr[hdr_len - 2] | (dev->rx_hdr[hdr_len - 1] << 8));
+
+	dev->rx_in_frame = 1;
+	dev->rx_left = frame_len - hdr_len;
+
+	if (!atomic_read(&ref_count_open)) {
+		esp_verbose("no user app listening: dropping packet\n");
+		dev->rx_drop = 1;
+	} else if (esp_rb_msg_begin(&dev->rb, frame_len)) {
+		esp_err("RB full, no space to receive. Dropping packet\n");
+		dev->rx_drop = 1;
+	} else {
+		esp_rb_msg_append(&dev->rb, dev->rx_hdr, hdr_len);
+	}
+}
+
+/* Collect TLV header, which may be split over fragments.
+ * Returns bytes consumed, or -EBADMSG */
+static int esp_serial_rx_hdr(struct esp_serial_devs *dev, const char *data, size_t len)
+{
+	size_t n = min(len, (size_t)(dev->rx_hdr_need - dev->rx_hdr_len));
+	u16 ep_len = 0;
+
+	memcpy(dev->rx_hdr + dev->rx_hdr_len, data, n);
+	dev->rx_hdr_len += n;
+
+	if (dev->rx_hdr_len < dev->rx_hdr_need)
+		return n;
+
+	if (dev->rx_hdr_need == 3) {
+		ep_len = dev->rx_hdr[1] | (dev->rx_hdr[2] << 8);
+		if (dev->rx_hdr[0] != ESP_SERIAL_TLV_T_EPNAME ||
+		    ep_len > ESP_SERIAL_MSG_EPNAME_MAX)
+			return -EBADMSG;
+
+		dev->rx_hdr_need = ESP_SERIAL_TLV_HDR_LEN(ep_len);
+		return n;
+	}
+
+	if (dev->rx_hdr[dev->rx_hdr_len - 3] != ESP_SERIAL_TLV_T_DATA)
+		return -EBADMSG;
+
+	esp_serial_rx_frame_start(dev);
+	return n;
+}
+
+/* Serial data from ESP is split in TLV frames here,
+ * each frame is published in rb as one message once complete */
 int esp_serial_data_received(int dev_index, const char *data, size_t len)
 {
-	int ret = 0, ret_len = 0;
+	struct esp_serial_devs *dev = NULL;
+	size_t ret_len = 0;
+	size_t n = 0;
+	int ret = 0;
+
 	if (dev_index >= ESP_SERIAL_MINOR_MAX) {
 		esp_err("%u ERR: serial_dev_idx[%d] >= minor_max[%d]\n",
 				__LINE__, dev_index, ESP_SERIAL_MINOR_MAX);
 		return -EINVAL;
 	}
 
-	if (!atomic_read(&ref_count_open)) {
-		esp_verbose("no user app listening: dropping packet\n");
-		return len;
-	}
+	dev = &devs[dev_index];
 
 	while (ret_len != len) {
-		ret = esp_rb_write_by_kernel(&devs[dev_index].rb,
-				data+ret_len, (len-ret_len));
-		if (ret <= 0) {
-			break;
+		if (!dev->rx_in_frame) {
+			ret = esp_serial_rx_hdr(dev, data + ret_len, len - ret_len);
+			if (ret < 0) {
+				/* frames start with packets, resync on next one */
+				esp_warn("malformed serial data, dropping %zu bytes\n",
+						len - ret_len);
+				esp_serial_rx_reset(dev);
+				return len;
+			}
+			ret_len += ret;
+		} else {
+			n = min(len - ret_len, (size_t)dev->rx_left);
+			if (!dev->rx_drop)
+				esp_rb_msg_append(&dev->rb, data + ret_len, n);
+			dev->rx_left -= n;
+			ret_len += n;
+		}
+
+		if (dev->rx_in_frame && !dev->rx_left) {
+			if (!dev->rx_drop)
+				esp_rb_msg_commit(&dev->rb);
+			esp_serial_rx_reset(dev);
 		}
-		ret_len += ret;
-	}
-	if (ret <= 0) {
-		return ret;
-	}
-	if (ret_len != len) {
-		esp_err("RB full, no space to receive. Dropping packet\n");
 	}
 
 	return ret_len;
@@ -278,6 +456,9 @@ int esp_serial_init(void *priv)
 	if (serial_init_done)
 		return 0;
 
+	BUILD_BUG_ON_NOT_POWER_OF_2(ESP_RX_RB_SIZE);
+	BUILD_BUG_ON(ESP_RX_RB_SIZE < ESP_SERIAL_MSG_MAX_LEN + ESP_RB_MSG_HDR_LEN);
+
 	err = alloc_chrdev_region(&dev_first, 0, ESP_SERIAL_MINOR_MAX, "esp_serial_driver");
 	if (err) {
 		esp_err("Error alloc chrdev region %d\n", err);
@@ -300,6 +481,8 @@ int esp_serial_init(void *priv)
 		esp_rb_init(&devs[i].rb, ESP_RX_RB_SIZE);
 		devs[i].priv = priv;
 		mutex_init(&devs[i].lock);
+		mutex_init(&devs[i].tx_lock);
+		esp_serial_rx_reset(&devs[i]);
 	}
 
 	serial_init_done = 1;
@@ -327,6 +510,7 @@ void esp_serial_cleanup(void)
 
 		esp_rb_cleanup(&devs[i].rb);
 		mutex_destroy(&devs[i].lock);
+		mutex_destroy(&devs[i].tx_lock);
 	}
 
 	class_destroy(cl);
@@ -59,8 +59,11 @@ static int raw_tp_tx_process(void *data)
 	struct sk_buff *tx_skb = NULL;
 	struct esp_payload_header *payload_header = NULL;
 	struct esp_adapter *adapter = esp_get_adapter();
+	struct netdev_queue *txq = NULL;
+	struct esp_skb_cb *cb = NULL;
 	u8 pad_len = 0;
 	u16 total_len = 0;
+	int queue = 0;
 
 	pad_len = sizeof(struct esp_payload_header);
 	total_len = TEST_RAW_TP__BUF_SIZE + pad_len;
@@ -89,7 +92,21 @@ static int raw_tp_tx_process(void *data)
 			payload_header->len = cpu_to_le16(TEST_RAW_TP__BUF_SIZE);
 			payload_header->offset = cpu_to_le16(pad_len);
 
-			ret = esp_send_packet(esp_get_adapter(), tx_skb);
+			if (!adapter->priv[0] || !adapter->priv[0]->ndev ||
+			    (queue = esp_tx_running_queue(adapter->priv[0]->ndev)) < 0) {
+				dev_kfree_skb(tx_skb);
+				msleep(10);
+				continue;
+			}
+
+			/* Shares staging ring of a running tx queue with xmit path */
+			cb = (struct esp_skb_cb *) tx_skb->cb;
+			cb->priv = adapter->priv[0];
+			skb_set_queue_mapping(tx_skb, queue);
+			txq = netdev_get_tx_queue(cb->priv->ndev, queue);
+			__netif_tx_lock_bh(txq);
+			ret = esp_send_packet(adapter, tx_skb);
+			__netif_tx_unlock_bh(txq);
 			if(!ret)
 				test_raw_tp_len += TEST_RAW_TP__BUF_SIZE;
 
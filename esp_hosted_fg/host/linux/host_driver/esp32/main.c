@@ -45,6 +45,7 @@ static int spi_cs = MOD_PARAM_UNINITIALISED;
 static int spi_mode = MOD_PARAM_UNINITIALISED; /* 1/2/3 */
 static int spi_handshake = MOD_PARAM_UNINITIALISED;
 static int spi_dataready = MOD_PARAM_UNINITIALISED;
+static int spi_pipeline = 0;
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Amey Inamdar <amey.inamdar@espressif.com>");
@@ -74,6 +75,9 @@ MODULE_PARM_DESC(spi_handshake, "SPI: Handshake GPIO number");
 module_param(spi_dataready, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(spi_dataready, "SPI: Data Ready GPIO number");
 
+module_param(spi_pipeline, int, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_pipeline, "SPI: 1 to submit transfers asynchronously, overlapping rx processing with next transfer");
+
 struct esp_adapter adapter;
 volatile u8 stop_data = 0;
 
@@ -129,6 +133,266 @@ struct esp_adapter * esp_get_adapter(void)
 	return &adapter;
 }
 
+/* Hand frames queued by rx work to the stack, within NAPI budget */
+static int esp_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct esp_private *priv = container_of(napi, struct esp_private, napi);
+	struct sk_buff *skb = NULL;
+	int work_done = 0;
+
+	while (work_done < budget) {
+		skb = skb_dequeue(&priv->rx_q);
+		if (!skb)
+			break;
+
+		priv->stats.rx_bytes += skb->len;
+		priv->stats.rx_packets++;
+		napi_gro_receive(napi, skb);
+		work_done++;
+	}
+
+	if (work_done < budget) {
+		napi_complete_done(napi, work_done);
+
+		/* Frame may have been queued while completing */
+		if (!skb_queue_empty(&priv->rx_q))
+			napi_schedule(napi);
+	}
+
+	return work_done;
+}
+
+static void esp_netdev_rx(struct esp_private *priv, struct sk_buff *skb)
+{
+	if (!netif_running(priv->ndev)) {
+		priv->stats.rx_dropped++;
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	skb_queue_tail(&priv->rx_q, skb);
+
+	/* Called from process context, let softirq run poll on bh enable */
+	local_bh_disable();
+	napi_schedule(&priv->napi);
+	local_bh_enable();
+}
+
+/*
+ * Netdev frames are staged per tx queue in a lockless kfifo: xmit on a queue
+ * is already serialized by the stack and transport thread is the only reader.
+ * Open interfaces are published to the reader under RCU, so neither side
+ * takes a lock per frame. BQL covers a frame from staging till transport is
+ * done with it and calls esp_tx_skb_done().
+ */
+int esp_tx_stage_skb(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	struct esp_private *priv = cb->priv;
+	struct netdev_queue *txq = NULL;
+	struct esp_tx_ring *ring = NULL;
+	u16 queue = skb_get_queue_mapping(skb);
+
+	if (!priv || !priv->ndev || queue >= priv->ndev->real_num_tx_queues)
+		return -EINVAL;
+
+	if (!netif_running(priv->ndev))
+		return -ENETDOWN;
+
+	txq = netdev_get_tx_queue(priv->ndev, queue);
+	ring = &priv->tx_ring[queue];
+
+	if (kfifo_is_full(&ring->skbs)) {
+		netif_tx_stop_queue(txq);
+		return -EBUSY;
+	}
+
+	cb->tx_epoch = READ_ONCE(priv->tx_epoch);
+	cb->bql_len = skb->len;
+
+	/* Account before publishing, consumer may complete it right away */
+	netdev_tx_sent_queue(txq, skb->len);
+	kfifo_put(&ring->skbs, skb);
+
+	if (kfifo_is_full(&ring->skbs)) {
+		netif_tx_stop_queue(txq);
+
+		/* Pairs with barrier in esp_tx_dequeue_staged() */
+		smp_mb();
+		if (!kfifo_is_full(&ring->skbs))
+			netif_tx_start_queue(txq);
+	}
+
+	return 0;
+}
+
+/* Next staged frame, rings of open interfaces drained round robin */
+struct sk_buff * esp_tx_dequeue_staged(struct esp_adapter *adapter)
+{
+	struct esp_private *priv = NULL;
+	struct esp_tx_ring *ring = NULL;
+	struct netdev_queue *txq = NULL;
+	struct sk_buff *skb = NULL;
+	u8 idx = 0, slot = 0;
+	u16 queue = 0;
+
+	rcu_read_lock();
+
+	for (idx = 0; idx < ESP_TX_RING_SLOTS; idx++) {
+		slot = (adapter->tx_ring_next + idx) % ESP_TX_RING_SLOTS;
+		priv = rcu_dereference(adapter->tx_ring_priv[slot / ESP_TX_QUEUES]);
+		queue = slot % ESP_TX_QUEUES;
+
+		if (!priv || queue >= priv->ndev->real_num_tx_queues)
+			continue;
+
+		ring = &priv->tx_ring[queue];
+		if (kfifo_get(&ring->skbs, &skb)) {
+			adapter->tx_ring_next = (slot + 1) % ESP_TX_RING_SLOTS;
+			break;
+		}
+	}
+
+	if (skb) {
+		txq = netdev_get_tx_queue(priv->ndev, queue);
+
+		/* Pairs with barrier in esp_tx_stage_skb() */
+		smp_mb();
+		if (netif_tx_queue_stopped(txq) && !kfifo_is_full(&ring->skbs))
+			netif_tx_wake_queue(txq);
+#if TEST_RAW_TP
+		if (!netif_xmit_stopped(txq))
+			esp_raw_tp_queue_resume();
+#endif
+	}
+
+	rcu_read_unlock();
+
+	return skb;
+}
+
+/*
+ * Transport is done with a frame from esp_tx_dequeue_staged(), sent or
+ * dropped. Completes it in BQL, unless its queue was reset since staging.
+ * Called from transport thread only, like dequeue.
+ */
+void esp_tx_skb_done(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	struct esp_private *priv = cb->priv;
+
+	rcu_read_lock();
+
+	/* esp_tx_rings_stop() waits for this section before resetting queues */
+	if (priv && READ_ONCE(priv->tx_epoch) == cb->tx_epoch)
+		netdev_tx_completed_queue(netdev_get_tx_queue(priv->ndev,
+					skb_get_queue_mapping(skb)), 1, cb->bql_len);
+
+	rcu_read_unlock();
+}
+
+bool esp_tx_staged_pending(struct esp_adapter *adapter)
+{
+	struct esp_private *priv = NULL;
+	bool pending = false;
+	u8 i = 0, queue = 0;
+
+	rcu_read_lock();
+
+	for (i = 0; i < ESP_MAX_INTERFACE && !pending; i++) {
+		priv = rcu_dereference(adapter->tx_ring_priv[i]);
+		if (!priv)
+			continue;
+
+		for (queue = 0; queue < priv->ndev->real_num_tx_queues; queue++) {
+			if (!kfifo_is_empty(&priv->tx_ring[queue].skbs)) {
+				pending = true;
+				break;
+			}
+		}
+	}
+
+	rcu_read_unlock();
+
+	return pending;
+}
+
+static void esp_tx_rings_start(struct esp_private *priv)
+{
+	struct esp_adapter *adapter = priv->adapter;
+	u8 i = 0;
+
+	spin_lock_bh(&adapter->tx_ring_lock);
+
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		if (!rcu_access_pointer(adapter->tx_ring_priv[i])) {
+			rcu_assign_pointer(adapter->tx_ring_priv[i], priv);
+			break;
+		}
+	}
+
+	spin_unlock_bh(&adapter->tx_ring_lock);
+
+	netif_tx_start_all_queues(priv->ndev);
+}
+
+static void esp_tx_rings_stop(struct esp_private *priv)
+{
+	struct esp_adapter *adapter = priv->adapter;
+	struct sk_buff *skb = NULL;
+	u8 i = 0, queue = 0;
+
+	spin_lock_bh(&adapter->tx_ring_lock);
+
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		if (rcu_access_pointer(adapter->tx_ring_priv[i]) == priv)
+			RCU_INIT_POINTER(adapter->tx_ring_priv[i], NULL);
+	}
+
+	spin_unlock_bh(&adapter->tx_ring_lock);
+
+	/* Frames still with transport must not complete into reset queues */
+	WRITE_ONCE(priv->tx_epoch, priv->tx_epoch + 1);
+
+	/* Transport is out of the rings and esp_tx_skb_done() after this */
+	synchronize_rcu();
+
+	/* Stack has quiesced xmit by now, so rings have no producer either */
+	for (queue = 0; queue < priv->ndev->real_num_tx_queues; queue++) {
+		while (kfifo_get(&priv->tx_ring[queue].skbs, &skb)) {
+			priv->stats.tx_dropped++;
+			dev_kfree_skb_any(skb);
+		}
+		netdev_tx_reset_queue(netdev_get_tx_queue(priv->ndev, queue));
+	}
+}
+
+#if defined(CONFIG_XPS) && (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0))
+/* Spread CPUs over tx queues, so each core mostly feeds a ring of its own */
+static void esp_tx_set_xps(struct net_device *ndev)
+{
+	cpumask_var_t mask;
+	unsigned int cpu;
+	u16 queue = 0;
+
+	if (ndev->real_num_tx_queues < 2 || !zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	for (queue = 0; queue < ndev->real_num_tx_queues; queue++) {
+		cpumask_clear(mask);
+		for_each_online_cpu(cpu) {
+			if (cpu % ndev->real_num_tx_queues == queue)
+				cpumask_set_cpu(cpu, mask);
+		}
+		netif_set_xps_queue(ndev, mask, queue);
+	}
+
+	free_cpumask_var(mask);
+}
+#else
+static inline void esp_tx_set_xps(struct net_device *ndev) { }
+#endif
+
 static int esp_open(struct net_device *ndev)
 {
 	struct esp_private *priv = netdev_priv(ndev);
@@ -139,14 +403,28 @@ static int esp_open(struct net_device *ndev)
 	/* Reset stats */
 	memset(&priv->stats, 0, sizeof(priv->stats));
 
+	skb_queue_purge(&priv->rx_q);
+	napi_enable(&priv->napi);
+
+	esp_tx_set_xps(ndev);
+	esp_tx_rings_start(priv);
+
 	return 0;
 }
 
 static int esp_stop(struct net_device *ndev)
 {
+	struct esp_private *priv = NULL;
+
 	if (!ndev)
 		return -EINVAL;
 
+	priv = netdev_priv(ndev);
+
+	napi_disable(&priv->napi);
+	skb_queue_purge(&priv->rx_q);
+	esp_tx_rings_stop(priv);
+
 	return 0;
 }
 
@@ -298,11 +576,6 @@ static int process_tx_packet (struct sk_buff *skb)
 
 	priv = cb->priv;
 
-	if (netif_queue_stopped((const struct net_device *) adapter.priv[0]->ndev) ||
-	    netif_queue_stopped((const struct net_device *) adapter.priv[1]->ndev)) {
-		return NETDEV_TX_BUSY;
-	}
-
 	if (is_host_sleeping()) {
 		return NETDEV_TX_BUSY;
 	}
@@ -342,9 +615,11 @@ static int process_tx_packet (struct sk_buff *skb)
 		pos = new_skb->data;
 		pos += pad_len;
 
-		/* Populate new SKB */
+		/* Populate new SKB, it stays on tx queue of the original */
 		skb_copy_from_linear_data(skb, pos, skb->len);
 		skb_put(new_skb, skb->len + pad_len);
+		skb_set_queue_mapping(new_skb, skb_get_queue_mapping(skb));
+		((struct esp_skb_cb *) new_skb->cb)->priv = priv;
 
 		/* Replace old SKB */
 		dev_kfree_skb_any(skb);
@@ -533,10 +808,8 @@ static void process_rx_packet(struct sk_buff *skb)
 		skb->protocol = eth_type_trans(skb, priv->ndev);
 		skb->ip_summed = CHECKSUM_NONE;
 
-		priv->stats.rx_bytes += skb->len;
 		/* Forward skb to kernel */
-		netif_rx_ni(skb);
-		priv->stats.rx_packets++;
+		esp_netdev_rx(priv, skb);
 
 	} else if (payload_header->if_type == ESP_HCI_IF) {
 		esp_hci_rx(adapter, skb);
@@ -557,45 +830,27 @@ static void process_rx_packet(struct sk_buff *skb)
 	}
 }
 
-int esp_is_tx_queue_paused(void)
+/* Tx queue of ndev that can take a frame, or -1 if all of them are stopped */
+int esp_tx_running_queue(struct net_device *ndev)
 {
-	if ((adapter.priv[0] && adapter.priv[0]->ndev &&
-			!netif_queue_stopped((const struct net_device *)
-				adapter.priv[0]->ndev)) ||
-	    (adapter.priv[1] && adapter.priv[1]->ndev &&
-			!netif_queue_stopped((const struct net_device *)
-				adapter.priv[1]->ndev)))
-		return 1;
-	return 0;
-}
-
+	u16 queue = 0;
 
-void esp_tx_pause(void)
-{
-    struct esp_private *priv;
-    int i;
+	for (queue = 0; queue < ndev->real_num_tx_queues; queue++) {
+		if (!netif_xmit_stopped(netdev_get_tx_queue(ndev, queue)))
+			return queue;
+	}
 
-    for (i = 0; i < ESP_MAX_INTERFACE; i++) {
-        priv = adapter.priv[i];
-        if (priv && priv->ndev && !netif_queue_stopped(priv->ndev)) {
-            netif_stop_queue(priv->ndev);
-			esp_verbose("TX queue paused on interface %d\n", i);
-        }
-    }
+	return -1;
 }
 
-void esp_tx_resume(void)
+int esp_is_tx_queue_paused(void)
 {
-    struct esp_private *priv;
-    int i;
-
-    for (i = 0; i < ESP_MAX_INTERFACE; i++) {
-        priv = adapter.priv[i];
-        if (priv && priv->ndev && netif_queue_stopped(priv->ndev)) {
-            netif_wake_queue(priv->ndev);
-            esp_verbose("TX queue resumed on interface %d\n", i);
-        }
-    }
+	if ((adapter.priv[0] && adapter.priv[0]->ndev &&
+			esp_tx_running_queue(adapter.priv[0]->ndev) >= 0) ||
+	    (adapter.priv[1] && adapter.priv[1]->ndev &&
+			esp_tx_running_queue(adapter.priv[1]->ndev) >= 0))
+		return 1;
+	return 0;
 }
 
 struct sk_buff * esp_alloc_skb(u32 len)
@@ -643,6 +898,31 @@ int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	return adapter->if_ops->write(adapter, skb);
 }
 
+/* Send skbs of list in order. List is always emptied */
+int esp_send_packet_list(struct esp_adapter *adapter, struct sk_buff_head *list)
+{
+	struct sk_buff *skb = NULL;
+	int ret = 0;
+
+	if (!adapter || !adapter->if_ops || !adapter->if_ops->write) {
+		__skb_queue_purge(list);
+		return -EINVAL;
+	}
+
+	if (adapter->if_ops->write_list)
+		return adapter->if_ops->write_list(adapter, list);
+
+	while ((skb = __skb_dequeue(list))) {
+		ret = adapter->if_ops->write(adapter, skb);
+		if (ret)
+			break;
+	}
+
+	__skb_queue_purge(list);
+
+	return ret;
+}
+
 static int insert_priv_to_adapter(struct esp_private *priv)
 {
 	int i = 0;
@@ -685,16 +965,20 @@ static int esp_init_priv(struct esp_private *priv, struct net_device *dev,
 static int esp_init_net_dev(struct net_device *ndev, struct esp_private *priv)
 {
 	int ret = 0;
+	u8 queue = 0;
 
 	/* Set netdev */
 	ndev->netdev_ops = &esp_netdev_ops;
 
+	skb_queue_head_init(&priv->rx_q);
+	NETIF_NAPI_ADD(ndev, &priv->napi, esp_napi_poll);
+
+	for (queue = 0; queue < ESP_TX_QUEUES; queue++)
+		INIT_KFIFO(priv->tx_ring[queue].skbs);
+
 #if 0
 	/* Set MTU to account for our headers */
 	ndev->mtu = ETH_DATA_LEN - sizeof(struct esp_payload_header);
-
-	/* Set TX queue length */
-	ndev->tx_queue_len = TX_MAX_PENDING_COUNT;
 #endif
 
 	eth_hw_addr_set(ndev, priv->mac_address);
@@ -720,14 +1004,18 @@ static int esp_add_interface(struct esp_adapter *adapter, u8 if_type, u8 if_num,
 {
 	struct net_device *ndev = NULL;
 	struct esp_private *priv = NULL;
+	unsigned int txqs = 1;
 	int ret = 0;
 
+	/* One tx queue per CPU, up to ESP_TX_QUEUES */
+	txqs = min_t(unsigned int, num_online_cpus(), ESP_TX_QUEUES);
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0))
 	ndev = alloc_netdev_mqs(sizeof(struct esp_private), name,
-			NET_NAME_ENUM, ether_setup, 1, 1);
+			NET_NAME_ENUM, ether_setup, txqs, 1);
 #else
 	ndev = alloc_netdev_mqs(sizeof(struct esp_private), name,
-			ether_setup, 1, 1);
+			ether_setup, txqs, 1);
 #endif
 
 	if (!ndev) {
@@ -890,6 +1178,7 @@ static int update_module_params(struct esp_adapter *adapter)
 	adapter->mod_param.spi_mode = spi_mode;
 	adapter->mod_param.spi_handshake = spi_handshake;
 	adapter->mod_param.spi_dataready = spi_dataready;
+	adapter->mod_param.spi_pipeline = spi_pipeline;
 	return 0;
 }
 
@@ -914,6 +1203,7 @@ static struct esp_adapter * init_adapter(void)
 	INIT_WORK(&adapter.if_rx_work, esp_if_rx_work);
 
 	skb_queue_head_init(&adapter.events_skb_q);
+	spin_lock_init(&adapter.tx_ring_lock);
 
 	adapter.events_wq = alloc_workqueue("ESP_EVENTS_WORKQUEUE", WQ_HIGHPRI|WQ_FREEZABLE, 0);
 
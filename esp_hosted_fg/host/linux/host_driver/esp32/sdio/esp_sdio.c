@@ -37,7 +37,8 @@
 #include "esp_fw_verify.h"
 
 #define MAX_WRITE_RETRIES       2
-#define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
+#define TX_CREDIT_POLL_US       100
+#define TX_CREDIT_TIMEOUT_MS    1000
 
 #define CHECK_SDIO_RW_ERROR(ret) do {			\
 	if (ret)						\
@@ -57,7 +58,6 @@
 #endif
 
 struct esp_sdio_context sdio_context;
-static atomic_t tx_pending;
 static atomic_t queue_items[MAX_PRIORITY_QUEUES];
 
 struct task_struct *tx_thread;
@@ -109,6 +109,25 @@ static void esp_process_interrupt(struct esp_sdio_context *context, u32 int_stat
 	}
 }
 
+/* Slave buffer token only moves forward; drop a stale read racing a newer one */
+static void update_tx_credits(struct esp_sdio_context *context, u32 token)
+{
+	unsigned long flags;
+
+	token = (token >> 16) & ESP_TX_BUFFER_MASK;
+
+	spin_lock_irqsave(&context->credit_lock, flags);
+	if (((token - context->tx_token) & ESP_TX_BUFFER_MASK) < (ESP_TX_BUFFER_MAX / 2))
+		context->tx_token = token;
+	spin_unlock_irqrestore(&context->credit_lock, flags);
+}
+
+static u32 get_tx_credits(struct esp_sdio_context *context)
+{
+	return (READ_ONCE(context->tx_token) + ESP_TX_BUFFER_MAX -
+			context->tx_buffer_count) % ESP_TX_BUFFER_MAX;
+}
+
 static void esp_handle_isr(struct sdio_func *func)
 {
 	struct esp_sdio_context *context = NULL;
@@ -145,6 +164,16 @@ static void esp_handle_isr(struct sdio_func *func)
 			(u8 *) int_status, sizeof(* int_status), ACQUIRE_LOCK);
 	CHECK_SDIO_RW_ERROR(ret);
 
+	/* TX thread is out of credits, refresh them while bus is already ours */
+	if (atomic_read(&context->credit_waiting)) {
+		ret = esp_read_reg(context, ESP_SLAVE_TOKEN_RDATA,
+				(u8 *) int_status, sizeof(* int_status), ACQUIRE_LOCK);
+		if (!ret) {
+			update_tx_credits(context, *int_status);
+			wake_up_interruptible(&context->credit_wait);
+		}
+	}
+
 	kfree(int_status);
 }
 
@@ -201,10 +230,9 @@ static int esp_slave_get_tx_buffer_num(struct esp_sdio_context *context, u32 *tx
 		return ret;
 	}
 
-	*len = (*len >> 16) & ESP_TX_BUFFER_MASK;
-	*len = (*len + ESP_TX_BUFFER_MAX - context->tx_buffer_count) % ESP_TX_BUFFER_MAX;
+	update_tx_credits(context, *len);
 
-	*tx_num = *len;
+	*tx_num = get_tx_credits(context);
 
 	kfree(len);
 	return ret;
@@ -323,6 +351,8 @@ static void esp_remove(struct sdio_func *func)
 
 		esp_info("Context deinit %d - %d\n", context->rx_byte_count,
 			context->tx_buffer_count);
+		esp_info("TX credit stalls %u drops %u\n", context->credit_stalls,
+			context->credit_drops);
 
 		/* Reset context after cleaning up all resources */
 		memset(context, 0, sizeof(struct esp_sdio_context));
@@ -382,6 +412,14 @@ static int init_context(struct esp_sdio_context *context)
 	else
 		context->tx_buffer_count = 0;
 
+	context->tx_token = *val;
+	context->credit_stalls = 0;
+	context->credit_drops = 0;
+	spin_lock_init(&context->credit_lock);
+	atomic_set(&context->credit_waiting, 0);
+	init_waitqueue_head(&context->credit_wait);
+	init_waitqueue_head(&context->tx_wait);
+
 	context->adapter = esp_get_adapter();
 
 	if (unlikely(!context->adapter))
@@ -500,6 +538,8 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 {
 	u32 max_pkt_size = ESP_RX_BUFFER_SIZE;
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	int ret = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -516,68 +556,99 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 		return -EPERM;
 	}
 
-	if (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT) {
-		esp_tx_pause();
-		dev_kfree_skb(skb);
-		return -EBUSY;
-	}
-
-	/* Enqueue SKB in tx_q */
-	atomic_inc(&tx_pending);
-
-	/* Notify to process queue */
+	/* Enqueue SKB in tx_q, netdev frames go to per queue staging ring */
 	if (payload_header->if_type == ESP_SERIAL_IF) {
 		atomic_inc(&queue_items[PRIO_Q_SERIAL]);
 		skb_queue_tail(&(sdio_context.tx_q[PRIO_Q_SERIAL]), skb);
 	} else if (payload_header->if_type == ESP_HCI_IF) {
 		atomic_inc(&queue_items[PRIO_Q_BT]);
 		skb_queue_tail(&(sdio_context.tx_q[PRIO_Q_BT]), skb);
+	} else if (cb->priv) {
+		ret = esp_tx_stage_skb(skb);
+		if (ret) {
+			dev_kfree_skb(skb);
+			return ret;
+		}
 	} else {
 		atomic_inc(&queue_items[PRIO_Q_OTHERS]);
 		skb_queue_tail(&(sdio_context.tx_q[PRIO_Q_OTHERS]), skb);
 	}
 
+	wake_up_interruptible(&sdio_context.tx_wait);
+
 	return 0;
 }
 
-static int is_sdio_write_buffer_available(u32 buf_needed)
+/*
+ * Slave buffer credits are cached from TOKEN_RDATA and only re-read when the
+ * cache runs short. If the slave is still out of buffers after a short poll,
+ * the TX thread sleeps and the interrupt handler refreshes the credits on the
+ * next slave interrupt, with a periodic re-read as fallback. Packet is dropped
+ * only if no buffer frees up within TX_CREDIT_TIMEOUT_MS.
+ */
+static int wait_for_tx_credits(struct esp_sdio_context *context, u32 buf_needed)
 {
-#define BUFFER_AVAILABLE        1
-#define BUFFER_UNAVAILABLE      0
-
-	int ret = 0;
-	static u32 buf_available = 0;
-	struct esp_sdio_context *context = &sdio_context;
+	unsigned long timeout;
 	u8 retry = MAX_WRITE_RETRIES;
+	u32 credits = 0;
+	int ret = 0;
 
-	/*If buffer needed are less than buffer available
-	  then only read for available buffer number from slave*/
-	if (buf_available < buf_needed) {
-		while (retry) {
-			ret = esp_slave_get_tx_buffer_num(context, &buf_available, ACQUIRE_LOCK);
+	if (get_tx_credits(context) >= buf_needed)
+		return 0;
 
-			if (buf_available < buf_needed) {
+	while (retry--) {
+		ret = esp_slave_get_tx_buffer_num(context, &credits, ACQUIRE_LOCK);
+		if (!ret && credits >= buf_needed)
+			return 0;
 
-				/* Release SDIO and retry after delay*/
-				retry--;
-				usleep_range(10,50);
-				continue;
-			}
+		usleep_range(10,50);
+	}
+
+	context->credit_stalls++;
+	timeout = jiffies + msecs_to_jiffies(TX_CREDIT_TIMEOUT_MS);
+	atomic_set(&context->credit_waiting, 1);
+	ret = 0;
 
+	while (get_tx_credits(context) < buf_needed) {
+		if (kthread_should_stop() || !context->adapter ||
+		    (atomic_read(&context->adapter->state) < ESP_CONTEXT_READY) ||
+		    time_after(jiffies, timeout)) {
+			ret = -EBUSY;
 			break;
 		}
+
+		if (wait_event_interruptible_hrtimeout(context->credit_wait,
+				kthread_should_stop() ||
+				(get_tx_credits(context) >= buf_needed),
+				us_to_ktime(TX_CREDIT_POLL_US)))
+			esp_slave_get_tx_buffer_num(context, &credits, ACQUIRE_LOCK);
 	}
 
-	if (buf_available >= buf_needed)
-		buf_available -= buf_needed;
+	atomic_set(&context->credit_waiting, 0);
 
-	if (!retry) {
+	if (ret) {
 		esp_verbose("slave buffer unavailable\n");
-		/* No buffer available at slave */
-		return BUFFER_UNAVAILABLE;
+		context->credit_drops++;
 	}
 
-	return BUFFER_AVAILABLE;
+	return ret;
+}
+
+/* Free tx skb once transport is done with it, sent or not */
+static void free_tx_skb(struct sk_buff *tx_skb, bool staged)
+{
+	if (staged)
+		esp_tx_skb_done(tx_skb);
+
+	dev_kfree_skb_any(tx_skb);
+}
+
+static bool is_tx_pending(struct esp_sdio_context *context)
+{
+	return atomic_read(&queue_items[PRIO_Q_SERIAL]) > 0 ||
+		atomic_read(&queue_items[PRIO_Q_BT]) > 0 ||
+		atomic_read(&queue_items[PRIO_Q_OTHERS]) > 0 ||
+		esp_tx_staged_pending(context->adapter);
 }
 
 static int tx_process(void *data)
@@ -589,6 +660,7 @@ static int tx_process(void *data)
 	u32 data_left, len_to_send, pad;
 	struct sk_buff *tx_skb = NULL;
 	struct esp_sdio_context *context = &sdio_context;
+	bool staged = false;
 
 	while (!kthread_should_stop()) {
 
@@ -599,6 +671,8 @@ static int tx_process(void *data)
 			continue;
 		}
 
+		staged = false;
+
 		if (atomic_read(&queue_items[PRIO_Q_SERIAL]) > 0) {
 			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_SERIAL]));
 			if (!tx_skb) {
@@ -618,34 +692,27 @@ static int tx_process(void *data)
 			}
 			atomic_dec(&queue_items[PRIO_Q_OTHERS]);
 		} else {
-			msleep(1);
-			continue;
-		}
-
-		if (atomic_read(&tx_pending))
-			atomic_dec(&tx_pending);
-
-		/* resume network tx queue if bearable load */
-		if (atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
-			esp_tx_resume();
-			#if TEST_RAW_TP
-				esp_raw_tp_queue_resume();
-			#endif
+			tx_skb = esp_tx_dequeue_staged(context->adapter);
+			if (!tx_skb) {
+				wait_event_interruptible(context->tx_wait,
+						kthread_should_stop() ||
+						is_tx_pending(context));
+				continue;
+			}
+			staged = true;
 		}
 
-		if (!tx_skb || !tx_skb->data || !tx_skb->len) {
-			if (tx_skb)
-				dev_kfree_skb_any(tx_skb);
+		if (!tx_skb->data || !tx_skb->len) {
+			free_tx_skb(tx_skb, staged);
 			continue;
 		}
 
 		buf_needed = (tx_skb->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
 
-		/*If SDIO slave buffer is available to write then only write data
-		else wait till buffer is available*/
-		ret = is_sdio_write_buffer_available(buf_needed);
-		if (!ret) {
-			dev_kfree_skb_any(tx_skb);
+		/* Wait till slave has buffers to take this packet */
+		ret = wait_for_tx_credits(context, buf_needed);
+		if (ret) {
+			free_tx_skb(tx_skb, staged);
 			continue;
 		}
 
@@ -682,14 +749,14 @@ static int tx_process(void *data)
 
 		if (ret) {
 			/* drop the packet */
-			dev_kfree_skb_any(tx_skb);
+			free_tx_skb(tx_skb, staged);
 			continue;
 		}
 
 		context->tx_buffer_count += buf_needed;
 		context->tx_buffer_count = context->tx_buffer_count % ESP_TX_BUFFER_MAX;
 
-		dev_kfree_skb_any(tx_skb);
+		free_tx_skb(tx_skb, staged);
 	}
 
 	do_exit(0);
@@ -753,7 +820,6 @@ static int esp_probe(struct sdio_func *func,
 	esp_info("ESP network device detected\n");
 
 	context = init_sdio_func(func, &ret);
-	atomic_set(&tx_pending, 0);
 
 	if (!context) {
 		if (ret)
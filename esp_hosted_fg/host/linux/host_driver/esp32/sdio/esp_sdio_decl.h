@@ -97,6 +97,17 @@ struct esp_sdio_context {
 	u32                    rx_byte_count;
 	u32                    tx_buffer_count;
 	u32                    sdio_clk_mhz;
+
+	/* tx_process sleeps here till a frame is queued or staged */
+	wait_queue_head_t      tx_wait;
+
+	/* Last slave TOKEN_RDATA buffer count, credits = tx_token - tx_buffer_count */
+	spinlock_t             credit_lock;
+	u32                    tx_token;
+	atomic_t               credit_waiting;
+	wait_queue_head_t      credit_wait;
+	u32                    credit_stalls;
+	u32                    credit_drops;
 };
 
 #endif
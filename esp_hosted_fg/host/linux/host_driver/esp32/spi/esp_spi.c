@@ -34,7 +34,6 @@
 
 #define SPI_INITIAL_CLK_MHZ     10
 #define NUMBER_1M               1000000
-#define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
 
 /* ESP in sdkconfig has CONFIG_IDF_FIRMWARE_CHIP_ID entry.
  * supported values of CONFIG_IDF_FIRMWARE_CHIP_ID are - */
@@ -58,15 +57,16 @@
 
 static struct sk_buff * read_packet(struct esp_adapter *adapter);
 static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static int write_packet_list(struct esp_adapter *adapter, struct sk_buff_head *list);
 static void spi_exit(void);
 static void esp_spi_transaction(void);
+static void release_held_tx_skb(void);
 static int spi_dev_init(struct esp_spi_context *context);
 static int spi_init(void);
 
 volatile u8 data_path = 0;
 static struct esp_spi_context spi_context;
 static char hardware_type = ESP_PRIV_FIRMWARE_CHIP_UNRECOGNIZED;
-static atomic_t tx_pending;
 u8 first_esp_bootup_over;
 
 #if !defined(CONFIG_ESP_HOSTED_USE_WORKQUEUE)
@@ -77,6 +77,7 @@ struct semaphore spi_sem;
 static struct esp_if_ops if_ops = {
 	.read		= read_packet,
 	.write		= write_packet,
+	.write_list	= write_packet_list,
 };
 
 static DEFINE_MUTEX(spi_lock);
@@ -104,8 +105,12 @@ static void print_capabilities(u32 cap)
 
 static void open_data_path(void)
 {
-	atomic_set(&tx_pending, 0);
 	msleep(200);
+
+	/* Slave may have loaded its transaction before we started listening */
+	if (gpio_get_value(spi_context.handshake_gpio))
+		set_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+
 	data_path = OPEN_DATAPATH;
 }
 
@@ -115,7 +120,7 @@ static void close_data_path(void)
 	msleep(200);
 }
 
-static irqreturn_t spi_data_ready_interrupt_handler(int irq, void * dev)
+static void esp_spi_trigger(void)
 {
 #if defined(CONFIG_ESP_HOSTED_USE_WORKQUEUE)
 	if (spi_context.spi_workqueue)
@@ -123,18 +128,21 @@ static irqreturn_t spi_data_ready_interrupt_handler(int irq, void * dev)
 #else
 	up(&spi_sem);
 #endif
+}
+
+static irqreturn_t spi_data_ready_interrupt_handler(int irq, void * dev)
+{
+	esp_spi_trigger();
 	esp_verbose("\n");
  	return IRQ_HANDLED;
  }
 
 static irqreturn_t spi_interrupt_handler(int irq, void * dev)
 {
-#if defined(CONFIG_ESP_HOSTED_USE_WORKQUEUE)
-	if (spi_context.spi_workqueue)
-		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
-#else
-	up(&spi_sem);
-#endif
+	/* Slave loaded next transaction */
+	set_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+
+	esp_spi_trigger();
 	esp_verbose("\n");
 	return IRQ_HANDLED;
 }
@@ -170,10 +178,25 @@ static struct sk_buff * read_packet(struct esp_adapter *adapter)
 	return skb;
 }
 
-static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+static void update_tx_checksum(struct esp_payload_header *h)
+{
+	u16 len = le16_to_cpu(h->len);
+	u16 offset = le16_to_cpu(h->offset);
+
+	if (!(spi_context.adapter->capabilities & ESP_CHECKSUM_ENABLED))
+		return;
+
+	h->checksum = 0;
+	h->checksum = cpu_to_le16(compute_checksum((u8 *) h, len + offset));
+}
+
+/* Queue skb for transmission, without waking up SPI transaction */
+static int enqueue_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 {
 	u32 max_pkt_size = SPI_BUF_SIZE;
 	struct esp_payload_header *h = (struct esp_payload_header *) skb->data;
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	int ret = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -195,31 +218,62 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	}
 
 	UPDATE_HEADER_TX_PKT_NO(h);
-	if (spi_context.adapter->capabilities & ESP_CHECKSUM_ENABLED) {
-		uint16_t len = le16_to_cpu(h->len);
-		uint16_t offset = le16_to_cpu(h->offset);
-		h->checksum = 0;
-		h->checksum = cpu_to_le16(compute_checksum((uint8_t*)h, len + offset));
-	}
+	/* Staged frames get their checksum on dequeue, after credit stamp */
+	if (!cb->priv || h->if_type == ESP_SERIAL_IF || h->if_type == ESP_HCI_IF)
+		update_tx_checksum(h);
 
-	/* Enqueue SKB in tx_q */
+	/* Enqueue SKB in tx_q, netdev frames go to per queue staging ring */
 	if (h->if_type == ESP_SERIAL_IF) {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_SERIAL], skb);
 	} else if (h->if_type == ESP_HCI_IF) {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_BT], skb);
+	} else if (cb->priv) {
+		ret = esp_tx_stage_skb(skb);
+		if (ret) {
+			dev_kfree_skb(skb);
+			return ret;
+		}
 	} else {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_OTHERS], skb);
-		atomic_inc(&tx_pending);
-		if (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT) {
-			esp_tx_pause();
-		}
 	}
 
-	up(&spi_sem);
+	return 0;
+}
+
+static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
+{
+	int ret = enqueue_packet(adapter, skb);
+
+	if (ret)
+		return ret;
+
+	esp_spi_trigger();
 
 	return 0;
 }
 
+/* Queue all skbs of list, then kick SPI transaction once */
+static int write_packet_list(struct esp_adapter *adapter, struct sk_buff_head *list)
+{
+	struct sk_buff *skb = NULL;
+	int queued = 0;
+	int ret = 0;
+
+	while ((skb = __skb_dequeue(list))) {
+		ret = enqueue_packet(adapter, skb);
+		if (ret)
+			break;
+		queued++;
+	}
+
+	__skb_queue_purge(list);
+
+	if (queued)
+		esp_spi_trigger();
+
+	return ret;
+}
+
 
 /* New: Handle device reinit in separate work function */
 static void esp_spi_reinit_work(struct work_struct *work)
@@ -233,6 +287,11 @@ static void esp_spi_reinit_work(struct work_struct *work)
 
 	atomic_set(&context->device_state, SPI_DEVICE_RESETTING);
 
+	/* Held frame carries credit stamp of previous slave session */
+	mutex_lock(&spi_lock);
+	release_held_tx_skb();
+	mutex_unlock(&spi_lock);
+
 	/* Purge all queues */
 	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
 		skb_queue_purge(&context->tx_q[prio_q_idx]);
@@ -269,6 +328,15 @@ int process_init_event(u8 *evt_buf, u8 len)
 
 	pos = evt_buf;
 
+	/* Slave may have been reflashed, wait for it to announce again */
+	spi_context.next_len_unit = 0;
+	spi_context.tx_credit_window = 0;
+	spi_context.tx_credit_sent = 0;
+	spi_context.tx_credit_seq = 0;
+	spi_context.prequeue_depth = 0;
+	spi_context.len_limit_slack = 0;
+	atomic_set(&spi_context.tx_credit_returned, 0);
+
 	while (len_left) {
 		tag_len = *(pos + 1);
 		esp_info("EVENT: %d\n", *pos);
@@ -287,6 +355,20 @@ int process_init_event(u8 *evt_buf, u8 len)
 				return -1;
 			}
 			fw_version_checked = 1;
+		} else if (*pos == ESP_PRIV_SPI_VAR_LEN) {
+			spi_context.next_len_unit = *(pos + 2);
+			esp_info("Variable length SPI transactions enabled\n");
+		} else if (*pos == ESP_PRIV_RX_CREDITS) {
+			spi_context.tx_credit_window = *(pos + 2);
+			esp_info("Tx credit flow control, window %u\n",
+					spi_context.tx_credit_window);
+		} else if (*pos == ESP_PRIV_SPI_PREQUEUE) {
+			spi_context.prequeue_depth = min_t(u8, *(pos + 2), SPI_RX_RING_SIZE);
+			esp_info("Pre-queued SPI transactions, depth %u\n",
+					spi_context.prequeue_depth);
+		} else if (*pos == ESP_PRIV_SPI_LEN_LIMIT) {
+			spi_context.len_limit_slack = *(pos + 2);
+			esp_info("Length limited SPI transactions enabled\n");
 		} else {
 			esp_warn("Unsupported tag in event\n");
 		}
@@ -333,18 +415,185 @@ int process_init_event(u8 *evt_buf, u8 len)
 }
 
 
-static int process_rx_buf(struct sk_buff *skb)
+static int spi_rx_ring_init(void)
+{
+	uint8_t idx = 0;
+
+	/* Sent when ESP has data for host but host has nothing to send */
+	spi_context.tx_dummy_buf = kzalloc(SPI_BUF_SIZE, GFP_KERNEL);
+	if (!spi_context.tx_dummy_buf)
+		return -ENOMEM;
+
+	for (idx = 0; idx < SPI_RX_RING_SIZE; idx++) {
+		spi_context.rx_ring[idx] = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+		if (!spi_context.rx_ring[idx])
+			return -ENOMEM;
+	}
+
+	spi_context.rx_ring_idx = 0;
+
+	return 0;
+}
+
+static void spi_rx_ring_deinit(void)
+{
+	uint8_t idx = 0;
+
+	for (idx = 0; idx < SPI_RX_RING_SIZE; idx++) {
+		if (spi_context.rx_ring[idx]) {
+			skb_free_frag(spi_context.rx_ring[idx]);
+			spi_context.rx_ring[idx] = NULL;
+		}
+	}
+
+	kfree(spi_context.tx_dummy_buf);
+	spi_context.tx_dummy_buf = NULL;
+}
+
+/*
+ * Slave announces in every frame how much it needs to be clocked next time,
+ * and whether that transaction is cut to that length. Fields are cleared as
+ * they are not covered by checksum.
+ */
+static void update_slave_next_len(u8 *rx_buf)
 {
 	struct esp_payload_header *header;
+
+	header = (struct esp_payload_header *) (rx_buf + SPI_RX_HEADROOM);
+
+	spi_context.slave_next_len = header->spi_next_len;
+	header->spi_next_len = 0;
+
+	spi_context.slave_next_limited = spi_context.len_limit_slack &&
+		(header->flags & FLAG_SPI_NEXT_LEN_LIMIT);
+	header->flags &= ~FLAG_SPI_NEXT_LEN_LIMIT;
+}
+
+static void reset_slave_next_len(void)
+{
+	spi_context.slave_next_len = 0;
+	spi_context.slave_next_limited = false;
+}
+
+/* Longest frame slave takes in next transaction */
+static u32 get_tx_len_limit(void)
+{
+	u32 len = spi_context.slave_next_len * spi_context.next_len_unit;
+
+	if (!spi_context.slave_next_limited || len <= spi_context.len_limit_slack)
+		return SPI_BUF_SIZE;
+
+	return len - spi_context.len_limit_slack;
+}
+
+/* Number of bytes to clock in next transaction */
+static u32 get_trans_len(struct sk_buff *tx_skb)
+{
+	u32 len = spi_context.slave_next_len * spi_context.next_len_unit;
+
+	/* Slave length not known, fall back to full size */
+	if (!len)
+		return SPI_BUF_SIZE;
+
+	if (tx_skb && tx_skb->len > len)
+		len = tx_skb->len;
+
+	return min_t(u32, ALIGN(len, 4), SPI_BUF_SIZE);
+}
+
+static bool is_credit_frame(struct esp_payload_header *header)
+{
+	return header->if_type == ESP_STA_IF || header->if_type == ESP_AP_IF;
+}
+
+static bool tx_credit_available(void)
+{
+	if (!spi_context.tx_credit_window)
+		return true;
+
+	return (spi_context.tx_credit_sent -
+		(u32)atomic_read(&spi_context.tx_credit_returned)) <
+		spi_context.tx_credit_window;
+}
+
+/*
+ * Take back credit of a frame that never went out. Only the latest one can be
+ * taken back, its sequence then gets reused. Slave accounts older ones from
+ * the sequence gap once a later frame reaches it.
+ */
+static void tx_credit_unsent(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+
+	if (!cb->tx_credit_seq || cb->tx_credit_seq != spi_context.tx_credit_seq)
+		return;
+
+	spi_context.tx_credit_seq--;
+	spi_context.tx_credit_sent--;
+}
+
+/*
+ * Slave reports running count of Wi-Fi frames it is done with, including
+ * ones dropped or lost on the way
+ */
+static int process_credit_event(struct esp_payload_header *header)
+{
+	struct esp_priv_event *event;
+	u32 returned = 0;
+	u8 *data = NULL;
+	u16 len = le16_to_cpu(header->len);
+	u16 offset = le16_to_cpu(header->offset);
+	u16 rx_checksum = 0;
+
+	if (header->if_type != ESP_PRIV_IF ||
+	    header->priv_pkt_type != ESP_PACKET_TYPE_EVENT)
+		return -EINVAL;
+
+	event = (struct esp_priv_event *) ((u8 *) header + offset);
+	if (event->event_type != ESP_PRIV_EVENT_RX_CREDIT)
+		return -EINVAL;
+
+	if (len < sizeof(*event) + sizeof(__le32) ||
+	    event->event_len < sizeof(__le32))
+		return -EPERM;
+
+	if (spi_context.adapter->capabilities & ESP_CHECKSUM_ENABLED) {
+		rx_checksum = le16_to_cpu(header->checksum);
+		header->checksum = 0;
+		if (compute_checksum((u8 *) header, len + offset) != rx_checksum)
+			return -EPERM;
+	}
+
+	data = event->event_data;
+	returned = data[0] | (data[1] << 8) | (data[2] << 16) | ((u32) data[3] << 24);
+	atomic_set(&spi_context.tx_credit_returned, returned);
+
+	/* Count is absolute. Slave being ahead means a frame taken back as
+	 * unsent did reach it, so resync to it instead of leaking the window */
+	if ((s32) (spi_context.tx_credit_sent - returned) < 0)
+		spi_context.tx_credit_sent = returned;
+
+	return 0;
+}
+
+/*
+ * Validate frame received in ring buffer and hand it up as an skb built over
+ * the buffer itself, rx_len being number of bytes clocked in. Returns 0 if
+ * buffer is consumed and ring slot needs refill.
+ */
+static int process_rx_buf(u8 *rx_buf, u32 rx_len)
+{
+	struct esp_payload_header *header;
+	struct sk_buff *skb = NULL;
 	u16 len = 0;
 	u16 offset = 0;
 
-	if (!skb)
+	if (!rx_buf)
 		return -EINVAL;
 
-	header = (struct esp_payload_header *) skb->data;
+	header = (struct esp_payload_header *) (rx_buf + SPI_RX_HEADROOM);
 
-	esp_hex_dump_dbg("spi_rx: ", skb->data , min(skb->len, 32));
+	esp_hex_dump_dbg("spi_rx: ", header, 32);
 
 	if (header->if_type >= ESP_MAX_IF) {
 		return -EINVAL;
@@ -357,24 +606,28 @@ static int process_rx_buf(struct sk_buff *skb)
 
 	offset = le16_to_cpu(header->offset);
 
-	/* Validate received SKB. Check len and offset fields */
-	if (offset != sizeof(struct esp_payload_header)) {
+	/* Validate received buffer. Check len and offset fields.
+	 * Slave may pad header for DMA alignment of frames sent in place */
+	if (offset < sizeof(struct esp_payload_header) ||
+	    offset > sizeof(struct esp_payload_header) + SPI_HDR_PAD_MAX) {
 		esp_err("offset_rcv[%d] != exp[%d], drop\n",
 				(int)offset, (int)sizeof(struct esp_payload_header));
-		esp_hex_dump_dbg("wrong offset: ", skb->data , min(skb->len, 32));
+		esp_hex_dump_dbg("wrong offset: ", header, 32);
 		return -EINVAL;
 	}
 
 
-	len += sizeof(struct esp_payload_header);
-	if (len > SPI_BUF_SIZE) {
-		esp_info("len[%u] > max[%u], drop\n", len, SPI_BUF_SIZE);
-		esp_hex_dump_dbg("wrong len: ", skb->data , 8);
+	len += offset;
+	if (len > rx_len) {
+		esp_info("len[%u] > max[%u], drop\n", len, rx_len);
+		esp_hex_dump_dbg("wrong len: ", header, 8);
 		return -EINVAL;
 	}
 
-	/* Trim SKB to actual size */
-	skb_trim(skb, len);
+	/* Credit updates are consumed here, tx path waits on them.
+	 * Buffer is left for reuse */
+	if (spi_context.tx_credit_window && !process_credit_event(header))
+		return -EAGAIN;
 
 
 	if (!data_path) {
@@ -382,6 +635,15 @@ static int process_rx_buf(struct sk_buff *skb)
 		return -EPERM;
 	}
 
+	skb = build_skb(rx_buf, SPI_RX_BUF_TRUESIZE);
+	if (!skb) {
+		esp_err("Failed to build rx skb\n");
+		return -ENOMEM;
+	}
+
+	skb_reserve(skb, SPI_RX_HEADROOM);
+	skb_put(skb, len);
+
 	/* enqueue skb for read_packet to pick it */
 	if (header->if_type == ESP_SERIAL_IF)
 		skb_queue_tail(&spi_context.rx_q[PRIO_Q_SERIAL], skb);
@@ -396,14 +658,299 @@ static int process_rx_buf(struct sk_buff *skb)
 	return 0;
 }
 
+/* staged is set if skb came from a netdev staging ring */
+static struct sk_buff * dequeue_tx_skb(bool *staged)
+{
+	struct esp_payload_header *h = NULL;
+	struct sk_buff *tx_skb = NULL;
+	struct esp_skb_cb *cb = NULL;
+
+	*staged = false;
+
+	tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_SERIAL]);
+	if (!tx_skb)
+		tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_BT]);
+	if (!tx_skb)
+		tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_OTHERS]);
+	if (!tx_skb && tx_credit_available()) {
+		tx_skb = esp_tx_dequeue_staged(spi_context.adapter);
+		if (!tx_skb)
+			return NULL;
+
+		*staged = true;
+		h = (struct esp_payload_header *) tx_skb->data;
+		cb = (struct esp_skb_cb *) tx_skb->cb;
+		cb->tx_credit_seq = 0;
+
+		if (spi_context.tx_credit_window && is_credit_frame(h)) {
+			spi_context.tx_credit_sent++;
+			/* Slave finds frames lost on the way from gaps in it */
+			cb->tx_credit_seq = ++spi_context.tx_credit_seq;
+			h->seq_num = cpu_to_le16((u16) cb->tx_credit_seq);
+		}
+		update_tx_checksum(h);
+	}
+
+	return tx_skb;
+}
+
+/*
+ * Next frame to send, if it fits in slave transaction. Frame that does not
+ * is held and goes first once slave is back to full length transactions.
+ */
+static struct sk_buff * next_tx_skb(bool *staged)
+{
+	struct sk_buff *tx_skb = spi_context.tx_held;
+
+	if (tx_skb) {
+		*staged = spi_context.tx_held_staged;
+		spi_context.tx_held = NULL;
+	} else {
+		tx_skb = dequeue_tx_skb(staged);
+	}
+
+	if (tx_skb && tx_skb->len > get_tx_len_limit()) {
+		spi_context.tx_held = tx_skb;
+		spi_context.tx_held_staged = *staged;
+		*staged = false;
+		return NULL;
+	}
+
+	return tx_skb;
+}
+
+/* Free tx skb once transfer is done with it, sent is false if it failed */
+static void free_tx_skb(struct sk_buff *tx_skb, bool staged, bool sent)
+{
+	if (!tx_skb)
+		return;
+
+	if (staged) {
+		if (!sent)
+			tx_credit_unsent(tx_skb);
+		esp_tx_skb_done(tx_skb);
+	}
+
+	dev_kfree_skb(tx_skb);
+}
+
+static void release_held_tx_skb(void)
+{
+	free_tx_skb(spi_context.tx_held, spi_context.tx_held_staged, false);
+	spi_context.tx_held = NULL;
+}
+
+/*
+ * Runs in SPI controller context once a pipelined transfer is clocked out.
+ * Received frame is left for spi thread or work to process.
+ */
+static void esp_spi_xfer_complete(void *data)
+{
+	struct esp_spi_xfer *xfer = data;
+	unsigned long flags;
+
+	smp_store_release(&xfer->state, ESP_SPI_XFER_DONE);
+	esp_spi_trigger();
+
+	/* Count drops under waitqueue lock, spi_pipeline_drain() takes the
+	 * lock after seeing it at zero, so unlock is our last access */
+	spin_lock_irqsave(&spi_context.xfer_wait.lock, flags);
+	if (atomic_dec_and_test(&spi_context.xfer_inflight))
+		wake_up_locked(&spi_context.xfer_wait);
+	spin_unlock_irqrestore(&spi_context.xfer_wait.lock, flags);
+}
+
+/* Hand up frames of completed transfers in submission order, refill slots */
+static void esp_spi_pipeline_reap(void)
+{
+	struct esp_spi_xfer *xfer = NULL;
+	u8 **rx_slot = NULL;
+
+	for (;;) {
+		xfer = &spi_context.xfer[spi_context.reap_idx];
+
+		if (smp_load_acquire(&xfer->state) != ESP_SPI_XFER_DONE)
+			break;
+
+		rx_slot = &spi_context.rx_ring[xfer->rx_idx];
+
+		if (xfer->msg.status) {
+			esp_err("SPI Transaction failed: %d\n", xfer->msg.status);
+			reset_slave_next_len();
+		} else {
+			update_slave_next_len(*rx_slot);
+			if (!process_rx_buf(*rx_slot, xfer->trans.len)) {
+				/* Buffer now belongs to rx skb */
+				*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+			}
+		}
+
+		free_tx_skb(xfer->tx_skb, xfer->tx_staged, !xfer->msg.status);
+		xfer->tx_skb = NULL;
+
+		xfer->state = ESP_SPI_XFER_FREE;
+		spi_context.reap_idx = (spi_context.reap_idx + 1) % SPI_RX_RING_SIZE;
+	}
+}
+
+/*
+ * Whether slave has a transaction loaded for next transfer. Legacy firmware
+ * loads one transaction at a time, so every handshake rising edge allows
+ * exactly one transfer. Firmware with pre-queued transactions holds handshake
+ * high while at least prequeue_depth of them are loaded, which covers any
+ * transfer of ours not yet clocked out.
+ */
+static bool esp_spi_slave_ready(void)
+{
+	if (spi_context.prequeue_depth)
+		return atomic_read(&spi_context.xfer_inflight) < spi_context.prequeue_depth &&
+			gpio_get_value(spi_context.handshake_gpio);
+
+	return test_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+}
+
+/* Gap after transfer, so controller does not clock slave before it reloads */
+static void esp_spi_set_xfer_gap(struct spi_transfer *trans)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0))
+	trans->delay.value = SPI_PIPELINE_GAP_US;
+	trans->delay.unit = SPI_DELAY_UNIT_USECS;
+#else
+	trans->delay_usecs = SPI_PIPELINE_GAP_US;
+#endif
+}
+
+/*
+ * Pipelined mode: a transfer is submitted with spi_async() as soon as the
+ * slave has a transaction loaded, without waiting for the previous transfer
+ * to be processed. Completed transfers are processed here, out of controller
+ * context.
+ */
+static void esp_spi_pipeline_transaction(void)
+{
+	struct esp_spi_xfer *xfer = NULL;
+	struct sk_buff *tx_skb = NULL;
+	bool staged = false;
+	u8 **rx_slot = NULL;
+	int ret = 0;
+
+	mutex_lock(&spi_lock);
+
+	esp_spi_pipeline_reap();
+
+	while (data_path) {
+		xfer = &spi_context.xfer[spi_context.xfer_idx];
+
+		if (READ_ONCE(xfer->state) != ESP_SPI_XFER_FREE ||
+		    !esp_spi_slave_ready())
+			break;
+
+		/* Slave may cut next transaction short, which is known only once
+		 * previous transfer is processed. Completion triggers us again */
+		if (spi_context.len_limit_slack &&
+		    spi_context.xfer[spi_context.reap_idx].state != ESP_SPI_XFER_FREE)
+			break;
+
+		tx_skb = next_tx_skb(&staged);
+		if (!tx_skb && !spi_context.slave_next_limited &&
+		    !gpio_get_value(spi_context.dataready_gpio))
+			break;
+
+		rx_slot = &spi_context.rx_ring[spi_context.xfer_idx];
+		if (!*rx_slot)
+			*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+
+		if (!*rx_slot || !spi_context.tx_dummy_buf) {
+			esp_err("No SPI buffer available\n");
+			free_tx_skb(tx_skb, staged, false);
+			break;
+		}
+
+		memset(&xfer->trans, 0, sizeof(xfer->trans));
+		xfer->trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
+		xfer->trans.tx_buf = tx_skb ? tx_skb->data : spi_context.tx_dummy_buf;
+		xfer->trans.rx_buf = *rx_slot + SPI_RX_HEADROOM;
+		/* Slave length is known only once previous transfer is processed */
+		if (spi_context.xfer[spi_context.reap_idx].state != ESP_SPI_XFER_FREE)
+			xfer->trans.len = SPI_BUF_SIZE;
+		else
+			xfer->trans.len = get_trans_len(tx_skb);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
+		if (hardware_type == ESP_PRIV_FIRMWARE_CHIP_ESP32) {
+			xfer->trans.cs_change = 1;
+		}
+#endif
+		if (spi_context.prequeue_depth)
+			esp_spi_set_xfer_gap(&xfer->trans);
+
+		spi_message_init(&xfer->msg);
+		spi_message_add_tail(&xfer->trans, &xfer->msg);
+		xfer->msg.complete = esp_spi_xfer_complete;
+		xfer->msg.context = xfer;
+		xfer->tx_skb = tx_skb;
+		xfer->tx_staged = staged;
+		xfer->rx_idx = spi_context.xfer_idx;
+		xfer->state = ESP_SPI_XFER_INFLIGHT;
+		atomic_inc(&spi_context.xfer_inflight);
+
+		/* Slave transaction gets used up by this transfer */
+		clear_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+
+		ret = spi_async(spi_context.esp_spi_dev, &xfer->msg);
+		if (ret) {
+			esp_err("SPI async submit failed: %d\n", ret);
+			xfer->tx_skb = NULL;
+			xfer->state = ESP_SPI_XFER_FREE;
+			atomic_dec(&spi_context.xfer_inflight);
+			free_tx_skb(tx_skb, staged, false);
+			if (gpio_get_value(spi_context.handshake_gpio))
+				set_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+			break;
+		}
+
+		spi_context.xfer_idx = (spi_context.xfer_idx + 1) % SPI_RX_RING_SIZE;
+	}
+
+	mutex_unlock(&spi_lock);
+}
+
+/*
+ * Controller owns rx and tx buffers of submitted transfers till they
+ * complete, so wait for all of them however long it takes.
+ */
+static void spi_pipeline_drain(void)
+{
+	mutex_lock(&spi_lock);
+
+	while (!wait_event_timeout(spi_context.xfer_wait,
+				!atomic_read(&spi_context.xfer_inflight), HZ))
+		esp_warn("Waiting for %d SPI transfers\n",
+				atomic_read(&spi_context.xfer_inflight));
+
+	/* Wait out the last completion, it may still hold the waitqueue lock */
+	spin_lock_irq(&spi_context.xfer_wait.lock);
+	spin_unlock_irq(&spi_context.xfer_wait.lock);
+
+	/* Datapath is closed, rx buffers stay in ring and tx skbs are freed */
+	esp_spi_pipeline_reap();
+
+	mutex_unlock(&spi_lock);
+}
+
 static void esp_spi_transaction(void)
 {
 	struct spi_transfer trans;
-	struct sk_buff *tx_skb = NULL, *rx_skb = NULL;
-	u8 *rx_buf;
+	struct sk_buff *tx_skb = NULL;
+	bool staged = false;
+	u8 **rx_slot = NULL;
 	int ret = 0;
 	volatile int rx_pending = 0;
 
+	if (spi_context.pipelined) {
+		esp_spi_pipeline_transaction();
+		return;
+	}
+
 #if defined(CONFIG_ESP_HOSTED_USE_WORKQUEUE)
 	if (!mutex_trylock(&spi_lock)) {
 		if (spi_context.spi_workqueue)
@@ -432,24 +979,11 @@ static void esp_spi_transaction(void)
 	rx_pending = gpio_get_value(spi_context.dataready_gpio);
 #endif
 
-	if (data_path) {
-		tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_SERIAL]);
-		if (!tx_skb)
-			tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_BT]);
-		if (!tx_skb)
-			tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_OTHERS]);
-
-		if (tx_skb && atomic_read(&tx_pending)) {
-			atomic_dec(&tx_pending);
-			if (atomic_read(&tx_pending) < TX_RESUME_THRESHOLD)
-				esp_tx_resume();
-			#if TEST_RAW_TP
-				esp_raw_tp_queue_resume();
-			#endif
-		}
-	}
+	if (data_path)
+		tx_skb = next_tx_skb(&staged);
 
-	if (!rx_pending && !tx_skb) {
+	/* Limited transaction is only announced for a frame slave has ready */
+	if (!rx_pending && !tx_skb && !spi_context.slave_next_limited) {
 		mutex_unlock(&spi_lock);
 		return;
 	}
@@ -460,16 +994,23 @@ static void esp_spi_transaction(void)
 	if (tx_skb) {
 		trans.tx_buf = tx_skb->data;
 	} else {
-		tx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-		trans.tx_buf = skb_put(tx_skb, SPI_BUF_SIZE);
-		memset((void*)trans.tx_buf, 0, SPI_BUF_SIZE);
+		trans.tx_buf = spi_context.tx_dummy_buf;
+	}
+
+	/* Refill ring slot if last refill failed */
+	rx_slot = &spi_context.rx_ring[spi_context.rx_ring_idx];
+	if (!*rx_slot)
+		*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+
+	if (!*rx_slot || !trans.tx_buf) {
+		esp_err("No SPI buffer available\n");
+		free_tx_skb(tx_skb, staged, false);
+		mutex_unlock(&spi_lock);
+		return;
 	}
 
-	rx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-	rx_buf = skb_put(rx_skb, SPI_BUF_SIZE);
-	memset(rx_buf, 0, SPI_BUF_SIZE);
-	trans.rx_buf = rx_buf;
-	trans.len = SPI_BUF_SIZE;
+	trans.rx_buf = *rx_slot + SPI_RX_HEADROOM;
+	trans.len = get_trans_len(tx_skb);
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
 	if (hardware_type == ESP_PRIV_FIRMWARE_CHIP_ESP32) {
@@ -479,28 +1020,31 @@ static void esp_spi_transaction(void)
 
 	ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
 	if (ret) {
-		dev_kfree_skb(rx_skb);
-		dev_kfree_skb(tx_skb);
+		reset_slave_next_len();
+		free_tx_skb(tx_skb, staged, false);
 		mutex_unlock(&spi_lock);
 		return;
 	}
 
-	if (process_rx_buf(rx_skb)) {
-		dev_kfree_skb(rx_skb);
-	}
+	update_slave_next_len(*rx_slot);
 
-	if (tx_skb) {
-		dev_kfree_skb(tx_skb);
+	if (!process_rx_buf(*rx_slot, trans.len)) {
+		/* Buffer now belongs to rx skb */
+		*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+		spi_context.rx_ring_idx = (spi_context.rx_ring_idx + 1) % SPI_RX_RING_SIZE;
 	}
 
+	free_tx_skb(tx_skb, staged, true);
+
 	mutex_unlock(&spi_lock);
 
 #if defined(CONFIG_ESP_HOSTED_USE_WORKQUEUE)
 	/* Queue next work only if there's data or slave is ready */
-	if (gpio_get_value(spi_context.dataready_gpio) ||
+	if (gpio_get_value(spi_context.dataready_gpio) || spi_context.tx_held ||
 		!skb_queue_empty(&spi_context.tx_q[PRIO_Q_SERIAL]) ||
 		!skb_queue_empty(&spi_context.tx_q[PRIO_Q_BT]) ||
-		!skb_queue_empty(&spi_context.tx_q[PRIO_Q_OTHERS])) {
+		!skb_queue_empty(&spi_context.tx_q[PRIO_Q_OTHERS]) ||
+		(tx_credit_available() && esp_tx_staged_pending(spi_context.adapter))) {
 		if (spi_context.spi_workqueue)
 			queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
 	}
@@ -706,6 +1250,7 @@ static int spi_init(void)
 
 	/* Init reinit work */
 	INIT_WORK(&spi_context.reinit_work, esp_spi_reinit_work);
+	init_waitqueue_head(&spi_context.xfer_wait);
 #if defined(CONFIG_ESP_HOSTED_USE_WORKQUEUE)
 	esp_info("ESP: Using SPI Workqueue solution\n");
 
@@ -738,6 +1283,12 @@ static int spi_init(void)
 		skb_queue_head_init(&spi_context.rx_q[prio_q_idx]);
 	}
 
+	status = spi_rx_ring_init();
+	if (status) {
+		spi_exit();
+		esp_err("Failed to allocate SPI buffers\n");
+		return status;
+	}
 
 	status = spi_dev_init(&spi_context);
 	if (status) {
@@ -777,6 +1328,13 @@ static void spi_exit(void)
 	close_data_path();
 	msleep(200);
 
+	if (spi_context.pipelined)
+		spi_pipeline_drain();
+
+	mutex_lock(&spi_lock);
+	release_held_tx_skb();
+	mutex_unlock(&spi_lock);
+
 	for (prio_q_idx=0; prio_q_idx<MAX_PRIORITY_QUEUES; prio_q_idx++) {
 		skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
 		skb_queue_purge(&spi_context.rx_q[prio_q_idx]);
@@ -795,6 +1353,8 @@ static void spi_exit(void)
 	}
 #endif
 
+	spi_rx_ring_deinit();
+
 	esp_remove_card(spi_context.adapter);
 
 	if (test_bit(ESP_SPI_GPIO_HS_IRQ_DONE, &spi_context.spi_flags)) {
@@ -864,6 +1424,7 @@ int esp_init_interface_layer(struct esp_adapter *adapter)
 
 	spi_context.handshake_gpio = adapter->mod_param.spi_handshake;
 	spi_context.dataready_gpio = adapter->mod_param.spi_dataready;
+	spi_context.pipelined = (adapter->mod_param.spi_pipeline > 0);
 
 	if(!gpio_is_valid(spi_context.handshake_gpio)) {
 		esp_err("Couldn't configure Handshake GPIO[%u]\n", spi_context.handshake_gpio);
@@ -21,6 +21,14 @@
 #include "esp.h"
 
 #define SPI_BUF_SIZE            1600
+/* Max padding slave may insert after payload header, for DMA alignment */
+#define SPI_HDR_PAD_MAX         3
+
+/* RX buffers are recycled across transactions and handed up with build_skb() */
+#define SPI_RX_RING_SIZE        4
+#define SPI_RX_HEADROOM         NET_SKB_PAD
+#define SPI_RX_BUF_TRUESIZE     (SKB_DATA_ALIGN(SPI_RX_HEADROOM + SPI_BUF_SIZE) + \
+				 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
 
 /* SPI device states */
 enum spi_device_state {
@@ -36,6 +44,26 @@ enum spi_flags_e {
 	ESP_SPI_GPIO_DR_REQUESTED,
 	ESP_SPI_GPIO_DR_IRQ_DONE,
 	ESP_SPI_DATAPATH_OPEN,
+	ESP_SPI_HS_ASSERTED,
+};
+
+/* Every pipelined transfer is followed by a gap for slave to load next one */
+#define SPI_PIPELINE_GAP_US     20
+
+enum esp_spi_xfer_state {
+	ESP_SPI_XFER_FREE,
+	ESP_SPI_XFER_INFLIGHT,
+	ESP_SPI_XFER_DONE,
+};
+
+/* Transfer submitted with spi_async() in pipelined mode */
+struct esp_spi_xfer {
+	struct spi_message         msg;
+	struct spi_transfer        trans;
+	struct sk_buff             *tx_skb;
+	bool                       tx_staged;
+	u8                         rx_idx;
+	u8                         state;
 };
 
 struct esp_spi_context {
@@ -53,6 +81,33 @@ struct esp_spi_context {
 	unsigned long              spi_flags;
 	int                        handshake_gpio;
 	int                        dataready_gpio;
+	u8                         *rx_ring[SPI_RX_RING_SIZE];
+	u8                         rx_ring_idx;
+	u8                         *tx_dummy_buf;
+	u8                         next_len_unit;
+	u8                         slave_next_len;
+	/* Slave cuts its next transaction short, see FLAG_SPI_NEXT_LEN_LIMIT */
+	bool                       slave_next_limited;
+	/* Slave may limit transactions, slack announced by it, 0 if it never does */
+	u8                         len_limit_slack;
+	/* Frame not fitting in limited transaction, sent ahead of queues next */
+	struct sk_buff             *tx_held;
+	bool                       tx_held_staged;
+
+	/* Host to slave Wi-Fi frame credits, window 0 if slave has none */
+	u8                         tx_credit_window;
+	u32                        tx_credit_sent;
+	atomic_t                   tx_credit_returned;
+	/* Stamped in seq_num of credited frames, reused if latest is unsent */
+	u32                        tx_credit_seq;
+	bool                       pipelined;
+	struct esp_spi_xfer        xfer[SPI_RX_RING_SIZE];
+	u8                         xfer_idx;
+	u8                         reap_idx;
+	atomic_t                   xfer_inflight;
+	wait_queue_head_t          xfer_wait;
+	/* Transfers slave lets host pipeline, 0 if one per handshake edge */
+	u8                         prequeue_depth;
 };
 
 enum {
@@ -211,11 +211,67 @@ int serial_drv_write (struct serial_drv_handle_t* serial_drv_handle,
  * Returns
  *      buf                         :   Protocol encoded data Buffer
  *                                      caller will decode the protobuf
+ *                                      and release it with serial_drv_read_done
  */
 
 uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
 		uint32_t *out_nbyte);
 
+/*
+ * serial_drv_read_done function releases buffer returned by serial_drv_read
+ * or serial_drv_read_nonblocking. If driver is in message mode, buffer is
+ * reused for next read and not freed.
+ *
+ * Input parameter
+ *      serial_drv_handle           :   Driver Handle
+ *      buf                         :   Buffer returned by read
+ */
+void serial_drv_read_done(struct serial_drv_handle_t *serial_drv_handle,
+		uint8_t *buf);
+
+/*
+ * serial_drv_get_fd function returns file descriptor of driver interface,
+ * which could be polled for received data
+ *
+ * Input parameter
+ *      serial_drv_handle           :   Driver Handle
+ * Returns
+ *      file descriptor or FAILURE(-1)
+ */
+int serial_drv_get_fd(struct serial_drv_handle_t *serial_drv_handle);
+
+/*
+ * serial_drv_set_nonblocking function switches reads on driver interface
+ * to non-blocking (enable = 1) or back to blocking (enable = 0)
+ *
+ * Input parameter
+ *      serial_drv_handle           :   Driver Handle
+ *      enable                      :   1 for non-blocking, 0 for blocking
+ * Returns
+ *      SUCCESS(0) or FAILURE(-1) of above operation
+ */
+int serial_drv_set_nonblocking(struct serial_drv_handle_t *serial_drv_handle,
+		int enable);
+
+/*
+ * serial_drv_read_nonblocking function is non-blocking variant of
+ * serial_drv_read. Partially received TLV frame is kept in driver handle
+ * and completed on next calls.
+ * serial_drv_set_nonblocking() is expected to be enabled beforehand.
+ *
+ * Input parameter
+ *      serial_drv_handle           :   Driver Handle
+ * Output parameter
+ *      out_nbyte                   :   Size of TLV parsed buffer
+ * Returns
+ *      buf                         :   Protocol encoded data Buffer, once
+ *                                      complete frame is received
+ *      NULL                        :   errno EAGAIN if frame is not yet
+ *                                      complete, other errno on failure
+ */
+uint8_t * serial_drv_read_nonblocking(struct serial_drv_handle_t *serial_drv_handle,
+		uint32_t *out_nbyte);
+
 /*
  * serial_drv_close function closes driver interface.
  *
@@ -23,6 +23,7 @@
 #define SUCCESS                 0
 #define FAILURE                 -1
 #define DUMMY_READ_BUF_LEN      64
+#define RX_TLV_HDR_MAX_LEN      32
 #define EAGAIN                  11
 
 #define HOSTED_CALLOC(buff,nbytes) do {                           \
@@ -38,6 +39,16 @@
 
 struct serial_drv_handle_t {
 	int file_desc;
+
+	/* Reused for every read if driver supports message mode */
+	uint8_t *msg_buf;
+
+	/* TLV frame being collected by serial_drv_read_nonblocking() */
+	uint8_t rx_hdr[RX_TLV_HDR_MAX_LEN];
+	uint16_t rx_hdr_len;
+	uint8_t *rx_buf;
+	uint32_t rx_buf_len;
+	uint32_t rx_buf_read;
 };
 
 extern int errno;
@@ -122,13 +133,18 @@ int control_path_platform_init(struct serial_drv_handle_t* serial_drv_handle)
 	 **/
 	int count = 0;
 	uint8_t *buf = NULL;
+	uint32_t buf_len = DUMMY_READ_BUF_LEN;
 
 	if (!serial_drv_handle) {
 		printf("%s:%u: Error: serial_drv_handle not initialised\n", __func__, __LINE__);
 		return FAILURE;
 	}
 
-	buf = (uint8_t *)hosted_calloc(1, DUMMY_READ_BUF_LEN);
+	/* In message mode, read must fit whole frame */
+	if (serial_drv_handle->msg_buf)
+		buf_len = ESP_SERIAL_MSG_MAX_LEN;
+
+	buf = (uint8_t *)hosted_calloc(1, buf_len);
 	if (!buf) {
 		printf("%s:%u, Failed to allocate memory \n", __func__, __LINE__);
 		goto close1;
@@ -143,7 +159,7 @@ int control_path_platform_init(struct serial_drv_handle_t* serial_drv_handle)
 	do {
 		/* dummy read, discard data */
 		count = read(serial_drv_handle->file_desc,
-				(buf), (DUMMY_READ_BUF_LEN));
+				(buf), (buf_len));
 		if (count < 0) {
 			if (-errno != -EAGAIN) {
 				printf("%s:%u read failed[%d]\n", __func__, __LINE__, errno);
@@ -527,6 +543,15 @@ struct serial_drv_handle_t* serial_drv_open(const char *transport)
 		return NULL;
 	}
 
+	/* One read per frame into reused buffer, if driver supports it */
+	if (ioctl(serial_drv_handle->file_desc, ESP_SERIAL_IOCTL_MSG_MODE, 1) == 1) {
+		serial_drv_handle->msg_buf = (uint8_t *)hosted_malloc(ESP_SERIAL_MSG_MAX_LEN);
+		if (!serial_drv_handle->msg_buf) {
+			printf("%s, Failed to allocate memory, using stream mode\n", __func__);
+			ioctl(serial_drv_handle->file_desc, ESP_SERIAL_IOCTL_MSG_MODE, 0);
+		}
+	}
+
 	return serial_drv_handle;
 }
 
@@ -556,6 +581,8 @@ int serial_drv_close(struct serial_drv_handle_t **serial_drv_handle)
 	    (*serial_drv_handle)->file_desc < 0) {
 		return FAILURE;
 	}
+	mem_free((*serial_drv_handle)->rx_buf);
+	mem_free((*serial_drv_handle)->msg_buf);
 	if(close((*serial_drv_handle)->file_desc) < 0) {
 		perror("close:");
 		mem_free(*serial_drv_handle);
@@ -567,6 +594,54 @@ int serial_drv_close(struct serial_drv_handle_t **serial_drv_handle)
 	return SUCCESS;
 }
 
+/* Message mode: driver returns exactly one complete TLV frame per read.
+ * Returned buffer points into msg_buf and is valid till next read */
+static uint8_t * serial_drv_read_msg(struct serial_drv_handle_t *serial_drv_handle,
+		uint32_t *out_nbyte)
+{
+	int count = 0;
+	uint32_t buf_len = 0;
+	const char* ep_name = CTRL_EP_NAME_RESP;
+	uint16_t init_read_len = SIZE_OF_TYPE + SIZE_OF_LENGTH + strlen(ep_name) +
+		SIZE_OF_TYPE + SIZE_OF_LENGTH;
+
+	*out_nbyte = 0;
+
+	do {
+		count = read(serial_drv_handle->file_desc,
+				serial_drv_handle->msg_buf, ESP_SERIAL_MSG_MAX_LEN);
+	} while (count < 0 && errno == EINTR);
+
+	if (count <= 0) {
+		if (!count)
+			errno = ENODEV;
+		return NULL;
+	}
+
+	if ((count < init_read_len) ||
+	    (parse_tlv(serial_drv_handle->msg_buf, &buf_len) != SUCCESS) ||
+	    !buf_len || (count != init_read_len + buf_len)) {
+		printf("%s, bad frame of %d bytes\n", __func__, count);
+		errno = EBADMSG;
+		return NULL;
+	}
+
+	*out_nbyte = buf_len;
+	return serial_drv_handle->msg_buf + init_read_len;
+}
+
+void serial_drv_read_done(struct serial_drv_handle_t *serial_drv_handle,
+		uint8_t *buf)
+{
+	/* msg_buf is reused, only buffers from two step read are freed */
+	if (serial_drv_handle && serial_drv_handle->msg_buf &&
+	    buf >= serial_drv_handle->msg_buf &&
+	    buf < serial_drv_handle->msg_buf + ESP_SERIAL_MSG_MAX_LEN)
+		return;
+
+	mem_free(buf);
+}
+
 /* This whole processing of two step parsing TLV is common for MPU and MCU
  * and ideally this processing should have been done in serial_if.c.
  * But the problem is there is difference in reading in MPU and MCU.
@@ -608,6 +683,13 @@ uint8_t * serial_drv_read(struct serial_drv_handle_t *serial_drv_handle,
 		return NULL;
 	}
 
+	if (serial_drv_handle->msg_buf) {
+		buf = serial_drv_read_msg(serial_drv_handle, out_nbyte);
+		if (!buf)
+			perror("read fail:");
+		return buf;
+	}
+
 	memset(init_read_buf, 0, sizeof(init_read_buf));
 
 	total_read_len = 0;
@@ -666,3 +748,104 @@ free_bufs:
 	*out_nbyte = 0;
 	return NULL;
 }
+
+int serial_drv_get_fd(struct serial_drv_handle_t *serial_drv_handle)
+{
+	if (!serial_drv_handle)
+		return FAILURE;
+
+	return serial_drv_handle->file_desc;
+}
+
+int serial_drv_set_nonblocking(struct serial_drv_handle_t *serial_drv_handle,
+		int enable)
+{
+	if (!serial_drv_handle || serial_drv_handle->file_desc < 0)
+		return FAILURE;
+
+	return set_read_access_nonblocking(serial_drv_handle, enable);
+}
+
+static void reset_rx_frame(struct serial_drv_handle_t *serial_drv_handle)
+{
+	mem_free(serial_drv_handle->rx_buf);
+	serial_drv_handle->rx_buf_len = 0;
+	serial_drv_handle->rx_buf_read = 0;
+	serial_drv_handle->rx_hdr_len = 0;
+}
+
+/* Same two step TLV parsing as serial_drv_read(), but returns as soon as
+ * driver has no more data. Progress so far is kept in handle */
+uint8_t * serial_drv_read_nonblocking(struct serial_drv_handle_t *serial_drv_handle,
+		uint32_t *out_nbyte)
+{
+	int count = 0;
+	uint8_t *buf = NULL;
+	const char* ep_name = CTRL_EP_NAME_RESP;
+	uint16_t init_read_len = SIZE_OF_TYPE + SIZE_OF_LENGTH + strlen(ep_name) +
+		SIZE_OF_TYPE + SIZE_OF_LENGTH;
+	struct serial_drv_handle_t *h = serial_drv_handle;
+
+	if (!h || h->file_desc < 0 || !out_nbyte ||
+	    init_read_len > RX_TLV_HDR_MAX_LEN) {
+		printf("%s:%u Invalid parameter\n",__func__,__LINE__);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*out_nbyte = 0;
+
+	/* Driver hands out whole frames, nothing to collect */
+	if (h->msg_buf)
+		return serial_drv_read_msg(h, out_nbyte);
+
+	/* 1. Fixed length part: endpoint and data length */
+	while (h->rx_hdr_len < init_read_len) {
+		count = read(h->file_desc, h->rx_hdr + h->rx_hdr_len,
+				init_read_len - h->rx_hdr_len);
+		if (count <= 0) {
+			if (!count)
+				errno = ENODEV;
+			return NULL;
+		}
+		h->rx_hdr_len += count;
+	}
+
+	if (!h->rx_buf) {
+		if ((parse_tlv(h->rx_hdr, &h->rx_buf_len) != SUCCESS) ||
+		    !h->rx_buf_len) {
+			reset_rx_frame(h);
+			errno = EBADMSG;
+			return NULL;
+		}
+
+		h->rx_buf = (uint8_t *)hosted_calloc(1, h->rx_buf_len);
+		if (!h->rx_buf) {
+			printf("%s, Failed to allocate memory \n", __func__);
+			reset_rx_frame(h);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	/* 2. Variable length part: protobuf payload */
+	while (h->rx_buf_read < h->rx_buf_len) {
+		count = read(h->file_desc, h->rx_buf + h->rx_buf_read,
+				h->rx_buf_len - h->rx_buf_read);
+		if (count <= 0) {
+			if (!count)
+				errno = ENODEV;
+			return NULL;
+		}
+		h->rx_buf_read += count;
+	}
+
+	buf = h->rx_buf;
+	*out_nbyte = h->rx_buf_len;
+
+	/* frame handed over to caller */
+	h->rx_buf = NULL;
+	reset_rx_frame(h);
+
+	return buf;
+}
@@ -43,6 +43,26 @@ int transport_pserial_close(void);
 int transport_pserial_send(uint8_t* data, uint16_t data_length);
 
 /* Read and return number of bytes and buffer from serial interface
+ * Buffer is to be released with transport_pserial_read_done()
  **/
 uint8_t * transport_pserial_read(uint32_t *out_nbyte);
+
+/* Release buffer returned by transport_pserial_read
+ **/
+void transport_pserial_read_done(uint8_t *buf);
+
+#ifndef MCU_SYS
+/* Get pollable file descriptor of serial interface
+ **/
+int transport_pserial_get_fd(void);
+
+/* Switch reads on serial interface to non-blocking or back
+ **/
+int transport_pserial_set_nonblocking(int enable);
+
+/* Non-blocking read of buffer from serial interface
+ * Returns NULL with errno EAGAIN till complete buffer is received
+ **/
+uint8_t * transport_pserial_read_nonblocking(uint32_t *out_nbyte);
+#endif
 #endif
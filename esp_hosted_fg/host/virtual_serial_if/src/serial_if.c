@@ -203,3 +203,30 @@ uint8_t * transport_pserial_read(uint32_t *out_nbyte)
 	/* Two step parsing TLV is moved in serial_drv_read */
 	return serial_drv_read(serial_handle, out_nbyte);
 }
+
+void transport_pserial_read_done(uint8_t *buf)
+{
+#ifdef MCU_SYS
+	mem_free(buf);
+#else
+	/* Linux port may hand out reused buffer */
+	serial_drv_read_done(serial_handle, buf);
+#endif
+}
+
+#ifndef MCU_SYS
+int transport_pserial_get_fd(void)
+{
+	return serial_drv_get_fd(serial_handle);
+}
+
+int transport_pserial_set_nonblocking(int enable)
+{
+	return serial_drv_set_nonblocking(serial_handle, enable);
+}
+
+uint8_t * transport_pserial_read_nonblocking(uint32_t *out_nbyte)
+{
+	return serial_drv_read_nonblocking(serial_handle, out_nbyte);
+}
+#endif
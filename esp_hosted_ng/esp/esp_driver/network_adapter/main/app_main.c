@@ -47,6 +47,10 @@
 #include "slave_bt.c"
 #include "stats.h"
 #include "esp_mac.h"
+#if CONFIG_ESP_TX_SCHED_DRR
+#include "esp_timer.h"
+#include "tx_sched.h"
+#endif
 
 static const char TAG[] = "FW_MAIN";
 
@@ -82,6 +86,22 @@ interface_context_t *if_context = NULL;
 interface_handle_t *if_handle = NULL;
 
 QueueHandle_t to_host_queue[MAX_PRIORITY_QUEUES] = {NULL};
+/* Counts buffers across all to_host_queue, send_task sleeps on it */
+static SemaphoreHandle_t to_host_sem = NULL;
+
+#if CONFIG_ESP_TX_SCHED_DRR
+static struct tx_sched to_host_sched;
+static const uint16_t to_host_quantum[MAX_PRIORITY_QUEUES] = {
+    [PRIO_Q_HIGH] = CONFIG_ESP_TX_SCHED_QUANTUM_HIGH,
+    [PRIO_Q_MID] = CONFIG_ESP_TX_SCHED_QUANTUM_MID,
+    [PRIO_Q_LOW] = CONFIG_ESP_TX_SCHED_QUANTUM_LOW,
+};
+static const char * const to_host_q_names[MAX_PRIORITY_QUEUES] = {
+    [PRIO_Q_HIGH] = "high",
+    [PRIO_Q_MID] = "mid",
+    [PRIO_Q_LOW] = "low",
+};
+#endif
 
 #if CONFIG_ESP_SPI_HOST_INTERFACE
 #ifdef CONFIG_IDF_TARGET_ESP32S2
@@ -231,7 +251,7 @@ esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb)
 
     /* ESP_LOGI(TAG, "Slave -> Host: AP data packet\n"); */
     /* ESP_LOG_BUFFER_HEXDUMP("RX", buffer, len, ESP_LOG_INFO); */
-    ret = xQueueSend(to_host_queue[PRIO_Q_LOW], &buf_handle, portMAX_DELAY);
+    ret = send_to_host(PRIO_Q_LOW, &buf_handle);
 
     if (ret != pdTRUE) {
         ESP_LOGE(TAG, "Slave -> Host: Failed to send buffer\n");
@@ -269,7 +289,7 @@ esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb)
     buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
     buf_handle.pkt_type = PACKET_TYPE_DATA;
 
-    ret = xQueueSend(to_host_queue[PRIO_Q_LOW], &buf_handle, portMAX_DELAY);
+    ret = send_to_host(PRIO_Q_LOW, &buf_handle);
 
     if (ret != pdTRUE) {
         ESP_LOGE(TAG, "Slave -> Host: Failed to send buffer\n");
@@ -308,7 +328,15 @@ void process_tx_pkt(interface_buffer_handle_t *buf_handle)
 
 esp_err_t send_to_host(uint8_t prio_q_idx, interface_buffer_handle_t *buf_handle)
 {
-    return xQueueSend(to_host_queue[prio_q_idx], buf_handle, portMAX_DELAY);
+#if CONFIG_ESP_TX_SCHED_DRR
+    buf_handle->enqueue_time = esp_timer_get_time();
+#endif
+    esp_err_t ret = xQueueSend(to_host_queue[prio_q_idx], buf_handle, portMAX_DELAY);
+
+    if (ret == pdTRUE)
+        xSemaphoreGive(to_host_sem);
+
+    return ret;
 }
 
 /* Send data to host */
@@ -319,42 +347,42 @@ void send_task(void* pvParameters)
     int d_total = 0;
 #endif
     interface_buffer_handle_t buf_handle = {0};
-    uint16_t high_prio_pkt_waiting = 0;
-    uint16_t mid_prio_pkt_waiting = 0;
-    uint16_t low_prio_pkt_waiting = 0;
+    int prio_q_idx = -1;
 
     while (1) {
-        high_prio_pkt_waiting = uxQueueMessagesWaiting(to_host_queue[PRIO_Q_HIGH]);
-        mid_prio_pkt_waiting = uxQueueMessagesWaiting(to_host_queue[PRIO_Q_MID]);
-        low_prio_pkt_waiting = uxQueueMessagesWaiting(to_host_queue[PRIO_Q_LOW]);
-
-        if (high_prio_pkt_waiting) {
-            while (high_prio_pkt_waiting) {
-                if (xQueueReceive(to_host_queue[PRIO_Q_HIGH], &buf_handle, portMAX_DELAY)) {
-                    process_tx_pkt(&buf_handle);
-                }
-                high_prio_pkt_waiting--;
-            }
-        } else if (mid_prio_pkt_waiting) {
-            if (xQueueReceive(to_host_queue[PRIO_Q_MID], &buf_handle, portMAX_DELAY)) {
-                process_tx_pkt(&buf_handle);
-            }
-        } else if (low_prio_pkt_waiting) {
-            if (xQueueReceive(to_host_queue[PRIO_Q_LOW], &buf_handle, portMAX_DELAY)) {
-#if CONFIG_ESP_SDIO_HOST_INTERFACE
-                if (power_save_on && wow.magic_pkt) {
-                    if (is_wakeup_needed(&buf_handle)) {
-                        ESP_LOGI(TAG, "Wakeup on Magic packet");
-                        wake_host();
-                        buf_handle.flag = 0xFF;
-                    }
-                }
+        /* One count per queued buffer, so a buffer is always found below */
+        xSemaphoreTake(to_host_sem, portMAX_DELAY);
+
+#if CONFIG_ESP_TX_SCHED_DRR
+        if (CONFIG_ESP_TX_SCHED_STATS_INTERVAL_SEC &&
+            esp_timer_get_time() - to_host_sched.stats_logged_at >
+            SEC_TO_USEC((int64_t)CONFIG_ESP_TX_SCHED_STATS_INTERVAL_SEC))
+            tx_sched_log_stats(&to_host_sched);
+
+        prio_q_idx = tx_sched_dequeue(&to_host_sched, &buf_handle);
+#else
+        if (xQueueReceive(to_host_queue[PRIO_Q_HIGH], &buf_handle, 0))
+            prio_q_idx = PRIO_Q_HIGH;
+        else if (xQueueReceive(to_host_queue[PRIO_Q_MID], &buf_handle, 0))
+            prio_q_idx = PRIO_Q_MID;
+        else if (xQueueReceive(to_host_queue[PRIO_Q_LOW], &buf_handle, 0))
+            prio_q_idx = PRIO_Q_LOW;
+        else
+            prio_q_idx = -1;
 #endif
-                process_tx_pkt(&buf_handle);
+        if (prio_q_idx < 0)
+            continue;
+
+#if CONFIG_ESP_SDIO_HOST_INTERFACE
+        if (prio_q_idx == PRIO_Q_LOW && power_save_on && wow.magic_pkt) {
+            if (is_wakeup_needed(&buf_handle)) {
+                ESP_LOGI(TAG, "Wakeup on Magic packet");
+                wake_host();
+                buf_handle.flag = 0xFF;
             }
-        } else {
-            vTaskDelay(1);
         }
+#endif
+        process_tx_pkt(&buf_handle);
     }
 }
 
@@ -736,6 +764,14 @@ void app_main()
         assert(to_host_queue[prio_q_idx] != NULL);
     }
 
+    to_host_sem = xSemaphoreCreateCounting(TO_HOST_QUEUE_SIZE * MAX_PRIORITY_QUEUES, 0);
+    assert(to_host_sem != NULL);
+
+#if CONFIG_ESP_TX_SCHED_DRR
+    tx_sched_init(&to_host_sched, to_host_queue, to_host_quantum, to_host_q_names,
+            CONFIG_ESP_TX_SCHED_STARVATION_LIMIT);
+#endif
+
     assert(xTaskCreate(recv_task, "recv_task", TASK_DEFAULT_STACK_SIZE, NULL, TASK_DEFAULT_PRIO, NULL) == pdTRUE);
     assert(xTaskCreate(send_task, "send_task", TASK_DEFAULT_STACK_SIZE, NULL, TASK_DEFAULT_PRIO, NULL) == pdTRUE);
 
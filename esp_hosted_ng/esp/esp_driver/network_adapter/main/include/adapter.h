@@ -4,6 +4,12 @@
 #ifndef __ESP_NETWORK_ADAPTER__H
 #define __ESP_NETWORK_ADAPTER__H
 
+#ifdef __KERNEL__
+  #include <linux/string.h>
+#else
+  #include <string.h>
+#endif
+
 #ifndef __packed
 #define __packed        __attribute__((__packed__))
 #endif
@@ -19,6 +25,8 @@
 
 /* ESP Payload Header Flags */
 #define MORE_FRAGMENT                   (1 << 0)
+/* Another frame follows in the same SDIO buffer (host to ESP aggregation) */
+#define MORE_AGGR_FRAMES                (1 << 1)
 #define MAX_SSID_LEN                    32
 #define OTA_CHUNK_SIZE                  1016
 
@@ -98,6 +106,12 @@ enum ESP_CAPABILITIES {
 	ESP_CHECKSUM_ENABLED = (1 << 7),
 };
 
+/* Sent in ESP_BOOTUP_EXT_CAPABILITY, as ESP_CAPABILITIES is full */
+enum ESP_EXT_CAPABILITIES {
+	ESP_SDIO_RX_AGGREGATION = (1 << 0),
+	ESP_SPI_PREQUEUED_TRANS = (1 << 1),
+};
+
 typedef enum {
 	ESP_TEST_RAW_TP_HOST_TO_ESP = (1 << 0),
 	ESP_TEST_RAW_TP_ESP_TO_HOST = (1 << 1)
@@ -113,6 +127,7 @@ enum ESP_BOOTUP_TAG_TYPE {
 	ESP_BOOTUP_SPI_CLK_MHZ,
 	ESP_BOOTUP_FIRMWARE_CHIP_ID,
 	ESP_BOOTUP_TEST_RAW_TP,
+	ESP_BOOTUP_EXT_CAPABILITY,
 };
 
 enum COMMAND_CODE {
@@ -441,16 +456,44 @@ struct fw_data {
 
 
 
+/* Checksum is 16 bit sum of all bytes. Bytes are summed a word at a time,
+ * in two 16 bit lanes, folding the lanes before they can overflow. */
+#define CHECKSUM_FOLD_WORDS 128
+
 static inline uint16_t compute_checksum(uint8_t *buf, uint16_t len)
 {
 	uint16_t checksum = 0;
-	uint16_t i = 0;
+	uint32_t lanes = 0;
+	uint32_t val = 0;
+	uint16_t count = 0;
+
+	/* Head bytes till word aligned */
+	while (len && ((uintptr_t)buf & (sizeof(uint32_t) - 1))) {
+		checksum += *buf++;
+		len--;
+	}
 
-	while (i < len) {
-		checksum += buf[i];
-		i++;
+	while (len >= sizeof(uint32_t)) {
+		count = len / sizeof(uint32_t);
+		if (count > CHECKSUM_FOLD_WORDS)
+			count = CHECKSUM_FOLD_WORDS;
+		len -= count * sizeof(uint32_t);
+
+		lanes = 0;
+		while (count--) {
+			/* Aligned by now, memcpy compiles to a plain load
+			 * without type punning the byte buffer */
+			memcpy(&val, buf, sizeof(val));
+			buf += sizeof(val);
+			lanes += (val & 0x00FF00FF) + ((val >> 8) & 0x00FF00FF);
+		}
+		checksum += (lanes & 0xFFFF) + (lanes >> 16);
 	}
 
+	/* Tail bytes */
+	while (len--)
+		checksum += *buf++;
+
 	return checksum;
 }
 
@@ -64,6 +64,9 @@ typedef struct {
     uint16_t payload_len;
     uint16_t seq_num;
     uint8_t  pkt_type;
+#if CONFIG_ESP_TX_SCHED_DRR
+    uint32_t enqueue_time;  /* us, for queue delay stats */
+#endif
 
     void (*free_buf_handle)(void *buf_handle);
 } interface_buffer_handle_t;
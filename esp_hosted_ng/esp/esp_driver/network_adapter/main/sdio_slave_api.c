@@ -45,6 +45,16 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
 static esp_err_t sdio_reset(interface_handle_t *handle);
 static void sdio_deinit(interface_handle_t *handle);
 
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+/* Receive buffer from host which still has frames left to be processed */
+static struct {
+    sdio_slave_buf_handle_t handle;
+    uint8_t *buf;
+    size_t len;
+    size_t pos;
+} rx_aggr;
+#endif
+
 static uint8_t gpio_oob = CONFIG_HOST_WAKEUP_GPIO;
 extern volatile uint8_t power_save_on;
 extern SemaphoreHandle_t wakeup_sem;
@@ -335,6 +345,13 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
     *pos = LENGTH_1_BYTE;                 pos++; len++;
     *pos = cap;                           pos++; len++;
 
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+    /* TLV - Extended capability */
+    *pos = ESP_BOOTUP_EXT_CAPABILITY;     pos++; len++;
+    *pos = LENGTH_1_BYTE;                 pos++; len++;
+    *pos = ESP_SDIO_RX_AGGREGATION;       pos++; len++;
+#endif
+
     /* TLV - FW data */
     *pos = ESP_BOOTUP_FW_DATA;            pos++; len++;
     *pos = sizeof(struct fw_data);        pos++; len++;
@@ -382,6 +399,10 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
     struct esp_payload_header *header = NULL;
 #if CONFIG_ESP_SDIO_CHECKSUM
     uint16_t rx_checksum = 0, checksum = 0;
+#endif
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+    uint8_t more_frames = 0;
+    size_t next_pos = 0;
 #endif
     uint16_t len = 0;
     size_t sdio_read_len = 0;
@@ -395,14 +416,56 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
         return ESP_FAIL;
     }
 
-    sdio_slave_recv(&(buf_handle->sdio_buf_handle), &(buf_handle->payload),
-                    &(sdio_read_len), portMAX_DELAY);
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+    if (rx_aggr.handle) {
+        /* Next frame from the previous aggregated buffer */
+        buf_handle->sdio_buf_handle = rx_aggr.handle;
+        buf_handle->payload = rx_aggr.buf + rx_aggr.pos;
+        sdio_read_len = rx_aggr.len - rx_aggr.pos;
+    } else
+#endif
+    {
+        sdio_slave_recv(&(buf_handle->sdio_buf_handle), &(buf_handle->payload),
+                        &(sdio_read_len), portMAX_DELAY);
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+        rx_aggr.buf = buf_handle->payload;
+        rx_aggr.len = sdio_read_len;
+        rx_aggr.pos = 0;
+#endif
+    }
     buf_handle->payload_len = sdio_read_len & 0xFFFF;
 
     header = (struct esp_payload_header *) buf_handle->payload;
 
     len = le16toh(header->len) + le16toh(header->offset);
 
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+    /* Host computes checksum before setting the aggregation flag */
+    more_frames = header->flags & MORE_AGGR_FRAMES;
+    header->flags &= ~MORE_AGGR_FRAMES;
+
+    if (len > sdio_read_len) {
+        rx_aggr.handle = NULL;
+        sdio_read_done(buf_handle->sdio_buf_handle);
+        return ESP_FAIL;
+    }
+
+    next_pos = rx_aggr.pos + ((len + 3) & ~3);
+
+    if (more_frames &&
+        (next_pos + sizeof(struct esp_payload_header) <= rx_aggr.len)) {
+        /* Buffer is given back to driver along with its last frame */
+        rx_aggr.handle = buf_handle->sdio_buf_handle;
+        rx_aggr.pos = next_pos;
+        buf_handle->free_buf_handle = NULL;
+    } else {
+        rx_aggr.handle = NULL;
+        buf_handle->free_buf_handle = sdio_read_done;
+    }
+#else
+    buf_handle->free_buf_handle = sdio_read_done;
+#endif
+
 #if CONFIG_ESP_SDIO_CHECKSUM
     rx_checksum = le16toh(header->checksum);
     header->checksum = 0;
@@ -414,6 +477,10 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
     checksum = compute_checksum(buf_handle->payload, len);
 
     if (checksum != rx_checksum) {
+#if CONFIG_ESP_SDIO_RX_AGGREGATION
+        /* Drop rest of the aggregated buffer as well */
+        rx_aggr.handle = NULL;
+#endif
         sdio_read_done(buf_handle->sdio_buf_handle);
         return ESP_FAIL;
     }
@@ -421,7 +488,6 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
 
     buf_handle->if_type = header->if_type;
     buf_handle->if_num = header->if_num;
-    buf_handle->free_buf_handle = sdio_read_done;
 #if 0
     ESP_LOGE(TAG, "\nFrom Host");
     ESP_LOG_BUFFER_HEXDUMP("h->s", buf_handle->payload, len, ESP_LOG_INFO);
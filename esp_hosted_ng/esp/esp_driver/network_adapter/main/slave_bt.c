@@ -31,7 +31,6 @@
 #endif
 
 static const char BT_TAG[] = "FW_BT";
-extern QueueHandle_t to_host_queue[MAX_PRIORITY_QUEUES];
 
 #if BLUETOOTH_HCI
 /* ***** HCI specific part ***** */
@@ -73,7 +72,7 @@ static int host_rcv_pkt(uint8_t *data, uint16_t len)
 #if CONFIG_ESP_BT_DEBUG
     ESP_LOG_BUFFER_HEXDUMP("bt_tx", data, len, ESP_LOG_INFO);
 #endif
-    ret = xQueueSend(to_host_queue[PRIO_Q_MID], &buf_handle, portMAX_DELAY);
+    ret = send_to_host(PRIO_Q_MID, &buf_handle);
 
     if (ret != pdTRUE) {
         ESP_LOGE(BT_TAG, "HCI send packet: Failed to send buffer\n");
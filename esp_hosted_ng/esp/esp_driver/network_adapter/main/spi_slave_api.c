@@ -153,6 +153,18 @@ static uint8_t gpio_data_ready = CONFIG_ESP_SPI_GPIO_DATA_READY;
 static QueueHandle_t spi_rx_queue[MAX_PRIORITY_QUEUES] = {NULL};
 static QueueHandle_t spi_tx_queue[MAX_PRIORITY_QUEUES] = {NULL};
 
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+/* Real data transactions loaded in SPI driver but not yet completed */
+static uint8_t spi_data_trans_queued;
+static portMUX_TYPE spi_data_trans_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Handshake is held high while at least this many transactions are queued in
+ * SPI driver, so host may keep as many transfers in flight */
+#define SPI_HS_PREQUEUE_DEPTH   2
+/* Transactions queued in SPI driver, including one loaded in hardware */
+static int16_t spi_trans_loaded;
+#endif
+
 static interface_handle_t * esp_spi_init(void);
 static int32_t esp_spi_write(interface_handle_t *handle,
                              interface_buffer_handle_t *buf_handle);
@@ -233,6 +245,13 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
     *pos = LENGTH_1_BYTE;                 pos++; len++;
     *pos = cap;                           pos++; len++;
 
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+    /* TLV - Extended capability */
+    *pos = ESP_BOOTUP_EXT_CAPABILITY;     pos++; len++;
+    *pos = LENGTH_1_BYTE;                 pos++; len++;
+    *pos = ESP_SPI_PREQUEUED_TRANS;       pos++; len++;
+#endif
+
     /* TLV - FW data */
     *pos = ESP_BOOTUP_FW_DATA;            pos++; len++;
     *pos = sizeof(struct fw_data);        pos++; len++;
@@ -268,8 +287,16 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
 
     /* indicate waiting data on ready pin */
     WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1ULL << gpio_data_ready));
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+    /* Fill the driver queue so that next transaction is loaded
+     * right after current one completes */
+    for (int i = 0; i < SPI_QUEUE_SIZE; i++) {
+        queue_next_transaction();
+    }
+#else
     /* process first data packet here to start transactions */
     queue_next_transaction();
+#endif
 
     return ESP_OK;
 }
@@ -277,16 +304,26 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
 /* Invoked after transaction is queued and ready for pickup by master */
 static void IRAM_ATTR spi_post_setup_cb(spi_slave_transaction_t *trans)
 {
+#if !CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
     /* ESP peripheral ready for spi transaction. Set hadnshake line high. */
     WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1ULL << gpio_handshake));
+#endif
 }
 
 /* Invoked after transaction is sent/received.
  * Use this to set the handshake line low */
 static void IRAM_ATTR spi_post_trans_cb(spi_slave_transaction_t *trans)
 {
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+    portENTER_CRITICAL_ISR(&spi_data_trans_lock);
+    if (--spi_trans_loaded < SPI_HS_PREQUEUE_DEPTH) {
+        WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1ULL << gpio_handshake));
+    }
+    portEXIT_CRITICAL_ISR(&spi_data_trans_lock);
+#else
     /* Clear handshake line */
     WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1ULL << gpio_handshake));
+#endif
 }
 
 static uint8_t * get_next_tx_buffer(uint32_t *len)
@@ -319,8 +356,18 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
         return buf_handle.payload;
     }
 
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+    /* Real data may still be queued ahead of this buffer in SPI driver.
+     * Keep ready line asserted till it is transferred */
+    portENTER_CRITICAL(&spi_data_trans_lock);
+    if (!spi_data_trans_queued) {
+        WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1ULL << gpio_data_ready));
+    }
+    portEXIT_CRITICAL(&spi_data_trans_lock);
+#else
     /* No real data pending, clear ready line and indicate host an idle state */
     WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1ULL << gpio_data_ready));
+#endif
 
     /* Create empty dummy buffer */
     sendbuf = heap_caps_malloc(RX_BUF_SIZE, MALLOC_CAP_DMA);
@@ -439,10 +486,26 @@ static void queue_next_transaction(void)
     /* Transaction len */
     spi_trans->length = RX_BUF_SIZE * SPI_BITS_PER_WORD;
 
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+    /* Account before queueing, transaction may complete right away */
+    if (len) {
+        portENTER_CRITICAL(&spi_data_trans_lock);
+        spi_data_trans_queued++;
+        portEXIT_CRITICAL(&spi_data_trans_lock);
+    }
+#endif
+
     ret = spi_slave_queue_trans(ESP_SPI_CONTROLLER, spi_trans, portMAX_DELAY);
 
     if (ret != ESP_OK) {
         ESP_LOGI(TAG, "Failed to queue next SPI transfer\n");
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+        if (len) {
+            portENTER_CRITICAL(&spi_data_trans_lock);
+            spi_data_trans_queued--;
+            portEXIT_CRITICAL(&spi_data_trans_lock);
+        }
+#endif
         free(spi_trans->rx_buffer);
         spi_trans->rx_buffer = NULL;
         free((void *)spi_trans->tx_buffer);
@@ -451,6 +514,15 @@ static void queue_next_transaction(void)
         spi_trans = NULL;
         return;
     }
+
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+    /* Counted only once queued, so host is never told of more than there are */
+    portENTER_CRITICAL(&spi_data_trans_lock);
+    if (++spi_trans_loaded >= SPI_HS_PREQUEUE_DEPTH) {
+        WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1ULL << gpio_handshake));
+    }
+    portEXIT_CRITICAL(&spi_data_trans_lock);
+#endif
 }
 
 static void spi_transaction_post_process_task(void* pvParameters)
@@ -483,6 +555,17 @@ static void spi_transaction_post_process_task(void* pvParameters)
 
         /*ESP_LOG_BUFFER_HEXDUMP(TAG, spi_trans->tx_buffer, 32, ESP_LOG_INFO);*/
 
+#if CONFIG_ESP_SPI_PREQUEUE_TRANSACTIONS
+        if (spi_trans->tx_buffer &&
+            ((struct esp_payload_header *) spi_trans->tx_buffer)->len) {
+            portENTER_CRITICAL(&spi_data_trans_lock);
+            if (spi_data_trans_queued) {
+                spi_data_trans_queued--;
+            }
+            portEXIT_CRITICAL(&spi_data_trans_lock);
+        }
+#endif
+
         /* Free any tx buffer, data is not relevant anymore */
         if (spi_trans->tx_buffer) {
             free((void *)spi_trans->tx_buffer);
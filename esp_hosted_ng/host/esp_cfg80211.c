@@ -293,8 +293,9 @@ struct wireless_dev *esp_cfg80211_add_iface(struct wiphy *wiphy,
 		return NULL;
 	}
 
-	ndev = ALLOC_NETDEV(sizeof(struct esp_wifi_device), name, name_assign_type,
-			ether_setup);
+	/* One tx queue per CPU, up to ESP_TX_QUEUES */
+	ndev = ALLOC_NETDEV_MQS(sizeof(struct esp_wifi_device), name, name_assign_type,
+			ether_setup, min_t(unsigned int, num_online_cpus(), ESP_TX_QUEUES), 1);
 
 	if (!ndev)
 		return ERR_PTR(-ENOMEM);
@@ -3,10 +3,13 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
+#include "esp_stats.h"
 
 #define DEBUGFS_DIR_NAME "esp32"
 #define LOG_LEVEL "log_level"
 #define VERSION "version"
+#define TX_LATENCY "tx_latency"
+#define TX_CREDITS "tx_credits"
 
 #define DEBUGFS_TODO 0
 
@@ -23,6 +26,8 @@ struct esp32_debugfs {
 	struct dentry *debugfs_dir;
 	struct dentry *log_level_file; /* log level for host dmesg */
 	struct dentry *version;
+	struct dentry *tx_latency;
+	struct dentry *tx_credits;
 #if DEBUGFS_TODO
 	struct dentry *host_log_level_file; /* log level for host logs in debugfs logger */
 	struct dentry *host_log_file; /* debugfs host logger */
@@ -65,6 +70,45 @@ static ssize_t version_read(struct file *file, char __user *buf, size_t count, l
 	return simple_read_from_buffer(buf, count, ppos, version_str, strlen(version_str));
 }
 
+static ssize_t tx_latency_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	char hist_str[768];
+	int len;
+
+	len = esp_latency_hist_show(&tx_latency_hist, hist_str, sizeof(hist_str));
+
+	return simple_read_from_buffer(buf, count, ppos, hist_str, len);
+}
+
+// Any write resets the histogram
+static ssize_t tx_latency_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	esp_latency_hist_reset(&tx_latency_hist);
+
+	return count;
+}
+
+static ssize_t tx_credits_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	char stats_str[96];
+	int len;
+
+	len = scnprintf(stats_str, sizeof(stats_str),
+			"stalls: %u\ndrops: %u\nwrite_errors: %u\n",
+			tx_credit_stats.stalls, tx_credit_stats.drops,
+			tx_credit_stats.write_errors);
+
+	return simple_read_from_buffer(buf, count, ppos, stats_str, len);
+}
+
+// Any write resets the counters
+static ssize_t tx_credits_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	memset(&tx_credit_stats, 0, sizeof(tx_credit_stats));
+
+	return count;
+}
+
 // Write operation for the debugfs file
 static ssize_t log_level_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 {
@@ -200,6 +244,16 @@ static const struct file_operations version_ops = {
 	.read = version_read,
 };
 
+static const struct file_operations tx_latency_ops = {
+	.read = tx_latency_read,
+	.write = tx_latency_write,
+};
+
+static const struct file_operations tx_credits_ops = {
+	.read = tx_credits_read,
+	.write = tx_credits_write,
+};
+
 // Module initialization function
 int debugfs_init(void)
 {
@@ -226,6 +280,18 @@ int debugfs_init(void)
 		goto cleanup;
 	}
 
+	debugfs->tx_latency = debugfs_create_file(TX_LATENCY, 0644, debugfs->debugfs_dir, NULL, &tx_latency_ops);
+	if (!debugfs->tx_latency) {
+		esp_err("Failed to create debugfs %s file\n", TX_LATENCY);
+		goto cleanup;
+	}
+
+	debugfs->tx_credits = debugfs_create_file(TX_CREDITS, 0644, debugfs->debugfs_dir, NULL, &tx_credits_ops);
+	if (!debugfs->tx_credits) {
+		esp_err("Failed to create debugfs %s file\n", TX_CREDITS);
+		goto cleanup;
+	}
+
 #if DEBUGFS_TODO
 	debugfs->host_log_level_file = debugfs_create_file(DEBUGFS_LOG_LEVEL, 0644, debugfs_dir, NULL, &debugfs_log_level_ops);
 	if (!debugfs->debugfs_log_level_file) {
@@ -280,6 +346,14 @@ void debugfs_exit(void)
 		debugfs_remove(debugfs->version);
 		debugfs->version = NULL;
 	}
+	if (debugfs->tx_latency) {
+		debugfs_remove(debugfs->tx_latency);
+		debugfs->tx_latency = NULL;
+	}
+	if (debugfs->tx_credits) {
+		debugfs_remove(debugfs->tx_credits);
+		debugfs->tx_credits = NULL;
+	}
 	if (debugfs->debugfs_dir) {
 		debugfs_remove(debugfs->debugfs_dir);
 		debugfs->debugfs_dir = NULL;
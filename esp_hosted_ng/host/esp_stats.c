@@ -48,8 +48,10 @@ static int raw_tp_tx_process(void *data)
 	struct esp_adapter *adapter = NULL;
 	struct esp_wifi_device *priv = NULL;
 	struct esp_skb_cb *cb = NULL;
+	struct netdev_queue *txq = NULL;
 	u8 pad_len = 0;
 	u16 total_len = 0;
+	int queue = 0;
 
 	pad_len = sizeof(struct esp_payload_header);
 	total_len = TEST_RAW_TP__BUF_SIZE + pad_len;
@@ -87,7 +89,17 @@ static int raw_tp_tx_process(void *data)
 					cpu_to_le16(compute_checksum(tx_skb->data,
 								(TEST_RAW_TP__BUF_SIZE + pad_len)));
 			}
+			/* Shares staging ring of a running tx queue with xmit path */
+			queue = esp_tx_running_queue(priv->ndev);
+			if (queue < 0) {
+				dev_kfree_skb(tx_skb);
+				continue;
+			}
+			skb_set_queue_mapping(tx_skb, queue);
+			txq = netdev_get_tx_queue(priv->ndev, queue);
+			__netif_tx_lock_bh(txq);
 			ret = esp_send_packet(esp_get_adapter(), tx_skb);
+			__netif_tx_unlock_bh(txq);
 			if (!ret)
 				test_raw_tp_len += TEST_RAW_TP__BUF_SIZE;
 
@@ -181,6 +193,50 @@ void update_test_raw_tp_rx_stats(u16 len)
 }
 #endif
 
+/* Enqueue to transport write latency of host to ESP packets */
+struct esp_latency_hist tx_latency_hist;
+
+void esp_latency_hist_update(struct esp_latency_hist *hist, u64 delta_ns)
+{
+	u64 delta_us = delta_ns / NSEC_PER_USEC;
+	u8 idx = 0;
+
+	if (!hist)
+		return;
+
+	while ((idx < ESP_LATENCY_HIST_BUCKETS - 1) && (delta_us >= (1ULL << idx)))
+		idx++;
+
+	hist->bucket[idx]++;
+
+	if (delta_ns > hist->max_ns)
+		hist->max_ns = delta_ns;
+}
+
+int esp_latency_hist_show(struct esp_latency_hist *hist, char *buf, size_t size)
+{
+	int len = 0;
+	u8 idx = 0;
+
+	for (idx = 0; idx < ESP_LATENCY_HIST_BUCKETS - 1; idx++)
+		len += scnprintf(buf + len, size - len, "< %6llu us: %u\n",
+				1ULL << idx, hist->bucket[idx]);
+
+	len += scnprintf(buf + len, size - len, ">= %5llu us: %u\n",
+			1ULL << (ESP_LATENCY_HIST_BUCKETS - 2), hist->bucket[idx]);
+	len += scnprintf(buf + len, size - len, "max: %llu us\n",
+			hist->max_ns / NSEC_PER_USEC);
+
+	return len;
+}
+
+void esp_latency_hist_reset(struct esp_latency_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+struct esp_tx_credit_stats tx_credit_stats;
+
 void process_test_capabilities(u32 raw_tp_mode)
 {
 #if TEST_RAW_TP
@@ -15,6 +15,8 @@
 #include <linux/inetdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/spinlock.h>
+#include <linux/kfifo.h>
+#include <linux/rcupdate.h>
 #include <net/cfg80211.h>
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/hci_core.h>
@@ -63,6 +65,11 @@ struct esp_adapter;
 
 #define MAX_COUNTRY_LEN 3
 
+/* Netdev TX queues per interface, each staged in its own ring */
+#define ESP_TX_QUEUES           4
+#define ESP_TX_RING_SIZE        64
+#define ESP_TX_RING_SLOTS       (ESP_MAX_INTERFACE * ESP_TX_QUEUES)
+
 enum adapter_flags_e {
 	ESP_CLEANUP_IN_PROGRESS,    /* Driver unloading or ESP reseted */
 	ESP_CMD_INIT_DONE,          /* Cmd component is initialized with esp_commands_setup() */
@@ -90,6 +97,7 @@ struct esp_adapter {
 	uint8_t                 if_type;
 	atomic_t                state;
 	uint32_t                capabilities;
+	uint32_t                ext_capabilities;
 
 	/* Possible types:
 	 * struct esp_sdio_context */
@@ -128,6 +136,12 @@ struct esp_adapter {
 
 	unsigned long           state_flags;
 	int                     chipset;
+
+	/* Open interfaces whose tx rings transport drains, published under
+	 * RCU. tx_ring_lock serializes open/stop only */
+	struct esp_wifi_device __rcu *tx_ring_priv[ESP_MAX_INTERFACE];
+	spinlock_t              tx_ring_lock;
+	uint8_t                 tx_ring_next;
 };
 
 struct esp_device {
@@ -136,6 +150,11 @@ struct esp_device {
 	struct esp_adapter      *adapter;
 };
 
+/* Single producer (ndo_start_xmit of one queue), single consumer (transport) */
+struct esp_tx_ring {
+	DECLARE_KFIFO(skbs, struct sk_buff *, ESP_TX_RING_SIZE);
+};
+
 struct esp_wifi_device {
 	struct wireless_dev     wdev;
 	struct net_device       *ndev;
@@ -173,10 +192,21 @@ struct esp_wifi_device {
 	uint8_t                 tx_pwr;
 	uint32_t                rssi;
 	bool                    local_disconnect_req;
+
+	struct napi_struct      napi;
+	struct sk_buff_head     rx_q;
+
+	struct esp_tx_ring      tx_ring[ESP_TX_QUEUES];
+	/* Bumped on esp_stop(), BQL of frames staged before is not completed */
+	u32                     tx_epoch;
 };
 
 
 struct esp_skb_cb {
 	struct esp_wifi_device      *priv;
+	ktime_t                     enqueue_time;
+	/* Set on staging, for esp_tx_skb_done() */
+	u32                         tx_epoch;
+	u32                         bql_len;
 };
 #endif
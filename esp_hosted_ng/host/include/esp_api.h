@@ -27,8 +27,10 @@ struct esp_wifi_device *get_priv_from_payload_header(struct esp_payload_header *
 struct sk_buff *esp_alloc_skb(u32 len);
 int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb);
 u8 esp_is_bt_supported_over_sdio(u32 cap);
-void esp_tx_pause(struct esp_wifi_device *priv);
-void esp_tx_resume(struct esp_wifi_device *priv);
+int esp_tx_stage_skb(struct sk_buff *skb);
+struct sk_buff *esp_tx_dequeue_staged(struct esp_adapter *adapter, u32 max_len);
+void esp_tx_skb_done(struct sk_buff *skb);
+bool esp_tx_staged_pending(struct esp_adapter *adapter);
 void esp_init_priv(struct net_device *ndev);
 void esp_port_open(struct esp_wifi_device *priv);
 void esp_port_close(struct esp_wifi_device *priv);
@@ -36,6 +38,7 @@ void esp_remove_network_interfaces(struct esp_adapter *adapter);
 void print_capabilities(u32 cap);
 void process_capabilities(struct esp_adapter *adapter);
 int esp_is_tx_queue_paused(struct esp_wifi_device *priv);
+int esp_tx_running_queue(struct net_device *ndev);
 int esp_deinit_module(struct esp_adapter *adapter);
 int esp_validate_chipset(struct esp_adapter *adapter, u8 chipset);
 int esp_adjust_spi_clock(struct esp_adapter *adapter, u8 spi_clk_mhz);
@@ -33,11 +33,11 @@ static inline void ether_addr_copy(u8 *dst, const u8 *src)
 #endif
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 17, 0)
-  #define ALLOC_NETDEV(size, name, type, setup) \
-    alloc_netdev(size, name, setup)
+  #define ALLOC_NETDEV_MQS(size, name, type, setup, txqs, rxqs) \
+    alloc_netdev_mqs(size, name, setup, txqs, rxqs)
 #else
-  #define ALLOC_NETDEV(size, name, type, setup) \
-    alloc_netdev(size, name, type, setup)
+  #define ALLOC_NETDEV_MQS(size, name, type, setup, txqs, rxqs) \
+    alloc_netdev_mqs(size, name, type, setup, txqs, rxqs)
 #endif
 
 
@@ -150,6 +150,17 @@ static inline void *skb_put_data(struct sk_buff *skb, const void *data,
 #define NETIF_RX_NI(skb)	netif_rx_ni(skb)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0))
+#define napi_complete_done(napi, work_done)	napi_complete(napi)
+#endif
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0))
+#define NETIF_NAPI_ADD(ndev, napi, poll)	netif_napi_add(ndev, napi, poll)
+#else
+#define NETIF_NAPI_ADD(ndev, napi, poll) \
+	netif_napi_add(ndev, napi, poll, NAPI_POLL_WEIGHT)
+#endif
+
 static inline
 void CFG80211_RX_ASSOC_RESP(struct net_device *dev,
 			    struct cfg80211_bss *bss,
@@ -227,4 +238,8 @@ static inline bool wireless_dev_current_bss_exists(struct wireless_dev *wdev)
   #define del_timer timer_delete_sync
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0))
+  #define skb_free_frag(data) put_page(virt_to_head_page(data))
+#endif
+
 #endif
@@ -25,4 +25,27 @@ void esp_raw_tp_queue_resume(void);
 void test_raw_tp_cleanup(void);
 void update_test_raw_tp_rx_stats(u16 len);
 
+/* Bucket n counts samples below 2^n usec, last bucket counts the rest */
+#define ESP_LATENCY_HIST_BUCKETS 16
+
+struct esp_latency_hist {
+	u32 bucket[ESP_LATENCY_HIST_BUCKETS];
+	u64 max_ns;
+};
+
+extern struct esp_latency_hist tx_latency_hist;
+
+void esp_latency_hist_update(struct esp_latency_hist *hist, u64 delta_ns);
+int esp_latency_hist_show(struct esp_latency_hist *hist, char *buf, size_t size);
+void esp_latency_hist_reset(struct esp_latency_hist *hist);
+
+/* Transport TX credit accounting */
+struct esp_tx_credit_stats {
+	u32 stalls;	/* TX had to wait for slave buffers */
+	u32 drops;	/* Packets dropped after waiting for slave buffers */
+	u32 write_errors; /* Packets lost to failed CMD53 writes */
+};
+
+extern struct esp_tx_credit_stats tx_credit_stats;
+
 #endif
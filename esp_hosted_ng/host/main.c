@@ -72,18 +72,47 @@ void esp_process_new_packet_intr(struct esp_adapter *adapter)
 		queue_work(adapter->if_rx_workqueue, &adapter->if_rx_work);
 }
 
+/* Transports map frags directly, which needs them in lowmem */
+static bool esp_skb_has_highmem_frags(struct sk_buff *skb)
+{
+	u8 idx = 0;
+
+	for (idx = 0; idx < skb_shinfo(skb)->nr_frags; idx++) {
+		if (PageHighMem(skb_frag_page(&skb_shinfo(skb)->frags[idx])))
+			return true;
+	}
+
+	return false;
+}
+
+static u16 compute_skb_checksum(struct sk_buff *skb)
+{
+	const skb_frag_t *frag = NULL;
+	u16 checksum = 0;
+	u8 idx = 0;
+
+	checksum = compute_checksum(skb->data, skb_headlen(skb));
+
+	for (idx = 0; idx < skb_shinfo(skb)->nr_frags; idx++) {
+		frag = &skb_shinfo(skb)->frags[idx];
+		checksum += compute_checksum(skb_frag_address(frag), skb_frag_size(frag));
+	}
+
+	return checksum;
+}
+
 static int process_tx_packet(struct sk_buff *skb)
 {
 	struct esp_wifi_device *priv = NULL;
 	struct esp_skb_cb *cb = NULL;
 	struct esp_payload_header *payload_header = NULL;
-	struct sk_buff *new_skb = NULL;
 	int ret = 0;
-	u8 pad_len = 0, realloc_skb = 0;
+	u8 pad_len = 0;
 	u16 len = 0;
 	u16 total_len = 0;
+	u32 headroom = 0;
+	u32 new_headroom = 0;
 	static u8 c;
-	u8 *pos = NULL;
 
 	c++;
 	/* Get the priv */
@@ -96,11 +125,6 @@ static int process_tx_packet(struct sk_buff *skb)
 		return NETDEV_TX_OK;
 	}
 
-	if (netif_queue_stopped((const struct net_device *) priv->ndev)) {
-		esp_info("Netif queue stopped\n");
-		return NETDEV_TX_BUSY;
-	}
-
 	if (host_sleep) {
 		return NETDEV_TX_BUSY;
 	}
@@ -115,44 +139,43 @@ static int process_tx_packet(struct sk_buff *skb)
 	/* Align buffer length */
 	pad_len += SKB_DATA_ADDR_ALIGNMENT - (total_len % SKB_DATA_ADDR_ALIGNMENT);
 
-	if (skb_headroom(skb) < pad_len) {
-		/* Headroom is not sufficient */
-		realloc_skb = 1;
+	if (esp_skb_has_highmem_frags(skb) && skb_linearize(skb)) {
+		priv->stats.tx_errors++;
+		dev_kfree_skb(skb);
+		esp_err("Failed to linearize SKB");
+		return NETDEV_TX_OK;
 	}
 
-	if (realloc_skb || !IS_ALIGNED((unsigned long) skb->data, SKB_DATA_ADDR_ALIGNMENT)) {
-		/* Realloc SKB */
-		if (skb_linearize(skb)) {
-			priv->stats.tx_errors++;
-			dev_kfree_skb(skb);
-			esp_err("Failed to linearize SKB");
-			return NETDEV_TX_OK;
-		}
+	/* ESP has no checksum engine, NETIF_F_HW_CSUM is served here */
+	if (skb->ip_summed == CHECKSUM_PARTIAL && skb_checksum_help(skb)) {
+		priv->stats.tx_errors++;
+		dev_kfree_skb(skb);
+		esp_err("Failed to checksum SKB");
+		return NETDEV_TX_OK;
+	}
+
+	headroom = skb_headroom(skb);
 
-		new_skb = esp_alloc_skb(skb->len + pad_len);
+	if (headroom < pad_len || skb_header_cloned(skb) ||
+	    !IS_ALIGNED((unsigned long) skb->data - pad_len, SKB_DATA_ADDR_ALIGNMENT)) {
+		/* Realloc only linear part, page frags are kept as is. New
+		 * headroom is pad_len past an aligned offset, so that pushed
+		 * header lands aligned */
+		new_headroom = pad_len;
+		if (headroom > pad_len)
+			new_headroom += ALIGN(headroom - pad_len, SKB_DATA_ADDR_ALIGNMENT);
 
-		if (!new_skb) {
-			esp_err("Failed to allocate SKB");
+		if (pskb_expand_head(skb, new_headroom - headroom, 0, GFP_ATOMIC)) {
+			esp_err("Failed to realloc SKB");
 			priv->stats.tx_errors++;
 			dev_kfree_skb(skb);
 			return NETDEV_TX_OK;
 		}
-
-		pos = new_skb->data;
-		pos += pad_len;
-
-		/* Populate new SKB */
-		skb_copy_from_linear_data(skb, pos, skb->len);
-		skb_put(new_skb, skb->len + pad_len);
-
-		/* Replace old SKB */
-		dev_kfree_skb_any(skb);
-		skb = new_skb;
-	} else {
-		/* Realloc is not needed, Make space for interface header */
-		skb_push(skb, pad_len);
 	}
 
+	/* Make space for interface header */
+	skb_push(skb, pad_len);
+
 	/* Set payload header */
 	payload_header = (struct esp_payload_header *) skb->data;
 	memset(payload_header, 0, pad_len);
@@ -164,7 +187,7 @@ static int process_tx_packet(struct sk_buff *skb)
 	payload_header->packet_type = PACKET_TYPE_DATA;
 
 	if (adapter.capabilities & ESP_CHECKSUM_ENABLED)
-		payload_header->checksum = cpu_to_le16(compute_checksum(skb->data, (len + pad_len)));
+		payload_header->checksum = cpu_to_le16(compute_skb_checksum(skb));
 
 	if (!priv->stop_data) {
 		ret = esp_send_packet(priv->adapter, skb);
@@ -303,6 +326,7 @@ static int process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8
 	}
 
 	clear_bit(ESP_INIT_DONE, &adapter->state_flags);
+	adapter->ext_capabilities = 0;
 	/* Deinit module if already initialized */
 	test_raw_tp_cleanup();
 	esp_deinit_module(adapter);
@@ -328,6 +352,9 @@ static int process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8
 		case ESP_BOOTUP_SPI_CLK_MHZ:
 			ret = esp_adjust_spi_clock(adapter, *(pos + 2));
 			break;
+		case ESP_BOOTUP_EXT_CAPABILITY:
+			adapter->ext_capabilities = *(pos + 2);
+			break;
 		default:
 			esp_warn("Unsupported tag=%x in bootup event\n", *pos);
 		}
@@ -373,12 +400,297 @@ static int process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8
 	}
 	set_bit(ESP_INIT_DONE, &adapter->state_flags);
 	print_capabilities(adapter->capabilities);
+	if (adapter->ext_capabilities & ESP_SDIO_RX_AGGREGATION)
+		esp_info("\t * SDIO TX aggregation\n");
+	if (adapter->ext_capabilities & ESP_SPI_PREQUEUED_TRANS)
+		esp_info("\t * SPI pre-queued transactions\n");
+
+	return 0;
+}
+
+/* Hand frames queued by rx work to the stack, within NAPI budget */
+static int esp_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct esp_wifi_device *priv = container_of(napi, struct esp_wifi_device, napi);
+	struct sk_buff *skb = NULL;
+	int work_done = 0;
+
+	while (work_done < budget) {
+		skb = skb_dequeue(&priv->rx_q);
+		if (!skb)
+			break;
+
+		priv->stats.rx_bytes += skb->len;
+		priv->stats.rx_packets++;
+		napi_gro_receive(napi, skb);
+		work_done++;
+	}
+
+	if (work_done < budget) {
+		napi_complete_done(napi, work_done);
+
+		/* Frame may have been queued while completing */
+		if (!skb_queue_empty(&priv->rx_q))
+			napi_schedule(napi);
+	}
+
+	return work_done;
+}
+
+static void esp_netdev_rx(struct esp_wifi_device *priv, struct sk_buff *skb)
+{
+	if (!netif_running(priv->ndev)) {
+		priv->stats.rx_dropped++;
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	skb_queue_tail(&priv->rx_q, skb);
+
+	/* Called from process context, let softirq run poll on bh enable */
+	local_bh_disable();
+	napi_schedule(&priv->napi);
+	local_bh_enable();
+}
+
+/*
+ * Netdev TX staging
+ *
+ * Every netdev tx queue owns a single producer, single consumer ring. The
+ * producer is ndo_start_xmit, which the stack already serializes per queue,
+ * so cores transmitting on different queues share no lock or counter. The
+ * transport thread is the only consumer and drains rings round robin.
+ * Open interfaces are published to it under RCU, tx_ring_lock only orders
+ * esp_open()/esp_stop(). BQL covers a frame from staging till transport is
+ * done with it and calls esp_tx_skb_done(), which bounds the whole backlog.
+ */
+int esp_tx_stage_skb(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	struct esp_wifi_device *priv = cb->priv;
+	struct netdev_queue *txq = NULL;
+	struct esp_tx_ring *ring = NULL;
+	u16 queue = skb_get_queue_mapping(skb);
+
+	if (!priv || !priv->ndev || queue >= priv->ndev->real_num_tx_queues)
+		return -EINVAL;
+
+	if (!netif_running(priv->ndev))
+		return -ENETDOWN;
+
+	txq = netdev_get_tx_queue(priv->ndev, queue);
+	ring = &priv->tx_ring[queue];
+
+	if (kfifo_is_full(&ring->skbs)) {
+		netif_tx_stop_queue(txq);
+		return -EBUSY;
+	}
+
+	cb->tx_epoch = READ_ONCE(priv->tx_epoch);
+	cb->bql_len = skb->len;
+
+	/* Account before publishing, consumer may complete it right away */
+	netdev_tx_sent_queue(txq, skb->len);
+	kfifo_put(&ring->skbs, skb);
+
+	if (kfifo_is_full(&ring->skbs)) {
+		netif_tx_stop_queue(txq);
+
+		/* Pairs with barrier in esp_tx_dequeue_staged() */
+		smp_mb();
+		if (!kfifo_is_full(&ring->skbs))
+			netif_tx_start_queue(txq);
+	}
 
 	return 0;
 }
 
+/* Next staged frame, or NULL if none or the next one exceeds max_len */
+struct sk_buff *esp_tx_dequeue_staged(struct esp_adapter *adapter, u32 max_len)
+{
+	struct esp_wifi_device *priv = NULL;
+	struct esp_tx_ring *ring = NULL;
+	struct netdev_queue *txq = NULL;
+	struct sk_buff *skb = NULL;
+	u8 idx = 0, slot = 0;
+	u16 queue = 0;
+
+	rcu_read_lock();
+
+	for (idx = 0; idx < ESP_TX_RING_SLOTS; idx++) {
+		slot = (adapter->tx_ring_next + idx) % ESP_TX_RING_SLOTS;
+		priv = rcu_dereference(adapter->tx_ring_priv[slot / ESP_TX_QUEUES]);
+		queue = slot % ESP_TX_QUEUES;
+
+		if (!priv || queue >= priv->ndev->real_num_tx_queues)
+			continue;
+
+		ring = &priv->tx_ring[queue];
+		if (!kfifo_peek(&ring->skbs, &skb))
+			continue;
+
+		if (skb->len > max_len) {
+			skb = NULL;
+			break;
+		}
+
+		kfifo_skip(&ring->skbs);
+		adapter->tx_ring_next = (slot + 1) % ESP_TX_RING_SLOTS;
+		break;
+	}
+
+	if (skb) {
+		txq = netdev_get_tx_queue(priv->ndev, queue);
+
+		/* Pairs with barrier in esp_tx_stage_skb() */
+		smp_mb();
+		if (netif_tx_queue_stopped(txq) && !kfifo_is_full(&ring->skbs))
+			netif_tx_wake_queue(txq);
+#if TEST_RAW_TP
+		if (raw_tp_mode != 0 && !netif_xmit_stopped(txq))
+			esp_raw_tp_queue_resume();
+#endif
+	}
+
+	rcu_read_unlock();
+
+	return skb;
+}
+
+/*
+ * Transport is done with a frame from esp_tx_dequeue_staged(), sent or
+ * dropped. Completes it in BQL, unless its queue was reset since staging.
+ * Called from transport thread only, like dequeue.
+ */
+void esp_tx_skb_done(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+	struct esp_wifi_device *priv = cb->priv;
+
+	rcu_read_lock();
+
+	/* esp_tx_rings_stop() waits for this section before resetting queues */
+	if (priv && READ_ONCE(priv->tx_epoch) == cb->tx_epoch)
+		netdev_tx_completed_queue(netdev_get_tx_queue(priv->ndev,
+					skb_get_queue_mapping(skb)), 1, cb->bql_len);
+
+	rcu_read_unlock();
+}
+
+bool esp_tx_staged_pending(struct esp_adapter *adapter)
+{
+	struct esp_wifi_device *priv = NULL;
+	bool pending = false;
+	u8 iface_idx = 0, queue = 0;
+
+	rcu_read_lock();
+
+	for (iface_idx = 0; iface_idx < ESP_MAX_INTERFACE && !pending; iface_idx++) {
+		priv = rcu_dereference(adapter->tx_ring_priv[iface_idx]);
+		if (!priv)
+			continue;
+
+		for (queue = 0; queue < priv->ndev->real_num_tx_queues; queue++) {
+			if (!kfifo_is_empty(&priv->tx_ring[queue].skbs)) {
+				pending = true;
+				break;
+			}
+		}
+	}
+
+	rcu_read_unlock();
+
+	return pending;
+}
+
+static void esp_tx_rings_start(struct esp_wifi_device *priv)
+{
+	struct esp_adapter *adapter = priv->adapter;
+	u8 iface_idx = 0;
+
+	spin_lock_bh(&adapter->tx_ring_lock);
+
+	for (iface_idx = 0; iface_idx < ESP_MAX_INTERFACE; iface_idx++) {
+		if (!rcu_access_pointer(adapter->tx_ring_priv[iface_idx])) {
+			rcu_assign_pointer(adapter->tx_ring_priv[iface_idx], priv);
+			break;
+		}
+	}
+
+	spin_unlock_bh(&adapter->tx_ring_lock);
+
+	netif_tx_start_all_queues(priv->ndev);
+}
+
+static void esp_tx_rings_stop(struct esp_wifi_device *priv)
+{
+	struct esp_adapter *adapter = priv->adapter;
+	struct sk_buff *skb = NULL;
+	u8 iface_idx = 0, queue = 0;
+
+	spin_lock_bh(&adapter->tx_ring_lock);
+
+	for (iface_idx = 0; iface_idx < ESP_MAX_INTERFACE; iface_idx++) {
+		if (rcu_access_pointer(adapter->tx_ring_priv[iface_idx]) == priv)
+			RCU_INIT_POINTER(adapter->tx_ring_priv[iface_idx], NULL);
+	}
+
+	spin_unlock_bh(&adapter->tx_ring_lock);
+
+	/* Frames still with transport must not complete into reset queues */
+	WRITE_ONCE(priv->tx_epoch, priv->tx_epoch + 1);
+
+	/* Transport is out of the rings and esp_tx_skb_done() after this */
+	synchronize_rcu();
+
+	/* Stack has quiesced xmit by now, so rings have no producer either */
+	for (queue = 0; queue < priv->ndev->real_num_tx_queues; queue++) {
+		while (kfifo_get(&priv->tx_ring[queue].skbs, &skb)) {
+			priv->stats.tx_dropped++;
+			dev_kfree_skb_any(skb);
+		}
+		netdev_tx_reset_queue(netdev_get_tx_queue(priv->ndev, queue));
+	}
+}
+
+#if defined(CONFIG_XPS) && (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0))
+/* Spread CPUs over tx queues, so each core mostly feeds a ring of its own */
+static void esp_tx_set_xps(struct net_device *ndev)
+{
+	cpumask_var_t mask;
+	unsigned int cpu;
+	u16 queue = 0;
+
+	if (ndev->real_num_tx_queues < 2 || !zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	for (queue = 0; queue < ndev->real_num_tx_queues; queue++) {
+		cpumask_clear(mask);
+		for_each_online_cpu(cpu) {
+			if (cpu % ndev->real_num_tx_queues == queue)
+				cpumask_set_cpu(cpu, mask);
+		}
+		netif_set_xps_queue(ndev, mask, queue);
+	}
+
+	free_cpumask_var(mask);
+}
+#else
+static inline void esp_tx_set_xps(struct net_device *ndev) { }
+#endif
+
 static int esp_open(struct net_device *ndev)
 {
+	struct esp_wifi_device *priv = netdev_priv(ndev);
+
+	if (!priv)
+		return 0;
+
+	skb_queue_purge(&priv->rx_q);
+	napi_enable(&priv->napi);
+
+	esp_tx_set_xps(ndev);
+	esp_tx_rings_start(priv);
 	return 0;
 }
 
@@ -389,6 +701,10 @@ static int esp_stop(struct net_device *ndev)
 	if (!priv)
 		return 0;
 
+	napi_disable(&priv->napi);
+	skb_queue_purge(&priv->rx_q);
+	esp_tx_rings_stop(priv);
+
 	esp_mark_scan_done_and_disconnect(priv, false);
 	esp_port_close(priv);
 	return 0;
@@ -477,9 +793,23 @@ static const struct net_device_ops esp_netdev_ops = {
 
 void esp_init_priv(struct net_device *ndev)
 {
+	struct esp_wifi_device *priv = netdev_priv(ndev);
+	u8 queue = 0;
+
 	ndev->netdev_ops = &esp_netdev_ops;
 	ndev->needed_headroom = roundup(sizeof(struct esp_payload_header) +
 			INTERFACE_HEADER_PADDING, 4);
+
+	/* Transports gather skb head and page frags themselves. Core keeps SG
+	 * only with a checksum feature, checksum is filled in by driver */
+	ndev->features |= NETIF_F_SG | NETIF_F_HW_CSUM;
+	ndev->hw_features |= NETIF_F_SG | NETIF_F_HW_CSUM;
+
+	skb_queue_head_init(&priv->rx_q);
+	NETIF_NAPI_ADD(ndev, &priv->napi, esp_napi_poll);
+
+	for (queue = 0; queue < ESP_TX_QUEUES; queue++)
+		INIT_KFIFO(priv->tx_ring[queue].skbs);
 }
 
 static int esp_add_network_ifaces(struct esp_adapter *adapter)
@@ -800,7 +1130,7 @@ static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 			esp_port_open(priv);
 			skb->dev = priv->ndev;
 			skb->protocol = eth_type_trans(skb, priv->ndev);
-			netif_rx(skb);
+			esp_netdev_rx(priv, skb);
 
 		} else if (payload_header->packet_type == PACKET_TYPE_DATA) {
 
@@ -808,10 +1138,8 @@ static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 			skb->protocol = eth_type_trans(skb, priv->ndev);
 			skb->ip_summed = CHECKSUM_NONE;
 
-			priv->stats.rx_bytes += skb->len;
 			/* Forward skb to kernel */
-			NETIF_RX_NI(skb);
-			priv->stats.rx_packets++;
+			esp_netdev_rx(priv, skb);
 		} else if (payload_header->packet_type == PACKET_TYPE_COMMAND_RESPONSE) {
 			process_cmd_resp(priv->adapter, skb);
 		} else if (payload_header->packet_type == PACKET_TYPE_EVENT) {
@@ -894,35 +1222,27 @@ bool esp_is_valid_hardware_id(int hardware_id)
 	}
 }
 
-int esp_is_tx_queue_paused(struct esp_wifi_device *priv)
+/* Tx queue of ndev that can take a frame, or -1 if all of them are stopped */
+int esp_tx_running_queue(struct net_device *ndev)
 {
-	if (!priv || !priv->ndev)
-		return 0;
-
-	if ((priv->ndev &&
-		    !netif_queue_stopped((const struct net_device *)priv->ndev)))
-		return 1;
-    return 0;
-}
+	u16 queue = 0;
 
-void esp_tx_pause(struct esp_wifi_device *priv)
-{
-	if (!priv || !priv->ndev)
-		return;
-
-	if (!netif_queue_stopped((const struct net_device *)priv->ndev)) {
-		netif_stop_queue(priv->ndev);
+	for (queue = 0; queue < ndev->real_num_tx_queues; queue++) {
+		if (!netif_xmit_stopped(netdev_get_tx_queue(ndev, queue)))
+			return queue;
 	}
+
+	return -1;
 }
 
-void esp_tx_resume(struct esp_wifi_device *priv)
+int esp_is_tx_queue_paused(struct esp_wifi_device *priv)
 {
 	if (!priv || !priv->ndev)
-		return;
+		return 0;
 
-	if (netif_queue_stopped((const struct net_device *)priv->ndev)) {
-		netif_wake_queue(priv->ndev);
-	}
+	if (esp_tx_running_queue(priv->ndev) >= 0)
+		return 1;
+    return 0;
 }
 
 struct sk_buff *esp_alloc_skb(u32 len)
@@ -1039,6 +1359,7 @@ static struct esp_adapter *init_adapter(void)
 	INIT_WORK(&adapter.if_rx_work, esp_if_rx_work);
 
 	skb_queue_head_init(&adapter.events_skb_q);
+	spin_lock_init(&adapter.tx_ring_lock);
 
 	adapter.events_wq = alloc_workqueue("ESP_EVENTS_WORKQUEUE", WQ_HIGHPRI, 0);
 
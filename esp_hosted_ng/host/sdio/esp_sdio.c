@@ -22,10 +22,9 @@
 #include "esp_utils.h"
 #include "esp_kernel_port.h"
 
-extern u32 raw_tp_mode;
 #define MAX_WRITE_RETRIES       2
-#define TX_MAX_PENDING_COUNT    200
-#define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
+#define TX_CREDIT_POLL_US       100
+#define TX_CREDIT_TIMEOUT_MS    1000
 
 #define CHECK_SDIO_RW_ERROR(ret) do {			\
 	if (ret)						\
@@ -33,7 +32,6 @@ extern u32 raw_tp_mode;
 } while (0);
 
 struct esp_sdio_context sdio_context;
-static atomic_t tx_pending;
 static atomic_t queue_items[MAX_PRIORITY_QUEUES];
 struct task_struct *tx_thread;
 volatile u8 host_sleep;
@@ -64,6 +62,25 @@ static void esp_process_interrupt(struct esp_sdio_context *context, u32 int_stat
 	}
 }
 
+/* Slave buffer token only moves forward; drop a stale read racing a newer one */
+static void update_tx_credits(struct esp_sdio_context *context, u32 token)
+{
+	unsigned long flags;
+
+	token = (token >> 16) & ESP_TX_BUFFER_MASK;
+
+	spin_lock_irqsave(&context->credit_lock, flags);
+	if (((token - context->tx_token) & ESP_TX_BUFFER_MASK) < (ESP_TX_BUFFER_MAX / 2))
+		context->tx_token = token;
+	spin_unlock_irqrestore(&context->credit_lock, flags);
+}
+
+static u32 get_tx_credits(struct esp_sdio_context *context)
+{
+	return (READ_ONCE(context->tx_token) + ESP_TX_BUFFER_MAX -
+			context->tx_buffer_count) % ESP_TX_BUFFER_MAX;
+}
+
 static void esp_handle_isr(struct sdio_func *func)
 {
 	struct esp_sdio_context *context = NULL;
@@ -103,6 +120,16 @@ static void esp_handle_isr(struct sdio_func *func)
 			(u8 *) int_status, sizeof(*int_status), ACQUIRE_LOCK);
 	CHECK_SDIO_RW_ERROR(ret);
 
+	/* TX thread is out of credits, refresh them while bus is already ours */
+	if (atomic_read(&context->credit_waiting)) {
+		ret = esp_read_reg(context, ESP_SLAVE_TOKEN_RDATA,
+				(u8 *) int_status, sizeof(*int_status), ACQUIRE_LOCK);
+		if (!ret) {
+			update_tx_credits(context, *int_status);
+			wake_up_interruptible(&context->credit_wait);
+		}
+	}
+
 	kfree(int_status);
 }
 
@@ -160,10 +187,9 @@ static int esp_slave_get_tx_buffer_num(struct esp_sdio_context *context, u32 *tx
 		return ret;
 	}
 
-	*len = (*len >> 16) & ESP_TX_BUFFER_MASK;
-	*len = (*len + ESP_TX_BUFFER_MAX - context->tx_buffer_count) % ESP_TX_BUFFER_MAX;
+	update_tx_credits(context, *len);
 
-	*tx_num = *len;
+	*tx_num = get_tx_credits(context);
 
 	kfree(len);
 	return ret;
@@ -279,6 +305,9 @@ static void esp_remove(struct sdio_func *func)
 			context->func = NULL;
 			context->adapter->dev = NULL;
 		}
+
+		kfree(context->tx_aggr_buf);
+		context->tx_aggr_buf = NULL;
 		memset(context, 0, sizeof(struct esp_sdio_context));
 	}
 	esp_dbg("ESP SDIO cleanup completed\n");
@@ -330,6 +359,9 @@ static int get_firmware_data(struct esp_sdio_context *context)
 		context->tx_buffer_count = 0;
 	esp_info("Tx Pos ======  %d\n", context->tx_buffer_count);
 
+	/* Slave may have been reset, so resync instead of moving forward */
+	WRITE_ONCE(context->tx_token, *val);
+
 	kfree(val);
 	return ret;
 }
@@ -356,6 +388,14 @@ static int init_context(struct esp_sdio_context *context)
 		skb_queue_head_init(&(sdio_context.tx_q[prio_q_idx]));
 		atomic_set(&queue_items[prio_q_idx], 0);
 	}
+	init_waitqueue_head(&context->tx_wait);
+	init_waitqueue_head(&context->credit_wait);
+	spin_lock_init(&context->credit_lock);
+	atomic_set(&context->credit_waiting, 0);
+
+	context->tx_aggr_buf = kzalloc(ESP_TX_AGGR_MAX_BUFS * ESP_RX_BUFFER_SIZE, GFP_KERNEL);
+	if (!context->tx_aggr_buf)
+		esp_warn("Failed to allocate TX aggregation buffer, aggregation disabled\n");
 
 	context->adapter->if_type = ESP_IF_TYPE_SDIO;
 
@@ -462,6 +502,7 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
 	struct esp_skb_cb *cb = NULL;
 	uint8_t prio = PRIO_Q_LOW;
+	int ret = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -482,18 +523,8 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	}
 
 	cb = (struct esp_skb_cb *)skb->cb;
-	if (cb && cb->priv && (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT)) {
-		esp_tx_pause(cb->priv);
-		dev_kfree_skb(skb);
-		skb = NULL;
-/*		esp_err("TX Pause busy");*/
-		return -EBUSY;
-	}
-
-	/* Enqueue SKB in tx_q */
-	atomic_inc(&tx_pending);
+	cb->enqueue_time = ktime_get();
 
-	/* Notify to process queue */
 	if (payload_header->if_type == ESP_INTERNAL_IF)
 		prio = PRIO_Q_HIGH;
 	else if (payload_header->if_type == ESP_HCI_IF)
@@ -501,49 +532,221 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	else
 		prio = PRIO_Q_LOW;
 
-	atomic_inc(&queue_items[prio]);
-	skb_queue_tail(&(sdio_context.tx_q[prio]), skb);
+	/* Enqueue SKB in tx_q, netdev frames go to per queue staging ring */
+	if (prio == PRIO_Q_LOW && cb->priv) {
+		ret = esp_tx_stage_skb(skb);
+		if (ret) {
+			dev_kfree_skb(skb);
+			skb = NULL;
+			return ret;
+		}
+	} else {
+		atomic_inc(&queue_items[prio]);
+		skb_queue_tail(&(sdio_context.tx_q[prio]), skb);
+	}
+
+	/* Notify to process queue */
+	wake_up_interruptible(&sdio_context.tx_wait);
 
 	return 0;
 }
 
-static int is_sdio_write_buffer_available(u32 buf_needed)
+/*
+ * Slave buffer credits are cached from TOKEN_RDATA and only re-read when the
+ * cache runs short. If the slave is still out of buffers after a short poll,
+ * the TX thread sleeps and the interrupt handler refreshes the credits on the
+ * next slave interrupt, with a periodic re-read as fallback. Packet is dropped
+ * only if no buffer frees up within TX_CREDIT_TIMEOUT_MS.
+ */
+static int wait_for_tx_credits(struct esp_sdio_context *context, u32 buf_needed)
+{
+	unsigned long timeout;
+	u8 retry = MAX_WRITE_RETRIES;
+	u32 credits = 0;
+	int ret = 0;
+
+	if (get_tx_credits(context) >= buf_needed)
+		return 0;
+
+	while (retry--) {
+		ret = esp_slave_get_tx_buffer_num(context, &credits, ACQUIRE_LOCK);
+		if (!ret && credits >= buf_needed)
+			return 0;
+
+		usleep_range(10, 50);
+	}
+
+	tx_credit_stats.stalls++;
+	timeout = jiffies + msecs_to_jiffies(TX_CREDIT_TIMEOUT_MS);
+	atomic_set(&context->credit_waiting, 1);
+	ret = 0;
+
+	while (get_tx_credits(context) < buf_needed) {
+		if (kthread_should_stop() || host_sleep ||
+		    (atomic_read(&context->adapter->state) < ESP_CONTEXT_READY) ||
+		    time_after(jiffies, timeout)) {
+			ret = -EBUSY;
+			break;
+		}
+
+		if (wait_event_interruptible_hrtimeout(context->credit_wait,
+				kthread_should_stop() ||
+				(get_tx_credits(context) >= buf_needed),
+				us_to_ktime(TX_CREDIT_POLL_US)))
+			esp_slave_get_tx_buffer_num(context, &credits, ACQUIRE_LOCK);
+	}
+
+	atomic_set(&context->credit_waiting, 0);
+
+	if (ret)
+		tx_credit_stats.drops++;
+
+	return ret;
+}
+
+/*
+ * Dequeue next frame in priority order, netdev staging rings last. Returns
+ * NULL if that frame is longer than max_len, so it stays queued for next
+ * write. tx_process() is the only consumer, so peeked skb stays at the head.
+ * staged is set if skb came from a netdev staging ring.
+ */
+static struct sk_buff *dequeue_tx_skb(struct esp_sdio_context *context, u32 max_len,
+		bool *staged)
+{
+	struct sk_buff *skb = NULL;
+	struct esp_skb_cb *cb = NULL;
+	u8 prio_q_idx = 0;
+
+	*staged = false;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (atomic_read(&queue_items[prio_q_idx]) <= 0)
+			continue;
+
+		skb = skb_peek(&(context->tx_q[prio_q_idx]));
+		if (!skb)
+			continue;
+
+		if (skb->len > max_len)
+			return NULL;
+
+		skb = skb_dequeue(&(context->tx_q[prio_q_idx]));
+		atomic_dec(&queue_items[prio_q_idx]);
+		break;
+	}
+
+	if (!skb) {
+		skb = esp_tx_dequeue_staged(context->adapter, max_len);
+		*staged = !!skb;
+	}
+	if (!skb)
+		return NULL;
+
+	cb = (struct esp_skb_cb *)skb->cb;
+	esp_latency_hist_update(&tx_latency_hist,
+			ktime_to_ns(ktime_sub(ktime_get(), cb->enqueue_time)));
+
+	return skb;
+}
+
+/* Free tx skb once transport is done with it, sent or not */
+static void free_tx_skb(struct sk_buff *tx_skb, bool staged)
 {
-#define BUFFER_AVAILABLE        1
-#define BUFFER_UNAVAILABLE      0
+	if (staged)
+		esp_tx_skb_done(tx_skb);
 
+	dev_kfree_skb(tx_skb);
+}
+
+/*
+ * Coalesce queued frames into a single CMD53 write.
+ *
+ * Every slave buffer (ESP_RX_BUFFER_SIZE) holds one or more complete frames,
+ * packed back to back at 4 byte alignment. A frame followed by another one in
+ * the same slave buffer carries MORE_AGGR_FRAMES, which the slave uses to
+ * split the buffer again. Frames never straddle slave buffers, so the number
+ * of slave buffers consumed is bounded by the credits already acquired.
+ * Frames are gathered from skb head and page frags, so this also serves as
+ * the bounce path for non-linear skbs, coalescing only if slave supports it.
+ */
+static int write_aggr_packets(struct esp_sdio_context *context, struct sk_buff *tx_skb,
+		bool staged)
+{
+	struct esp_payload_header *prev = NULL;
+	struct sk_buff_head sent_q, staged_q;
+	u32 max_bufs, buf_idx = 0, buf_offset = 0;
+	u32 len_to_send, max_len;
+	u8 *pos = NULL;
 	int ret = 0;
-	static u32 buf_available;
-	struct esp_sdio_context *context = &sdio_context;
-	u8 retry = MAX_WRITE_RETRIES;
 
-	/*If buffer needed are less than buffer available
-	  then only read for available buffer number from slave*/
-	if (buf_available < buf_needed) {
-		while (retry) {
-			ret = esp_slave_get_tx_buffer_num(context, &buf_available, ACQUIRE_LOCK);
+	/* Frames are freed only once the write completed, or failed */
+	__skb_queue_head_init(&sent_q);
+	__skb_queue_head_init(&staged_q);
 
-			if (buf_available < buf_needed) {
+	/* Caller made sure at least one buffer is there for tx_skb */
+	max_bufs = min_t(u32, get_tx_credits(context), ESP_TX_AGGR_MAX_BUFS);
 
-				/* Release SDIO and retry after delay*/
-				retry--;
-				usleep_range(10, 50);
-				continue;
-			}
+	while (tx_skb) {
+		pos = context->tx_aggr_buf + (buf_idx * ESP_RX_BUFFER_SIZE) + buf_offset;
+		skb_copy_bits(tx_skb, 0, pos, tx_skb->len);
+		prev = (struct esp_payload_header *) pos;
+		buf_offset += ALIGN(tx_skb->len, 4);
+		__skb_queue_tail(staged ? &staged_q : &sent_q, tx_skb);
 
+		if (!(context->adapter->ext_capabilities & ESP_SDIO_RX_AGGREGATION))
 			break;
+
+		/* Next frame may start another slave buffer, if credits allow */
+		if (buf_idx + 1 < max_bufs)
+			max_len = ESP_RX_BUFFER_SIZE;
+		else if (buf_offset < ESP_RX_BUFFER_SIZE)
+			max_len = ESP_RX_BUFFER_SIZE - buf_offset;
+		else
+			break;
+
+		tx_skb = dequeue_tx_skb(context, max_len, &staged);
+		if (!tx_skb)
+			break;
+
+		if (buf_offset + tx_skb->len > ESP_RX_BUFFER_SIZE) {
+			buf_idx++;
+			buf_offset = 0;
+		} else {
+			prev->flags |= MORE_AGGR_FRAMES;
 		}
 	}
 
-	if (buf_available >= buf_needed)
-		buf_available -= buf_needed;
+	len_to_send = roundup((buf_idx * ESP_RX_BUFFER_SIZE) + buf_offset, ESP_BLOCK_SIZE);
 
-	if (!retry) {
-		/* No buffer available at slave */
-		return BUFFER_UNAVAILABLE;
+	ret = esp_write_block(context, ESP_SLAVE_CMD53_END_ADDR - len_to_send,
+			context->tx_aggr_buf, len_to_send, ACQUIRE_LOCK);
+	if (ret) {
+		esp_err("Failed to send aggregated data: %d %d %u\n", ret, len_to_send,
+				skb_queue_len(&sent_q) + skb_queue_len(&staged_q));
+		tx_credit_stats.write_errors += skb_queue_len(&sent_q) +
+			skb_queue_len(&staged_q);
+	} else {
+		context->tx_buffer_count += buf_idx + 1;
+		context->tx_buffer_count = context->tx_buffer_count % ESP_TX_BUFFER_MAX;
 	}
 
-	return BUFFER_AVAILABLE;
+	__skb_queue_purge(&sent_q);
+	while ((tx_skb = __skb_dequeue(&staged_q)))
+		free_tx_skb(tx_skb, true);
+
+	return ret;
+}
+
+static bool is_tx_queue_empty(struct esp_sdio_context *context)
+{
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (!skb_queue_empty(&(context->tx_q[prio_q_idx])))
+			return false;
+	}
+
+	return !esp_tx_staged_pending(context->adapter);
 }
 
 static int tx_process(void *data)
@@ -556,8 +759,7 @@ static int tx_process(void *data)
 	struct sk_buff *tx_skb = NULL;
 	struct esp_adapter *adapter = (struct esp_adapter *) data;
 	struct esp_sdio_context *context = NULL;
-	struct esp_skb_cb *cb = NULL;
-	u8 retry;
+	bool staged = false;
 
 	context = adapter->if_context;
 
@@ -569,62 +771,46 @@ static int tx_process(void *data)
 			continue;
 		}
 
-		if (host_sleep) {
-			/* TODO: Use wait_event_interruptible_timeout */
-			msleep(100);
+		/* Sleep till write_packet() queues a packet or host resumes */
+		wait_event_interruptible(context->tx_wait,
+				kthread_should_stop() ||
+				(!host_sleep && !is_tx_queue_empty(context)));
+
+		if (kthread_should_stop())
+			break;
+
+		if (host_sleep)
 			continue;
-		}
 
-		if (atomic_read(&queue_items[PRIO_Q_HIGH]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_HIGH]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_HIGH]);
-		} else if (atomic_read(&queue_items[PRIO_Q_MID]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_MID]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_MID]);
-		} else if (atomic_read(&queue_items[PRIO_Q_LOW]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_LOW]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_LOW]);
-		} else {
-			/* esp_verbose("not ready high=%d mid=%d low=%d\n",
-					atomic_read(&queue_items[PRIO_Q_HIGH]),
-					atomic_read(&queue_items[PRIO_Q_MID]),
-					atomic_read(&queue_items[PRIO_Q_LOW])); */
-			msleep(1);
+		tx_skb = dequeue_tx_skb(context, U32_MAX, &staged);
+		if (!tx_skb) {
 			continue;
 		}
 
-		if (atomic_read(&tx_pending))
-			atomic_dec(&tx_pending);
-
-		retry = MAX_WRITE_RETRIES;
+		buf_needed = (tx_skb->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
 
-		/* resume network tx queue if bearable load */
-		cb = (struct esp_skb_cb *)tx_skb->cb;
-		if (cb && cb->priv && atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
-			esp_tx_resume(cb->priv);
-#if TEST_RAW_TP
-			if (raw_tp_mode != 0) {
-				esp_raw_tp_queue_resume();
-			}
-#endif
+		/* Wait till slave has buffers to take this packet */
+		ret = wait_for_tx_credits(context, buf_needed);
+		if (ret) {
+			free_tx_skb(tx_skb, staged);
+			continue;
 		}
 
-		buf_needed = (tx_skb->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
+		if (context->tx_aggr_buf &&
+		    (skb_is_nonlinear(tx_skb) ||
+		     ((adapter->ext_capabilities & ESP_SDIO_RX_AGGREGATION) &&
+		      !is_tx_queue_empty(context)))) {
+			/* Gather frags and any waiting frames in one transfer */
+			ret = write_aggr_packets(context, tx_skb, staged);
+			if (ret)
+				esp_dbg("aggregated write dropped batch: %d\n", ret);
+			tx_skb = NULL;
+			continue;
+		}
 
-		/*If SDIO slave buffer is available to write then only write data
-		else wait till buffer is available*/
-		ret = is_sdio_write_buffer_available(buf_needed);
-		if (!ret) {
-			dev_kfree_skb(tx_skb);
+		/* CMD53 needs contiguous buffer */
+		if (skb_linearize(tx_skb)) {
+			free_tx_skb(tx_skb, staged);
 			continue;
 		}
 
@@ -653,14 +839,15 @@ static int tx_process(void *data)
 
 		if (ret) {
 			/* drop the packet */
-			dev_kfree_skb(tx_skb);
+			tx_credit_stats.write_errors++;
+			free_tx_skb(tx_skb, staged);
 			continue;
 		}
 
 		context->tx_buffer_count += buf_needed;
 		context->tx_buffer_count = context->tx_buffer_count % ESP_TX_BUFFER_MAX;
 
-		dev_kfree_skb(tx_skb);
+		free_tx_skb(tx_skb, staged);
 		tx_skb = NULL;
 	}
 
@@ -727,7 +914,6 @@ static int esp_probe(struct sdio_func *func,
 	esp_info("ESP network device detected\n");
 
 	context = init_sdio_func(func, &ret);;
-	atomic_set(&tx_pending, 0);
 
 	if (!context) {
 		if (ret)
@@ -837,6 +1023,8 @@ static int esp_resume(struct device *dev)
 	msleep(100);
 	generate_slave_intr(context, BIT(ESP_POWER_SAVE_OFF));
 	host_sleep = 0;
+	/* Flush packets queued while host was asleep */
+	wake_up_interruptible(&context->tx_wait);
 	return 0;
 }
 
@@ -34,6 +34,9 @@
 #define ESP_TX_BUFFER_MAX              0x1000
 #define ESP_MAX_BUF_CNT                10
 
+/* Max slave buffers coalesced into one host to ESP CMD53 write */
+#define ESP_TX_AGGR_MAX_BUFS           8
+
 #define ESP_SLAVE_SLCHOST_BASE         0x3FF55000
 
 #define ESP_SLAVE_SCRATCH_REG_7        (ESP_SLAVE_SLCHOST_BASE + 0x8C)
@@ -84,6 +87,14 @@ struct esp_sdio_context {
 	u32                    rx_byte_count;
 	u32                    tx_buffer_count;
 	u32			sdio_clk_mhz;
+	u8                     *tx_aggr_buf;
+	wait_queue_head_t      tx_wait;
+
+	/* Last slave TOKEN_RDATA buffer count, credits = tx_token - tx_buffer_count */
+	spinlock_t             credit_lock;
+	u32                    tx_token;
+	atomic_t               credit_waiting;
+	wait_queue_head_t      credit_wait;
 };
 
 #endif
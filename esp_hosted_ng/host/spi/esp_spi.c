@@ -19,11 +19,13 @@
 #include "esp_cfg80211.h"
 
 #define SPI_INITIAL_CLK_MHZ     10
-#define TX_MAX_PENDING_COUNT    100
-#define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
 
-extern u32 raw_tp_mode;
 uint8_t g_spi_mode = SPI_MODE_2;
+
+static bool spi_pipeline;
+module_param(spi_pipeline, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_pipeline, "Submit SPI transfers asynchronously, overlapping rx processing with next transfer");
+
 static struct sk_buff *read_packet(struct esp_adapter *adapter);
 static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb);
 static void spi_exit(void);
@@ -34,7 +36,6 @@ volatile u8 data_path;
 volatile u8 host_sleep;
 static struct esp_spi_context spi_context;
 static char hardware_type = ESP_FIRMWARE_CHIP_UNRECOGNIZED;
-static atomic_t tx_pending;
 
 static struct esp_if_ops if_ops = {
 	.read		= read_packet,
@@ -45,8 +46,12 @@ static DEFINE_MUTEX(spi_lock);
 
 static void open_data_path(void)
 {
-	atomic_set(&tx_pending, 0);
 	msleep(200);
+
+	/* Slave may have loaded its transaction before we started listening */
+	if (gpio_get_value(HANDSHAKE_PIN))
+		set_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+
 	data_path = OPEN_DATAPATH;
 }
 
@@ -68,6 +73,8 @@ static irqreturn_t spi_data_ready_interrupt_handler(int irq, void *dev)
 static irqreturn_t spi_interrupt_handler(int irq, void *dev)
 {
 	/* ESP peripheral is ready for next SPI transaction */
+	set_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+
 	if (spi_context.spi_workqueue)
 		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
 
@@ -109,6 +116,7 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	u32 max_pkt_size = SPI_BUF_SIZE - sizeof(struct esp_payload_header);
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
 	struct esp_skb_cb *cb = NULL;
+	int ret = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -126,6 +134,12 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 		return -EPERM;
 	}
 
+	if (skb_shinfo(skb)->nr_frags > SPI_TX_MAX_FRAGS && skb_linearize(skb)) {
+		esp_err("Failed to linearize skb\n");
+		dev_kfree_skb(skb);
+		return -ENOMEM;
+	}
+
 	if (!data_path) {
 		esp_info("%u datapath closed\n", __LINE__);
 		dev_kfree_skb(skb);
@@ -133,24 +147,23 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	}
 
 	cb = (struct esp_skb_cb *)skb->cb;
-	if (cb && cb->priv && (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT)) {
-		esp_tx_pause(cb->priv);
-		dev_kfree_skb(skb);
-		skb = NULL;
-		esp_verbose("TX Pause busy");
-		if (spi_context.spi_workqueue)
-			queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
-		return -EBUSY;
-	}
 
-	/* Enqueue SKB in tx_q */
+	/* Enqueue SKB in tx_q, netdev frames go to per queue staging ring */
 	if (payload_header->if_type == ESP_INTERNAL_IF) {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_HIGH], skb);
 	} else if (payload_header->if_type == ESP_HCI_IF) {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_MID], skb);
+	} else if (cb->priv) {
+		ret = esp_tx_stage_skb(skb);
+		if (ret) {
+			esp_verbose("TX staging busy: %d", ret);
+			dev_kfree_skb(skb);
+			if (spi_context.spi_workqueue)
+				queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
+			return ret;
+		}
 	} else {
 		skb_queue_tail(&spi_context.tx_q[PRIO_Q_LOW], skb);
-		atomic_inc(&tx_pending);
 	}
 
 	if (spi_context.spi_workqueue)
@@ -211,16 +224,56 @@ int esp_deinit_module(struct esp_adapter *adapter)
 	return 0;
 }
 
-static int process_rx_buf(struct sk_buff *skb)
+static int spi_rx_ring_init(void)
+{
+	uint8_t idx = 0;
+
+	/* Sent when ESP has data for host but host has nothing to send */
+	spi_context.tx_dummy_buf = kzalloc(SPI_BUF_SIZE, GFP_KERNEL);
+	if (!spi_context.tx_dummy_buf)
+		return -ENOMEM;
+
+	for (idx = 0; idx < SPI_RX_RING_SIZE; idx++) {
+		spi_context.rx_ring[idx] = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+		if (!spi_context.rx_ring[idx])
+			return -ENOMEM;
+	}
+
+	spi_context.rx_ring_idx = 0;
+
+	return 0;
+}
+
+static void spi_rx_ring_deinit(void)
+{
+	uint8_t idx = 0;
+
+	for (idx = 0; idx < SPI_RX_RING_SIZE; idx++) {
+		if (spi_context.rx_ring[idx]) {
+			skb_free_frag(spi_context.rx_ring[idx]);
+			spi_context.rx_ring[idx] = NULL;
+		}
+	}
+
+	kfree(spi_context.tx_dummy_buf);
+	spi_context.tx_dummy_buf = NULL;
+}
+
+/*
+ * Validate frame received in ring buffer and hand it up as an skb built over
+ * the buffer itself. Returns 0 if buffer is consumed and ring slot needs refill.
+ */
+static int process_rx_buf(u8 *rx_buf)
 {
 	struct esp_payload_header *header;
+	struct sk_buff *skb = NULL;
 	u16 len = 0;
 	u16 offset = 0;
 
-	if (!skb)
+	if (!rx_buf)
 		return -EINVAL;
 
-	header = (struct esp_payload_header *) skb->data;
+	header = (struct esp_payload_header *) (rx_buf + SPI_RX_HEADROOM);
 
 	if (header->if_type >= ESP_MAX_IF) {
 		return -EINVAL;
@@ -228,7 +281,7 @@ static int process_rx_buf(struct sk_buff *skb)
 
 	offset = le16_to_cpu(header->offset);
 
-	/* Validate received SKB. Check len and offset fields */
+	/* Validate received buffer. Check len and offset fields */
 	if (offset != sizeof(struct esp_payload_header)) {
 		esp_info("offset_rcv[%d] != exp[%d], drop\n",
 				(int)offset, (int)sizeof(struct esp_payload_header));
@@ -246,15 +299,20 @@ static int process_rx_buf(struct sk_buff *skb)
 		return -EINVAL;
 	}
 
-	/* Trim SKB to actual size */
-	skb_trim(skb, len);
-
-
 	if (!data_path) {
 		esp_verbose("%u datapath closed\n", __LINE__);
 		return -EPERM;
 	}
 
+	skb = build_skb(rx_buf, SPI_RX_BUF_TRUESIZE);
+	if (!skb) {
+		esp_err("Failed to build rx skb\n");
+		return -ENOMEM;
+	}
+
+	skb_reserve(skb, SPI_RX_HEADROOM);
+	skb_put(skb, len);
+
 	/* enqueue skb for read_packet to pick it */
 	if (header->if_type == ESP_INTERNAL_IF)
 		skb_queue_tail(&spi_context.rx_q[PRIO_Q_HIGH], skb);
@@ -269,98 +327,320 @@ static int process_rx_buf(struct sk_buff *skb)
 	return 0;
 }
 
+/* staged is set if skb came from a netdev staging ring */
+static struct sk_buff *dequeue_tx_skb(bool *staged)
+{
+	struct sk_buff *tx_skb = NULL;
+
+	*staged = false;
+
+	tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_HIGH]);
+	if (!tx_skb)
+		tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_MID]);
+	if (!tx_skb)
+		tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_LOW]);
+	if (!tx_skb) {
+		tx_skb = esp_tx_dequeue_staged(spi_context.adapter, U32_MAX);
+		*staged = !!tx_skb;
+	}
+
+	return tx_skb;
+}
+
+/* Free tx skb once transfer is done with it, sent or not */
+static void free_tx_skb(struct sk_buff *tx_skb, bool staged)
+{
+	if (!tx_skb)
+		return;
+
+	if (staged)
+		esp_tx_skb_done(tx_skb);
+
+	dev_kfree_skb(tx_skb);
+}
+
+/*
+ * Lay out one SPI transaction over tx skb segments. Skb head and page frags
+ * are clocked out back to back with CS held, remainder of SPI_BUF_SIZE comes
+ * from dummy buffer. Received data lands contiguous in rx_buf.
+ */
+static void esp_spi_setup_msg(struct spi_message *msg, struct spi_transfer *trans,
+		struct sk_buff *tx_skb, u8 *rx_buf)
+{
+	const skb_frag_t *frag = NULL;
+	u32 offset = 0;
+	u8 num_trans = 0, idx = 0;
+
+	memset(trans, 0, sizeof(*trans) * SPI_MAX_TRANS_PER_MSG);
+
+	if (tx_skb) {
+		trans[num_trans].tx_buf = tx_skb->data;
+		trans[num_trans].len = skb_headlen(tx_skb);
+		num_trans++;
+
+		for (idx = 0; idx < skb_shinfo(tx_skb)->nr_frags; idx++) {
+			frag = &skb_shinfo(tx_skb)->frags[idx];
+			trans[num_trans].tx_buf = skb_frag_address(frag);
+			trans[num_trans].len = skb_frag_size(frag);
+			num_trans++;
+		}
+		esp_hex_dump_verbose("tx: ", tx_skb->data, 32);
+	}
+
+	spi_message_init(msg);
+
+	for (idx = 0; idx < num_trans; idx++) {
+		trans[idx].rx_buf = rx_buf + offset;
+		offset += trans[idx].len;
+	}
+
+	if (offset < SPI_BUF_SIZE) {
+		trans[num_trans].tx_buf = spi_context.tx_dummy_buf;
+		trans[num_trans].rx_buf = rx_buf + offset;
+		trans[num_trans].len = SPI_BUF_SIZE - offset;
+		num_trans++;
+	}
+
+	for (idx = 0; idx < num_trans; idx++) {
+		trans[idx].speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
+		spi_message_add_tail(&trans[idx], msg);
+	}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
+	if (hardware_type == ESP_FIRMWARE_CHIP_ESP32) {
+		trans[num_trans - 1].cs_change = 1;
+	}
+#endif
+}
+
+/*
+ * Runs in SPI controller context once a pipelined transfer is clocked out.
+ * Received frame is left for spi work to process, out of controller context.
+ */
+static void esp_spi_xfer_complete(void *data)
+{
+	struct esp_spi_xfer *xfer = data;
+	unsigned long flags;
+
+	smp_store_release(&xfer->state, ESP_SPI_XFER_DONE);
+
+	if (spi_context.spi_workqueue)
+		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
+
+	/* Count drops under waitqueue lock, spi_pipeline_drain() takes the
+	 * lock after seeing it at zero, so unlock is our last access */
+	spin_lock_irqsave(&spi_context.xfer_wait.lock, flags);
+	if (atomic_dec_and_test(&spi_context.xfer_inflight))
+		wake_up_locked(&spi_context.xfer_wait);
+	spin_unlock_irqrestore(&spi_context.xfer_wait.lock, flags);
+}
+
+/* Hand up frames of completed transfers in submission order, refill slots */
+static void esp_spi_pipeline_reap(void)
+{
+	struct esp_spi_xfer *xfer = NULL;
+	u8 **rx_slot = NULL;
+
+	for (;;) {
+		xfer = &spi_context.xfer[spi_context.reap_idx];
+
+		if (smp_load_acquire(&xfer->state) != ESP_SPI_XFER_DONE)
+			break;
+
+		rx_slot = &spi_context.rx_ring[xfer->rx_idx];
+
+		if (xfer->msg.status) {
+			esp_err("SPI Transaction failed: %d", xfer->msg.status);
+		} else if (!process_rx_buf(*rx_slot)) {
+			/* Buffer now belongs to rx skb */
+			*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+		}
+
+		free_tx_skb(xfer->tx_skb, xfer->tx_staged);
+		xfer->tx_skb = NULL;
+
+		xfer->state = ESP_SPI_XFER_FREE;
+		spi_context.reap_idx = (spi_context.reap_idx + 1) % SPI_RX_RING_SIZE;
+	}
+}
+
+/*
+ * Whether slave has a transaction loaded for next transfer. Legacy firmware
+ * loads one transaction at a time, so every handshake rising edge allows
+ * exactly one transfer. Firmware with pre-queued transactions holds handshake
+ * high while at least SPI_PIPELINE_MAX_DEPTH of them are loaded, which covers
+ * any transfer of ours not yet clocked out.
+ */
+static bool esp_spi_slave_ready(void)
+{
+	if (spi_context.adapter->ext_capabilities & ESP_SPI_PREQUEUED_TRANS)
+		return atomic_read(&spi_context.xfer_inflight) < SPI_PIPELINE_MAX_DEPTH &&
+			gpio_get_value(HANDSHAKE_PIN);
+
+	return test_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+}
+
+/* Gap after transfer, so controller does not clock slave before it reloads */
+static void esp_spi_set_xfer_gap(struct spi_message *msg)
+{
+	struct spi_transfer *last;
+
+	last = list_last_entry(&msg->transfers, struct spi_transfer, transfer_list);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0))
+	last->delay.value = SPI_PIPELINE_GAP_US;
+	last->delay.unit = SPI_DELAY_UNIT_USECS;
+#else
+	last->delay_usecs = SPI_PIPELINE_GAP_US;
+#endif
+}
+
+/*
+ * Pipelined mode: a transfer is submitted with spi_async() as soon as the
+ * slave has a transaction loaded, without waiting for the previous transfer
+ * to be processed. Completed transfers are processed here, in spi work.
+ */
+static void esp_spi_pipeline_work(void)
+{
+	struct esp_spi_xfer *xfer = NULL;
+	struct sk_buff *tx_skb = NULL;
+	bool staged = false;
+	u8 **rx_slot = NULL;
+	int ret = 0;
+
+	esp_spi_pipeline_reap();
+
+	while (data_path) {
+		xfer = &spi_context.xfer[spi_context.xfer_idx];
+
+		if (READ_ONCE(xfer->state) != ESP_SPI_XFER_FREE ||
+		    !esp_spi_slave_ready())
+			break;
+
+		tx_skb = dequeue_tx_skb(&staged);
+		if (!tx_skb && !gpio_get_value(SPI_DATA_READY_PIN))
+			break;
+
+		rx_slot = &spi_context.rx_ring[spi_context.xfer_idx];
+		if (!*rx_slot)
+			*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+
+		if (!*rx_slot || !spi_context.tx_dummy_buf) {
+			esp_err("No SPI buffer available\n");
+			free_tx_skb(tx_skb, staged);
+			break;
+		}
+
+		esp_spi_setup_msg(&xfer->msg, xfer->trans, tx_skb,
+				*rx_slot + SPI_RX_HEADROOM);
+		if (spi_context.adapter->ext_capabilities & ESP_SPI_PREQUEUED_TRANS)
+			esp_spi_set_xfer_gap(&xfer->msg);
+		xfer->msg.complete = esp_spi_xfer_complete;
+		xfer->msg.context = xfer;
+		xfer->tx_skb = tx_skb;
+		xfer->tx_staged = staged;
+		xfer->rx_idx = spi_context.xfer_idx;
+		xfer->state = ESP_SPI_XFER_INFLIGHT;
+		atomic_inc(&spi_context.xfer_inflight);
+
+		/* Slave transaction gets used up by this transfer */
+		clear_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+
+		ret = spi_async(spi_context.esp_spi_dev, &xfer->msg);
+		if (ret) {
+			esp_err("SPI async submit failed: %d", ret);
+			xfer->tx_skb = NULL;
+			xfer->state = ESP_SPI_XFER_FREE;
+			atomic_dec(&spi_context.xfer_inflight);
+			free_tx_skb(tx_skb, staged);
+			if (gpio_get_value(HANDSHAKE_PIN))
+				set_bit(ESP_SPI_HS_ASSERTED, &spi_context.spi_flags);
+			break;
+		}
+
+		spi_context.xfer_idx = (spi_context.xfer_idx + 1) % SPI_RX_RING_SIZE;
+	}
+}
+
+/*
+ * Controller owns rx and tx buffers of submitted transfers till they
+ * complete, so wait for all of them however long it takes.
+ */
+static void spi_pipeline_drain(void)
+{
+	mutex_lock(&spi_lock);
+
+	while (!wait_event_timeout(spi_context.xfer_wait,
+				!atomic_read(&spi_context.xfer_inflight), HZ))
+		esp_warn("Waiting for %d SPI transfers\n",
+				atomic_read(&spi_context.xfer_inflight));
+
+	/* Wait out the last completion, it may still hold the waitqueue lock */
+	spin_lock_irq(&spi_context.xfer_wait.lock);
+	spin_unlock_irq(&spi_context.xfer_wait.lock);
+
+	/* Datapath is closed, rx buffers stay in ring and tx skbs are freed */
+	esp_spi_pipeline_reap();
+
+	mutex_unlock(&spi_lock);
+}
+
 static void esp_spi_work(struct work_struct *work)
 {
-	struct spi_transfer trans;
-	struct sk_buff *tx_skb = NULL, *rx_skb = NULL;
-	struct esp_skb_cb *cb = NULL;
-	u8 *rx_buf = NULL;
+	struct sk_buff *tx_skb = NULL;
+	bool staged = false;
+	u8 **rx_slot = NULL;
 	int ret = 0;
 	volatile int trans_ready, rx_pending;
 
 	mutex_lock(&spi_lock);
 
+	if (spi_pipeline) {
+		esp_spi_pipeline_work();
+		mutex_unlock(&spi_lock);
+		return;
+	}
+
 	trans_ready = gpio_get_value(HANDSHAKE_PIN);
 	rx_pending = gpio_get_value(SPI_DATA_READY_PIN);
 
 	if (trans_ready) {
-		if (data_path) {
-			tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_HIGH]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_MID]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_LOW]);
-			if (tx_skb) {
-				if (atomic_read(&tx_pending))
-					atomic_dec(&tx_pending);
-
-				/* resume network tx queue if bearable load */
-				cb = (struct esp_skb_cb *)tx_skb->cb;
-				if (cb && cb->priv && atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
-					esp_tx_resume(cb->priv);
-#if TEST_RAW_TP
-					if (raw_tp_mode != 0) {
-						esp_raw_tp_queue_resume();
-					}
-#endif
-				}
-			}
-		}
+		if (data_path)
+			tx_skb = dequeue_tx_skb(&staged);
 
 		if (rx_pending || tx_skb) {
-			memset(&trans, 0, sizeof(trans));
-			trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
-
 			/* Setup and execute SPI transaction
 			 *	Tx_buf: Check if tx_q has valid buffer for transmission,
-			 *		else keep it blank
+			 *		else send preallocated blank buffer
 			 *
-			 *	Rx_buf: Allocate memory for incoming data. This will be freed
-			 *		immediately if received buffer is invalid.
-			 *		If it is a valid buffer, upper layer will free it.
+			 *	Rx_buf: Next buffer from rx ring. It is handed up only
+			 *		if received data is valid, else reused as is.
 			 * */
 
-			/* Configure TX buffer if available */
+			/* Configure RX buffer, refill slot if last refill failed */
+			rx_slot = &spi_context.rx_ring[spi_context.rx_ring_idx];
+			if (!*rx_slot)
+				*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
 
-			if (tx_skb) {
-				trans.tx_buf = tx_skb->data;
-				esp_hex_dump_verbose("tx: ", trans.tx_buf, 32);
-			} else {
-				tx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-				trans.tx_buf = skb_put(tx_skb, SPI_BUF_SIZE);
-				memset((void *)trans.tx_buf, 0, SPI_BUF_SIZE);
+			if (!*rx_slot || !spi_context.tx_dummy_buf) {
+				esp_err("No SPI buffer available\n");
+				free_tx_skb(tx_skb, staged);
+				mutex_unlock(&spi_lock);
+				return;
 			}
 
-			/* Configure RX buffer */
-			rx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-			rx_buf = skb_put(rx_skb, SPI_BUF_SIZE);
-
-			memset(rx_buf, 0, SPI_BUF_SIZE);
+			esp_spi_setup_msg(&spi_context.msg, spi_context.trans, tx_skb,
+					*rx_slot + SPI_RX_HEADROOM);
 
-			trans.rx_buf = rx_buf;
-			trans.len = SPI_BUF_SIZE;
-
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
-			if (hardware_type == ESP_FIRMWARE_CHIP_ESP32) {
-				trans.cs_change = 1;
-			}
-#endif
-
-			ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
+			ret = spi_sync(spi_context.esp_spi_dev, &spi_context.msg);
 			if (ret) {
 				esp_err("SPI Transaction failed: %d", ret);
-				dev_kfree_skb(rx_skb);
-				dev_kfree_skb(tx_skb);
-			} else {
-
-				/* Free rx_skb if received data is not valid */
-				if (process_rx_buf(rx_skb)) {
-					dev_kfree_skb(rx_skb);
-				}
-
-				if (tx_skb)
-					dev_kfree_skb(tx_skb);
+			} else if (!process_rx_buf(*rx_slot)) {
+				/* Buffer now belongs to rx skb */
+				*rx_slot = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+				spi_context.rx_ring_idx = (spi_context.rx_ring_idx + 1) % SPI_RX_RING_SIZE;
 			}
+
+			free_tx_skb(tx_skb, staged);
 		}
 	}
 
@@ -539,6 +819,14 @@ static int spi_init(void)
 	}
 
 	INIT_WORK(&spi_context.spi_work, esp_spi_work);
+	init_waitqueue_head(&spi_context.xfer_wait);
+
+	status = spi_rx_ring_init();
+	if (status) {
+		spi_exit();
+		esp_err("Failed to allocate SPI buffers\n");
+		return status;
+	}
 
 	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
 		skb_queue_head_init(&spi_context.tx_q[prio_q_idx]);
@@ -605,6 +893,9 @@ static void spi_exit(void)
 	close_data_path();
 	msleep(200);
 
+	if (spi_pipeline)
+		spi_pipeline_drain();
+
 	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
 		skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
 		skb_queue_purge(&spi_context.rx_q[prio_q_idx]);
@@ -616,6 +907,8 @@ static void spi_exit(void)
 		spi_context.spi_workqueue = NULL;
 	}
 
+	spi_rx_ring_deinit();
+
 	esp_remove_card(spi_context.adapter);
 
 	cleanup_spi_gpio();
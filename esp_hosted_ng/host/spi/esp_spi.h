@@ -15,6 +15,16 @@
 #define SPI_DATA_READY_IRQ      gpio_to_irq(SPI_DATA_READY_PIN)
 #define SPI_BUF_SIZE            1600
 
+/* RX buffers are recycled across transactions and handed up with build_skb() */
+#define SPI_RX_RING_SIZE        4
+#define SPI_RX_HEADROOM         NET_SKB_PAD
+#define SPI_RX_BUF_TRUESIZE     (SKB_DATA_ALIGN(SPI_RX_HEADROOM + SPI_BUF_SIZE) + \
+				 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+/* TX skb head, its page frags and padding go out as one SPI message */
+#define SPI_TX_MAX_FRAGS        4
+#define SPI_MAX_TRANS_PER_MSG   (SPI_TX_MAX_FRAGS + 2)
+
 enum spi_flags_e {
 	ESP_SPI_BUS_CLAIMED,
 	ESP_SPI_BUS_SET,
@@ -23,6 +33,28 @@ enum spi_flags_e {
 	ESP_SPI_GPIO_DR_REQUESTED,
 	ESP_SPI_GPIO_DR_IRQ_DONE,
 	ESP_SPI_DATAPATH_OPEN,
+	ESP_SPI_HS_ASSERTED,
+};
+
+/* Pipelined transfers in flight when slave keeps its transactions pre-queued.
+ * Every pipelined transfer is followed by a gap for slave to load next one */
+#define SPI_PIPELINE_MAX_DEPTH  2
+#define SPI_PIPELINE_GAP_US     20
+
+enum esp_spi_xfer_state {
+	ESP_SPI_XFER_FREE,
+	ESP_SPI_XFER_INFLIGHT,
+	ESP_SPI_XFER_DONE,
+};
+
+/* Transfer submitted with spi_async() in pipelined mode */
+struct esp_spi_xfer {
+	struct spi_message          msg;
+	struct spi_transfer         trans[SPI_MAX_TRANS_PER_MSG];
+	struct sk_buff              *tx_skb;
+	bool                        tx_staged;
+	uint8_t                     rx_idx;
+	uint8_t                     state;
 };
 
 struct esp_spi_context {
@@ -35,8 +67,18 @@ struct esp_spi_context {
 	struct workqueue_struct     *nw_cmd_reinit_workqueue;
 	struct work_struct          nw_cmd_reinit_work;
 	uint8_t                     spi_clk_mhz;
-	uint8_t                     reserved[2];
+	uint8_t                     rx_ring_idx;
+	uint8_t                     reserved[1];
 	unsigned long               spi_flags;
+	u8                          *rx_ring[SPI_RX_RING_SIZE];
+	u8                          *tx_dummy_buf;
+	struct spi_message          msg;
+	struct spi_transfer         trans[SPI_MAX_TRANS_PER_MSG];
+	struct esp_spi_xfer         xfer[SPI_RX_RING_SIZE];
+	uint8_t                     xfer_idx;
+	uint8_t                     reap_idx;
+	atomic_t                    xfer_inflight;
+	wait_queue_head_t           xfer_wait;
 };
 
 enum {